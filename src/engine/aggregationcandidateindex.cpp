@@ -0,0 +1,486 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "aggregationcandidateindex_p.h"
+#include "contactsdatabase.h"
+
+#include <QContactGender>
+
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include <algorithm>
+
+QTCONTACTS_USE_NAMESPACE
+
+namespace {
+
+const int ExactNameScore = 20;
+const int NicknameOnlyScore = 15;
+const int PartialNameScore = 12;
+const int SharedAddressScore = 3;
+const int SharedNicknameScore = 1;
+
+// Each task of the thread pool scores at least this many contacts
+const int ContactsPerTask = 8;
+
+// Phone numbers are grouped for duplicate detection by this many trailing characters
+const int PhoneNumberSuffixLength = 7;
+
+void insertKeys(QMultiHash<QString, quint32> *hash, const QSet<QString> &keys, quint32 aggregateId)
+{
+    foreach (const QString &key, keys) {
+        hash->insert(key, aggregateId);
+    }
+}
+
+void removeKeys(QMultiHash<QString, quint32> *hash, const QSet<QString> &keys, quint32 aggregateId)
+{
+    foreach (const QString &key, keys) {
+        hash->remove(key, aggregateId);
+    }
+}
+
+QString lowestValue(const QSet<QString> &values)
+{
+    QString rv;
+    foreach (const QString &value, values) {
+        if (rv.isNull() || value < rv)
+            rv = value;
+    }
+    return rv;
+}
+
+void lookupKey(const QMultiHash<QString, quint32> &hash, const QString &key, QSet<quint32> *aggregateIds)
+{
+    // A null value is bound as NULL, which matches no stored value
+    if (key.isNull())
+        return;
+
+    QMultiHash<QString, quint32>::const_iterator it = hash.constFind(key), end = hash.constEnd();
+    for ( ; it != end && it.key() == key; ++it) {
+        aggregateIds->insert(*it);
+    }
+}
+
+void lookupKeys(const QMultiHash<QString, quint32> &hash, const QStringList &keys, QSet<quint32> *aggregateIds)
+{
+    foreach (const QString &key, keys) {
+        lookupKey(hash, key, aggregateIds);
+    }
+}
+
+bool containsAny(const QSet<QString> &values, const QStringList &keys)
+{
+    foreach (const QString &key, keys) {
+        if (!key.isNull() && values.contains(key))
+            return true;
+    }
+    return false;
+}
+
+// Scores the next unscored contact until none remain; the entries are only read, so any
+// number of tasks can share them
+class ScoringTask : public QRunnable
+{
+public:
+    ScoringTask(const AggregationCandidateIndex::Entries &entries, AggregationCandidateIndex::Scores *scores, int count, QAtomicInt *next, QSemaphore *finished)
+        : m_entries(entries)
+        , m_scores(scores)
+        , m_count(count)
+        , m_next(next)
+        , m_finished(finished)
+    {
+    }
+
+    void run() override
+    {
+        for (int i = m_next->fetchAndAddOrdered(1); i < m_count; i = m_next->fetchAndAddOrdered(1)) {
+            m_scores[i].matches = m_entries.matches(m_scores[i].contact);
+        }
+        if (m_finished) {
+            m_finished->release();
+        }
+    }
+
+private:
+    const AggregationCandidateIndex::Entries &m_entries;
+    AggregationCandidateIndex::Scores *m_scores;
+    const int m_count;
+    QAtomicInt *m_next;
+    QSemaphore *m_finished;
+};
+
+}
+
+bool AggregationCandidateIndex::Contact::sameValues(const Contact &other) const
+{
+    // The contact ID is not compared: a new contact has no IsNot relationships
+    return firstName == other.firstName
+        && lastName == other.lastName
+        && nickname == other.nickname
+        && nickname.isNull() == other.nickname.isNull()
+        && phoneNumbers == other.phoneNumbers
+        && emailAddresses == other.emailAddresses
+        && accountUris == other.accountUris
+        && excludeGender == other.excludeGender;
+}
+
+void AggregationCandidateIndex::Entries::insert(quint32 aggregateId, const Aggregate &aggregate)
+{
+    remove(aggregateId);
+
+    m_aggregates.insert(aggregateId, aggregate);
+
+    // Only non-empty names can contribute to a match
+    typedef QPair<QString, QString> NamePair;
+    foreach (const NamePair &name, aggregate.names) {
+        if (!name.first.isEmpty())
+            m_firstNames.insert(name.first, aggregateId);
+        if (!name.second.isEmpty())
+            m_lastNames.insert(name.second, aggregateId);
+    }
+    insertKeys(&m_nicknames, aggregate.nicknames, aggregateId);
+    insertKeys(&m_emailAddresses, aggregate.emailAddresses, aggregateId);
+    insertKeys(&m_phoneNumbers, aggregate.phoneNumbers, aggregateId);
+    insertKeys(&m_accountUris, aggregate.accountUris, aggregateId);
+    foreach (const QString &key, blockingKeys(aggregate)) {
+        m_blockingKeys.insert(key, aggregateId);
+    }
+}
+
+void AggregationCandidateIndex::Entries::remove(quint32 aggregateId)
+{
+    QHash<quint32, Aggregate>::iterator it = m_aggregates.find(aggregateId);
+    if (it == m_aggregates.end())
+        return;
+
+    typedef QPair<QString, QString> NamePair;
+    foreach (const NamePair &name, it->names) {
+        m_firstNames.remove(name.first, aggregateId);
+        m_lastNames.remove(name.second, aggregateId);
+    }
+    removeKeys(&m_nicknames, it->nicknames, aggregateId);
+    removeKeys(&m_emailAddresses, it->emailAddresses, aggregateId);
+    removeKeys(&m_phoneNumbers, it->phoneNumbers, aggregateId);
+    removeKeys(&m_accountUris, it->accountUris, aggregateId);
+    foreach (const QString &key, blockingKeys(*it)) {
+        m_blockingKeys.remove(key, aggregateId);
+    }
+
+    m_aggregates.erase(it);
+}
+
+void AggregationCandidateIndex::Entries::insertIsNot(quint32 firstId, quint32 secondId)
+{
+    m_isNot[firstId].insert(secondId);
+    m_isNot[secondId].insert(firstId);
+}
+
+void AggregationCandidateIndex::Entries::clearIsNot()
+{
+    m_isNot.clear();
+}
+
+QList<AggregationCandidateIndex::Match> AggregationCandidateIndex::Entries::matches(const Contact &contact) const
+{
+    // Any aggregate with a non-zero score shares at least one of the indexed values
+    QSet<quint32> aggregateIds;
+    if (!contact.firstName.isEmpty())
+        lookupKey(m_firstNames, contact.firstName, &aggregateIds);
+    if (!contact.lastName.isEmpty())
+        lookupKey(m_lastNames, contact.lastName, &aggregateIds);
+    lookupKey(m_nicknames, contact.nickname, &aggregateIds);
+    lookupKeys(m_emailAddresses, contact.emailAddresses, &aggregateIds);
+    lookupKeys(m_phoneNumbers, contact.phoneNumbers, &aggregateIds);
+    lookupKeys(m_accountUris, contact.accountUris, &aggregateIds);
+
+    QList<Match> rv;
+    foreach (quint32 id, aggregateIds) {
+        appendMatch(contact, id, &rv);
+    }
+    return rv;
+}
+
+QList<AggregationCandidateIndex::Match> AggregationCandidateIndex::Entries::matches(const Contact &contact, const QSet<quint32> &aggregateIds) const
+{
+    QList<Match> rv;
+    foreach (quint32 id, aggregateIds) {
+        appendMatch(contact, id, &rv);
+    }
+    return rv;
+}
+
+bool AggregationCandidateIndex::Entries::bestMatch(const Contact &contact, quint32 *aggregateId, int *score) const
+{
+    return bestMatch(matches(contact), aggregateId, score);
+}
+
+bool AggregationCandidateIndex::Entries::bestMatch(const QList<Match> &matches, quint32 *aggregateId, int *score)
+{
+    quint32 bestId = 0;
+    int bestScore = 0;
+    foreach (const Match &match, matches) {
+        if (match.score > bestScore || (match.score == bestScore && match.aggregateId < bestId)) {
+            bestId = match.aggregateId;
+            bestScore = match.score;
+        }
+    }
+
+    if (bestScore == 0)
+        return false;
+
+    *aggregateId = bestId;
+    *score = bestScore;
+    return true;
+}
+
+void AggregationCandidateIndex::Entries::matchAll(QVector<Scores> *scores) const
+{
+    // Detach the vector before the tasks share its elements
+    Scores *data = scores->data();
+    const int count = scores->count();
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int taskCount = qMin(count / ContactsPerTask, pool->maxThreadCount());
+
+    QAtomicInt next(0);
+    QSemaphore finished;
+    for (int i = 1; i < taskCount; ++i) {
+        pool->start(new ScoringTask(*this, data, count, &next, &finished));
+    }
+
+    // The calling thread also scores contacts, so that they are scored even if the pool is busy
+    ScoringTask(*this, data, count, &next, nullptr).run();
+    if (taskCount > 1) {
+        finished.acquire(taskCount - 1);
+    }
+}
+
+QList<quint32> AggregationCandidateIndex::Entries::aggregateIds() const
+{
+    QList<quint32> rv(m_aggregates.keys());
+    std::sort(rv.begin(), rv.end());
+    return rv;
+}
+
+QList<AggregationCandidateIndex::Match> AggregationCandidateIndex::Entries::duplicates(quint32 aggregateId) const
+{
+    QList<Match> rv;
+
+    QHash<quint32, Aggregate>::const_iterator it = m_aggregates.constFind(aggregateId);
+    if (it == m_aggregates.constEnd())
+        return rv;
+
+    // Only the aggregates sharing a blocking key are compared, and each pair only once
+    QSet<quint32> aggregateIds;
+    foreach (const QString &key, blockingKeys(*it)) {
+        QMultiHash<QString, quint32>::const_iterator kit = m_blockingKeys.constFind(key), end = m_blockingKeys.constEnd();
+        for ( ; kit != end && kit.key() == key; ++kit) {
+            if (*kit > aggregateId)
+                aggregateIds.insert(*kit);
+        }
+    }
+
+    const Contact contact(candidateValues(aggregateId, *it));
+    foreach (quint32 id, aggregateIds) {
+        appendMatch(contact, id, &rv);
+    }
+    return rv;
+}
+
+void AggregationCandidateIndex::Entries::appendMatch(const Contact &contact, quint32 aggregateId, QList<Match> *matches) const
+{
+    QHash<quint32, Aggregate>::const_iterator it = m_aggregates.constFind(aggregateId);
+    if (it == m_aggregates.constEnd() || !isCandidate(contact, aggregateId, *it))
+        return;
+
+    const int aggregateScore = score(contact, *it);
+    if (aggregateScore > 0) {
+        const Match match = { aggregateId, aggregateScore };
+        matches->append(match);
+    }
+}
+
+bool AggregationCandidateIndex::Entries::isCandidate(const Contact &contact, quint32 aggregateId, const Aggregate &aggregate) const
+{
+    // An aggregate with a name must not have a different last name; otherwise it must have a nickname
+    if (!aggregate.names.isEmpty()) {
+        bool compatibleName = false;
+        typedef QPair<QString, QString> NamePair;
+        foreach (const NamePair &name, aggregate.names) {
+            if (contact.lastName.isEmpty() || name.second.isEmpty() || name.second == contact.lastName) {
+                compatibleName = true;
+                break;
+            }
+        }
+        if (!compatibleName)
+            return false;
+    } else if (!aggregate.hasNickname) {
+        return false;
+    }
+
+    if (!aggregate.gender.isNull() && aggregate.gender == contact.excludeGender)
+        return false;
+
+    QHash<quint32, QSet<quint32> >::const_iterator it = m_isNot.constFind(contact.contactId);
+    return it == m_isNot.constEnd() || !it->contains(aggregateId);
+}
+
+int AggregationCandidateIndex::Entries::score(const Contact &contact, const Aggregate &aggregate)
+{
+    // As in the SQL heuristic, each rule contributes its score once, however many values match
+    const bool contactNameEmpty = contact.firstName.isEmpty() && contact.lastName.isEmpty();
+    const bool nicknameMatch = !contact.nickname.isNull() && aggregate.nicknames.contains(contact.nickname);
+
+    bool exactName = false;
+    bool nicknameOnly = contactNameEmpty && nicknameMatch && aggregate.names.isEmpty();
+    bool partialName = false;
+
+    typedef QPair<QString, QString> NamePair;
+    foreach (const NamePair &name, aggregate.names) {
+        const QString &firstName(name.first);
+        const QString &lastName(name.second);
+        const bool firstNameMatch = !firstName.isEmpty() && firstName == contact.firstName;
+        const bool lastNameMatch = !lastName.isEmpty() && lastName == contact.lastName;
+
+        if (firstNameMatch && lastNameMatch)
+            exactName = true;
+        if (contactNameEmpty && firstName.isEmpty() && lastName.isEmpty() && nicknameMatch)
+            nicknameOnly = true;
+        if (firstNameMatch && (lastName.isEmpty() || contact.lastName.isEmpty()))
+            partialName = true;
+        if (lastNameMatch && (firstName.isEmpty() || contact.firstName.isEmpty()))
+            partialName = true;
+    }
+
+    const bool sharedAddress = containsAny(aggregate.emailAddresses, contact.emailAddresses)
+                            || containsAny(aggregate.phoneNumbers, contact.phoneNumbers)
+                            || containsAny(aggregate.accountUris, contact.accountUris);
+    const bool sharedNickname = nicknameMatch && !contact.nickname.isEmpty();
+
+    return (exactName ? ExactNameScore : 0)
+         + (nicknameOnly ? NicknameOnlyScore : 0)
+         + (partialName ? PartialNameScore : 0)
+         + (sharedAddress ? SharedAddressScore : 0)
+         + (sharedNickname ? SharedNicknameScore : 0);
+}
+
+QStringList AggregationCandidateIndex::Entries::blockingKeys(const Aggregate &aggregate)
+{
+    QStringList keys;
+
+    typedef QPair<QString, QString> NamePair;
+    foreach (const NamePair &name, aggregate.names) {
+        if (!name.second.isEmpty())
+            keys.append(QStringLiteral("n:%1:%2").arg(name.second).arg(name.first.left(1)));
+    }
+    foreach (const QString &emailAddress, aggregate.emailAddresses) {
+        if (!emailAddress.isEmpty())
+            keys.append(QStringLiteral("e:") + emailAddress);
+    }
+    foreach (const QString &phoneNumber, aggregate.phoneNumbers) {
+        if (!phoneNumber.isEmpty())
+            keys.append(QStringLiteral("p:") + phoneNumber.right(PhoneNumberSuffixLength));
+    }
+
+    keys.removeDuplicates();
+    return keys;
+}
+
+AggregationCandidateIndex::Contact AggregationCandidateIndex::Entries::candidateValues(quint32 aggregateId, const Aggregate &aggregate)
+{
+    // The values are those a contact with the details of the aggregate would be matched with
+    Contact contact;
+    contact.contactId = aggregateId;
+    if (!aggregate.names.isEmpty()) {
+        contact.firstName = aggregate.names.first().first;
+        contact.lastName = aggregate.names.first().second;
+    }
+    contact.nickname = lowestValue(aggregate.nicknames);
+    contact.phoneNumbers = aggregate.phoneNumbers.toList();
+    contact.emailAddresses = aggregate.emailAddresses.toList();
+    contact.accountUris = aggregate.accountUris.toList();
+
+    if (aggregate.gender == QString::number(static_cast<int>(QContactGender::GenderMale))) {
+        contact.excludeGender = QString::number(static_cast<int>(QContactGender::GenderFemale));
+    } else if (aggregate.gender == QString::number(static_cast<int>(QContactGender::GenderFemale))) {
+        contact.excludeGender = QString::number(static_cast<int>(QContactGender::GenderMale));
+    } else {
+        contact.excludeGender = QStringLiteral("none");
+    }
+
+    return contact;
+}
+
+AggregationCandidateIndex::AggregationCandidateIndex()
+    : m_generation(0)
+    , m_invalidations(0)
+{
+}
+
+QSharedPointer<const AggregationCandidateIndex::Entries> AggregationCandidateIndex::entries(quint64 *generation) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    *generation = this->generation();
+    if (m_entries && m_generation == *generation) {
+        return m_entries;
+    }
+    return QSharedPointer<const Entries>();
+}
+
+void AggregationCandidateIndex::update(const QSharedPointer<const Entries> &entries, quint64 generation)
+{
+    QMutexLocker locker(&m_mutex);
+
+    // Don't store entries that may have been superseded while they were being read
+    if (generation != this->generation())
+        return;
+
+    m_entries = entries;
+    m_generation = generation;
+}
+
+void AggregationCandidateIndex::invalidate()
+{
+    QMutexLocker locker(&m_mutex);
+
+    ++m_invalidations;
+    m_entries.clear();
+}
+
+quint64 AggregationCandidateIndex::generation() const
+{
+    return (static_cast<quint64>(m_invalidations) << 32) | ContactsDatabase::commitGeneration();
+}
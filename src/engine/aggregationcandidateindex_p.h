@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef AGGREGATIONCANDIDATEINDEX_P_H
+#define AGGREGATIONCANDIDATEINDEX_P_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QSet>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// An in-memory index of the aggregate contacts, keyed by the lowercased name, nickname, email
+// address and account URI values and the normalized phone numbers used by the aggregation
+// heuristic, so that the aggregate matching a contact can be found without querying each table.
+// The entries are discarded when the index is invalidated, or when any transaction is
+// committed to the database by this process.
+class AggregationCandidateIndex
+{
+public:
+    struct Aggregate
+    {
+        Aggregate() : hasNickname(false) {}
+
+        QList<QPair<QString, QString> > names; // lowerFirstName, lowerLastName
+        QSet<QString> nicknames;
+        bool hasNickname; // true even if the stored nicknames are null
+        QSet<QString> emailAddresses;
+        QSet<QString> phoneNumbers;
+        QSet<QString> accountUris;
+        QString gender;
+    };
+
+    // The values of a contact to be aggregated, in the form bound to the SQL heuristic:
+    // a null nickname or match value does not match any stored value
+    struct Contact
+    {
+        Contact() : contactId(0) {}
+
+        quint32 contactId;
+        QString firstName;
+        QString lastName;
+        QString nickname;
+        QStringList phoneNumbers;
+        QStringList emailAddresses;
+        QStringList accountUris;
+        QString excludeGender;
+
+        bool sameValues(const Contact &other) const;
+    };
+
+    struct Match
+    {
+        quint32 aggregateId;
+        int score;
+    };
+
+    // The matches of a contact, scored before the transaction in which it is aggregated
+    struct Scores
+    {
+        Contact contact;
+        QList<Match> matches;
+    };
+
+    // Only the aggregates which may be matched are held: those which are not deactivated,
+    // excluding the self contact
+    class Entries
+    {
+    public:
+        void insert(quint32 aggregateId, const Aggregate &aggregate);
+        void remove(quint32 aggregateId);
+
+        void insertIsNot(quint32 firstId, quint32 secondId);
+        void clearIsNot();
+
+        // Reports the aggregates with a non-zero score for the contact, optionally limited to
+        // the specified aggregates
+        QList<Match> matches(const Contact &contact) const;
+        QList<Match> matches(const Contact &contact, const QSet<quint32> &aggregateIds) const;
+
+        // Reports the aggregate with the highest score for the contact, preferring the lowest ID
+        // where scores are equal; returns false if no aggregate has any score
+        bool bestMatch(const Contact &contact, quint32 *aggregateId, int *score) const;
+        static bool bestMatch(const QList<Match> &matches, quint32 *aggregateId, int *score);
+
+        // Scores each of the contacts, using the threads of the global thread pool
+        void matchAll(QVector<Scores> *scores) const;
+
+        // The IDs of the aggregates, in ascending order
+        QList<quint32> aggregateIds() const;
+
+        // Reports the aggregates with a greater ID than the specified aggregate which share a
+        // blocking key with it (a phone number suffix, an email address, or a last name with the
+        // same first initial), scored as if the aggregate were a contact matched against them
+        QList<Match> duplicates(quint32 aggregateId) const;
+
+    private:
+        void appendMatch(const Contact &contact, quint32 aggregateId, QList<Match> *matches) const;
+        bool isCandidate(const Contact &contact, quint32 aggregateId, const Aggregate &aggregate) const;
+        static int score(const Contact &contact, const Aggregate &aggregate);
+        static QStringList blockingKeys(const Aggregate &aggregate);
+        static Contact candidateValues(quint32 aggregateId, const Aggregate &aggregate);
+
+        QHash<quint32, Aggregate> m_aggregates;
+        QMultiHash<QString, quint32> m_firstNames;
+        QMultiHash<QString, quint32> m_lastNames;
+        QMultiHash<QString, quint32> m_nicknames;
+        QMultiHash<QString, quint32> m_emailAddresses;
+        QMultiHash<QString, quint32> m_phoneNumbers;
+        QMultiHash<QString, quint32> m_accountUris;
+        QMultiHash<QString, quint32> m_blockingKeys;
+        QHash<quint32, QSet<quint32> > m_isNot;
+    };
+
+    AggregationCandidateIndex();
+
+    // Returns null if the entries must be read again, in which case the read entries should
+    // be stored with the reported generation
+    QSharedPointer<const Entries> entries(quint64 *generation) const;
+    void update(const QSharedPointer<const Entries> &entries, quint64 generation);
+    void invalidate();
+
+private:
+    quint64 generation() const;
+
+    mutable QMutex m_mutex;
+    QSharedPointer<const Entries> m_entries;
+    quint64 m_generation;
+    quint32 m_invalidations;
+};
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+
+#include "contactattributeindex_p.h"
+#include "contactsdatabase.h"
+#include "trace_p.h"
+
+static const QString attributeIndexContactsTable(QStringLiteral("attributeIndexContacts"));
+
+void ContactIdBitmap::insert(quint32 contactId)
+{
+    const int word = contactId / 64;
+    if (word >= m_words.count()) {
+        m_words.resize(word + 1);
+    }
+    m_words[word] |= (Q_UINT64_C(1) << (contactId % 64));
+}
+
+void ContactIdBitmap::remove(quint32 contactId)
+{
+    const int word = contactId / 64;
+    if (word < m_words.count()) {
+        m_words[word] &= ~(Q_UINT64_C(1) << (contactId % 64));
+    }
+}
+
+bool ContactIdBitmap::contains(quint32 contactId) const
+{
+    const int word = contactId / 64;
+    return word < m_words.count() && (m_words.at(word) & (Q_UINT64_C(1) << (contactId % 64)));
+}
+
+ContactIdBitmap &ContactIdBitmap::operator&=(const ContactIdBitmap &other)
+{
+    if (m_words.count() > other.m_words.count()) {
+        m_words.resize(other.m_words.count());
+    }
+
+    quint64 *words = m_words.data();
+    const quint64 *otherWords = other.m_words.constData();
+    for (int i = 0, n = m_words.count(); i < n; ++i) {
+        words[i] &= otherWords[i];
+    }
+    return *this;
+}
+
+ContactIdBitmap &ContactIdBitmap::operator|=(const ContactIdBitmap &other)
+{
+    if (m_words.count() < other.m_words.count()) {
+        m_words.resize(other.m_words.count());
+    }
+
+    quint64 *words = m_words.data();
+    const quint64 *otherWords = other.m_words.constData();
+    for (int i = 0, n = other.m_words.count(); i < n; ++i) {
+        words[i] |= otherWords[i];
+    }
+    return *this;
+}
+
+QList<quint32> ContactIdBitmap::contactIds() const
+{
+    QList<quint32> rv;
+    for (int i = 0, n = m_words.count(); i < n; ++i) {
+        quint64 word = m_words.at(i);
+        while (word) {
+            const int bit = qCountTrailingZeroBits(word);
+            rv.append(static_cast<quint32>(i * 64 + bit));
+            word &= (word - 1);
+        }
+    }
+    return rv;
+}
+
+bool ContactAttributeIndex::Entries::read(ContactsDatabase &database, const QVariantList &contactIds)
+{
+    QString statement(QStringLiteral(
+                "\n SELECT Contacts.contactId, Contacts.collectionId, Contacts.type,"
+                " Contacts.hasPhoneNumber, Contacts.hasEmailAddress, Contacts.hasOnlineAccount,"
+                " Contacts.isDeactivated, Contacts.changeFlags, Favorites.isFavorite"
+                "\n FROM Contacts"
+                "\n LEFT JOIN Favorites ON Favorites.contactId = Contacts.contactId"));
+
+    if (!contactIds.isEmpty()) {
+        database.clearTemporaryContactIdsTable(attributeIndexContactsTable);
+        if (!database.createTemporaryContactIdsTable(attributeIndexContactsTable, contactIds)) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Error creating attributeIndexContacts temporary table"));
+            return false;
+        }
+        statement.append(QStringLiteral("\n WHERE Contacts.contactId IN (SELECT contactId FROM temp.attributeIndexContacts)"));
+    }
+
+    ContactsDatabase::Query query(database.prepare(statement));
+    query.setForwardOnly(true);
+    if (!ContactsDatabase::execute(query)) {
+        query.reportError("Failed to query contact attribute index");
+        return false;
+    }
+
+    while (query.next()) {
+        const quint32 contactId = query.value<quint32>(0);
+        const int changeFlags = query.value<int>(7);
+
+        collections[query.value<quint32>(1)].insert(contactId);
+        types[query.value<int>(2)].insert(contactId);
+        if (query.value<bool>(3))
+            attributes[HasPhoneNumber].insert(contactId);
+        if (query.value<bool>(4))
+            attributes[HasEmailAddress].insert(contactId);
+        if (query.value<bool>(5))
+            attributes[HasOnlineAccount].insert(contactId);
+        if (query.value<bool>(6))
+            attributes[IsDeactivated].insert(contactId);
+        if (changeFlags & ContactsDatabase::IsAdded)
+            attributes[IsAdded].insert(contactId);
+        if (changeFlags & ContactsDatabase::IsModified)
+            attributes[IsModified].insert(contactId);
+        if (changeFlags >= ContactsDatabase::IsDeleted)
+            attributes[IsDeleted].insert(contactId);
+        if (query.value<bool>(8))
+            attributes[IsFavorite].insert(contactId);
+    }
+
+    return true;
+}
+
+void ContactAttributeIndex::Entries::remove(quint32 contactId)
+{
+    for (int i = 0; i < AttributeCount; ++i) {
+        attributes[i].remove(contactId);
+    }
+    for (QHash<quint32, ContactIdBitmap>::iterator it = collections.begin(); it != collections.end(); ++it) {
+        it->remove(contactId);
+    }
+    for (QHash<int, ContactIdBitmap>::iterator it = types.begin(); it != types.end(); ++it) {
+        it->remove(contactId);
+    }
+}
+
+ContactAttributeIndex::ContactAttributeIndex()
+    : m_generation(0)
+    , m_invalidations(0)
+{
+}
+
+QSharedPointer<const ContactAttributeIndex::Entries> ContactAttributeIndex::entries(quint64 *generation) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    *generation = this->generation();
+    if (m_entries && m_generation == *generation) {
+        return m_entries;
+    }
+    return QSharedPointer<const Entries>();
+}
+
+void ContactAttributeIndex::update(const QSharedPointer<const Entries> &entries, quint64 generation)
+{
+    QMutexLocker locker(&m_mutex);
+
+    // Don't store entries that may have been superseded while they were being read
+    if (generation != this->generation())
+        return;
+
+    m_entries = entries;
+    m_generation = generation;
+}
+
+void ContactAttributeIndex::invalidate()
+{
+    QMutexLocker locker(&m_mutex);
+
+    ++m_invalidations;
+    m_entries.clear();
+}
+
+quint64 ContactAttributeIndex::generation() const
+{
+    return (static_cast<quint64>(m_invalidations) << 32) | ContactsDatabase::commitGeneration();
+}
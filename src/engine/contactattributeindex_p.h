@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+
+#ifndef CONTACTATTRIBUTEINDEX_P_H
+#define CONTACTATTRIBUTEINDEX_P_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QVariantList>
+#include <QVector>
+
+class ContactsDatabase;
+
+// A set of contact IDs, stored as a bitmap of 64-bit words indexed by database ID
+class ContactIdBitmap
+{
+public:
+    void insert(quint32 contactId);
+    void remove(quint32 contactId);
+    bool contains(quint32 contactId) const;
+
+    ContactIdBitmap &operator&=(const ContactIdBitmap &other);
+    ContactIdBitmap &operator|=(const ContactIdBitmap &other);
+
+    QList<quint32> contactIds() const;
+
+private:
+    QVector<quint64> m_words;
+};
+
+// An in-memory index of the boolean and low-cardinality attributes of contacts, used to
+// evaluate compound filters on those attributes without testing each row of the Contacts table.
+// The entries are discarded when the index is invalidated, or when any transaction is
+// committed to the database by this process, unless the writer has applied the changes
+// of the transaction to them.
+class ContactAttributeIndex
+{
+public:
+    enum Attribute {
+        HasPhoneNumber = 0,
+        HasEmailAddress,
+        HasOnlineAccount,
+        IsDeactivated,
+        IsAdded,
+        IsModified,
+        IsDeleted,
+        IsFavorite,
+        AttributeCount
+    };
+
+    struct Entries
+    {
+        // Reads the contacts with the specified IDs into the entries, or every contact if no IDs are specified
+        bool read(ContactsDatabase &database, const QVariantList &contactIds);
+        void remove(quint32 contactId);
+
+        ContactIdBitmap attributes[AttributeCount];
+        QHash<quint32, ContactIdBitmap> collections;
+        QHash<int, ContactIdBitmap> types;
+    };
+
+    ContactAttributeIndex();
+
+    // Returns null if the entries must be read again, in which case the read entries should
+    // be stored with the reported generation
+    QSharedPointer<const Entries> entries(quint64 *generation) const;
+    void update(const QSharedPointer<const Entries> &entries, quint64 generation);
+    void invalidate();
+
+private:
+    quint64 generation() const;
+
+    mutable QMutex m_mutex;
+    QSharedPointer<const Entries> m_entries;
+    quint64 m_generation;
+    quint32 m_invalidations;
+};
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "contactidcache_p.h"
+#include "contactsdatabase.h"
+
+#include <QDataStream>
+
+ContactIdCache::ContactIdCache(int maximumEntries)
+    : m_entries(maximumEntries)
+    , m_invalidations(0)
+    , m_hits(0)
+    , m_misses(0)
+{
+}
+
+QByteArray ContactIdCache::key(const QContactFilter &filter, const QList<QContactSortOrder> &sortOrders)
+{
+    QByteArray rv;
+    {
+        QDataStream ds(&rv, QIODevice::WriteOnly);
+        ds << filter << sortOrders;
+    }
+    return rv;
+}
+
+bool ContactIdCache::find(const QByteArray &key, QList<QContactId> *contactIds, quint64 *generation)
+{
+    QMutexLocker locker(&m_mutex);
+
+    *generation = this->generation();
+
+    Entry *entry = m_entries.object(key);
+    if (entry && entry->generation == *generation) {
+        *contactIds = entry->contactIds;
+        ++m_hits;
+        return true;
+    }
+
+    ++m_misses;
+    return false;
+}
+
+void ContactIdCache::insert(const QByteArray &key, const QList<QContactId> &contactIds, quint64 generation)
+{
+    QMutexLocker locker(&m_mutex);
+
+    // Don't store a result that may have been superseded while it was being read
+    if (generation != this->generation())
+        return;
+
+    Entry *entry = new Entry;
+    entry->contactIds = contactIds;
+    entry->generation = generation;
+    m_entries.insert(key, entry);
+}
+
+void ContactIdCache::invalidate()
+{
+    QMutexLocker locker(&m_mutex);
+
+    ++m_invalidations;
+    m_entries.clear();
+}
+
+int ContactIdCache::hits() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_hits;
+}
+
+int ContactIdCache::misses() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_misses;
+}
+
+quint64 ContactIdCache::generation() const
+{
+    return (static_cast<quint64>(m_invalidations) << 32) | ContactsDatabase::commitGeneration();
+}
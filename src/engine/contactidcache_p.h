@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef CONTACTIDCACHE_P_H
+#define CONTACTIDCACHE_P_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QContactFilter>
+#include <QContactId>
+#include <QContactSortOrder>
+#include <QList>
+#include <QMutex>
+
+QTCONTACTS_USE_NAMESPACE
+
+// A cache of contact ID query results, keyed by the serialized filter and sort order.
+// Entries are discarded when the cache is invalidated, or when any transaction is
+// committed or rolled back, or any transient detail is changed, by this process.
+class ContactIdCache
+{
+public:
+    enum { DefaultMaximumEntries = 32 };
+
+    explicit ContactIdCache(int maximumEntries = DefaultMaximumEntries);
+
+    static QByteArray key(const QContactFilter &filter, const QList<QContactSortOrder> &sortOrders);
+
+    bool find(const QByteArray &key, QList<QContactId> *contactIds, quint64 *generation);
+    void insert(const QByteArray &key, const QList<QContactId> &contactIds, quint64 generation);
+    void invalidate();
+
+    int hits() const;
+    int misses() const;
+
+private:
+    struct Entry
+    {
+        QList<QContactId> contactIds;
+        quint64 generation;
+    };
+
+    quint64 generation() const;
+
+    mutable QMutex m_mutex;
+    QCache<QByteArray, Entry> m_entries;
+    quint32 m_invalidations;
+    int m_hits;
+    int m_misses;
+};
+
+#endif
@@ -238,6 +238,12 @@ bool ContactNotifier::connect(const char *name, const char *signature, QObject *
     return true;
 }
 
+bool ContactNotifier::sentByThisProcess(const QDBusMessage &message)
+{
+    // The signals sent by this process are received by it too
+    return message.service() == QDBusConnection::sessionBus().baseService();
+}
+
 void ContactNotifier::sendMessage(const QDBusMessage &message)
 {
     static QDBusConnection connection(QDBusConnection::sessionBus());
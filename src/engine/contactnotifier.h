@@ -66,6 +66,8 @@ public:
 
     bool connect(const char *name, const char *signature, QObject *receiver, const char *slot);
 
+    static bool sentByThisProcess(const QDBusMessage &message);
+
 private:
     void sendMessage(const QDBusMessage &message);
 
@@ -32,6 +32,9 @@
 
 #include "contactreader.h"
 #include "contactsengine.h"
+#include "contactattributeindex_p.h"
+#include "contactrefinementcache_p.h"
+#include "phonenumberindex_p.h"
 
 #include "../extensions/qtcontacts-extensions.h"
 #include "../extensions/qcontactdeactivated.h"
@@ -78,7 +81,11 @@
 
 #include <QContactManagerEngine>
 
+#include <QSemaphore>
 #include <QSqlError>
+#include <QSqlRecord>
+#include <QThread>
+#include <QThreadPool>
 #include <QVector>
 #include <QBuffer>
 #include <QDataStream>
@@ -113,6 +120,51 @@ struct FieldInfo
     FieldType fieldType;
 };
 
+// The values of a single result row, copied out of the query so that the row can be
+// converted into contact details on a thread other than the one stepping the statement.
+class ResultRow
+{
+public:
+    ResultRow() : m_leadingCount(0), m_offset(0) {}
+    ResultRow(const QSqlQuery &query, int columnCount)
+        : m_leadingCount(columnCount), m_offset(columnCount)
+    {
+        m_values.reserve(columnCount);
+        for (int i = 0; i < columnCount; ++i) {
+            m_values.append(query.value(i));
+        }
+    }
+
+    // Copy only the leading columns, and the columns in the range [offset, offset + count)
+    ResultRow(const QSqlQuery &query, int leadingCount, int offset, int count)
+        : m_leadingCount(leadingCount), m_offset(offset)
+    {
+        m_values.reserve(leadingCount + count);
+        for (int i = 0; i < leadingCount; ++i) {
+            m_values.append(query.value(i));
+        }
+        for (int i = 0; i < count; ++i) {
+            m_values.append(query.value(offset + i));
+        }
+    }
+
+    QVariant value(int index) const
+    {
+        if (index >= m_leadingCount) {
+            if (index < m_offset) {
+                return QVariant();
+            }
+            index = index - m_offset + m_leadingCount;
+        }
+        return m_values.value(index);
+    }
+
+private:
+    QVector<QVariant> m_values;
+    int m_leadingCount;
+    int m_offset;
+};
+
 static void setValue(QContactDetail *detail, int key, const QVariant &value)
 {
     if (value.type() != QVariant::String || !value.toString().isEmpty())
@@ -194,7 +246,7 @@ static QList<int> subTypeList(const QStringList &subTypeValues)
     return rv;
 }
 
-static void setValues(QContactAddress *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactAddress *detail, const ResultRow *query, const int offset)
 {
     typedef QContactAddress T;
 
@@ -213,10 +265,11 @@ static const FieldInfo anniversaryFields[] =
     { QContactAnniversary::FieldOriginalDate, "originalDateTime", DateField },
     { QContactAnniversary::FieldCalendarId, "calendarId", StringField },
     { QContactAnniversary::FieldSubType, "subType", StringField },
-    { QContactAnniversary::FieldEvent, "event", StringField }
+    { QContactAnniversary::FieldEvent, "event", StringField },
+    { invalidField, "monthDay", IntegerField }
 };
 
-static void setValues(QContactAnniversary *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactAnniversary *detail, const ResultRow *query, const int offset)
 {
     typedef QContactAnniversary T;
 
@@ -224,6 +277,7 @@ static void setValues(QContactAnniversary *detail, QSqlQuery *query, const int o
     setValue(detail, T::FieldCalendarId  , query->value(offset + 1));
     setValue(detail, T::FieldSubType     , QVariant::fromValue<QString>(query->value(offset + 2).toString()));
     setValue(detail, T::FieldEvent       , query->value(offset + 3));
+    // ignore monthDay
 }
 
 static const FieldInfo avatarFields[] =
@@ -233,7 +287,7 @@ static const FieldInfo avatarFields[] =
     { QContactAvatar::FieldMetaData, "avatarMetadata", StringField }
 };
 
-static void setValues(QContactAvatar *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactAvatar *detail, const ResultRow *query, const int offset)
 {
     typedef QContactAvatar T;
 
@@ -245,25 +299,28 @@ static void setValues(QContactAvatar *detail, QSqlQuery *query, const int offset
 static const FieldInfo birthdayFields[] =
 {
     { QContactBirthday::FieldBirthday, "birthday", DateField },
-    { QContactBirthday::FieldCalendarId, "calendarId", StringField }
+    { QContactBirthday::FieldCalendarId, "calendarId", StringField },
+    { invalidField, "monthDay", IntegerField }
 };
 
-static void setValues(QContactBirthday *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactBirthday *detail, const ResultRow *query, const int offset)
 {
     typedef QContactBirthday T;
 
     setValue(detail, T::FieldBirthday  , dateValue(query->value(offset + 0)));
     setValue(detail, T::FieldCalendarId, query->value(offset + 1));
+    // ignore monthDay
 }
 
 static const FieldInfo displayLabelFields[] =
 {
     { QContactDisplayLabel::FieldLabel, "displayLabel", LocalizedField },
     { QContactDisplayLabel__FieldLabelGroup, "displayLabelGroup", LocalizedField },
-    { QContactDisplayLabel__FieldLabelGroupSortOrder, "displayLabelGroupSortOrder", IntegerField }
+    { QContactDisplayLabel__FieldLabelGroupSortOrder, "displayLabelGroupSortOrder", IntegerField },
+    { invalidField, "sortDisplayLabel", OtherField }
 };
 
-static void setValues(QContactDisplayLabel *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactDisplayLabel *detail, const ResultRow *query, const int offset)
 {
     typedef QContactDisplayLabel T;
 
@@ -277,6 +334,7 @@ static void setValues(QContactDisplayLabel *detail, QSqlQuery *query, const int
         setValue(detail, QContactDisplayLabel__FieldLabelGroup, group);
     if (!label.trimmed().isEmpty() || !group.trimmed().isEmpty())
         setValue(detail, QContactDisplayLabel__FieldLabelGroupSortOrder, sortOrder);
+    // ignore sortDisplayLabel
 }
 
 static const FieldInfo emailAddressFields[] =
@@ -286,7 +344,7 @@ static const FieldInfo emailAddressFields[] =
     { QContactDetail::FieldContext, "context", StringField }
 };
 
-static void setValues(QContactEmailAddress *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactEmailAddress *detail, const ResultRow *query, const int offset)
 {
     typedef QContactEmailAddress T;
 
@@ -300,7 +358,7 @@ static const FieldInfo familyFields[] =
     { QContactFamily::FieldChildren, "children", LocalizedListField }
 };
 
-static void setValues(QContactFamily *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactFamily *detail, const ResultRow *query, const int offset)
 {
     typedef QContactFamily T;
 
@@ -313,7 +371,7 @@ static const FieldInfo favoriteFields[] =
     { QContactFavorite::FieldFavorite, "isFavorite", BooleanField },
 };
 
-static void setValues(QContactFavorite *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactFavorite *detail, const ResultRow *query, const int offset)
 {
     typedef QContactFavorite T;
 
@@ -325,7 +383,7 @@ static const FieldInfo genderFields[] =
     { QContactGender::FieldGender, "gender", StringField },
 };
 
-static void setValues(QContactGender *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactGender *detail, const ResultRow *query, const int offset)
 {
     typedef QContactGender T;
 
@@ -345,7 +403,7 @@ static const FieldInfo geoLocationFields[] =
     { QContactGeoLocation::FieldTimestamp, "timestamp", DateField }
 };
 
-static void setValues(QContactGeoLocation *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactGeoLocation *detail, const ResultRow *query, const int offset)
 {
     typedef QContactGeoLocation T;
 
@@ -365,7 +423,7 @@ static const FieldInfo guidFields[] =
     { QContactGuid::FieldGuid, "guid", StringField }
 };
 
-static void setValues(QContactGuid *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactGuid *detail, const ResultRow *query, const int offset)
 {
     typedef QContactGuid T;
 
@@ -377,7 +435,7 @@ static const FieldInfo hobbyFields[] =
     { QContactHobby::FieldHobby, "hobby", LocalizedField }
 };
 
-static void setValues(QContactHobby *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactHobby *detail, const ResultRow *query, const int offset)
 {
     typedef QContactHobby T;
 
@@ -393,10 +451,14 @@ static const FieldInfo nameFields[] =
     { QContactName::FieldMiddleName, "middleName", LocalizedField },
     { QContactName::FieldPrefix, "prefix", LocalizedField },
     { QContactName::FieldSuffix, "suffix", LocalizedField },
-    { QContactName::FieldCustomLabel, "customLabel", LocalizedField }
+    { QContactName::FieldCustomLabel, "customLabel", LocalizedField },
+    { invalidField, "keypadFirstName", StringField },
+    { invalidField, "keypadLastName", StringField },
+    { invalidField, "sortFirstName", OtherField },
+    { invalidField, "sortLastName", OtherField }
 };
 
-static void setValues(QContactName *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactName *detail, const ResultRow *query, const int offset)
 {
     typedef QContactName T;
 
@@ -408,20 +470,22 @@ static void setValues(QContactName *detail, QSqlQuery *query, const int offset)
     setValue(detail, T::FieldPrefix, query->value(offset + 5));
     setValue(detail, T::FieldSuffix, query->value(offset + 6));
     setValue(detail, T::FieldCustomLabel, query->value(offset + 7));
+    // ignore keypadFirstName, keypadLastName, sortFirstName and sortLastName
 }
 
 static const FieldInfo nicknameFields[] =
 {
     { QContactNickname::FieldNickname, "nickname", LocalizedField },
-    { invalidField, "lowerNickname", LocalizedField }
+    { invalidField, "lowerNickname", LocalizedField },
+    { invalidField, "keypadNickname", StringField }
 };
 
-static void setValues(QContactNickname *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactNickname *detail, const ResultRow *query, const int offset)
 {
     typedef QContactNickname T;
 
     setValue(detail, T::FieldNickname, query->value(offset + 0));
-    // ignore lowerNickname
+    // ignore lowerNickname and keypadNickname
 }
 
 static const FieldInfo noteFields[] =
@@ -429,7 +493,7 @@ static const FieldInfo noteFields[] =
     { QContactNote::FieldNote, "note", LocalizedField }
 };
 
-static void setValues(QContactNote *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactNote *detail, const ResultRow *query, const int offset)
 {
     typedef QContactNote T;
 
@@ -451,7 +515,7 @@ static const FieldInfo onlineAccountFields[] =
     { QContactOnlineAccount__FieldServiceProviderDisplayName, "serviceProviderDisplayName", LocalizedField }
 };
 
-static void setValues(QContactOnlineAccount *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactOnlineAccount *detail, const ResultRow *query, const int offset)
 {
     typedef QContactOnlineAccount T;
 
@@ -482,7 +546,7 @@ static const FieldInfo organizationFields[] =
     { QContactOrganization::FieldAssistantName, "assistantName", StringField }
 };
 
-static void setValues(QContactOrganization *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactOrganization *detail, const ResultRow *query, const int offset)
 {
     typedef QContactOrganization T;
 
@@ -499,10 +563,11 @@ static const FieldInfo phoneNumberFields[] =
 {
     { QContactPhoneNumber::FieldNumber, "phoneNumber", LocalizedField },
     { QContactPhoneNumber::FieldNormalizedNumber, "normalizedNumber", StringField },
-    { QContactPhoneNumber::FieldSubTypes, "subTypes", StringListField }
+    { QContactPhoneNumber::FieldSubTypes, "subTypes", StringListField },
+    { invalidField, "reversedNumber", StringField }
 };
 
-static void setValues(QContactPhoneNumber *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactPhoneNumber *detail, const ResultRow *query, const int offset)
 {
     typedef QContactPhoneNumber T;
 
@@ -512,6 +577,7 @@ static void setValues(QContactPhoneNumber *detail, QSqlQuery *query, const int o
     setValue(detail, T::FieldSubTypes, QVariant::fromValue<QList<int> >(subTypeList(subTypeValues)));
 
     setValue(detail, QContactPhoneNumber::FieldNormalizedNumber, query->value(offset + 2));
+    // ignore reversedNumber
 }
 
 static const FieldInfo presenceFields[] =
@@ -524,7 +590,7 @@ static const FieldInfo presenceFields[] =
     { QContactPresence::FieldPresenceStateImageUrl, "presenceStateImageUrl", StringField }
 };
 
-static void setValues(QContactPresence *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactPresence *detail, const ResultRow *query, const int offset)
 {
     typedef QContactPresence T;
 
@@ -536,7 +602,18 @@ static void setValues(QContactPresence *detail, QSqlQuery *query, const int offs
     setValue(detail, T::FieldPresenceStateImageUrl, urlValue(query->value(offset + 5)));
 }
 
-static void setValues(QContactGlobalPresence *detail, QSqlQuery *query, const int offset)
+static const FieldInfo globalPresenceFields[] =
+{
+    { QContactGlobalPresence::FieldPresenceState, "presenceState", IntegerField },
+    { QContactGlobalPresence::FieldTimestamp, "timestamp", DateField },
+    { QContactGlobalPresence::FieldNickname, "nickname", LocalizedField },
+    { QContactGlobalPresence::FieldCustomMessage, "customMessage", LocalizedField },
+    { QContactGlobalPresence::FieldPresenceStateText, "presenceStateText", StringField },
+    { QContactGlobalPresence::FieldPresenceStateImageUrl, "presenceStateImageUrl", StringField },
+    { invalidField, "presenceRank", IntegerField }
+};
+
+static void setValues(QContactGlobalPresence *detail, const ResultRow *query, const int offset)
 {
     typedef QContactPresence T;
 
@@ -546,6 +623,7 @@ static void setValues(QContactGlobalPresence *detail, QSqlQuery *query, const in
     setValue(detail, T::FieldCustomMessage, query->value(offset + 3));
     setValue(detail, T::FieldPresenceStateText, query->value(offset + 4));
     setValue(detail, T::FieldPresenceStateImageUrl, urlValue(query->value(offset + 5)));
+    // ignore presenceRank
 }
 
 static const FieldInfo ringtoneFields[] =
@@ -555,7 +633,7 @@ static const FieldInfo ringtoneFields[] =
     { QContactRingtone::FieldVibrationRingtoneUrl, "vibrationRingtone", StringField }
 };
 
-static void setValues(QContactRingtone *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactRingtone *detail, const ResultRow *query, const int offset)
 {
     typedef QContactRingtone T;
 
@@ -569,7 +647,7 @@ static const FieldInfo syncTargetFields[] =
     { QContactSyncTarget::FieldSyncTarget, "syncTarget", StringField }
 };
 
-static void setValues(QContactSyncTarget *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactSyncTarget *detail, const ResultRow *query, const int offset)
 {
     typedef QContactSyncTarget T;
 
@@ -581,7 +659,7 @@ static const FieldInfo tagFields[] =
     { QContactTag::FieldTag, "tag", LocalizedField }
 };
 
-static void setValues(QContactTag *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactTag *detail, const ResultRow *query, const int offset)
 {
     typedef QContactTag T;
 
@@ -594,7 +672,7 @@ static const FieldInfo urlFields[] =
     { QContactUrl::FieldSubType, "subTypes", StringField }
 };
 
-static void setValues(QContactUrl *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactUrl *detail, const ResultRow *query, const int offset)
 {
     typedef QContactUrl T;
 
@@ -609,7 +687,7 @@ static const FieldInfo originMetadataFields[] =
     { QContactOriginMetadata::FieldEnabled, "enabled", BooleanField }
 };
 
-static void setValues(QContactOriginMetadata *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactOriginMetadata *detail, const ResultRow *query, const int offset)
 {
     setValue(detail, QContactOriginMetadata::FieldId     , query->value(offset + 0));
     setValue(detail, QContactOriginMetadata::FieldGroupId, query->value(offset + 1));
@@ -622,7 +700,7 @@ static const FieldInfo extendedDetailFields[] =
     { QContactExtendedDetail::FieldData, "data", OtherField }
 };
 
-static void setValues(QContactExtendedDetail *detail, QSqlQuery *query, const int offset)
+static void setValues(QContactExtendedDetail *detail, const ResultRow *query, const int offset)
 {
     setValue(detail, QContactExtendedDetail::FieldName, query->value(offset + 0));
 
@@ -668,7 +746,7 @@ static int contextType(const QString &type)
 }
 
 template <typename T>
-static void readDetail(QContact *contact, QSqlQuery &query, quint32 contactId, quint32 detailId,
+static void readDetail(QContact *contact, const ResultRow &query, quint32 contactId, quint32 detailId,
                        bool syncable, const QContactCollectionId &apiCollectionId, bool relaxConstraints,
                        bool keepChangeFlags, int offset)
 {
@@ -762,11 +840,11 @@ static void readDetail(QContact *contact, QSqlQuery &query, quint32 contactId, q
 }
 
 template <typename T>
-static void appendUniqueDetail(QList<QContactDetail> *details, QSqlQuery &query)
+static void appendUniqueDetail(QList<QContactDetail> *details, const ResultRow &row)
 {
     T detail;
 
-    setValues(&detail, &query, 0);
+    setValues(&detail, &row, 0);
 
     details->append(detail);
 }
@@ -783,10 +861,10 @@ static QContactRelationship makeRelationship(const QString &type, quint32 firstI
     return relationship;
 }
 
-typedef void (*ReadDetail)(QContact *contact, QSqlQuery &query, quint32 contactId, quint32 detailId, bool syncable,
+typedef void (*ReadDetail)(QContact *contact, const ResultRow &query, quint32 contactId, quint32 detailId, bool syncable,
                            const QContactCollectionId &collectionId, bool relaxConstraints, bool keepChangeFlags,
                            int offset);
-typedef void (*AppendUniqueDetail)(QList<QContactDetail> *details, QSqlQuery &query);
+typedef void (*AppendUniqueDetail)(QList<QContactDetail> *details, const ResultRow &row);
 
 struct DetailInfo
 {
@@ -800,10 +878,15 @@ struct DetailInfo
     const ReadDetail read;
     const AppendUniqueDetail appendUnique;
 
+    QString select() const
+    {
+        return QStringLiteral("SELECT contactId FROM %1 WHERE %2").arg(QLatin1String(table));
+    }
+
     QString where(bool queryContacts) const
     {
         return table && queryContacts
-                ? QStringLiteral("Contacts.contactId IN (SELECT contactId FROM %1 WHERE %2)").arg(QLatin1String(table))
+                ? QStringLiteral("Contacts.contactId IN (%1)").arg(select())
                 : QStringLiteral("%2");
     }
 
@@ -867,7 +950,7 @@ static const DetailInfo detailInfo[] =
     DEFINE_DETAIL(QContactTag           , Tags           , tagFields           , false, false),
     DEFINE_DETAIL(QContactUrl           , Urls           , urlFields           , false, false),
     DEFINE_DETAIL(QContactOriginMetadata, OriginMetadata , originMetadataFields, false, true),
-    DEFINE_DETAIL(QContactGlobalPresence, GlobalPresences, presenceFields      , false, true),
+    DEFINE_DETAIL(QContactGlobalPresence, GlobalPresences, globalPresenceFields, false, true),
     DEFINE_DETAIL(QContactExtendedDetail, ExtendedDetails, extendedDetailFields, false, false),
 };
 
@@ -935,6 +1018,56 @@ static QString caseInsensitiveColumnName(const char *table, const char *column)
     return columnNames.value(fieldName(table, column));
 }
 
+static QHash<QString, QString> getKeypadColumnNames()
+{
+    QHash<QString, QString> names;
+    names.insert(fieldName("Names", "firstName"), QStringLiteral("keypadFirstName"));
+    names.insert(fieldName("Names", "lastName"), QStringLiteral("keypadLastName"));
+    names.insert(fieldName("Nicknames", "nickname"), QStringLiteral("keypadNickname"));
+    return names;
+}
+
+static QString keypadColumnName(const char *table, const char *column)
+{
+    static QHash<QString, QString> columnNames(getKeypadColumnNames());
+    return columnNames.value(fieldName(table, column));
+}
+
+static QHash<QString, QString> getSortKeyColumnNames()
+{
+    QHash<QString, QString> names;
+    names.insert(fieldName("Names", "firstName"), QStringLiteral("sortFirstName"));
+    names.insert(fieldName("Names", "lastName"), QStringLiteral("sortLastName"));
+    names.insert(fieldName("DisplayLabels", "displayLabel"), QStringLiteral("sortDisplayLabel"));
+    return names;
+}
+
+static QString sortKeyColumnName(const char *table, const char *column)
+{
+    static QHash<QString, QString> columnNames(getSortKeyColumnNames());
+    return columnNames.value(fieldName(table, column));
+}
+
+static QString prefixUpperBound(const QString &prefix)
+{
+    // Find the least string which is greater than every string beginning with prefix,
+    // or return a null string if the bound cannot be simply represented
+    if (prefix.isEmpty())
+        return QString();
+
+    const ushort last = prefix.at(prefix.length() - 1).unicode();
+    if (last >= 0xd7ff && last < 0xe000) {
+        // UTF-16 ordering of surrogates does not match the UTF-8 ordering used by sqlite
+        return QString();
+    } else if (last == 0xffff) {
+        return QString();
+    }
+
+    QString bound(prefix);
+    bound[bound.length() - 1] = QChar(static_cast<ushort>(last + 1));
+    return bound;
+}
+
 static QString dateString(const DetailInfo &detail, const QDateTime &qdt)
 {
     if (detail.detailType == QContactBirthday::Type
@@ -997,6 +1130,215 @@ static QString convertFilterValueToString(const QContactDetailFilter &filter, co
     return defaultValue;
 }
 
+static QString fullTextSearchColumn(QContactDetail::DetailType type)
+{
+    switch (type) {
+    case QContactDetail::TypeName:
+    case QContactDetail::TypeDisplayLabel:
+        return QStringLiteral("name");
+    case QContactDetail::TypeNickname:
+        return QStringLiteral("nickname");
+    case QContactDetail::TypeEmailAddress:
+        return QStringLiteral("emailAddress");
+    case QContactDetail::TypePhoneNumber:
+        return QStringLiteral("phoneNumber");
+    case QContactDetail::TypeOrganization:
+        return QStringLiteral("organization");
+    case QContactDetail::TypeNote:
+        return QStringLiteral("note");
+    default:
+        break;
+    }
+    return QString();
+}
+
+// Returns the indexed column searched by the filter, which is empty if every column is searched
+static QString fullTextSearchFilterColumn(const QContactDetailFilter &filter, bool *failed)
+{
+    QString column;
+    if (filter.detailType() != QContactDetail::TypeUndefined) {
+        column = fullTextSearchColumn(filter.detailType());
+        if (column.isEmpty()) {
+            *failed = true;
+            qWarning() << "Cannot perform full-text search on detail type:" << filter.detailType();
+            return QString();
+        }
+    }
+
+    const int globValue = filter.matchFlags() & 7;
+    if (globValue == QContactFilter::MatchEndsWith) {
+        *failed = true;
+        qWarning() << "Cannot perform full-text search with suffix matching";
+        return QString();
+    }
+
+    return column;
+}
+
+static QStringList fullTextSearchTokens(const QString &value)
+{
+    QStringList tokens;
+    QString token;
+    for (int i = 0; i <= value.length(); ++i) {
+        const QChar ch(i < value.length() ? value.at(i) : QChar());
+        if (ch.isLetterOrNumber()) {
+            token.append(ch);
+        } else if (!token.isEmpty()) {
+            tokens.append(token);
+            token.clear();
+        }
+    }
+    return tokens;
+}
+
+static QString fullTextSearchExpression(const QContactDetailFilter &filter, bool *failed)
+{
+    // Build an FTS5 query expression requiring each token of the filter value to be present
+    const QString column(fullTextSearchFilterColumn(filter, failed));
+    if (*failed)
+        return QString();
+
+    // Token prefixes are indexed; infix matches cannot be supported, so 'contains' matches token prefixes
+    const int globValue = filter.matchFlags() & 7;
+    const bool prefixMatch = (globValue == QContactFilter::MatchStartsWith || globValue == QContactFilter::MatchContains);
+
+    QStringList terms;
+    foreach (const QString &token, fullTextSearchTokens(filter.value().toString())) {
+        QString term(QStringLiteral("\"%1\"").arg(token));
+        if (prefixMatch) {
+            term.append(QChar('*'));
+        }
+        if (!column.isEmpty()) {
+            term.prepend(column + QStringLiteral(" : "));
+        }
+        terms.append(term);
+    }
+
+    return terms.join(QStringLiteral(" AND "));
+}
+
+static bool fullTextSearchFilter(const QContactFilter &filter, ContactsDatabase &db, QString *expression)
+{
+    if (filter.type() != QContactFilter::ContactDetailFilter || !db.hasFullTextSearch())
+        return false;
+
+    const QContactDetailFilter &detailFilter(static_cast<const QContactDetailFilter &>(filter));
+    if ((detailFilter.matchFlags() & QContactFilter__MatchFullTextSearch) == 0)
+        return false;
+
+    bool failed = false;
+    *expression = fullTextSearchExpression(detailFilter, &failed);
+    return !failed && !expression->isEmpty();
+}
+
+// Without the FTS5 module there is no search index, so each token is matched anywhere within
+// the contact's searchable text, computed as it would be indexed
+static QString buildFullTextSearchFallbackSelect(const QContactDetailFilter &filter, QVariantList *bindings, bool *failed)
+{
+    const QString column(fullTextSearchFilterColumn(filter, failed));
+    if (*failed) {
+        return QStringLiteral("FAILED");
+    }
+
+    const QString text(column.isEmpty()
+            ? QStringLiteral("(COALESCE(name, '') || ' ' || COALESCE(nickname, '') || ' ' || COALESCE(emailAddress, '') || ' ' || "
+                             "COALESCE(phoneNumber, '') || ' ' || COALESCE(organization, '') || ' ' || COALESCE(note, ''))")
+            : column);
+
+    QStringList clauses;
+    foreach (const QString &token, fullTextSearchTokens(filter.value().toString())) {
+        clauses.append(QStringLiteral("%1 LIKE ?").arg(text));
+        bindings->append(QStringLiteral("%") + token + QStringLiteral("%"));
+    }
+
+    const QString select(QStringLiteral("SELECT contactId FROM (%1)").arg(ContactsDatabase::searchContentSelect()));
+    return clauses.isEmpty() ? select : select + QStringLiteral(" WHERE ") + clauses.join(QStringLiteral(" AND "));
+}
+
+static QString buildFullTextSearchSelect(const QContactDetailFilter &filter, ContactsDatabase &db, QVariantList *bindings, bool *failed)
+{
+    if (!db.hasFullTextSearch()) {
+        return buildFullTextSearchFallbackSelect(filter, bindings, failed);
+    }
+
+    const QString expression(fullTextSearchExpression(filter, failed));
+    if (*failed) {
+        return QStringLiteral("FAILED");
+    }
+
+    if (expression.isEmpty()) {
+        // No tokens to match; any contact with indexed content matches
+        return QStringLiteral("SELECT rowid FROM ContactsSearch");
+    }
+
+    bindings->append(expression);
+    return QStringLiteral("SELECT rowid FROM ContactsSearch WHERE ContactsSearch MATCH ?");
+}
+
+static QString buildFullTextSearchWhere(const QContactDetailFilter &filter, ContactsDatabase &db, bool queryContacts, QVariantList *bindings, bool *failed)
+{
+    if (!queryContacts) {
+        *failed = true;
+        qWarning() << "Cannot perform full-text search on relationships";
+        return QStringLiteral("FAILED");
+    }
+
+    const QString select(buildFullTextSearchSelect(filter, db, bindings, failed));
+    if (*failed) {
+        return QStringLiteral("FAILED");
+    }
+
+    return QStringLiteral("Contacts.contactId IN (%1)").arg(select);
+}
+
+static QString fullTextSearchOrderBy()
+{
+    return QStringLiteral("(SELECT rank FROM ContactsSearch WHERE ContactsSearch MATCH ? AND rowid = Contacts.contactId), Contacts.contactId");
+}
+
+static QString buildKeypadWhere(
+        const QContactDetailFilter &filter,
+        const DetailInfo &detail,
+        const FieldInfo &field,
+        bool queryContacts,
+        QVariantList *bindings,
+        bool *failed)
+{
+    const QString column(keypadColumnName(detail.table, field.column));
+    if (column.isEmpty()) {
+        *failed = true;
+        qWarning() << "Cannot buildWhere with keypad collation on detail:" << filter.detailType() << "field:" << filter.detailField();
+        return QStringLiteral("FAILED");
+    }
+
+    // The filter value may be specified either as keypad digits or as text
+    const QString digits(ContactsEngine::keypadDigits(filter.value().toString()));
+    if (digits.isEmpty()) {
+        *failed = true;
+        qWarning() << "Cannot buildWhere with keypad collation on empty value";
+        return QStringLiteral("FAILED");
+    }
+
+    QString comparison;
+    const int globValue = filter.matchFlags() & 7;
+    if (globValue == QContactFilter::MatchStartsWith) {
+        comparison = QStringLiteral("(%1 >= ? AND %1 < ?)");
+        bindings->append(digits);
+        bindings->append(prefixUpperBound(digits));
+    } else if (globValue == QContactFilter::MatchContains) {
+        comparison = QStringLiteral("%1 GLOB ?");
+        bindings->append(QStringLiteral("*") + digits + QStringLiteral("*"));
+    } else if (globValue == QContactFilter::MatchEndsWith) {
+        comparison = QStringLiteral("%1 GLOB ?");
+        bindings->append(QStringLiteral("*") + digits);
+    } else {
+        comparison = QStringLiteral("%1 = ?");
+        bindings->append(digits);
+    }
+
+    return detail.where(queryContacts).arg(comparison.arg(column));
+}
+
 static QString buildWhere(const QContactCollectionFilter &filter, QVariantList *bindings, bool *failed)
 {
     const QSet<QContactCollectionId> &filterIds(filter.collectionIds());
@@ -1029,16 +1371,15 @@ static QString buildWhere(const QContactCollectionFilter &filter, QVariantList *
 
 static QString buildWhere(
         const QContactDetailFilter &filter,
+        ContactsDatabase &db,
         bool queryContacts,
         QVariantList *bindings,
         bool *failed,
         bool *transientModifiedRequired,
         bool *globalPresenceRequired)
 {
-    if (filter.matchFlags() & QContactFilter::MatchKeypadCollation) {
-        *failed = true;
-        qWarning() << "Cannot buildWhere with filter requiring keypad collation";
-        return QStringLiteral("FAILED");
+    if (filter.matchFlags() & QContactFilter__MatchFullTextSearch) {
+        return buildFullTextSearchWhere(filter, db, queryContacts, bindings, failed);
     }
 
     const DetailInfo &detail(detailInformation(filter.detailType()));
@@ -1060,6 +1401,10 @@ static QString buildWhere(
         return QStringLiteral("FAILED");
     }
 
+    if (filter.matchFlags() & QContactFilter::MatchKeypadCollation) {
+        return buildKeypadWhere(filter, detail, field, queryContacts, bindings, failed);
+    }
+
     if (!filter.value().isValid()     // "match if detail and field exists, don't care about value" filter
         || (filterOnField<QContactSyncTarget>(filter, QContactSyncTarget::FieldSyncTarget) &&
             filter.value().toString().isEmpty())) { // match all sync targets if empty sync target filter
@@ -1150,6 +1495,7 @@ static QString buildWhere(
         bool phoneNumberMatch = filter.matchFlags() & QContactFilter::MatchPhoneNumber;
         bool fixedString = filter.matchFlags() & QContactFilter::MatchFixedString;
         bool useNormalizedNumber = false;
+        bool useReversedNumber = false;
         int globValue = filter.matchFlags() & 7;
         if (field.fieldType == StringListField || field.fieldType == LocalizedListField) {
             // With a string list, the only string match type we can do is 'contains'
@@ -1206,6 +1552,21 @@ static QString buildWhere(
                         bindValue.append(current);
                     }
                 }
+
+                // A suffix match on the number can be performed as a prefix match on the reversed number
+                useReversedNumber = (filterOnField<QContactPhoneNumber>(filter, QContactPhoneNumber::FieldNumber) &&
+                                     (globValue == QContactFilter::MatchEndsWith) &&
+                                     !bindValue.isEmpty());
+                if (useReversedNumber) {
+                    QString reversedValue;
+                    reversedValue.reserve(bindValue.length());
+                    for (int i = bindValue.length() - 1; i >= 0; --i) {
+                        reversedValue.append(bindValue.at(i));
+                    }
+                    bindValue = reversedValue;
+                    comparison = QStringLiteral("(%1 >= ? AND %1 < ?)");
+                    column = QStringLiteral("reversedNumber");
+                }
             }
         } else {
             const QVariant &v(filter.value());
@@ -1236,8 +1597,20 @@ static QString buildWhere(
             }
         }
 
-        if (stringField || fixedString) {
-            if (globValue == QContactFilter::MatchStartsWith) {
+        // A prefix match on a case-insensitive column can be expressed as a range over its index
+        const QString upperBound((caseInsensitive && !column.isEmpty() && !phoneNumberMatch
+                                   && (field.fieldType == StringField || field.fieldType == LocalizedField))
+                ? prefixUpperBound(bindValue) : QString());
+
+        if (useReversedNumber) {
+            bindings->append(bindValue);
+            bindings->append(prefixUpperBound(bindValue));
+        } else if (stringField || fixedString) {
+            if (globValue == QContactFilter::MatchStartsWith && !upperBound.isEmpty()) {
+                comparison = QStringLiteral("(%1 >= ? AND %1 < ?)");
+                bindings->append(bindValue);
+                bindings->append(upperBound);
+            } else if (globValue == QContactFilter::MatchStartsWith) {
                 bindValue = bindValue + QStringLiteral("*");
                 comparison += QStringLiteral(" GLOB ?");
                 bindings->append(bindValue);
@@ -1361,30 +1734,20 @@ static QString buildWhere(const QContactDetailRangeFilter &filter, bool queryCon
     return detail.where(queryContacts).arg(comparison.arg(comparisonArg));
 }
 
-static QString buildWhere(const QContactIdFilter &filter, ContactsDatabase &db, const QString &table, QVariantList *bindings, bool *failed)
+static QString buildContactIdsWhere(const QList<quint32> &dbIds, ContactsDatabase &db, const QString &table, QVariantList *bindings, bool *failed)
 {
-    const QList<QContactId> &filterIds(filter.ids());
-    if (filterIds.isEmpty()) {
-        *failed = true;
-        qWarning() << "Cannot buildWhere with empty contact ID list";
-        return QStringLiteral("FALSE");
-    }
-
-    QList<quint32> dbIds;
-    dbIds.reserve(filterIds.count());
-    bindings->reserve(filterIds.count());
-
-    foreach (const QContactId &id, filterIds) {
-        dbIds.append(ContactId::databaseId(id));
+    if (dbIds.isEmpty()) {
+        return QStringLiteral("Contacts.contactId IN ()");
     }
 
     // We don't want to exceed the maximum bound variables limit; if there are too
     // many IDs in the list, create a temporary table to look them up from
     const int maxInlineIdsCount = 800;
-    if (filterIds.count() > maxInlineIdsCount) {
+    if (dbIds.count() > maxInlineIdsCount) {
         QVariantList varIds;
-        foreach (const QContactId &id, filterIds) {
-            varIds.append(QVariant(ContactId::databaseId(id)));
+        varIds.reserve(dbIds.count());
+        foreach (quint32 dbId, dbIds) {
+            varIds.append(QVariant(dbId));
         }
 
         QString transientTable;
@@ -1397,6 +1760,8 @@ static QString buildWhere(const QContactIdFilter &filter, ContactsDatabase &db,
         return QStringLiteral("Contacts.contactId IN (SELECT contactId FROM %1)").arg(transientTable);
     }
 
+    bindings->reserve(bindings->count() + dbIds.count());
+
     QString statement = QStringLiteral("Contacts.contactId IN (?");
     bindings->append(dbIds.first());
 
@@ -1407,6 +1772,25 @@ static QString buildWhere(const QContactIdFilter &filter, ContactsDatabase &db,
     return statement + QStringLiteral(")");
 }
 
+static QString buildWhere(const QContactIdFilter &filter, ContactsDatabase &db, const QString &table, QVariantList *bindings, bool *failed)
+{
+    const QList<QContactId> &filterIds(filter.ids());
+    if (filterIds.isEmpty()) {
+        *failed = true;
+        qWarning() << "Cannot buildWhere with empty contact ID list";
+        return QStringLiteral("FALSE");
+    }
+
+    QList<quint32> dbIds;
+    dbIds.reserve(filterIds.count());
+
+    foreach (const QContactId &id, filterIds) {
+        dbIds.append(ContactId::databaseId(id));
+    }
+
+    return buildContactIdsWhere(dbIds, db, table, bindings, failed);
+}
+
 static QString buildWhere(const QContactRelationshipFilter &filter, QVariantList *bindings, bool *failed)
 {
     QContactId rci = filter.relatedContactId();
@@ -1610,43 +1994,60 @@ static QString buildWhere(
 
 static QString buildContactWhere(const QContactFilter &filter, ContactsDatabase &db, const QString &table,
                                  QContactDetail::DetailType detailType, QVariantList *bindings,
-                                 bool *failed, bool *transientModifiedRequired, bool *globalPresenceRequired)
+                                 bool *failed, bool *transientModifiedRequired, bool *globalPresenceRequired);
+
+// Returns true if the filter selects contacts by a predicate on a single detail table, or on the
+// full-text index, so that it can be evaluated as a subquery selecting contact IDs
+static bool selectsContactIds(const QContactFilter &filter)
 {
-    Q_ASSERT(failed);
-    Q_ASSERT(globalPresenceRequired);
-    Q_ASSERT(transientModifiedRequired);
+    if (filter.type() == QContactFilter::ContactDetailFilter) {
+        const QContactDetailFilter &detailFilter(static_cast<const QContactDetailFilter &>(filter));
+        if (detailFilter.matchFlags() & QContactFilter__MatchFullTextSearch) {
+            return true;
+        }
 
-    switch (filter.type()) {
-    case QContactFilter::DefaultFilter:
-        return QString();
-    case QContactFilter::ContactDetailFilter:
-        return buildWhere(static_cast<const QContactDetailFilter &>(filter), true, bindings, failed,
-                          transientModifiedRequired, globalPresenceRequired);
-    case QContactFilter::ContactDetailRangeFilter:
-        return buildWhere(static_cast<const QContactDetailRangeFilter &>(filter), true, bindings, failed);
-    case QContactFilter::ChangeLogFilter:
-        return buildWhere(static_cast<const QContactChangeLogFilter &>(filter), bindings, failed, transientModifiedRequired);
-    case QContactFilter::RelationshipFilter:
-        return buildWhere(static_cast<const QContactRelationshipFilter &>(filter), bindings, failed);
-    case QContactFilter::IntersectionFilter:
-        return buildWhere(buildContactWhere, static_cast<const QContactIntersectionFilter &>(filter), db, table,
-                          detailType, bindings, failed, transientModifiedRequired, globalPresenceRequired);
-    case QContactFilter::UnionFilter:
-        return buildWhere(buildContactWhere, static_cast<const QContactUnionFilter &>(filter), db, table, detailType,
-                          bindings, failed, transientModifiedRequired, globalPresenceRequired);
-    case QContactFilter::IdFilter:
-        return buildWhere(static_cast<const QContactIdFilter &>(filter), db, table, bindings, failed);
-    case QContactFilter::CollectionFilter:
-        return buildWhere(static_cast<const QContactCollectionFilter &>(filter), bindings, failed);
-    default:
-        *failed = true;
-        qWarning() << "Cannot buildWhere with unknown filter type:" << filter.type();
-        return QStringLiteral("FALSE");
+        const DetailInfo &detail(detailInformation(detailFilter.detailType()));
+        if (!detail.table || detailFilter.detailField() == invalidField
+                || fieldInformation(detail, detailFilter.detailField()).field == invalidField) {
+            return false;
+        }
+
+        // The presence state is compared with the transient state joined to its table
+        return !filterOnField<QContactGlobalPresence>(detailFilter, QContactGlobalPresence::FieldPresenceState);
+    } else if (filter.type() == QContactFilter::ContactDetailRangeFilter) {
+        const QContactDetailRangeFilter &rangeFilter(static_cast<const QContactDetailRangeFilter &>(filter));
+        const DetailInfo &detail(detailInformation(rangeFilter.detailType()));
+        return detail.table && rangeFilter.detailField() != invalidField
+                && fieldInformation(detail, rangeFilter.detailField()).field != invalidField;
     }
+
+    return false;
 }
 
-static QString buildDetailWhere(
-        const QContactFilter &filter,
+// Returns the statement selecting the IDs of the contacts matching a filter for which selectsContactIds() is true
+static QString buildContactIdsSelect(const QContactFilter &filter, ContactsDatabase &db, QVariantList *bindings, bool *failed,
+                                     bool *transientModifiedRequired, bool *globalPresenceRequired)
+{
+    if (filter.type() == QContactFilter::ContactDetailRangeFilter) {
+        const QContactDetailRangeFilter &rangeFilter(static_cast<const QContactDetailRangeFilter &>(filter));
+        const QString comparison(buildWhere(rangeFilter, false, bindings, failed));
+        return detailInformation(rangeFilter.detailType()).select().arg(comparison);
+    }
+
+    const QContactDetailFilter &detailFilter(static_cast<const QContactDetailFilter &>(filter));
+    if (detailFilter.matchFlags() & QContactFilter__MatchFullTextSearch) {
+        return buildFullTextSearchSelect(detailFilter, db, bindings, failed);
+    }
+
+    const QString comparison(buildWhere(detailFilter, db, false, bindings, failed, transientModifiedRequired, globalPresenceRequired));
+    return detailInformation(detailFilter.detailType()).select().arg(comparison);
+}
+
+// The alternatives of a contact union which select contacts by detail predicates are combined into
+// a single compound subquery, so that each is evaluated once via its own index rather than being
+// tested for every contact
+static QString buildContactUnionWhere(
+        const QContactUnionFilter &filter,
         ContactsDatabase &db,
         const QString &table,
         QContactDetail::DetailType detailType,
@@ -1655,42 +2056,518 @@ static QString buildDetailWhere(
         bool *transientModifiedRequired,
         bool *globalPresenceRequired)
 {
-    Q_ASSERT(failed);
-    Q_ASSERT(globalPresenceRequired);
-    Q_ASSERT(transientModifiedRequired);
-
-    switch (filter.type()) {
-    case QContactFilter::DefaultFilter:
-        return QString();
-    case QContactFilter::ContactDetailFilter: {
-        const QContactDetailFilter &detailFilter = static_cast<const QContactDetailFilter &>(filter);
-
-        if (detailFilter.detailType() == detailType) {
-            return buildWhere(
-                        detailFilter,
-                        false,
-                        bindings,
-                        failed,
-                        transientModifiedRequired,
-                        globalPresenceRequired);
+    QList<QContactFilter> selections;
+    QList<QContactFilter> remainder;
+    foreach (const QContactFilter &partialFilter, filter.filters()) {
+        if (selectsContactIds(partialFilter)) {
+            selections.append(partialFilter);
         } else {
-            *failed = true;
-            qWarning() << "Cannot build detail query with mismatched details type:" << detailType << detailFilter.detailType();
-            return QStringLiteral("FALSE");
+            remainder.append(partialFilter);
         }
     }
-    case QContactFilter::ContactDetailRangeFilter: {
-        const QContactDetailRangeFilter &detailFilter = static_cast<const QContactDetailRangeFilter &>(filter);
 
-        if (detailFilter.detailType() == detailType) {
-            return buildWhere(detailFilter, false, bindings, failed);
-        } else {
-            *failed = true;
-            qWarning() << QString::fromLatin1("Cannot build detail query with mismatched details type: %1 != %2").arg(detailType).arg(detailFilter.detailType());
+    if (selections.count() < 2) {
+        return buildWhere(buildContactWhere, filter, db, table, detailType, bindings, failed,
+                          transientModifiedRequired, globalPresenceRequired);
+    }
+
+    QStringList subqueries;
+    foreach (const QContactFilter &selection, selections) {
+        subqueries.append(buildContactIdsSelect(selection, db, bindings, failed, transientModifiedRequired, globalPresenceRequired));
+        if (*failed) {
             return QStringLiteral("FALSE");
         }
     }
-    case QContactFilter::IntersectionFilter:
+
+    QStringList fragments;
+    fragments.append(QStringLiteral("Contacts.contactId IN (%1)").arg(subqueries.join(QStringLiteral(" UNION "))));
+    if (!remainder.isEmpty()) {
+        QContactUnionFilter remainderFilter;
+        remainderFilter.setFilters(remainder);
+        const QString fragment(buildWhere(buildContactWhere, remainderFilter, db, table, detailType, bindings, failed,
+                                          transientModifiedRequired, globalPresenceRequired));
+        if (!*failed && !fragment.isEmpty()) {
+            fragments.append(fragment);
+        }
+    }
+
+    return QStringLiteral("( %1 )").arg(fragments.join(QStringLiteral(" OR ")));
+}
+
+// Returns the number of attribute predicates in the filter, or zero if any part of it cannot be
+// evaluated from the contact attribute index
+static int attributeIndexPredicateCount(const QContactFilter &filter)
+{
+    switch (filter.type()) {
+    case QContactFilter::ContactDetailFilter: {
+        const QContactDetailFilter &detailFilter(static_cast<const QContactDetailFilter &>(filter));
+        const QVariant &value(detailFilter.value());
+        if (filterOnField<QContactStatusFlags>(detailFilter, QContactStatusFlags::FieldFlags)) {
+            // Online status is affected by transient presence state, so it is not indexed
+            const quint64 indexedFlags = QContactStatusFlags::HasPhoneNumber | QContactStatusFlags::HasEmailAddress
+                                       | QContactStatusFlags::HasOnlineAccount | QContactStatusFlags::IsDeactivated
+                                       | QContactStatusFlags::IsAdded | QContactStatusFlags::IsModified
+                                       | QContactStatusFlags::IsDeleted;
+            const quint64 flagsValue = value.value<quint64>();
+            if (detailFilter.matchFlags() == QContactFilter::MatchContains && flagsValue != 0
+                    && (flagsValue & ~indexedFlags) == 0) {
+                int count = 0;
+                for (quint64 flags = flagsValue; flags; flags &= (flags - 1)) {
+                    ++count;
+                }
+                return count;
+            }
+        } else if (filterOnField<QContactFavorite>(detailFilter, QContactFavorite::FieldFavorite)) {
+            if (detailFilter.matchFlags() == QContactFilter::MatchExactly && value.type() == QVariant::Bool && value.toBool()) {
+                return 1;
+            }
+        } else if (filterOnField<QContactType>(detailFilter, QContactType::FieldType)) {
+            if (detailFilter.matchFlags() == QContactFilter::MatchExactly
+                    && (value.type() == QVariant::Int || value.type() == QVariant::UInt)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    case QContactFilter::CollectionFilter:
+        return static_cast<const QContactCollectionFilter &>(filter).collectionIds().isEmpty() ? 0 : 1;
+
+    case QContactFilter::IntersectionFilter:
+    case QContactFilter::UnionFilter: {
+        const QList<QContactFilter> filters(filter.type() == QContactFilter::IntersectionFilter
+                ? static_cast<const QContactIntersectionFilter &>(filter).filters()
+                : static_cast<const QContactUnionFilter &>(filter).filters());
+        int count = 0;
+        foreach (const QContactFilter &partialFilter, filters) {
+            const int partialCount = attributeIndexPredicateCount(partialFilter);
+            if (partialCount == 0) {
+                return 0;
+            }
+            count += partialCount;
+        }
+        return count;
+    }
+
+    default:
+        return 0;
+    }
+}
+
+// Returns the contacts matching a filter for which attributeIndexPredicateCount() is non-zero
+static ContactIdBitmap attributeIndexMatches(const ContactAttributeIndex::Entries &entries, const QContactFilter &filter)
+{
+    ContactIdBitmap rv;
+
+    switch (filter.type()) {
+    case QContactFilter::ContactDetailFilter: {
+        const QContactDetailFilter &detailFilter(static_cast<const QContactDetailFilter &>(filter));
+        if (filterOnField<QContactStatusFlags>(detailFilter, QContactStatusFlags::FieldFlags)) {
+            static const quint64 flags[] = { QContactStatusFlags::HasPhoneNumber,
+                                             QContactStatusFlags::HasEmailAddress,
+                                             QContactStatusFlags::HasOnlineAccount,
+                                             QContactStatusFlags::IsDeactivated,
+                                             QContactStatusFlags::IsAdded,
+                                             QContactStatusFlags::IsModified,
+                                             QContactStatusFlags::IsDeleted };
+            static const ContactAttributeIndex::Attribute attributes[] = { ContactAttributeIndex::HasPhoneNumber,
+                                                                           ContactAttributeIndex::HasEmailAddress,
+                                                                           ContactAttributeIndex::HasOnlineAccount,
+                                                                           ContactAttributeIndex::IsDeactivated,
+                                                                           ContactAttributeIndex::IsAdded,
+                                                                           ContactAttributeIndex::IsModified,
+                                                                           ContactAttributeIndex::IsDeleted };
+
+            const quint64 flagsValue = detailFilter.value().value<quint64>();
+            bool first = true;
+            for (int i = 0; i < lengthOf(flags); ++i) {
+                if (flagsValue & flags[i]) {
+                    if (first) {
+                        rv = entries.attributes[attributes[i]];
+                        first = false;
+                    } else {
+                        rv &= entries.attributes[attributes[i]];
+                    }
+                }
+            }
+        } else if (filterOnField<QContactFavorite>(detailFilter, QContactFavorite::FieldFavorite)) {
+            rv = entries.attributes[ContactAttributeIndex::IsFavorite];
+        } else {
+            rv = entries.types.value(detailFilter.value().toInt());
+        }
+        break;
+    }
+
+    case QContactFilter::CollectionFilter:
+        foreach (const QContactCollectionId &id, static_cast<const QContactCollectionFilter &>(filter).collectionIds()) {
+            rv |= entries.collections.value(ContactCollectionId::databaseId(id));
+        }
+        break;
+
+    case QContactFilter::IntersectionFilter: {
+        const QList<QContactFilter> filters(static_cast<const QContactIntersectionFilter &>(filter).filters());
+        rv = attributeIndexMatches(entries, filters.first());
+        for (int i = 1; i < filters.count(); ++i) {
+            rv &= attributeIndexMatches(entries, filters.at(i));
+        }
+        break;
+    }
+
+    case QContactFilter::UnionFilter:
+        foreach (const QContactFilter &partialFilter, static_cast<const QContactUnionFilter &>(filter).filters()) {
+            rv |= attributeIndexMatches(entries, partialFilter);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return rv;
+}
+
+static QSharedPointer<const ContactAttributeIndex::Entries> attributeIndexEntries(ContactsDatabase &db)
+{
+    ContactAttributeIndex *index = db.attributeIndex();
+
+    quint64 generation = 0;
+    QSharedPointer<const ContactAttributeIndex::Entries> entries(index->entries(&generation));
+    if (entries) {
+        return entries;
+    }
+
+    QSharedPointer<ContactAttributeIndex::Entries> readEntries(new ContactAttributeIndex::Entries);
+    if (!readEntries->read(db, QVariantList())) {
+        return entries;
+    }
+
+    index->update(readEntries, generation);
+    return readEntries;
+}
+
+// Returns false if no SQL is generated for the filter; such a filter is ignored by the compound filters containing it
+static bool constrainsSelection(const QContactFilter &filter)
+{
+    if (filter.type() == QContactFilter::DefaultFilter)
+        return false;
+
+    if (filter.type() == QContactFilter::IntersectionFilter || filter.type() == QContactFilter::UnionFilter) {
+        const QList<QContactFilter> filters(filter.type() == QContactFilter::IntersectionFilter
+                ? static_cast<const QContactIntersectionFilter &>(filter).filters()
+                : static_cast<const QContactUnionFilter &>(filter).filters());
+        foreach (const QContactFilter &partialFilter, filters) {
+            if (constrainsSelection(partialFilter))
+                return true;
+        }
+        return false;
+    }
+
+    return true;
+}
+
+// Evaluates the indexed attribute predicates of a compound filter from the contact attribute index,
+// leaving only the remaining predicates to be tested by SQL. Returns false if the filter does not
+// combine multiple indexed predicates.
+static bool buildAttributeIndexWhere(
+        const QContactFilter &filter,
+        ContactsDatabase &db,
+        const QString &table,
+        QContactDetail::DetailType detailType,
+        QVariantList *bindings,
+        bool *failed,
+        bool *transientModifiedRequired,
+        bool *globalPresenceRequired,
+        QString *where)
+{
+    if (!db.attributeIndex())
+        return false;
+
+    const bool intersection(filter.type() == QContactFilter::IntersectionFilter);
+    const QList<QContactFilter> filters(intersection
+            ? static_cast<const QContactIntersectionFilter &>(filter).filters()
+            : static_cast<const QContactUnionFilter &>(filter).filters());
+
+    QList<QContactFilter> indexedFilters;
+    QList<QContactFilter> remainingFilters;
+    int predicateCount = 0;
+    foreach (const QContactFilter &partialFilter, filters) {
+        const int count = attributeIndexPredicateCount(partialFilter);
+        if (count > 0) {
+            indexedFilters.append(partialFilter);
+            predicateCount += count;
+        } else if (constrainsSelection(partialFilter)) {
+            remainingFilters.append(partialFilter);
+        }
+    }
+
+    // A single predicate is tested as efficiently by SQL
+    if (predicateCount < 2)
+        return false;
+
+    const QSharedPointer<const ContactAttributeIndex::Entries> entries(attributeIndexEntries(db));
+    if (!entries)
+        return false;
+
+    ContactIdBitmap matches(attributeIndexMatches(*entries, indexedFilters.first()));
+    for (int i = 1; i < indexedFilters.count(); ++i) {
+        if (intersection) {
+            matches &= attributeIndexMatches(*entries, indexedFilters.at(i));
+        } else {
+            matches |= attributeIndexMatches(*entries, indexedFilters.at(i));
+        }
+    }
+
+    const QString indexedWhere(buildContactIdsWhere(matches.contactIds(), db, table, bindings, failed));
+    if (remainingFilters.isEmpty()) {
+        *where = indexedWhere;
+        return true;
+    }
+
+    QString remainingWhere;
+    if (intersection) {
+        QContactIntersectionFilter remainder;
+        remainder.setFilters(remainingFilters);
+        remainingWhere = buildWhere(buildContactWhere, remainder, db, table, detailType, bindings, failed,
+                                    transientModifiedRequired, globalPresenceRequired);
+        *where = indexedWhere + QStringLiteral(" AND ") + remainingWhere;
+    } else {
+        QContactUnionFilter remainder;
+        remainder.setFilters(remainingFilters);
+        remainingWhere = buildWhere(buildContactWhere, remainder, db, table, detailType, bindings, failed,
+                                    transientModifiedRequired, globalPresenceRequired);
+        *where = QStringLiteral("( %1 OR %2 )").arg(indexedWhere).arg(remainingWhere);
+    }
+    return true;
+}
+
+static bool geoLocationRangeFilter(const QContactFilter &filter, int field)
+{
+    if (filter.type() != QContactFilter::ContactDetailRangeFilter)
+        return false;
+
+    const QContactDetailRangeFilter &rangeFilter(static_cast<const QContactDetailRangeFilter &>(filter));
+    return rangeFilter.detailType() == QContactGeoLocation::Type
+        && rangeFilter.detailField() == field
+        && (rangeFilter.minValue().isValid() || rangeFilter.maxValue().isValid());
+}
+
+// The spatial index stores bounds rounded outwards to single precision, so it is used to select
+// candidate locations by overlap, whose coordinates are then compared exactly
+static void appendGeoLocationRange(const QContactDetailRangeFilter &filter, const char *column,
+                                   const char *minimumColumn, const char *maximumColumn,
+                                   QStringList *indexClauses, QVariantList *indexBindings,
+                                   QStringList *clauses, QVariantList *bindings)
+{
+    if (filter.minValue().isValid()) {
+        indexClauses->append(QStringLiteral("GeoLocationsIndex.%1 >= ?").arg(QLatin1String(maximumColumn)));
+        indexBindings->append(filter.minValue());
+
+        const QString comparison((filter.rangeFlags() & QContactDetailRangeFilter::ExcludeLower)
+                ? QStringLiteral("GeoLocations.%1 > ?")
+                : QStringLiteral("GeoLocations.%1 >= ?"));
+        clauses->append(comparison.arg(QLatin1String(column)));
+        bindings->append(filter.minValue());
+    }
+
+    if (filter.maxValue().isValid()) {
+        indexClauses->append(QStringLiteral("GeoLocationsIndex.%1 <= ?").arg(QLatin1String(minimumColumn)));
+        indexBindings->append(filter.maxValue());
+
+        const QString comparison((filter.rangeFlags() & QContactDetailRangeFilter::IncludeUpper)
+                ? QStringLiteral("GeoLocations.%1 <= ?")
+                : QStringLiteral("GeoLocations.%1 < ?"));
+        clauses->append(comparison.arg(QLatin1String(column)));
+        bindings->append(filter.maxValue());
+    }
+}
+
+// Evaluates an intersection containing both latitude and longitude ranges as a single bounding
+// box lookup in the spatial index; any other parts of the intersection are built as usual
+static bool buildGeoLocationWhere(
+        const QContactIntersectionFilter &filter,
+        ContactsDatabase &db,
+        const QString &table,
+        QContactDetail::DetailType detailType,
+        QVariantList *bindings,
+        bool *failed,
+        bool *transientModifiedRequired,
+        bool *globalPresenceRequired,
+        QString *where)
+{
+    const QList<QContactFilter> filters(filter.filters());
+
+    int latitudeIndex = -1;
+    int longitudeIndex = -1;
+    for (int i = 0; i < filters.count(); ++i) {
+        if (latitudeIndex == -1 && geoLocationRangeFilter(filters.at(i), QContactGeoLocation::FieldLatitude)) {
+            latitudeIndex = i;
+        } else if (longitudeIndex == -1 && geoLocationRangeFilter(filters.at(i), QContactGeoLocation::FieldLongitude)) {
+            longitudeIndex = i;
+        }
+    }
+
+    // Without the R*Tree module, the ranges are compared on the GeoLocations table alone
+    if (latitudeIndex == -1 || longitudeIndex == -1 || !db.hasSpatialIndex())
+        return false;
+
+    QStringList indexClauses;
+    QVariantList indexBindings;
+    QStringList clauses;
+    QVariantList rangeBindings;
+    appendGeoLocationRange(static_cast<const QContactDetailRangeFilter &>(filters.at(latitudeIndex)),
+                           "latitude", "minLatitude", "maxLatitude",
+                           &indexClauses, &indexBindings, &clauses, &rangeBindings);
+    appendGeoLocationRange(static_cast<const QContactDetailRangeFilter &>(filters.at(longitudeIndex)),
+                           "longitude", "minLongitude", "maxLongitude",
+                           &indexClauses, &indexBindings, &clauses, &rangeBindings);
+
+    const QString indexedWhere(QStringLiteral(
+            "Contacts.contactId IN ("
+            "SELECT GeoLocations.contactId FROM GeoLocationsIndex "
+            "JOIN GeoLocations ON GeoLocations.detailId = GeoLocationsIndex.detailId "
+            "WHERE %1 AND %2)").arg(indexClauses.join(QStringLiteral(" AND "))).arg(clauses.join(QStringLiteral(" AND "))));
+    bindings->append(indexBindings);
+    bindings->append(rangeBindings);
+
+    QList<QContactFilter> remainingFilters;
+    for (int i = 0; i < filters.count(); ++i) {
+        if (i != latitudeIndex && i != longitudeIndex) {
+            remainingFilters.append(filters.at(i));
+        }
+    }
+
+    if (remainingFilters.isEmpty()) {
+        *where = indexedWhere;
+        return true;
+    }
+
+    QContactIntersectionFilter remainder;
+    remainder.setFilters(remainingFilters);
+    const QString remainingWhere(buildContactWhere(remainder, db, table, detailType, bindings, failed,
+                                                   transientModifiedRequired, globalPresenceRequired));
+    *where = remainingWhere.isEmpty() ? indexedWhere : indexedWhere + QStringLiteral(" AND ") + remainingWhere;
+    return true;
+}
+
+static QString buildContactWhere(const QContactFilter &filter, ContactsDatabase &db, const QString &table,
+                                 QContactDetail::DetailType detailType, QVariantList *bindings,
+                                 bool *failed, bool *transientModifiedRequired, bool *globalPresenceRequired)
+{
+    Q_ASSERT(failed);
+    Q_ASSERT(globalPresenceRequired);
+    Q_ASSERT(transientModifiedRequired);
+
+    switch (filter.type()) {
+    case QContactFilter::DefaultFilter:
+        return QString();
+    case QContactFilter::ContactDetailFilter:
+        return buildWhere(static_cast<const QContactDetailFilter &>(filter), db, true, bindings, failed,
+                          transientModifiedRequired, globalPresenceRequired);
+    case QContactFilter::ContactDetailRangeFilter:
+        return buildWhere(static_cast<const QContactDetailRangeFilter &>(filter), true, bindings, failed);
+    case QContactFilter::ChangeLogFilter:
+        return buildWhere(static_cast<const QContactChangeLogFilter &>(filter), bindings, failed, transientModifiedRequired);
+    case QContactFilter::RelationshipFilter:
+        return buildWhere(static_cast<const QContactRelationshipFilter &>(filter), bindings, failed);
+    case QContactFilter::IntersectionFilter:
+    case QContactFilter::UnionFilter: {
+        QString where;
+        if (filter.type() == QContactFilter::IntersectionFilter
+                && buildGeoLocationWhere(static_cast<const QContactIntersectionFilter &>(filter), db, table, detailType,
+                                         bindings, failed, transientModifiedRequired, globalPresenceRequired, &where)) {
+            return where;
+        }
+        if (buildAttributeIndexWhere(filter, db, table, detailType, bindings, failed,
+                                     transientModifiedRequired, globalPresenceRequired, &where)) {
+            return where;
+        }
+        if (filter.type() == QContactFilter::IntersectionFilter) {
+            return buildWhere(buildContactWhere, static_cast<const QContactIntersectionFilter &>(filter), db, table,
+                              detailType, bindings, failed, transientModifiedRequired, globalPresenceRequired);
+        }
+        return buildContactUnionWhere(static_cast<const QContactUnionFilter &>(filter), db, table, detailType,
+                                      bindings, failed, transientModifiedRequired, globalPresenceRequired);
+    }
+    case QContactFilter::IdFilter:
+        return buildWhere(static_cast<const QContactIdFilter &>(filter), db, table, bindings, failed);
+    case QContactFilter::CollectionFilter:
+        return buildWhere(static_cast<const QContactCollectionFilter &>(filter), bindings, failed);
+    default:
+        *failed = true;
+        qWarning() << "Cannot buildWhere with unknown filter type:" << filter.type();
+        return QStringLiteral("FALSE");
+    }
+}
+
+static QString buildRefinementWhere(const QString &where, const QContactFilter &filter, ContactsDatabase &db,
+                                    const QString &table, QVariantList *bindings, bool *failed, quint64 *generation)
+{
+    // If the filter refines that of a recent query, only the contacts matched by that query need be tested
+    ContactRefinementCache *cache = db.refinementCache();
+    QList<quint32> previousIds;
+    if (!cache || !cache->find(filter, &previousIds, generation)) {
+        return where;
+    }
+
+    const QString restriction(buildContactIdsWhere(previousIds, db, table, bindings, failed));
+    return QStringLiteral("( %1 ) AND %2").arg(where).arg(restriction);
+}
+
+static void recordRefinementResults(ContactsDatabase &db, const QContactFilter &filter, const QList<quint32> &contactIds,
+                                    quint64 generation)
+{
+    if (ContactRefinementCache *cache = db.refinementCache()) {
+        cache->insert(filter, contactIds, generation);
+    }
+}
+
+static QString buildDetailWhere(
+        const QContactFilter &filter,
+        ContactsDatabase &db,
+        const QString &table,
+        QContactDetail::DetailType detailType,
+        QVariantList *bindings,
+        bool *failed,
+        bool *transientModifiedRequired,
+        bool *globalPresenceRequired)
+{
+    Q_ASSERT(failed);
+    Q_ASSERT(globalPresenceRequired);
+    Q_ASSERT(transientModifiedRequired);
+
+    switch (filter.type()) {
+    case QContactFilter::DefaultFilter:
+        return QString();
+    case QContactFilter::ContactDetailFilter: {
+        const QContactDetailFilter &detailFilter = static_cast<const QContactDetailFilter &>(filter);
+
+        if (detailFilter.detailType() == detailType) {
+            return buildWhere(
+                        detailFilter,
+                        db,
+                        false,
+                        bindings,
+                        failed,
+                        transientModifiedRequired,
+                        globalPresenceRequired);
+        } else {
+            *failed = true;
+            qWarning() << "Cannot build detail query with mismatched details type:" << detailType << detailFilter.detailType();
+            return QStringLiteral("FALSE");
+        }
+    }
+    case QContactFilter::ContactDetailRangeFilter: {
+        const QContactDetailRangeFilter &detailFilter = static_cast<const QContactDetailRangeFilter &>(filter);
+
+        if (detailFilter.detailType() == detailType) {
+            return buildWhere(detailFilter, false, bindings, failed);
+        } else {
+            *failed = true;
+            qWarning() << QString::fromLatin1("Cannot build detail query with mismatched details type: %1 != %2").arg(detailType).arg(detailFilter.detailType());
+            return QStringLiteral("FALSE");
+        }
+    }
+    case QContactFilter::IntersectionFilter:
         return buildWhere(
                     buildDetailWhere,
                     static_cast<const QContactIntersectionFilter &>(filter),
@@ -1732,7 +2609,9 @@ static QString buildOrderBy(
         QStringList *joins,
         bool *transientModifiedRequired,
         bool *globalPresenceRequired,
-        bool useLocale )
+        bool useLocale,
+        bool useSortKeys,
+        bool useNullsOrdering)
 {
     Q_ASSERT(joins);
     Q_ASSERT(transientModifiedRequired);
@@ -1771,27 +2650,30 @@ static QString buildOrderBy(
     bool collate = true;
     bool localized = field.fieldType == LocalizedField;
 
+    const QString sortKeyColumn(localized && useLocale && useSortKeys ? sortKeyColumnName(detail.table, field.column) : QString());
+
+    // The display label sort key is mirrored to Contacts, where it is indexed following the collection
+    const bool contactsSortKey = joinToSort && !sortKeyColumn.isEmpty() && detail.detailType == QContactDisplayLabel::Type;
+
     // Special case for accessing transient data
     if (detail.detailType == detailIdentifier<QContactGlobalPresence>() &&
         field.field == QContactGlobalPresence::FieldPresenceState) {
         // We need to coalesce the transient values with the table values
         *globalPresenceRequired = true;
 
-        // Look at the temporary state value if present, otherwise use the normal value
-        sortExpression = QStringLiteral("COALESCE(temp.GlobalPresenceStates.presenceState, GlobalPresences.presenceState)");
+        // Look at the temporary state rank if present, otherwise use the stored rank
+        sortExpression = QStringLiteral("COALESCE(temp.GlobalPresenceStates.presenceRank, GlobalPresences.presenceRank)");
+        sortBlanks = false;
+        collate = false;
+    } else if (!sortKeyColumn.isEmpty()) {
+        // Compare the stored collation keys rather than collating the values during the query
+        sortExpression = contactsSortKey
+                ? QStringLiteral("Contacts.%1").arg(sortKeyColumn)
+                : joinToSort
+                ? QStringLiteral("%1.%2").arg(detail.table).arg(sortKeyColumn)
+                : sortKeyColumn;
         sortBlanks = false;
         collate = false;
-
-#ifdef SORT_PRESENCE_BY_AVAILABILITY
-        // The order we want is Available(1),Away(4),ExtendedAway(5),Busy(3),Hidden(2),Offline(6),Unknown(0)
-        sortExpression = QStringLiteral("CASE %1 WHEN 1 THEN 0 "
-                                                "WHEN 4 THEN 1 "
-                                                "WHEN 5 THEN 2 "
-                                                "WHEN 3 THEN 3 "
-                                                "WHEN 2 THEN 4 "
-                                                "WHEN 6 THEN 5 "
-                                                       "ELSE 6 END").arg(sortExpression);
-#endif
     } else if (detail.detailType == detailIdentifier<QContactTimestamp>() &&
                field.field == QContactTimestamp::FieldModificationTimestamp) {
         *transientModifiedRequired = true;
@@ -1803,8 +2685,21 @@ static QString buildOrderBy(
     }
 
     QString result;
-
-    if (sortBlanks) {
+    QString nullsLocation;
+
+    if (!sortKeyColumn.isEmpty()) {
+        // Blank values have no key; NULL sorts first in ascending order and last in descending order
+        const bool ascending = (order.direction() == Qt::AscendingOrder);
+        const bool blanksFirst = (order.blankPolicy() == QContactSortOrder::BlanksFirst);
+        if (blanksFirst != ascending) {
+            // Unlike a leading IS NULL term, an explicit NULL placement can still be read from the index
+            if (useNullsOrdering) {
+                nullsLocation = blanksFirst ? QStringLiteral(" NULLS FIRST") : QStringLiteral(" NULLS LAST");
+            } else {
+                result = QStringLiteral("%1 IS NULL %2, ").arg(sortExpression).arg(ascending ? QStringLiteral("ASC") : QStringLiteral("DESC"));
+            }
+        }
+    } else if (sortBlanks) {
         QString blanksLocation = (order.blankPolicy() == QContactSortOrder::BlanksLast)
                 ? QStringLiteral("CASE WHEN COALESCE(%1, '') = '' THEN 1 ELSE 0 END, ")
                 : QStringLiteral("CASE WHEN COALESCE(%1, '') = '' THEN 0 ELSE 1 END, ");
@@ -1822,8 +2717,11 @@ static QString buildOrderBy(
     }
 
     result.append((order.direction() == Qt::AscendingOrder) ? QStringLiteral(" ASC") : QStringLiteral(" DESC"));
+    result.append(nullsLocation);
 
-    if (joinToSort ) {
+    if (contactsSortKey) {
+        return result;
+    } else if (joinToSort ) {
         QString join = QStringLiteral(
                 "LEFT JOIN %1 ON Contacts.contactId = %1.contactId")
                 .arg(QLatin1String(detail.table));
@@ -1848,6 +2746,8 @@ static QString buildOrderBy(
         bool *transientModifiedRequired,
         bool *globalPresenceRequired,
         bool useLocale,
+        bool useSortKeys,
+        bool useNullsOrdering,
         QContactDetail::DetailType detailType = QContactDetail::TypeUndefined,
         const QString &finalOrder = QStringLiteral("Contacts.contactId"))
 {
@@ -1862,7 +2762,7 @@ static QString buildOrderBy(
     QStringList fragments;
     foreach (const QContactSortOrder &sort, order) {
         const QString fragment = buildOrderBy(
-                    sort, detailType, &joins, transientModifiedRequired, globalPresenceRequired, useLocale);
+                    sort, detailType, &joins, transientModifiedRequired, globalPresenceRequired, useLocale, useSortKeys, useNullsOrdering);
         if (!fragment.isEmpty()) {
             fragments.append(fragment);
         }
@@ -1906,308 +2806,334 @@ namespace {
 // The selfId is fixed - DB ID 1 is the 'self' local contact, and DB ID 2 is the aggregate
 const quint32 selfId(2);
 
-bool includesSelfId(const QContactFilter &filter);
+QContactFilter normalizeFilter(const QContactFilter &filter);
 
-// Returns true if this filter includes the self contact by ID
-bool includesSelfId(const QList<QContactFilter> &filters)
+// The properties of a filter which determine the implicit constraints of a contact query
+struct FilterAnalysis
 {
-    foreach (const QContactFilter &filter, filters) {
-        if (includesSelfId(filter)) {
+    bool includesSelfId;
+    bool includesCollectionFilter;
+    bool includesDeleted;
+    bool includesDeactivated;
+    bool includesIdFilter;
+};
+
+// Returns true if the filter selects contacts having the specified status flag
+bool includesStatusFlag(const QContactDetailFilter &filter, quint64 flag)
+{
+    if (filterOnField<QContactStatusFlags>(filter, QContactStatusFlags::FieldFlags)) {
+        quint64 flagsValue = filter.value().value<quint64>();
+        if (flagsValue & flag) {
             return true;
         }
     }
     return false;
 }
-bool includesSelfId(const QContactIntersectionFilter &filter)
-{
-    return includesSelfId(filter.filters());
-}
-bool includesSelfId(const QContactUnionFilter &filter)
-{
-    return includesSelfId(filter.filters());
-}
-bool includesSelfId(const QContactIdFilter &filter)
-{
-    foreach (const QContactId &id, filter.ids()) {
-        if (ContactId::databaseId(id) == selfId)
-            return true;
-    }
-    return false;
-}
-bool includesSelfId(const QContactFilter &filter)
+
+void analyzeFilter(const QContactFilter &filter, FilterAnalysis *analysis)
 {
     switch (filter.type()) {
     case QContactFilter::DefaultFilter:
-    case QContactFilter::ContactDetailFilter:
     case QContactFilter::ContactDetailRangeFilter:
     case QContactFilter::ChangeLogFilter:
     case QContactFilter::RelationshipFilter:
+        break;
+
     case QContactFilter::CollectionFilter:
-        return false;
+        analysis->includesCollectionFilter = true;
+        break;
 
-    case QContactFilter::IntersectionFilter:
-        return includesSelfId(static_cast<const QContactIntersectionFilter &>(filter));
-    case QContactFilter::UnionFilter:
-        return includesSelfId(static_cast<const QContactUnionFilter &>(filter));
     case QContactFilter::IdFilter:
-        return includesSelfId(static_cast<const QContactIdFilter &>(filter));
-
-    default:
-        qWarning() << "Cannot includesSelfId with unknown filter type" << filter.type();
-        return false;
-    }
-}
-
-bool includesCollectionFilter(const QContactFilter &filter);
+        analysis->includesIdFilter = true;
+        foreach (const QContactId &id, static_cast<const QContactIdFilter &>(filter).ids()) {
+            if (ContactId::databaseId(id) == selfId) {
+                analysis->includesSelfId = true;
+                break;
+            }
+        }
+        break;
 
-// Returns true if this filter includes a filter for specific collection
-bool includesCollectionFilter(const QList<QContactFilter> &filters)
-{
-    foreach (const QContactFilter &filter, filters) {
-        if (includesCollectionFilter(filter)) {
-            return true;
+    case QContactFilter::ContactDetailFilter: {
+        const QContactDetailFilter &detailFilter(static_cast<const QContactDetailFilter &>(filter));
+        if (includesStatusFlag(detailFilter, QContactStatusFlags::IsDeleted)) {
+            analysis->includesDeleted = true;
         }
+        if (includesStatusFlag(detailFilter, QContactStatusFlags::IsDeactivated)) {
+            analysis->includesDeactivated = true;
+        }
+        break;
     }
-    return false;
-}
-bool includesCollectionFilter(const QContactIntersectionFilter &filter)
-{
-    return includesCollectionFilter(filter.filters());
-}
-bool includesCollectionFilter(const QContactUnionFilter &filter)
-{
-    return includesCollectionFilter(filter.filters());
-}
-bool includesCollectionFilter(const QContactFilter &filter)
-{
-    switch (filter.type()) {
-    case QContactFilter::CollectionFilter:
-        return true;
-
-    case QContactFilter::DefaultFilter:
-    case QContactFilter::ContactDetailFilter:
-    case QContactFilter::ContactDetailRangeFilter:
-    case QContactFilter::ChangeLogFilter:
-    case QContactFilter::RelationshipFilter:
-    case QContactFilter::IdFilter:
-        return false;
 
     case QContactFilter::IntersectionFilter:
-        return includesCollectionFilter(static_cast<const QContactIntersectionFilter &>(filter));
+        foreach (const QContactFilter &partialFilter, static_cast<const QContactIntersectionFilter &>(filter).filters()) {
+            analyzeFilter(partialFilter, analysis);
+        }
+        break;
     case QContactFilter::UnionFilter:
-        return includesCollectionFilter(static_cast<const QContactUnionFilter &>(filter));
+        foreach (const QContactFilter &partialFilter, static_cast<const QContactUnionFilter &>(filter).filters()) {
+            analyzeFilter(partialFilter, analysis);
+        }
+        break;
 
     default:
-        qWarning() << "Cannot includesCollectionFilter with unknown filter type" << filter.type();
-        return false;
+        qWarning() << "Cannot analyzeFilter with unknown filter type" << filter.type();
+        break;
     }
 }
 
-bool includesDeleted(const QContactFilter &filter);
-
-// Returns true if this filter includes deleted contacts
-bool includesDeleted(const QList<QContactFilter> &filters)
-{
-    foreach (const QContactFilter &filter, filters) {
-        if (includesDeleted(filter)) {
-            return true;
-        }
-    }
-    return false;
-}
-bool includesDeleted(const QContactIntersectionFilter &filter)
-{
-    return includesDeleted(filter.filters());
-}
-bool includesDeleted(const QContactUnionFilter &filter)
+FilterAnalysis analyzeFilter(const QContactFilter &filter)
 {
-    return includesDeleted(filter.filters());
+    FilterAnalysis analysis = { false, false, false, false, false };
+    analyzeFilter(filter, &analysis);
+    return analysis;
 }
-bool includesDeleted(const QContactDetailFilter &filter)
+
+static bool deletedContactFilter(const QContactFilter &filter)
 {
-    if (filterOnField<QContactStatusFlags>(filter, QContactStatusFlags::FieldFlags)) {
-        quint64 flagsValue = filter.value().value<quint64>();
-        if (flagsValue & QContactStatusFlags::IsDeleted) {
-            return true;
+    const QContactFilter::FilterType filterType(filter.type());
+
+    // The only queries we suport regarding deleted contacts are for the IDs, possibly
+    // intersected with a syncTarget detail filter or a collection filter
+    if (filterType == QContactFilter::ChangeLogFilter) {
+        const QContactChangeLogFilter &changeLogFilter(static_cast<const QContactChangeLogFilter &>(filter));
+        return changeLogFilter.eventType() == QContactChangeLogFilter::EventRemoved;
+    } else if (filterType == QContactFilter::IntersectionFilter) {
+        const QContactIntersectionFilter &intersectionFilter(static_cast<const QContactIntersectionFilter &>(filter));
+        const QList<QContactFilter> filters(intersectionFilter.filters());
+        if (filters.count() <= 2) {
+            foreach (const QContactFilter &partialFilter, filters) {
+                if (partialFilter.type() == QContactFilter::ChangeLogFilter) {
+                    const QContactChangeLogFilter &changeLogFilter(static_cast<const QContactChangeLogFilter &>(partialFilter));
+                    if (changeLogFilter.eventType() == QContactChangeLogFilter::EventRemoved) {
+                        return true;
+                    }
+                }
+            }
         }
     }
+
     return false;
 }
-bool includesDeleted(const QContactFilter &filter)
+
+// Returns an estimate of the relative cost of evaluating a filter; cheaper and more selective
+// filters are ordered first within an intersection, so that they reduce the candidate set early
+int selectivityRank(const QContactFilter &filter)
 {
     switch (filter.type()) {
     case QContactFilter::IdFilter:
-    case QContactFilter::DefaultFilter:
-    case QContactFilter::ContactDetailRangeFilter:
-    case QContactFilter::ChangeLogFilter:
+        return 0;
+    case QContactFilter::ContactDetailFilter: {
+        const QContactDetailFilter &detailFilter(static_cast<const QContactDetailFilter &>(filter));
+        const QContactFilter::MatchFlags flags(detailFilter.matchFlags());
+        if (flags & QContactFilter__MatchFullTextSearch) {
+            return 2;
+        }
+        const int globValue = flags & 7;
+        if (globValue == QContactFilter::MatchContains || globValue == QContactFilter::MatchEndsWith) {
+            // Infix and suffix matches cannot use an index
+            return 8;
+        }
+        if (globValue == QContactFilter::MatchExactly && !detailFilter.value().isNull()) {
+            return 1;
+        }
+        return 3;
+    }
     case QContactFilter::RelationshipFilter:
+        return 4;
+    case QContactFilter::ContactDetailRangeFilter:
+        return 5;
     case QContactFilter::CollectionFilter:
-        return false;
-
-    case QContactFilter::IntersectionFilter:
-        return includesDeleted(static_cast<const QContactIntersectionFilter &>(filter));
-    case QContactFilter::UnionFilter:
-        return includesDeleted(static_cast<const QContactUnionFilter &>(filter));
-    case QContactFilter::ContactDetailFilter:
-        return includesDeleted(static_cast<const QContactDetailFilter &>(filter));
-
+        return 6;
+    case QContactFilter::ChangeLogFilter:
+        return 7;
     default:
-        qWarning() << "Cannot includesDeleted with unknown filter type" << filter.type();
-        return false;
+        return 8;
     }
 }
 
-
-bool includesDeactivated(const QContactFilter &filter);
-
-// Returns true if this filter includes deactivated contacts
-bool includesDeactivated(const QList<QContactFilter> &filters)
-{
-    foreach (const QContactFilter &filter, filters) {
-        if (includesDeactivated(filter)) {
-            return true;
-        }
-    }
-    return false;
-}
-bool includesDeactivated(const QContactIntersectionFilter &filter)
-{
-    return includesDeactivated(filter.filters());
-}
-bool includesDeactivated(const QContactUnionFilter &filter)
-{
-    return includesDeactivated(filter.filters());
-}
-bool includesDeactivated(const QContactDetailFilter &filter)
+QList<QContactFilter> normalizedFilters(const QList<QContactFilter> &filters, QContactFilter::FilterType compoundType)
 {
-    if (filterOnField<QContactStatusFlags>(filter, QContactStatusFlags::FieldFlags)) {
-        quint64 flagsValue = filter.value().value<quint64>();
-        if (flagsValue & QContactStatusFlags::IsDeactivated) {
-            return true;
+    QList<QContactFilter> flattened;
+    foreach (const QContactFilter &partialFilter, filters) {
+        const QContactFilter normalized(normalizeFilter(partialFilter));
+
+        // An empty compound yields a distinct expression, so it is not merged into its parent
+        if (normalized.type() == compoundType) {
+            const QList<QContactFilter> nestedFilters(compoundType == QContactFilter::IntersectionFilter
+                    ? static_cast<const QContactIntersectionFilter &>(normalized).filters()
+                    : static_cast<const QContactUnionFilter &>(normalized).filters());
+            if (!nestedFilters.isEmpty()) {
+                flattened.append(nestedFilters);
+                continue;
+            }
         }
+        flattened.append(normalized);
     }
-    return false;
-}
-bool includesDeactivated(const QContactFilter &filter)
-{
-    switch (filter.type()) {
-    case QContactFilter::IdFilter:
-    case QContactFilter::DefaultFilter:
-    case QContactFilter::ContactDetailRangeFilter:
-    case QContactFilter::ChangeLogFilter:
-    case QContactFilter::RelationshipFilter:
-    case QContactFilter::CollectionFilter:
-        return false;
 
-    case QContactFilter::IntersectionFilter:
-        return includesDeactivated(static_cast<const QContactIntersectionFilter &>(filter));
-    case QContactFilter::UnionFilter:
-        return includesDeactivated(static_cast<const QContactUnionFilter &>(filter));
-    case QContactFilter::ContactDetailFilter:
-        return includesDeactivated(static_cast<const QContactDetailFilter &>(filter));
+    const bool intersecting(compoundType == QContactFilter::IntersectionFilter);
 
-    default:
-        qWarning() << "Cannot includesDeactivated with unknown filter type" << filter.type();
-        return false;
-    }
-}
+    QList<QContactFilter> rv;
+    QList<QContactId> mergedIds;
+    QSet<QContactId> mergedIdSet;
+    int idFilterIndex = -1;
+    QSet<QContactCollectionId> mergedCollectionIds;
+    int collectionFilterIndex = -1;
+    bool defaultOnly = true;
+
+    foreach (const QContactFilter &partialFilter, flattened) {
+        if (rv.contains(partialFilter)) {
+            continue;
+        }
 
-bool includesIdFilter(const QContactFilter &filter);
+        if (partialFilter.type() != QContactFilter::DefaultFilter) {
+            defaultOnly = false;
+        }
 
-// Returns true if this filter includes a filter for specific IDs
-bool includesIdFilter(const QList<QContactFilter> &filters)
-{
-    foreach (const QContactFilter &filter, filters) {
-        if (includesIdFilter(filter)) {
-            return true;
+        if (partialFilter.type() == QContactFilter::IdFilter) {
+            const QList<QContactId> ids(static_cast<const QContactIdFilter &>(partialFilter).ids());
+            if (idFilterIndex == -1) {
+                idFilterIndex = rv.count();
+                mergedIds = ids;
+                mergedIdSet = ids.toSet();
+            } else if (intersecting) {
+                QList<QContactId> commonIds;
+                foreach (const QContactId &id, mergedIds) {
+                    if (ids.contains(id)) {
+                        commonIds.append(id);
+                    }
+                }
+                if (commonIds.isEmpty()) {
+                    // The intersection is empty; leave the filters separate, since an empty ID filter is invalid
+                    rv.append(partialFilter);
+                } else {
+                    mergedIds = commonIds;
+                    mergedIdSet = commonIds.toSet();
+                }
+                continue;
+            } else {
+                foreach (const QContactId &id, ids) {
+                    if (!mergedIdSet.contains(id)) {
+                        mergedIdSet.insert(id);
+                        mergedIds.append(id);
+                    }
+                }
+                continue;
+            }
+        } else if (partialFilter.type() == QContactFilter::CollectionFilter) {
+            // An empty collection set selects all collections, so only merge non-empty sets
+            const QSet<QContactCollectionId> collectionIds(static_cast<const QContactCollectionFilter &>(partialFilter).collectionIds());
+            if (!collectionIds.isEmpty()) {
+                if (collectionFilterIndex == -1) {
+                    collectionFilterIndex = rv.count();
+                    mergedCollectionIds = collectionIds;
+                } else if (intersecting) {
+                    QSet<QContactCollectionId> commonIds(mergedCollectionIds);
+                    commonIds.intersect(collectionIds);
+                    if (commonIds.isEmpty()) {
+                        rv.append(partialFilter);
+                    } else {
+                        mergedCollectionIds = commonIds;
+                    }
+                    continue;
+                } else {
+                    mergedCollectionIds.unite(collectionIds);
+                    continue;
+                }
+            }
         }
+
+        rv.append(partialFilter);
     }
-    return false;
-}
-bool includesIdFilter(const QContactIntersectionFilter &filter)
-{
-    return includesIdFilter(filter.filters());
-}
-bool includesIdFilter(const QContactUnionFilter &filter)
-{
-    return includesIdFilter(filter.filters());
-}
-bool includesIdFilter(const QContactFilter &filter)
-{
-    switch (filter.type()) {
-    case QContactFilter::DefaultFilter:
-    case QContactFilter::ContactDetailFilter:
-    case QContactFilter::ContactDetailRangeFilter:
-    case QContactFilter::ChangeLogFilter:
-    case QContactFilter::RelationshipFilter:
-    case QContactFilter::CollectionFilter:
-        return false;
 
-    case QContactFilter::IntersectionFilter:
-        return includesIdFilter(static_cast<const QContactIntersectionFilter &>(filter));
-    case QContactFilter::UnionFilter:
-        return includesIdFilter(static_cast<const QContactUnionFilter &>(filter));
-    case QContactFilter::IdFilter:
-        return true;
+    if (idFilterIndex != -1) {
+        QContactIdFilter idFilter;
+        idFilter.setIds(mergedIds);
+        rv[idFilterIndex] = idFilter;
+    }
+    if (collectionFilterIndex != -1) {
+        QContactCollectionFilter collectionFilter;
+        collectionFilter.setCollectionIds(mergedCollectionIds);
+        rv[collectionFilterIndex] = collectionFilter;
+    }
 
-    default:
-        qWarning() << "Cannot includesIdFilter with unknown filter type" << filter.type();
-        return false;
+    if (intersecting && !defaultOnly) {
+        // The default filter does not constrain an intersection; order the remainder by selectivity
+        QMap<int, QList<QContactFilter> > rankedFilters;
+        foreach (const QContactFilter &partialFilter, rv) {
+            if (partialFilter.type() != QContactFilter::DefaultFilter) {
+                rankedFilters[selectivityRank(partialFilter)].append(partialFilter);
+            }
+        }
+
+        rv.clear();
+        QMap<int, QList<QContactFilter> >::const_iterator it = rankedFilters.constBegin(), end = rankedFilters.constEnd();
+        for ( ; it != end; ++it) {
+            rv.append(*it);
+        }
     }
+
+    return rv;
 }
 
-static bool deletedContactFilter(const QContactFilter &filter)
+// Returns an equivalent filter with nested compounds flattened, duplicates removed, ID and
+// collection constraints combined, and intersected filters ordered by estimated selectivity
+QContactFilter normalizeFilter(const QContactFilter &filter)
 {
     const QContactFilter::FilterType filterType(filter.type());
+    if (filterType != QContactFilter::IntersectionFilter && filterType != QContactFilter::UnionFilter) {
+        return filter;
+    }
 
-    // The only queries we suport regarding deleted contacts are for the IDs, possibly
-    // intersected with a syncTarget detail filter or a collection filter
-    if (filterType == QContactFilter::ChangeLogFilter) {
-        const QContactChangeLogFilter &changeLogFilter(static_cast<const QContactChangeLogFilter &>(filter));
-        return changeLogFilter.eventType() == QContactChangeLogFilter::EventRemoved;
-    } else if (filterType == QContactFilter::IntersectionFilter) {
-        const QContactIntersectionFilter &intersectionFilter(static_cast<const QContactIntersectionFilter &>(filter));
-        const QList<QContactFilter> filters(intersectionFilter.filters());
-        if (filters.count() <= 2) {
-            foreach (const QContactFilter &partialFilter, filters) {
-                if (partialFilter.type() == QContactFilter::ChangeLogFilter) {
-                    const QContactChangeLogFilter &changeLogFilter(static_cast<const QContactChangeLogFilter &>(partialFilter));
-                    if (changeLogFilter.eventType() == QContactChangeLogFilter::EventRemoved) {
-                        return true;
-                    }
-                }
-            }
-        }
+    const QList<QContactFilter> filters(filterType == QContactFilter::IntersectionFilter
+            ? static_cast<const QContactIntersectionFilter &>(filter).filters()
+            : static_cast<const QContactUnionFilter &>(filter).filters());
+    if (filters.isEmpty()) {
+        return filter;
     }
 
-    return false;
+    const QList<QContactFilter> normalized(normalizedFilters(filters, filterType));
+    if (normalized.count() == 1) {
+        return normalized.first();
+    }
+
+    if (filterType == QContactFilter::IntersectionFilter) {
+        QContactIntersectionFilter intersectionFilter;
+        intersectionFilter.setFilters(normalized);
+        return intersectionFilter;
+    }
+
+    QContactUnionFilter unionFilter;
+    unionFilter.setFilters(normalized);
+    return unionFilter;
 }
 
 QString expandWhere(const QString &where, const QContactFilter &filter, const bool aggregating)
 {
     QStringList constraints;
 
+    const FilterAnalysis analysis(analyzeFilter(filter));
+
     // remove the self contact, unless specifically included
-    if (!includesSelfId(filter)) {
+    if (!analysis.includesSelfId) {
         constraints.append("Contacts.contactId > 2 ");
     }
 
     // if the filter does not specify contacts by ID
-    if (!includesIdFilter(filter)) {
+    if (!analysis.includesIdFilter) {
         if (aggregating) {
             // exclude non-aggregates, unless the filter specifies collections
-            if (!includesCollectionFilter(filter)) {
+            if (!analysis.includesCollectionFilter) {
                 constraints.append("Contacts.collectionId = 1 "); // AggregateAddressbookCollectionId
             }
         }
 
         // exclude deactivated unless they're explicitly included
-        if (!includesDeactivated(filter)) {
+        if (!analysis.includesDeactivated) {
             constraints.append("Contacts.isDeactivated = 0 ");
         }
 
         // exclude deleted unless they're explicitly included
-        if (!includesDeleted(filter)) {
+        if (!analysis.includesDeleted) {
             constraints.append("Contacts.changeFlags < 4 ");
         }
     }
@@ -2299,67 +3225,118 @@ QContactManager::Error ContactReader::fetchContacts(const QContactCollectionId &
     return error;
 }
 
-QContactManager::Error ContactReader::readContacts(
-        const QString &table,
-        QList<QContact> *contacts,
+/*
+    Builds the joins, WHERE expression and ordering selecting the contacts matched
+    by the (normalized) filter, and populates the transient state they refer to.
+    The ordering is not built if \a orderBy is null.
+*/
+static QContactManager::Error buildContactSelection(
+        ContactsDatabase &db,
         const QContactFilter &filter,
         const QList<QContactSortOrder> &order,
-        const QContactFetchHint &fetchHint,
-        bool keepChangeFlags)
+        const QString &tableName,
+        QString *join,
+        QString *where,
+        QString *orderBy,
+        QVariantList *bindings,
+        quint64 *refinementGeneration)
 {
-    QMutexLocker locker(m_database.accessMutex());
-
-    m_database.clearTemporaryContactIdsTable(table);
-
-    QString join;
     bool transientModifiedRequired = false;
     bool globalPresenceRequired = false;
-    const QString orderBy = buildOrderBy(order, &join, &transientModifiedRequired, &globalPresenceRequired, m_database.localized());
+    if (orderBy) {
+        *orderBy = buildOrderBy(order, join, &transientModifiedRequired, &globalPresenceRequired,
+                                db.localized(), db.hasSortKeys(), db.hasNullsOrdering());
+    }
 
-    bool whereFailed = false;
-    QVariantList bindings;
-    QString where = buildContactWhere(filter, m_database, table, QContactDetail::TypeUndefined, &bindings, &whereFailed,
-                                      &transientModifiedRequired, &globalPresenceRequired);
-    if (whereFailed) {
+    bool failed = false;
+    *where = buildContactWhere(filter, db, tableName, QContactDetail::TypeUndefined, bindings,
+                               &failed, &transientModifiedRequired, &globalPresenceRequired);
+    if (!failed) {
+        *where = buildRefinementWhere(*where, filter, db, tableName, bindings, &failed, refinementGeneration);
+    }
+    if (failed) {
         qWarning() << "Failed to create WHERE expression: invalid filter specification";
         return QContactManager::UnspecifiedError;
     }
 
-    where = expandWhere(where, filter, m_database.aggregating());
+    QString searchExpression;
+    if (orderBy && order.isEmpty() && fullTextSearchFilter(filter, db, &searchExpression)) {
+        // Without a specified order, report full-text search results by relevance
+        *orderBy = fullTextSearchOrderBy();
+        bindings->append(searchExpression);
+    }
+
+    *where = expandWhere(*where, filter, db.aggregating());
 
     if (transientModifiedRequired || globalPresenceRequired) {
         // Provide the temporary transient state information to filter/sort on
-        if (!m_database.populateTemporaryTransientState(transientModifiedRequired, globalPresenceRequired)) {
+        if (!db.populateTemporaryTransientState(transientModifiedRequired, globalPresenceRequired)) {
             return QContactManager::UnspecifiedError;
         }
 
         if (transientModifiedRequired) {
-            join.append(QStringLiteral(" LEFT JOIN temp.Timestamps ON Contacts.contactId = temp.Timestamps.contactId"));
+            join->append(QStringLiteral(" LEFT JOIN temp.Timestamps ON Contacts.contactId = temp.Timestamps.contactId"));
         }
         if (globalPresenceRequired) {
-            join.append(QStringLiteral(" LEFT JOIN temp.GlobalPresenceStates ON Contacts.contactId = temp.GlobalPresenceStates.contactId"));
+            join->append(QStringLiteral(" LEFT JOIN temp.GlobalPresenceStates ON Contacts.contactId = temp.GlobalPresenceStates.contactId"));
         }
     }
 
-    const int maximumCount = fetchHint.maxCountHint();
-
-    QContactManager::Error error = QContactManager::NoError;
-    if (!m_database.createTemporaryContactIdsTable(table, join, where, orderBy, bindings, maximumCount)) {
-        error = QContactManager::UnspecifiedError;
-    } else {
-        error = queryContacts(table, contacts, fetchHint,
-                              false /* relax constraints */,
-                              false /* ignore deleted - however they will be omitted unless filter specifically requires */,
-                              keepChangeFlags);
-    }
-
-    return error;
+    return QContactManager::NoError;
 }
 
 QContactManager::Error ContactReader::readContacts(
         const QString &table,
         QList<QContact> *contacts,
-        const QList<QContactId> &contactIds,
+        const QContactFilter &inputFilter,
+        const QList<QContactSortOrder> &order,
+        const QContactFetchHint &fetchHint,
+        bool keepChangeFlags)
+{
+    QMutexLocker locker(m_database.accessMutex());
+
+    m_database.clearTemporaryContactIdsTable(table);
+
+    const QContactFilter filter(normalizeFilter(inputFilter));
+
+    QString join;
+    QString where;
+    QString orderBy;
+    QVariantList bindings;
+    quint64 refinementGeneration = 0;
+    QContactManager::Error error = buildContactSelection(m_database, filter, order, table, &join, &where, &orderBy,
+                                                         &bindings, &refinementGeneration);
+    if (error != QContactManager::NoError)
+        return error;
+
+    const int maximumCount = fetchHint.maxCountHint();
+
+    if (!m_database.createTemporaryContactIdsTable(table, join, where, orderBy, bindings, maximumCount)) {
+        error = QContactManager::UnspecifiedError;
+    } else {
+        error = queryContacts(table, contacts, fetchHint,
+                              false /* relax constraints */,
+                              false /* ignore deleted - however they will be omitted unless filter specifically requires */,
+                              keepChangeFlags);
+    }
+
+    // A result truncated to the maximum count cannot be used to evaluate refinements of the filter
+    if (error == QContactManager::NoError && maximumCount <= 0 && ContactRefinementCache::refinable(filter)) {
+        QList<quint32> databaseIds;
+        databaseIds.reserve(contacts->count());
+        foreach (const QContact &contact, *contacts) {
+            databaseIds.append(ContactId::databaseId(contact.id()));
+        }
+        recordRefinementResults(m_database, filter, databaseIds, refinementGeneration);
+    }
+
+    return error;
+}
+
+QContactManager::Error ContactReader::readContacts(
+        const QString &table,
+        QList<QContact> *contacts,
+        const QList<QContactId> &contactIds,
         const QContactFetchHint &fetchHint)
 {
     QList<quint32> databaseIds;
@@ -2418,17 +3395,9 @@ QContactManager::Error ContactReader::readContacts(
     return error;
 }
 
-QContactManager::Error ContactReader::queryContacts(
-        const QString &tableName,
-        QList<QContact> *contacts,
-        const QContactFetchHint &fetchHint,
-        bool relaxConstraints,
-        bool ignoreDeleted,
-        bool keepChangeFlags)
+static QString contactQueryStatement(const QString &tableName, bool ignoreDeleted)
 {
-    QContactManager::Error err = QContactManager::NoError;
-
-    const QString dataQueryStatement(QStringLiteral(
+    return QStringLiteral(
         "SELECT " // order and content can change due to schema upgrades, so list manually.
             "Contacts.contactId, "
             "Contacts.collectionId, "
@@ -2446,9 +3415,12 @@ QContactManager::Error ContactReader::queryContacts(
         "%2 "
         "ORDER BY temp.%1.rowId ASC").arg(tableName)
                                      .arg(ignoreDeleted ? QStringLiteral("WHERE Contacts.changeFlags < 4") // ChangeFlags::IsDeleted
-                                                        : QString()));
+                                                        : QString());
+}
 
-    const QString relationshipQueryStatement(QStringLiteral(
+static QString relationshipQueryStatement(const QString &tableName)
+{
+    return QStringLiteral(
         "SELECT "
             "temp.%1.contactId AS contactId,"
             "R1.type AS secondType,"
@@ -2463,7 +3435,21 @@ QContactManager::Error ContactReader::queryContacts(
          // in the queryContacts(..., relationshipQuery, ...) method.
         "LEFT JOIN Relationships AS R1 ON R1.secondId = temp.%1.contactId AND R1.firstId NOT IN (SELECT contactId FROM Contacts WHERE changeFlags >= 4) "
         "LEFT JOIN Relationships AS R2 ON R2.firstId = temp.%1.contactId AND R2.secondId NOT IN (SELECT contactId FROM Contacts WHERE changeFlags >= 4) "
-        "ORDER BY contactId ASC").arg(tableName));
+        "ORDER BY contactId ASC").arg(tableName);
+}
+
+QContactManager::Error ContactReader::queryContacts(
+        const QString &tableName,
+        QList<QContact> *contacts,
+        const QContactFetchHint &fetchHint,
+        bool relaxConstraints,
+        bool ignoreDeleted,
+        bool keepChangeFlags)
+{
+    QContactManager::Error err = QContactManager::NoError;
+
+    const QString dataQueryStatement(contactQueryStatement(tableName, ignoreDeleted));
+    const QString relationshipQueryStatement(::relationshipQueryStatement(tableName));
 
     QSqlQuery contactQuery(m_database);
     QSqlQuery relationshipQuery(m_database);
@@ -2520,14 +3506,257 @@ QContactManager::Error ContactReader::queryContacts(
     return err;
 }
 
-QContactManager::Error ContactReader::queryContacts(
-        const QString &tableName,
-        QList<QContact> *contacts,
-        const QContactFetchHint &fetchHint,
-        bool relaxConstraints,
-        bool keepChangeFlags,
-        QSqlQuery &contactQuery,
-        QSqlQuery &relationshipQuery)
+namespace {
+
+// The number of Details table columns selected at the start of each joined detail row
+const int DetailsColumnCount = 13;
+
+// The location of a detail type's values within the joined detail query
+struct DetailReadProperties
+{
+    ReadDetail read;
+    QContactDetail::DetailType detailType;
+    int offset;
+    int fieldCount;
+};
+
+// The transient presence of a constituent, which supersedes the presence promoted to its aggregate
+struct ConstituentPresence
+{
+    quint32 contactId;
+    quint32 collectionId;
+    QList<QContactDetail> details;
+};
+
+// The rows stepped from the contact, detail and relationship queries for a single contact
+struct ContactRows
+{
+    ResultRow contactRow;
+    QVector<QPair<const DetailReadProperties *, ResultRow> > detailRows;
+    QVector<ResultRow> relationshipRows;
+    QPair<QDateTime, QList<QContactDetail> > transientDetails;
+    QVector<ConstituentPresence> constituentPresence;
+};
+
+// The state shared by all contacts materialized for a query; it is not modified once materialization begins
+struct MaterializationContext
+{
+    QString managerUri;
+    ContactWriter::DetailList definitionMask;
+    bool relaxConstraints;
+    bool keepChangeFlags;
+    bool includeRelationships;
+};
+
+QContact materializeContact(const MaterializationContext &context, const ContactRows &rows)
+{
+    const ResultRow &contactRow(rows.contactRow);
+
+    int col = 0;
+    const quint32 dbId = contactRow.value(col++).toUInt();
+    const quint32 collectionId = contactRow.value(col++).toUInt();
+    const QContactCollectionId apiCollectionId = ContactCollectionId::apiId(collectionId, context.managerUri);
+    const bool aggregateContact = collectionId == ContactsDatabase::AggregateAddressbookCollectionId;
+
+    QContact contact;
+    contact.setId(ContactId::apiId(dbId, context.managerUri));
+    contact.setCollectionId(apiCollectionId);
+
+    QContactTimestamp timestamp;
+    setValue(&timestamp, QContactTimestamp::FieldCreationTimestamp    , ContactsDatabase::fromDateTimeString(contactRow.value(col++).toString()));
+    setValue(&timestamp, QContactTimestamp::FieldModificationTimestamp, ContactsDatabase::fromDateTimeString(contactRow.value(col++).toString()));
+    col++; // ignore Deleted timestamp.
+
+    QContactStatusFlags flags;
+    flags.setFlag(QContactStatusFlags::HasPhoneNumber, contactRow.value(col++).toBool());
+    flags.setFlag(QContactStatusFlags::HasEmailAddress, contactRow.value(col++).toBool());
+    flags.setFlag(QContactStatusFlags::HasOnlineAccount, contactRow.value(col++).toBool());
+    flags.setFlag(QContactStatusFlags::IsOnline, contactRow.value(col++).toBool());
+    flags.setFlag(QContactStatusFlags::IsDeactivated, contactRow.value(col++).toBool());
+    const int changeFlags = contactRow.value(col++).toInt();
+    flags.setFlag(QContactStatusFlags::IsAdded, changeFlags & ContactsDatabase::IsAdded);
+    flags.setFlag(QContactStatusFlags::IsModified, changeFlags & ContactsDatabase::IsModified);
+    flags.setFlag(QContactStatusFlags::IsDeleted, changeFlags >= ContactsDatabase::IsDeleted);
+
+    if (flags.testFlag(QContactStatusFlags::IsDeactivated)) {
+        QContactDeactivated deactivated;
+        setDetailImmutableIfAggregate(aggregateContact, &deactivated);
+        contact.saveDetail(&deactivated);
+    }
+
+    // ignore created and modified timestamps, will be saved by readDetail()
+    col++;
+    col++;
+
+    int contactType = contactRow.value(col++).toInt();
+    QContactType typeDetail = contact.detail<QContactType>();
+    typeDetail.setType(static_cast<QContactType::TypeValues>(contactType));
+    setDetailImmutableIfAggregate(aggregateContact, &typeDetail);
+    contact.saveDetail(&typeDetail);
+
+    bool syncable = collectionId != ContactsDatabase::AggregateAddressbookCollectionId
+            && collectionId != ContactsDatabase::LocalAddressbookCollectionId;
+
+    QSet<QContactDetail::DetailType> transientTypes;
+
+    // Apply any transient details for this contact
+    const QPair<QDateTime, QList<QContactDetail> > &transientDetails(rows.transientDetails);
+    if (!transientDetails.first.isNull()) {
+        // Update the contact timestamp to that of the transient details
+        setValue(&timestamp, QContactTimestamp::FieldModificationTimestamp, transientDetails.first);
+
+        QList<QContactDetail>::const_iterator it = transientDetails.second.constBegin(), end = transientDetails.second.constEnd();
+        for ( ; it != end; ++it) {
+            // Copy the transient detail into the contact
+            const QContactDetail &transient(*it);
+
+            const QContactDetail::DetailType transientType(transient.type());
+
+            if (transientType == QContactGlobalPresence::Type) {
+                // If global presence is in the transient details, the IsOnline status flag is out of date
+                const int presenceState = transient.value<int>(QContactGlobalPresence::FieldPresenceState);
+                const bool isOnline(presenceState >= QContactPresence::PresenceAvailable &&
+                                    presenceState <= QContactPresence::PresenceExtendedAway);
+                flags.setFlag(QContactStatusFlags::IsOnline, isOnline);
+            }
+
+            // Ignore details that aren't in the requested types
+            if (!context.definitionMask.isEmpty() && !context.definitionMask.contains(transientType)) {
+                continue;
+            }
+
+            QContactDetail detail(transient.type());
+            if (!context.relaxConstraints) {
+                QContactManagerEngine::setDetailAccessConstraints(&detail, transient.accessConstraints());
+            }
+
+            const QMap<int, QVariant> values(transient.values());
+            QMap<int, QVariant>::const_iterator vit = values.constBegin(), vend = values.constEnd();
+            for ( ; vit != vend; ++vit) {
+                bool append(true);
+
+                if (vit.key() == QContactDetail__FieldModifiable) {
+                    append = syncable;
+                }
+
+                if (append) {
+                    detail.setValue(vit.key(), vit.value());
+                }
+            }
+
+            setDetailImmutableIfAggregate(aggregateContact, &detail);
+            contact.saveDetail(&detail);
+            transientTypes.insert(transientType);
+        }
+    }
+
+    // Add the updated status flags
+    QContactManagerEngine::setDetailAccessConstraints(&flags, QContactDetail::ReadOnly | QContactDetail::Irremovable);
+    setDetailImmutableIfAggregate(aggregateContact, &flags);
+    contact.saveDetail(&flags);
+
+    // Add the timestamp info
+    if (!timestamp.isEmpty()) {
+        setDetailImmutableIfAggregate(aggregateContact, &timestamp);
+        contact.saveDetail(&timestamp);
+    }
+
+    // Add the details of this contact from the detail tables
+    QVector<QPair<const DetailReadProperties *, ResultRow> >::const_iterator dit = rows.detailRows.constBegin(), dend = rows.detailRows.constEnd();
+    for ( ; dit != dend; ++dit) {
+        const DetailReadProperties *properties(dit->first);
+        const ResultRow &detailRow(dit->second);
+
+        // Are there transient details of this type for this contact?
+        if (transientTypes.contains(properties->detailType)) {
+            // This contact has transient details of this type; skip the extraction
+            continue;
+        }
+
+        // Extract the values from the result row (readDetail()).
+        properties->read(&contact, detailRow, dbId, detailRow.value(0).toUInt(), syncable,
+                         apiCollectionId, context.relaxConstraints, context.keepChangeFlags,
+                         properties->offset);
+    }
+
+    // Apply the transient presence of the constituents of an aggregate, in place of the
+    // presence promoted from their stored state
+    if (!rows.constituentPresence.isEmpty()) {
+        QSet<quint32> constituentIds;
+        foreach (const ConstituentPresence &constituent, rows.constituentPresence) {
+            constituentIds.insert(constituent.contactId);
+        }
+
+        foreach (QContactPresence presence, contact.details<QContactPresence>()) {
+            const quint32 provenanceId = presence.provenance().section(QChar::fromLatin1(':'), 1, 1).toUInt();
+            if (constituentIds.contains(provenanceId)) {
+                contact.removeDetail(&presence, QContact::IgnoreAccessConstraints);
+            }
+        }
+
+        foreach (const ConstituentPresence &constituent, rows.constituentPresence) {
+            foreach (const QContactDetail &transient, constituent.details) {
+                QContactPresence presence;
+                const QMap<int, QVariant> values(transient.values());
+                QMap<int, QVariant>::const_iterator vit = values.constBegin(), vend = values.constEnd();
+                for ( ; vit != vend; ++vit) {
+                    if (vit.key() != QContactDetail__FieldModifiable) {
+                        presence.setValue(vit.key(), vit.value());
+                    }
+                }
+                if (presence.provenance().isEmpty()) {
+                    presence.setValue(QContactDetail::FieldProvenance, QStringLiteral("%1:%2:%3").arg(constituent.collectionId).arg(constituent.contactId).arg(0));
+                }
+                if (!context.relaxConstraints) {
+                    QContactManagerEngine::setDetailAccessConstraints(&presence, transient.accessConstraints());
+                }
+                setDetailImmutableIfAggregate(aggregateContact, &presence);
+                contact.saveDetail(&presence, QContact::IgnoreAccessConstraints);
+            }
+        }
+
+        ContactsEngine::updateGlobalPresence(&contact);
+
+        QContactGlobalPresence globalPresence(contact.detail<QContactGlobalPresence>());
+        const int presenceState = globalPresence.presenceState();
+        if (!context.definitionMask.isEmpty() && !context.definitionMask.contains(QContactGlobalPresence::Type)) {
+            contact.removeDetail(&globalPresence, QContact::IgnoreAccessConstraints);
+        }
+
+        QContactStatusFlags statusFlags(contact.detail<QContactStatusFlags>());
+        statusFlags.setFlag(QContactStatusFlags::IsOnline, presenceState >= QContactPresence::PresenceAvailable &&
+                                                           presenceState <= QContactPresence::PresenceExtendedAway);
+        contact.saveDetail(&statusFlags, QContact::IgnoreAccessConstraints);
+    }
+
+    if (context.includeRelationships) {
+        QList<QContactRelationship> relationships;
+
+        foreach (const ResultRow &relationshipRow, rows.relationshipRows) {
+            const QString secondType = relationshipRow.value(1).toString();
+            const quint32 firstId = relationshipRow.value(2).toUInt();
+            const QString firstType = relationshipRow.value(3).toString();
+            const quint32 secondId = relationshipRow.value(4).toUInt();
+
+            if (!firstType.isEmpty()) {
+                QContactRelationship rel(makeRelationship(firstType, dbId, secondId, context.managerUri));
+                relationships.append(rel);
+            } else if (!secondType.isEmpty()) {
+                QContactRelationship rel(makeRelationship(secondType, firstId, dbId, context.managerUri));
+                relationships.append(rel);
+            }
+        }
+
+        QContactManagerEngine::setContactRelationships(&contact, relationships);
+    }
+
+    return contact;
+}
+
+// Returns the statement selecting the details of the contacts listed in the temporary table, and
+// the location of each detail type's values within its result rows
+QString detailQueryStatement(const QString &tableName, const ContactWriter::DetailList &definitionMask,
+                             QHash<QString, DetailReadProperties> *readProperties)
 {
     // Formulate the query to fetch the contact details
     const QString detailQueryTemplate(QStringLiteral(
@@ -2563,12 +3792,8 @@ QContactManager::Error ContactReader::queryContacts(
     QStringList joinSpec;
     QStringList detailNameSpec;
 
-    QHash<QString, QPair<ReadDetail, int> > readProperties;
-
     // Skip the Details table fields, and the indexing fields of the first join table
-    int offset = 13 + 2;
-
-    const ContactWriter::DetailList &definitionMask = fetchHint.detailTypesHint();
+    int offset = DetailsColumnCount + 2;
 
     for (int i = 0; i < lengthOf(detailInfo); ++i) {
         const DetailInfo &detail = detailInfo[i];
@@ -2584,7 +3809,8 @@ QContactManager::Error ContactReader::queryContacts(
             joinSpec.append(joinTemplate.arg(detailTable));
             detailNameSpec.append(detailName);
 
-            readProperties.insert(detailName, qMakePair(detail.read, offset));
+            const DetailReadProperties properties = { detail.read, detail.detailType, offset, detail.fieldCount };
+            readProperties->insert(detailName, properties);
             offset += detail.fieldCount + (detail.includesContext ? 1 : 2);
         }
     }
@@ -2598,9 +3824,178 @@ QContactManager::Error ContactReader::queryContacts(
     else
         detailQueryStatement = detailQueryStatement.arg(detailNameTemplate.arg(detailNameSpec.join(QStringLiteral("','"))));
 
-    // If selectSpec is empty, all required details are in the Contacts table
+    return detailQueryStatement;
+}
+
+// Below this size, a batch is cheaper to materialize on the calling thread than to dispatch
+const int MinimumParallelBatchSize = 8;
+
+Q_GLOBAL_STATIC(QThreadPool, materializationThreadPool);
+
+class MaterializationTask : public QRunnable
+{
+public:
+    MaterializationTask(const MaterializationContext &context, const ContactRows *rows, QContact *contacts, int count, QSemaphore *completed)
+        : m_context(context), m_rows(rows), m_contacts(contacts), m_count(count), m_completed(completed)
+    {
+    }
+
+    void run() override
+    {
+        for (int i = 0; i < m_count; ++i) {
+            m_contacts[i] = materializeContact(m_context, m_rows[i]);
+        }
+        m_completed->release();
+    }
+
+private:
+    const MaterializationContext &m_context;
+    const ContactRows *m_rows;
+    QContact *m_contacts;
+    const int m_count;
+    QSemaphore *m_completed;
+};
+
+// Find the transient presence of the constituents of the aggregates in these rows
+static void readConstituentPresence(ContactsDatabase &db, QVector<ContactRows> *rows)
+{
+    if (!db.hasTransientDetails()) {
+        return;
+    }
+
+    QHash<quint32, int> aggregateIndices;
+    for (int i = 0; i < rows->count(); ++i) {
+        const ResultRow &contactRow(rows->at(i).contactRow);
+        if (contactRow.value(1).toUInt() == ContactsDatabase::AggregateAddressbookCollectionId) {
+            aggregateIndices.insert(contactRow.value(0).toUInt(), i);
+        }
+    }
+    if (aggregateIndices.isEmpty()) {
+        return;
+    }
+
+    QString idList;
+    for (int i = 0; i < aggregateIndices.count(); ++i) {
+        idList.append(idList.isEmpty() ? QStringLiteral("?") : QStringLiteral(",?"));
+    }
+
+    const QString statement(QStringLiteral(
+        " SELECT Relationships.firstId, Relationships.secondId, Contacts.collectionId"
+        " FROM Relationships"
+        " JOIN Contacts ON Contacts.contactId = Relationships.secondId AND Contacts.isDeactivated = 0"
+        " WHERE Relationships.type = 'Aggregates' AND Relationships.firstId IN (%1)").arg(idList));
+
+    ContactsDatabase::Query query(db.prepare(statement));
+    query.setForwardOnly(true);
+    for (QHash<quint32, int>::const_iterator it = aggregateIndices.constBegin(); it != aggregateIndices.constEnd(); ++it) {
+        query.addBindValue(it.key());
+    }
+    if (!ContactsDatabase::execute(query)) {
+        query.reportError(QStringLiteral("Failed to query constituents for aggregate presence"));
+        return;
+    }
+
+    QList<QPair<quint32, QPair<quint32, quint32> > > constituents;
+    QList<quint32> constituentIds;
+    while (query.next()) {
+        const quint32 constituentId = query.value<quint32>(1);
+        constituents.append(qMakePair(query.value<quint32>(0), qMakePair(constituentId, query.value<quint32>(2))));
+        constituentIds.append(constituentId);
+    }
+    query.finish();
+
+    const QHash<quint32, QPair<QDateTime, QList<QContactDetail> > > transientDetails(db.transientDetails(constituentIds));
+    if (transientDetails.isEmpty()) {
+        return;
+    }
+
+    QList<QPair<quint32, QPair<quint32, quint32> > >::const_iterator cit = constituents.constBegin(), cend = constituents.constEnd();
+    for ( ; cit != cend; ++cit) {
+        QHash<quint32, QPair<QDateTime, QList<QContactDetail> > >::const_iterator tit = transientDetails.constFind(cit->second.first);
+        if (tit == transientDetails.constEnd()) {
+            continue;
+        }
+
+        ConstituentPresence presence;
+        presence.contactId = cit->second.first;
+        presence.collectionId = cit->second.second;
+        foreach (const QContactDetail &detail, tit->second) {
+            if (detail.type() == QContactPresence::Type) {
+                presence.details.append(detail);
+            }
+        }
+        if (!presence.details.isEmpty()) {
+            (*rows)[aggregateIndices.value(cit->first)].constituentPresence.append(presence);
+        }
+    }
+}
+
+// A batch of contacts whose rows have been stepped, and which are materialized by the worker pool
+// while the rows of the following batch are stepped.
+class MaterializationBatch
+{
+public:
+    MaterializationBatch() : m_taskCount(0) {}
+    ~MaterializationBatch() { wait(); }
+
+    QVector<ContactRows> rows;
+    QVector<QContact> contacts;
+
+    void start(const MaterializationContext &context)
+    {
+        contacts.resize(rows.size());
+
+        const int threadCount = QThread::idealThreadCount();
+        if (threadCount <= 1 || rows.size() < MinimumParallelBatchSize) {
+            for (int i = 0; i < rows.size(); ++i) {
+                contacts[i] = materializeContact(context, rows.at(i));
+            }
+            return;
+        }
+
+        // Divide the batch into contiguous ranges, so that the output order matches the row order
+        const int rangeSize = (rows.size() + threadCount - 1) / threadCount;
+        const ContactRows *input = rows.constData();
+        QContact *output = contacts.data();
+        for (int begin = 0; begin < rows.size(); begin += rangeSize) {
+            const int count = qMin(rangeSize, rows.size() - begin);
+            materializationThreadPool()->start(new MaterializationTask(context, input + begin, output + begin, count, &m_completed));
+            ++m_taskCount;
+        }
+    }
+
+    void wait()
+    {
+        if (m_taskCount > 0) {
+            m_completed.acquire(m_taskCount);
+            m_taskCount = 0;
+        }
+    }
+
+private:
+    QSemaphore m_completed;
+    int m_taskCount;
+};
+
+}
+
+QContactManager::Error ContactReader::queryContacts(
+        const QString &tableName,
+        QList<QContact> *contacts,
+        const QContactFetchHint &fetchHint,
+        bool relaxConstraints,
+        bool keepChangeFlags,
+        QSqlQuery &contactQuery,
+        QSqlQuery &relationshipQuery)
+{
+    const ContactWriter::DetailList &definitionMask = fetchHint.detailTypesHint();
+
+    QHash<QString, DetailReadProperties> readProperties;
+    const QString detailQueryStatement(::detailQueryStatement(tableName, definitionMask, &readProperties));
+
+    // If no detail tables are joined, all required details are in the Contacts table
     ContactsDatabase::Query detailQuery(m_database.prepare(detailQueryStatement));
-    if (!selectSpec.isEmpty()) {
+    if (!readProperties.isEmpty()) {
         // Read the details for these contacts
         detailQuery.setForwardOnly(true);
         if (!ContactsDatabase::execute(detailQuery)) {
@@ -2615,125 +4010,41 @@ QContactManager::Error ContactReader::queryContacts(
     const bool includeRelationships(relationshipQuery.isValid());
     const bool includeDetails(detailQuery.isValid());
 
-    // We need to report our retrievals periodically
-    int unreportedCount = 0;
-
-    const int maximumCount = fetchHint.maxCountHint();
-    const int batchSize = (maximumCount > 0) ? 0 : ReportBatchSize; // If count is constrained, don't report periodically
-
-    while (contactQuery.next()) {
-        int col = 0;
-        const quint32 dbId = contactQuery.value(col++).toUInt();
-        const quint32 collectionId = contactQuery.value(col++).toUInt();
-        const QContactCollectionId apiCollectionId = ContactCollectionId::apiId(collectionId, m_managerUri);
-        const bool aggregateContact = collectionId == ContactsDatabase::AggregateAddressbookCollectionId;
-
-        QContact contact;
-        contact.setId(ContactId::apiId(dbId, m_managerUri));
-        contact.setCollectionId(apiCollectionId);
-
-        QContactTimestamp timestamp;
-        setValue(&timestamp, QContactTimestamp::FieldCreationTimestamp    , ContactsDatabase::fromDateTimeString(contactQuery.value(col++).toString()));
-        setValue(&timestamp, QContactTimestamp::FieldModificationTimestamp, ContactsDatabase::fromDateTimeString(contactQuery.value(col++).toString()));
-        col++; // ignore Deleted timestamp.
-
-        QContactStatusFlags flags;
-        flags.setFlag(QContactStatusFlags::HasPhoneNumber, contactQuery.value(col++).toBool());
-        flags.setFlag(QContactStatusFlags::HasEmailAddress, contactQuery.value(col++).toBool());
-        flags.setFlag(QContactStatusFlags::HasOnlineAccount, contactQuery.value(col++).toBool());
-        flags.setFlag(QContactStatusFlags::IsOnline, contactQuery.value(col++).toBool());
-        flags.setFlag(QContactStatusFlags::IsDeactivated, contactQuery.value(col++).toBool());
-        const int changeFlags = contactQuery.value(col++).toInt();
-        flags.setFlag(QContactStatusFlags::IsAdded, changeFlags & ContactsDatabase::IsAdded);
-        flags.setFlag(QContactStatusFlags::IsModified, changeFlags & ContactsDatabase::IsModified);
-        flags.setFlag(QContactStatusFlags::IsDeleted, changeFlags >= ContactsDatabase::IsDeleted);
-
-        if (flags.testFlag(QContactStatusFlags::IsDeactivated)) {
-            QContactDeactivated deactivated;
-            setDetailImmutableIfAggregate(aggregateContact, &deactivated);
-            contact.saveDetail(&deactivated);
-        }
-
-        // ignore created and modified timestamps, will be saved by readDetail()
-        col++;
-        col++;
-
-        int contactType = contactQuery.value(col++).toInt();
-        QContactType typeDetail = contact.detail<QContactType>();
-        typeDetail.setType(static_cast<QContactType::TypeValues>(contactType));
-        setDetailImmutableIfAggregate(aggregateContact, &typeDetail);
-        contact.saveDetail(&typeDetail);
-
-        bool syncable = collectionId != ContactsDatabase::AggregateAddressbookCollectionId
-                && collectionId != ContactsDatabase::LocalAddressbookCollectionId;
-
-        QSet<QContactDetail::DetailType> transientTypes;
-
-        // Find any transient details for this contact
-        if (m_database.hasTransientDetails(dbId)) {
-            const QPair<QDateTime, QList<QContactDetail> > transientDetails(m_database.transientDetails(dbId));
-            if (!transientDetails.first.isNull()) {
-                // Update the contact timestamp to that of the transient details
-                setValue(&timestamp, QContactTimestamp::FieldModificationTimestamp, transientDetails.first);
-
-                QList<QContactDetail>::const_iterator it = transientDetails.second.constBegin(), end = transientDetails.second.constEnd();
-                for ( ; it != end; ++it) {
-                    // Copy the transient detail into the contact
-                    const QContactDetail &transient(*it);
-
-                    const QContactDetail::DetailType transientType(transient.type());
-
-                    if (transientType == QContactGlobalPresence::Type) {
-                        // If global presence is in the transient details, the IsOnline status flag is out of date
-                        const int presenceState = transient.value<int>(QContactGlobalPresence::FieldPresenceState);
-                        const bool isOnline(presenceState >= QContactPresence::PresenceAvailable &&
-                                            presenceState <= QContactPresence::PresenceExtendedAway);
-                        flags.setFlag(QContactStatusFlags::IsOnline, isOnline);
-                    }
-
-                    // Ignore details that aren't in the requested types
-                    if (!definitionMask.isEmpty() && !definitionMask.contains(transientType)) {
-                        continue;
-                    }
-
-                    QContactDetail detail(transient.type());
-                    if (!relaxConstraints) {
-                        QContactManagerEngine::setDetailAccessConstraints(&detail, transient.accessConstraints());
-                    }
+    MaterializationContext context;
+    context.managerUri = m_managerUri;
+    context.definitionMask = definitionMask;
+    context.relaxConstraints = relaxConstraints;
+    context.keepChangeFlags = keepChangeFlags;
+    context.includeRelationships = includeRelationships;
 
-                    const QMap<int, QVariant> values(transient.values());
-                    QMap<int, QVariant>::const_iterator vit = values.constBegin(), vend = values.constEnd();
-                    for ( ; vit != vend; ++vit) {
-                        bool append(true);
+    const int contactColumnCount = contactQuery.record().count();
+    const int relationshipColumnCount = includeRelationships ? relationshipQuery.record().count() : 0;
 
-                        if (vit.key() == QContactDetail__FieldModifiable) {
-                            append = syncable;
-                        }
+    // The presence of aggregates is derived from the transient presence of their constituents
+    const bool includePresence(m_database.aggregating() &&
+                               (definitionMask.isEmpty() || definitionMask.contains(QContactPresence::Type)));
 
-                        if (append) {
-                            detail.setValue(vit.key(), vit.value());
-                        }
-                    }
+    // We need to report our retrievals periodically
+    const int maximumCount = fetchHint.maxCountHint();
+    const bool reportBatches = (maximumCount <= 0); // If count is constrained, don't report periodically
+    bool unreported = false;
 
-                    setDetailImmutableIfAggregate(aggregateContact, &detail);
-                    contact.saveDetail(&detail);
-                    transientTypes.insert(transientType);
-                }
-            }
-        }
+    // The rows of each batch are stepped on this thread, while the previous batch is materialized
+    // by the worker pool; the batches are appended in the order they were stepped.
+    QScopedPointer<MaterializationBatch> pendingBatch;
+    QScopedPointer<MaterializationBatch> batch(new MaterializationBatch);
+    QList<quint32> batchContactIds;
 
-        // Add the updated status flags
-        QContactManagerEngine::setDetailAccessConstraints(&flags, QContactDetail::ReadOnly | QContactDetail::Irremovable);
-        setDetailImmutableIfAggregate(aggregateContact, &flags);
-        contact.saveDetail(&flags);
+    bool rowsRemaining = contactQuery.next();
+    while (rowsRemaining) {
+        const quint32 dbId = contactQuery.value(0).toUInt();
 
-        // Add the timestamp info
-        if (!timestamp.isEmpty()) {
-            setDetailImmutableIfAggregate(aggregateContact, &timestamp);
-            contact.saveDetail(&timestamp);
-        }
+        batch->rows.append(ContactRows());
+        ContactRows &rows(batch->rows.last());
+        rows.contactRow = ResultRow(contactQuery, contactColumnCount);
+        batchContactIds.append(dbId);
 
-        // Add the details of this contact from the detail tables
+        // Collect the details of this contact from the detail tables
         if (includeDetails) {
             if (detailQuery.isValid()) {
                 quint32 firstContactDetailId = 0;
@@ -2752,71 +4063,79 @@ QContactManager::Error ContactReader::queryContacts(
                         break;
                     }
 
-                    const QString detailName = detailQuery.value(2).toString();
-
                     // Are we reporting this detail type?
-                    const QPair<ReadDetail, int> properties(readProperties[detailName]);
-                    if (properties.first && properties.second) {
-                        // Are there transient details of this type for this contact?
-                        const QContactDetail::DetailType detailType(detailIdentifier(detailName));
-                        if (transientTypes.contains(detailType)) {
-                            // This contact has transient details of this type; skip the extraction
-                            continue;
-                        }
-
-                        // Extract the values from the result row (readDetail()).
-                        properties.first(&contact, detailQuery, contactId, detailId, syncable,
-                                         apiCollectionId, relaxConstraints, keepChangeFlags,
-                                         properties.second);
+                    QHash<QString, DetailReadProperties>::const_iterator pit = readProperties.constFind(detailQuery.value(2).toString());
+                    if (pit != readProperties.constEnd()) {
+                        // Copy only the Details columns and those of this detail's table
+                        rows.detailRows.append(qMakePair(&(*pit), ResultRow(detailQuery, DetailsColumnCount, pit->offset, pit->fieldCount)));
                     }
                 } while (detailQuery.next());
             }
         }
 
         if (includeRelationships) {
-            // Find any relationships for this contact
+            // Collect the relationships for this contact
             if (relationshipQuery.isValid()) {
-                // Find the relationships for the contacts in this batch
-                QList<QContactRelationship> relationships;
-
                 do {
                     const quint32 contactId = relationshipQuery.value(0).toUInt();
                     if (contactId != dbId) {
                         break;
                     }
 
-                    const QString secondType = relationshipQuery.value(1).toString();
-                    const quint32 firstId = relationshipQuery.value(2).toUInt();
-                    const QString firstType = relationshipQuery.value(3).toString();
-                    const quint32 secondId = relationshipQuery.value(4).toUInt();
-
-                    if (!firstType.isEmpty()) {
-                        QContactRelationship rel(makeRelationship(firstType, contactId, secondId, m_managerUri));
-                        relationships.append(rel);
-                    } else if (!secondType.isEmpty()) {
-                        QContactRelationship rel(makeRelationship(secondType, firstId, contactId, m_managerUri));
-                        relationships.append(rel);
-                    }
+                    rows.relationshipRows.append(ResultRow(relationshipQuery, relationshipColumnCount));
                 } while (relationshipQuery.next());
-
-                QContactManagerEngine::setContactRelationships(&contact, relationships);
             }
         }
 
-        // Append this contact to the output set
-        contacts->append(contact);
+        rowsRemaining = contactQuery.next();
+        if (batch->rows.size() == ReportBatchSize || !rowsRemaining) {
+            // Find any transient details for the contacts of this batch, with a single access to the store
+            const QHash<quint32, QPair<QDateTime, QList<QContactDetail> > > transientDetails(m_database.transientDetails(batchContactIds));
+            if (!transientDetails.isEmpty()) {
+                for (int i = 0; i < batchContactIds.count(); ++i) {
+                    QHash<quint32, QPair<QDateTime, QList<QContactDetail> > >::const_iterator tit = transientDetails.constFind(batchContactIds.at(i));
+                    if (tit != transientDetails.constEnd()) {
+                        batch->rows[i].transientDetails = *tit;
+                    }
+                }
+            }
+            batchContactIds.clear();
+
+            if (includePresence) {
+                readConstituentPresence(m_database, &batch->rows);
+            }
+
+            batch->start(context);
 
-        // Periodically report our retrievals
-        if (++unreportedCount == batchSize) {
-            unreportedCount = 0;
-            contactsAvailable(*contacts);
+            if (pendingBatch) {
+                pendingBatch->wait();
+                foreach (const QContact &contact, pendingBatch->contacts) {
+                    contacts->append(contact);
+                }
+                if (reportBatches) {
+                    contactsAvailable(*contacts);
+                } else {
+                    unreported = true;
+                }
+            }
+
+            pendingBatch.reset(batch.take());
+            batch.reset(new MaterializationBatch);
         }
     }
 
     detailQuery.finish();
 
+    if (pendingBatch) {
+        pendingBatch->wait();
+        foreach (const QContact &contact, pendingBatch->contacts) {
+            contacts->append(contact);
+        }
+        unreported = true;
+    }
+
     // If any retrievals are not yet reported, do so now
-    if (unreportedCount > 0) {
+    if (unreported) {
         contactsAvailable(*contacts);
     }
 
@@ -2923,50 +4242,32 @@ QContactManager::Error ContactReader::readDeletedContactIds(
 
 QContactManager::Error ContactReader::readContactIds(
         QList<QContactId> *contactIds,
-        const QContactFilter &filter,
+        const QContactFilter &inputFilter,
         const QList<QContactSortOrder> &order)
 {
     QMutexLocker locker(m_database.accessMutex());
 
     // Is this a query on deleted contacts?
-    if (deletedContactFilter(filter)) {
-        return readDeletedContactIds(contactIds, filter);
+    if (deletedContactFilter(inputFilter)) {
+        return readDeletedContactIds(contactIds, inputFilter);
     }
 
+    const QContactFilter filter(normalizeFilter(inputFilter));
+
     // Use a dummy table name to identify any temporary tables we create
     const QString tableName(QStringLiteral("readContactIds"));
 
     m_database.clearTransientContactIdsTable(tableName);
 
     QString join;
-    bool transientModifiedRequired = false;
-    bool globalPresenceRequired = false;
-    const QString orderBy = buildOrderBy(order, &join, &transientModifiedRequired, &globalPresenceRequired, m_database.localized());
-
-    bool failed = false;
+    QString where;
+    QString orderBy;
     QVariantList bindings;
-    QString where = buildContactWhere(filter, m_database, tableName, QContactDetail::TypeUndefined, &bindings,
-                                      &failed, &transientModifiedRequired, &globalPresenceRequired);
-    if (failed) {
-        qWarning() << "Failed to create WHERE expression: invalid filter specification";
-        return QContactManager::UnspecifiedError;
-    }
-
-    where = expandWhere(where, filter, m_database.aggregating());
-
-    if (transientModifiedRequired || globalPresenceRequired) {
-        // Provide the temporary transient state information to filter/sort on
-        if (!m_database.populateTemporaryTransientState(transientModifiedRequired, globalPresenceRequired)) {
-            return QContactManager::UnspecifiedError;
-        }
-
-        if (transientModifiedRequired) {
-            join.append(QStringLiteral(" LEFT JOIN temp.Timestamps ON Contacts.contactId = temp.Timestamps.contactId"));
-        }
-        if (globalPresenceRequired) {
-            join.append(QStringLiteral(" LEFT JOIN temp.GlobalPresenceStates ON Contacts.contactId = temp.GlobalPresenceStates.contactId"));
-        }
-    }
+    quint64 refinementGeneration = 0;
+    QContactManager::Error error = buildContactSelection(m_database, filter, order, tableName, &join, &where, &orderBy,
+                                                         &bindings, &refinementGeneration);
+    if (error != QContactManager::NoError)
+        return error;
 
     QString queryString = QStringLiteral(
                 "\n SELECT DISTINCT Contacts.contactId"
@@ -2997,13 +4298,18 @@ QContactManager::Error ContactReader::readContactIds(
         debugFilterExpansion("Contact IDs selection:", queryString, bindings);
     }
 
+    QList<quint32> databaseIds;
     do {
         for (int i = 0; i < ReportBatchSize && query.next(); ++i) {
-            contactIds->append(ContactId::apiId(query.value(0).toUInt(), m_managerUri));
+            const quint32 dbId = query.value(0).toUInt();
+            databaseIds.append(dbId);
+            contactIds->append(ContactId::apiId(dbId, m_managerUri));
         }
         contactIdsAvailable(*contactIds);
     } while (query.isValid());
 
+    recordRefinementResults(m_database, filter, databaseIds, refinementGeneration);
+
     return QContactManager::NoError;
 }
 
@@ -3139,6 +4445,8 @@ QContactManager::Error ContactReader::readDetails(
                 &transientModifiedRequired,
                 &globalPresenceRequired,
                 m_database.localized(),
+                m_database.hasSortKeys(),
+                m_database.hasNullsOrdering(),
                 type,
                 QString());
 
@@ -3205,8 +4513,9 @@ QContactManager::Error ContactReader::readDetails(
     }
 
 
+    const int columnCount = query.record().count();
     while (query.next()) {
-        info.appendUnique(details, query);
+        info.appendUnique(details, ResultRow(query, columnCount));
     }
 
     return QContactManager::NoError;
@@ -3497,6 +4806,475 @@ bool ContactReader::fetchOOBKeys(const QString &scope, QStringList *keys)
     return true;
 }
 
+QContactManager::Error ContactReader::readContactCount(
+        int *count,
+        const QContactFilter &filter)
+{
+    QMutexLocker locker(m_database.accessMutex());
+
+    if (deletedContactFilter(filter)) {
+        QList<QContactId> contactIds;
+        QContactManager::Error error = readDeletedContactIds(&contactIds, filter);
+        *count = contactIds.count();
+        return error;
+    }
+
+    // Use a dummy table name to identify any temporary tables we create
+    const QString tableName(QStringLiteral("readContactCount"));
+
+    m_database.clearTransientContactIdsTable(tableName);
+
+    QString join;
+    QString where;
+    QVariantList bindings;
+    quint64 refinementGeneration = 0;
+    QContactManager::Error error = buildContactSelection(m_database, normalizeFilter(filter), QList<QContactSortOrder>(), tableName,
+                                                         &join, &where, 0, &bindings, &refinementGeneration);
+    if (error != QContactManager::NoError)
+        return error;
+
+    const QString queryString = QStringLiteral(
+                "\n SELECT COUNT(DISTINCT Contacts.contactId)"
+                "\n FROM Contacts %1"
+                "\n %2").arg(join).arg(where);
+
+    QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+    if (!query.prepare(queryString)) {
+        qWarning() << QString::fromLatin1("Failed to prepare contact count:\n%1\nQuery:\n%2")
+                .arg(query.lastError().text())
+                .arg(queryString);
+        return QContactManager::UnspecifiedError;
+    }
+
+    for (int i = 0; i < bindings.count(); ++i)
+        query.bindValue(i, bindings.at(i));
+
+    if (!ContactsDatabase::execute(query)) {
+        qWarning() << QString::fromLatin1("Failed to query contact count\n%1\nQuery:\n%2")
+                .arg(query.lastError().text())
+                .arg(queryString);
+        return QContactManager::UnspecifiedError;
+    } else {
+        debugFilterExpansion("Contact count selection:", queryString, bindings);
+    }
+
+    *count = query.next() ? query.value(0).toInt() : 0;
+    query.finish();
+
+    return QContactManager::NoError;
+}
+
+QContactManager::Error ContactReader::readDisplayLabelGroupCounts(
+        QList<QPair<QString, int> > *groupCounts,
+        const QContactFilter &filter)
+{
+    QMutexLocker locker(m_database.accessMutex());
+
+    if (deletedContactFilter(filter)) {
+        // Deleted contacts are not presented in display label group order
+        return QContactManager::NotSupportedError;
+    }
+
+    const QString tableName(QStringLiteral("readDisplayLabelGroupCounts"));
+
+    m_database.clearTransientContactIdsTable(tableName);
+
+    QString join;
+    QString where;
+    QVariantList bindings;
+    quint64 refinementGeneration = 0;
+    QContactManager::Error error = buildContactSelection(m_database, normalizeFilter(filter), QList<QContactSortOrder>(), tableName,
+                                                         &join, &where, 0, &bindings, &refinementGeneration);
+    if (error != QContactManager::NoError)
+        return error;
+
+    // Report the groups in the order produced by sorting on the display label group,
+    // where contacts without a group are placed last
+    const QString queryString = QStringLiteral(
+                "\n SELECT DisplayLabels.displayLabelGroup, COUNT(DISTINCT Contacts.contactId)"
+                "\n FROM Contacts"
+                "\n LEFT JOIN DisplayLabels ON DisplayLabels.contactId = Contacts.contactId %1"
+                "\n %2"
+                "\n GROUP BY DisplayLabels.displayLabelGroupSortOrder, DisplayLabels.displayLabelGroup"
+                "\n ORDER BY CASE WHEN DisplayLabels.displayLabelGroupSortOrder IS NULL THEN 1 ELSE 0 END,"
+                " DisplayLabels.displayLabelGroupSortOrder ASC").arg(join).arg(where);
+
+    QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+    if (!query.prepare(queryString)) {
+        qWarning() << QString::fromLatin1("Failed to prepare display label group counts:\n%1\nQuery:\n%2")
+                .arg(query.lastError().text())
+                .arg(queryString);
+        return QContactManager::UnspecifiedError;
+    }
+
+    for (int i = 0; i < bindings.count(); ++i)
+        query.bindValue(i, bindings.at(i));
+
+    if (!ContactsDatabase::execute(query)) {
+        qWarning() << QString::fromLatin1("Failed to query display label group counts\n%1\nQuery:\n%2")
+                .arg(query.lastError().text())
+                .arg(queryString);
+        return QContactManager::UnspecifiedError;
+    } else {
+        debugFilterExpansion("Display label group count selection:", queryString, bindings);
+    }
+
+    while (query.next()) {
+        groupCounts->append(qMakePair(query.value(0).toString(), query.value(1).toInt()));
+    }
+    query.finish();
+
+    return QContactManager::NoError;
+}
+
+static bool explainQueryPlan(ContactsDatabase &db, const QString &statement, const QVariantList &bindings, QStringList *plan)
+{
+    const QString planStatement(QStringLiteral("EXPLAIN QUERY PLAN ") + statement);
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.prepare(planStatement)) {
+        qWarning() << QString::fromLatin1("Failed to prepare query plan:\n%1\nQuery:\n%2")
+                .arg(query.lastError().text())
+                .arg(planStatement);
+        return false;
+    }
+
+    for (int i = 0; i < bindings.count(); ++i)
+        query.bindValue(i, bindings.at(i));
+
+    if (!ContactsDatabase::execute(query)) {
+        qWarning() << QString::fromLatin1("Failed to query plan\n%1\nQuery:\n%2")
+                .arg(query.lastError().text())
+                .arg(planStatement);
+        return false;
+    }
+
+    // The final column of each row describes a step of the plan
+    while (query.next()) {
+        plan->append(query.value(query.record().count() - 1).toString());
+    }
+    query.finish();
+
+    return true;
+}
+
+static bool profileStatement(ContactsDatabase &db, const QString &description, const QString &statement,
+                             const QVariantList &bindings, QtContactsSqliteExtensions::QueryProfileStep *step)
+{
+    step->description = description;
+    step->statement = ContactsDatabase::expandQuery(statement, bindings);
+    step->elapsedUsecs = 0;
+    step->rowCount = 0;
+
+    if (!explainQueryPlan(db, statement, bindings, &step->queryPlan))
+        return false;
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.prepare(statement)) {
+        qWarning() << QString::fromLatin1("Failed to prepare profiled query:\n%1\nQuery:\n%2")
+                .arg(query.lastError().text())
+                .arg(statement);
+        return false;
+    }
+
+    for (int i = 0; i < bindings.count(); ++i)
+        query.bindValue(i, bindings.at(i));
+
+    // Statements are evaluated as their rows are stepped, so the time includes stepping every row
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!ContactsDatabase::execute(query)) {
+        qWarning() << QString::fromLatin1("Failed to execute profiled query\n%1\nQuery:\n%2")
+                .arg(query.lastError().text())
+                .arg(statement);
+        return false;
+    }
+    while (query.next()) {
+        ++step->rowCount;
+    }
+    step->elapsedUsecs = timer.nsecsElapsed() / 1000;
+    query.finish();
+
+    return true;
+}
+
+QContactManager::Error ContactReader::profileContacts(
+        QList<QtContactsSqliteExtensions::QueryProfileStep> *steps,
+        const QContactFilter &inputFilter,
+        const QList<QContactSortOrder> &order,
+        const QContactFetchHint &fetchHint)
+{
+    QMutexLocker locker(m_database.accessMutex());
+
+    if (deletedContactFilter(inputFilter)) {
+        // Deleted contacts are reported by ID only, without any of the fetch steps
+        return QContactManager::NotSupportedError;
+    }
+
+    // Use a dummy table name to identify any temporary tables we create
+    const QString table(QStringLiteral("profileContacts"));
+
+    m_database.clearTemporaryContactIdsTable(table);
+
+    const QContactFilter filter(normalizeFilter(inputFilter));
+
+    QString join;
+    bool transientModifiedRequired = false;
+    bool globalPresenceRequired = false;
+    QString orderBy = buildOrderBy(order, &join, &transientModifiedRequired, &globalPresenceRequired,
+                                   m_database.localized(), m_database.hasSortKeys(), m_database.hasNullsOrdering());
+
+    bool whereFailed = false;
+    QVariantList bindings;
+    QString where = buildContactWhere(filter, m_database, table, QContactDetail::TypeUndefined, &bindings, &whereFailed,
+                                      &transientModifiedRequired, &globalPresenceRequired);
+    if (whereFailed) {
+        qWarning() << "Failed to create WHERE expression: invalid filter specification";
+        return QContactManager::UnspecifiedError;
+    }
+
+    QString searchExpression;
+    if (order.isEmpty() && fullTextSearchFilter(filter, m_database, &searchExpression)) {
+        orderBy = fullTextSearchOrderBy();
+        bindings.append(searchExpression);
+    }
+
+    where = expandWhere(where, filter, m_database.aggregating());
+
+    QElapsedTimer timer;
+
+    if (transientModifiedRequired || globalPresenceRequired) {
+        QtContactsSqliteExtensions::QueryProfileStep step;
+        step.description = QStringLiteral("Transient state population");
+        step.rowCount = 0;
+
+        timer.start();
+        if (!m_database.populateTemporaryTransientState(transientModifiedRequired, globalPresenceRequired)) {
+            return QContactManager::UnspecifiedError;
+        }
+        step.elapsedUsecs = timer.nsecsElapsed() / 1000;
+        steps->append(step);
+
+        if (transientModifiedRequired) {
+            join.append(QStringLiteral(" LEFT JOIN temp.Timestamps ON Contacts.contactId = temp.Timestamps.contactId"));
+        }
+        if (globalPresenceRequired) {
+            join.append(QStringLiteral(" LEFT JOIN temp.GlobalPresenceStates ON Contacts.contactId = temp.GlobalPresenceStates.contactId"));
+        }
+    }
+
+    const int maximumCount = fetchHint.maxCountHint();
+
+    // The selection is measured as the population of the temporary table, as it is performed by a fetch
+    {
+        QString selectionStatement = QStringLiteral("SELECT Contacts.contactId FROM Contacts %1 %2").arg(join).arg(where);
+        if (!orderBy.isEmpty()) {
+            selectionStatement.append(QStringLiteral(" ORDER BY ") + orderBy);
+        }
+        if (maximumCount > 0) {
+            selectionStatement.append(QStringLiteral(" LIMIT %1").arg(maximumCount));
+        }
+
+        QtContactsSqliteExtensions::QueryProfileStep step;
+        step.description = QStringLiteral("Temporary table population");
+        step.statement = ContactsDatabase::expandQuery(selectionStatement, bindings);
+        if (!explainQueryPlan(m_database, selectionStatement, bindings, &step.queryPlan)) {
+            return QContactManager::UnspecifiedError;
+        }
+
+        timer.start();
+        if (!m_database.createTemporaryContactIdsTable(table, join, where, orderBy, bindings, maximumCount)) {
+            return QContactManager::UnspecifiedError;
+        }
+        step.elapsedUsecs = timer.nsecsElapsed() / 1000;
+
+        QSqlQuery countQuery(m_database);
+        if (!countQuery.prepare(QStringLiteral("SELECT COUNT(*) FROM temp.%1").arg(table))
+                || !ContactsDatabase::execute(countQuery) || !countQuery.next()) {
+            qWarning() << "Failed to count temporary contact IDs:" << countQuery.lastError().text();
+            return QContactManager::UnspecifiedError;
+        }
+        step.rowCount = countQuery.value(0).toInt();
+        countQuery.finish();
+
+        steps->append(step);
+    }
+
+    QContactManager::Error error = QContactManager::NoError;
+
+    QtContactsSqliteExtensions::QueryProfileStep contactStep;
+    if (!profileStatement(m_database, QStringLiteral("Contact query"), contactQueryStatement(table, false), QVariantList(), &contactStep)) {
+        error = QContactManager::UnspecifiedError;
+    } else {
+        steps->append(contactStep);
+    }
+
+    if (error == QContactManager::NoError) {
+        QHash<QString, DetailReadProperties> readProperties;
+        const QString statement(detailQueryStatement(table, fetchHint.detailTypesHint(), &readProperties));
+        if (!readProperties.isEmpty()) {
+            QtContactsSqliteExtensions::QueryProfileStep step;
+            if (!profileStatement(m_database, QStringLiteral("Detail query"), statement, QVariantList(), &step)) {
+                error = QContactManager::UnspecifiedError;
+            } else {
+                steps->append(step);
+            }
+        }
+    }
+
+    if (error == QContactManager::NoError && (fetchHint.optimizationHints() & QContactFetchHint::NoRelationships) == 0) {
+        QtContactsSqliteExtensions::QueryProfileStep step;
+        if (!profileStatement(m_database, QStringLiteral("Relationship query"), relationshipQueryStatement(table), QVariantList(), &step)) {
+            error = QContactManager::UnspecifiedError;
+        } else {
+            steps->append(step);
+        }
+    }
+
+    m_database.clearTemporaryContactIdsTable(table);
+
+    return error;
+}
+
+QContactManager::Error ContactReader::readPhoneNumberIndex(PhoneNumberIndex *index)
+{
+    QMutexLocker locker(m_database.accessMutex());
+
+    // Index the numbers of the contacts that would be reported by an unfiltered query
+    const QString where(expandWhere(QString(), QContactFilter(), m_database.aggregating()));
+    const QString statement(QStringLiteral(
+                "\n SELECT PhoneNumbers.normalizedNumber, Contacts.contactId, DisplayLabels.displayLabel"
+                "\n FROM PhoneNumbers"
+                "\n JOIN Contacts ON Contacts.contactId = PhoneNumbers.contactId"
+                "\n LEFT JOIN DisplayLabels ON DisplayLabels.contactId = Contacts.contactId"
+                "\n %1").arg(where));
+
+    QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+    if (!query.prepare(statement)) {
+        qWarning() << QString::fromLatin1("Failed to prepare phone number index query:\n%1\nQuery:\n%2")
+                .arg(query.lastError().text())
+                .arg(statement);
+        return QContactManager::UnspecifiedError;
+    }
+
+    index->clear();
+    if (!ContactsDatabase::execute(query)) {
+        qWarning() << QString::fromLatin1("Failed to query phone number index: %1")
+                .arg(query.lastError().text());
+        return QContactManager::UnspecifiedError;
+    }
+
+    while (query.next()) {
+        index->insert(query.value(0).toString(), query.value(1).value<quint32>(), query.value(2).toString());
+    }
+    query.finish();
+    index->finalize();
+
+    return QContactManager::NoError;
+}
+
+static QDate nextOccurrence(const QDate &date, int year)
+{
+    // A date which does not occur in the year (29th February) falls on the preceding day
+    QDate occurrence(year, date.month(), date.day());
+    return occurrence.isValid() ? occurrence : QDate(year, date.month(), date.day() - 1);
+}
+
+QContactManager::Error ContactReader::readUpcomingDates(
+        QList<QtContactsSqliteExtensions::UpcomingDate> *dates,
+        const QDate &startDate,
+        int maximumCount,
+        bool includeDisplayLabels)
+{
+    if (!startDate.isValid())
+        return QContactManager::BadArgumentError;
+
+    QMutexLocker locker(m_database.accessMutex());
+
+    // Select the dates of the contacts that would be reported by an unfiltered query,
+    // scanning the month-day index of each table for the range of the segment
+    const QString where(expandWhere(QString(), QContactFilter(), m_database.aggregating()));
+    const QString statement(QStringLiteral(
+                "\n SELECT Dates.contactId, Dates.detailType, Dates.date, %1"
+                "\n FROM ("
+                "\n  SELECT contactId, detailId, %2 AS detailType, birthday AS date, monthDay"
+                "\n  FROM Birthdays WHERE monthDay >= ? AND monthDay < ?"
+                "\n  UNION ALL"
+                "\n  SELECT contactId, detailId, %3 AS detailType, originalDateTime AS date, monthDay"
+                "\n  FROM Anniversaries WHERE monthDay >= ? AND monthDay < ?"
+                "\n ) AS Dates"
+                "\n JOIN Contacts ON Contacts.contactId = Dates.contactId"
+                "\n JOIN Details ON Details.detailId = Dates.detailId AND Details.changeFlags < 4" // ChangeFlags::IsDeleted
+                "\n %4"
+                "\n %5"
+                "\n ORDER BY Dates.monthDay, Dates.detailType, Dates.contactId"
+                "\n LIMIT ?")
+            .arg(includeDisplayLabels ? QStringLiteral("DisplayLabels.displayLabel") : QStringLiteral("NULL"))
+            .arg(static_cast<int>(QContactBirthday::Type))
+            .arg(static_cast<int>(QContactAnniversary::Type))
+            .arg(includeDisplayLabels ? QStringLiteral("LEFT JOIN DisplayLabels ON DisplayLabels.contactId = Contacts.contactId") : QString())
+            .arg(where));
+
+    // The dates occurring on or after the start date this year are followed by those
+    // occurring before it, next year
+    const int startMonthDay = ContactsDatabase::monthDay(startDate);
+    const int segments[2][3] = {
+        { startMonthDay, ContactsDatabase::monthDay(QDate(startDate.year(), 12, 31)) + 1, startDate.year() },
+        { 0,             startMonthDay,                                                   startDate.year() + 1 },
+    };
+
+    for (int i = 0; i < 2; ++i) {
+        int limit = -1;
+        if (maximumCount > 0) {
+            limit = maximumCount - dates->count();
+            if (limit <= 0)
+                break;
+        }
+
+        QSqlQuery query(m_database);
+        query.setForwardOnly(true);
+        if (!query.prepare(statement)) {
+            qWarning() << QString::fromLatin1("Failed to prepare upcoming dates query:\n%1\nQuery:\n%2")
+                    .arg(query.lastError().text())
+                    .arg(statement);
+            return QContactManager::UnspecifiedError;
+        }
+
+        QVariantList bindings;
+        bindings << segments[i][0] << segments[i][1] << segments[i][0] << segments[i][1] << limit;
+        for (int j = 0; j < bindings.count(); ++j)
+            query.bindValue(j, bindings.at(j));
+
+        if (!ContactsDatabase::execute(query)) {
+            qWarning() << QString::fromLatin1("Failed to query upcoming dates\n%1\nQuery:\n%2")
+                    .arg(query.lastError().text())
+                    .arg(statement);
+            return QContactManager::UnspecifiedError;
+        } else {
+            debugFilterExpansion("Upcoming dates selection:", statement, bindings);
+        }
+
+        while (query.next()) {
+            QtContactsSqliteExtensions::UpcomingDate upcoming;
+            upcoming.contactId = ContactId::apiId(query.value(0).value<quint32>(), m_managerUri);
+            upcoming.detailType = static_cast<QContactDetail::DetailType>(query.value(1).toInt());
+            upcoming.date = dateValue(query.value(2)).toDate();
+            upcoming.nextOccurrence = nextOccurrence(upcoming.date, segments[i][2]);
+            upcoming.displayLabel = query.value(3).toString();
+            dates->append(upcoming);
+        }
+        query.finish();
+    }
+
+    return QContactManager::NoError;
+}
+
 void ContactReader::contactsAvailable(const QList<QContact> &)
 {
 }
@@ -3508,3 +5286,7 @@ void ContactReader::contactIdsAvailable(const QList<QContactId> &)
 void ContactReader::collectionsAvailable(const QList<QContactCollection> &)
 {
 }
+
+void ContactReader::duplicatesAvailable(const QList<Duplicate> &)
+{
+}
@@ -44,6 +44,13 @@
 
 QTCONTACTS_USE_NAMESPACE
 
+class PhoneNumberIndex;
+
+namespace QtContactsSqliteExtensions {
+struct QueryProfileStep;
+struct UpcomingDate;
+}
+
 class ContactReader
 {
 public:
@@ -76,6 +83,20 @@ public:
             const QContactFilter &filter,
             const QList<QContactSortOrder> &order);
 
+    QContactManager::Error readContactCount(
+            int *count,
+            const QContactFilter &filter);
+
+    QContactManager::Error readDisplayLabelGroupCounts(
+            QList<QPair<QString, int> > *groupCounts,
+            const QContactFilter &filter);
+
+    QContactManager::Error profileContacts(
+            QList<QtContactsSqliteExtensions::QueryProfileStep> *steps,
+            const QContactFilter &filter,
+            const QList<QContactSortOrder> &order,
+            const QContactFetchHint &fetchHint);
+
     QContactManager::Error getIdentity(
             ContactsDatabase::Identity identity, QContactId *contactId);
 
@@ -124,6 +145,25 @@ public:
 
     bool fetchOOBKeys(const QString &scope, QStringList *keys);
 
+    QContactManager::Error readPhoneNumberIndex(PhoneNumberIndex *index);
+
+    QContactManager::Error readUpcomingDates(
+            QList<QtContactsSqliteExtensions::UpcomingDate> *dates,
+            const QDate &startDate,
+            int maximumCount,
+            bool includeDisplayLabels);
+
+    // A pair of contacts which may represent the same person, found by ContactWriter::findDuplicates()
+    struct Duplicate
+    {
+        QContactId firstId;
+        QContactId secondId;
+        int score;
+    };
+
+    // Reports all of the duplicates found so far by a duplicate scan using this reader
+    virtual void duplicatesAvailable(const QList<Duplicate> &duplicates);
+
 protected:
     QContactManager::Error readDeletedContactIds(
             QList<QContactId> *contactIds,
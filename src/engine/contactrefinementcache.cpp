@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+
+#include "contactrefinementcache_p.h"
+#include "contactsdatabase.h"
+
+#include "../extensions/qtcontacts-extensions.h"
+
+#include <QContactDetailFilter>
+#include <QContactIntersectionFilter>
+#include <QContactUnionFilter>
+
+namespace {
+
+int matchType(const QContactDetailFilter &filter)
+{
+    const int globValue = filter.matchFlags() & 7;
+    if ((filter.matchFlags() & QContactFilter__MatchFullTextSearch) && globValue == QContactFilter::MatchContains) {
+        // Full-text search matches the tokens of the value by prefix, rather than as a substring
+        return QContactFilter::MatchStartsWith;
+    }
+    return globValue;
+}
+
+QList<QContactFilter> childFilters(const QContactFilter &filter)
+{
+    if (filter.type() == QContactFilter::IntersectionFilter) {
+        return static_cast<const QContactIntersectionFilter &>(filter).filters();
+    }
+    return static_cast<const QContactUnionFilter &>(filter).filters();
+}
+
+}
+
+ContactRefinementCache::ContactRefinementCache(int maximumEntries)
+    : m_maximumEntries(maximumEntries)
+    , m_invalidations(0)
+    , m_hits(0)
+    , m_misses(0)
+{
+}
+
+bool ContactRefinementCache::refinable(const QContactFilter &filter)
+{
+    if (filter.type() == QContactFilter::ContactDetailFilter) {
+        const QContactDetailFilter &detailFilter(static_cast<const QContactDetailFilter &>(filter));
+        const int type = matchType(detailFilter);
+        return (type == QContactFilter::MatchStartsWith || type == QContactFilter::MatchContains || type == QContactFilter::MatchEndsWith)
+            && detailFilter.value().type() == QVariant::String
+            && !detailFilter.value().toString().isEmpty();
+    } else if (filter.type() == QContactFilter::IntersectionFilter || filter.type() == QContactFilter::UnionFilter) {
+        foreach (const QContactFilter &childFilter, childFilters(filter)) {
+            if (refinable(childFilter)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool ContactRefinementCache::refines(const QContactFilter &filter, const QContactFilter &previous)
+{
+    if (filter.type() != previous.type()) {
+        return false;
+    }
+
+    if (filter.type() == QContactFilter::ContactDetailFilter) {
+        const QContactDetailFilter &detailFilter(static_cast<const QContactDetailFilter &>(filter));
+        const QContactDetailFilter &previousFilter(static_cast<const QContactDetailFilter &>(previous));
+        if (detailFilter.detailType() != previousFilter.detailType()
+                || detailFilter.detailField() != previousFilter.detailField()
+                || detailFilter.matchFlags() != previousFilter.matchFlags()) {
+            return false;
+        }
+        if (detailFilter.value() == previousFilter.value()) {
+            return true;
+        }
+        if (detailFilter.value().type() != QVariant::String || previousFilter.value().type() != QVariant::String) {
+            return false;
+        }
+
+        // Any case folding, keypad mapping or digit extraction applied to the values preserves
+        // the relationship between them, so the comparison is made on the values as given
+        const QString value(detailFilter.value().toString());
+        const QString previousValue(previousFilter.value().toString());
+
+        const int type = matchType(detailFilter);
+        if (type == QContactFilter::MatchStartsWith) {
+            return value.startsWith(previousValue);
+        } else if (type == QContactFilter::MatchContains) {
+            return value.contains(previousValue);
+        } else if (type == QContactFilter::MatchEndsWith) {
+            return value.endsWith(previousValue);
+        }
+        return false;
+    } else if (filter.type() == QContactFilter::IntersectionFilter || filter.type() == QContactFilter::UnionFilter) {
+        // Compound filters refine the previous filter if each of their parts do
+        const QList<QContactFilter> filters(childFilters(filter));
+        const QList<QContactFilter> previousFilters(childFilters(previous));
+        if (filters.count() != previousFilters.count()) {
+            return false;
+        }
+        for (int i = 0; i < filters.count(); ++i) {
+            if (!refines(filters.at(i), previousFilters.at(i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    return filter == previous;
+}
+
+bool ContactRefinementCache::find(const QContactFilter &filter, QList<quint32> *contactIds, quint64 *generation)
+{
+    QMutexLocker locker(&m_mutex);
+
+    *generation = this->generation();
+
+    if (!refinable(filter)) {
+        return false;
+    }
+
+    QList<Entry>::const_iterator it = m_entries.constBegin(), end = m_entries.constEnd();
+    for ( ; it != end; ++it) {
+        if (it->generation == *generation && refines(filter, it->filter)) {
+            *contactIds = it->contactIds;
+            ++m_hits;
+            return true;
+        }
+    }
+
+    ++m_misses;
+    return false;
+}
+
+void ContactRefinementCache::insert(const QContactFilter &filter, const QList<quint32> &contactIds, quint64 generation)
+{
+    if (contactIds.count() > MaximumContactIds || !refinable(filter)) {
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+
+    // Don't store a result that may have been superseded while it was being read
+    if (generation != this->generation())
+        return;
+
+    // Any entries from earlier generations can no longer be used
+    QList<Entry>::iterator it = m_entries.begin();
+    while (it != m_entries.end()) {
+        if (it->generation != generation || it->filter == filter) {
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    Entry entry;
+    entry.filter = filter;
+    entry.contactIds = contactIds;
+    entry.generation = generation;
+    m_entries.prepend(entry);
+
+    while (m_entries.count() > m_maximumEntries) {
+        m_entries.removeLast();
+    }
+}
+
+void ContactRefinementCache::invalidate()
+{
+    QMutexLocker locker(&m_mutex);
+
+    ++m_invalidations;
+    m_entries.clear();
+}
+
+int ContactRefinementCache::hits() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_hits;
+}
+
+int ContactRefinementCache::misses() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_misses;
+}
+
+quint64 ContactRefinementCache::generation() const
+{
+    return (static_cast<quint64>(m_invalidations) << 32) | ContactsDatabase::commitGeneration();
+}
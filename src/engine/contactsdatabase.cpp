@@ -40,6 +40,7 @@
 #include <QContactName>
 #include <QContactDisplayLabel>
 
+#include <QAtomicInt>
 #include <QPluginLoader>
 #include <QElapsedTimer>
 #include <QStandardPaths>
@@ -50,11 +51,13 @@
 #include <QSqlDriver>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QSqlRecord>
 
 #include <QtDebug>
 
 #ifdef QTCONTACTS_SQLITE_LOAD_ICU
 #include <sqlite3.h>
+#include <unicode/ucol.h>
 #endif
 
 static const char *setupEncoding =
@@ -105,7 +108,8 @@ static const char *createContactsTable =
         "\n isDeactivated BOOL DEFAULT 0,"
         "\n changeFlags INTEGER DEFAULT 0,"
         "\n unhandledChangeFlags INTEGER DEFAULT 0,"
-        "\n type INTEGER DEFAULT 0);"; // QContactType::TypeContact
+        "\n type INTEGER DEFAULT 0," // QContactType::TypeContact
+        "\n sortDisplayLabel BLOB);"; // mirrors DisplayLabels.sortDisplayLabel
 
 static const char *createAddressesTable =
         "\n CREATE TABLE Addresses ("
@@ -126,7 +130,8 @@ static const char *createAnniversariesTable =
         "\n originalDateTime DATETIME,"
         "\n calendarId TEXT,"
         "\n subType TEXT,"                  // Contains an INTEGER represented as TEXT
-        "\n event TEXT);";
+        "\n event TEXT,"
+        "\n monthDay INTEGER);";
 
 static const char *createAvatarsTable =
         "\n CREATE TABLE Avatars ("
@@ -141,7 +146,8 @@ static const char *createBirthdaysTable =
         "\n detailId INTEGER PRIMARY KEY ASC REFERENCES Details (detailId),"
         "\n contactId INTEGER KEY,"
         "\n birthday DATETIME,"
-        "\n calendarId TEXT);";
+        "\n calendarId TEXT,"
+        "\n monthDay INTEGER);";
 
 static const char *createDisplayLabelsTable =
         "\n CREATE TABLE DisplayLabels ("
@@ -149,7 +155,8 @@ static const char *createDisplayLabelsTable =
         "\n contactId INTEGER KEY UNIQUE," // only one display label detail per contact
         "\n displayLabel TEXT,"
         "\n displayLabelGroup TEXT,"
-        "\n displayLabelGroupSortOrder INTEGER)";
+        "\n displayLabelGroupSortOrder INTEGER,"
+        "\n sortDisplayLabel BLOB)";
 
 static const char *createEmailAddressesTable =
         "\n CREATE TABLE EmailAddresses ("
@@ -200,7 +207,8 @@ static const char *createGlobalPresencesTable =
         "\n nickname TEXT,"
         "\n customMessage TEXT,"
         "\n presenceStateText TEXT,"
-        "\n presenceStateImageUrl TEXT);";
+        "\n presenceStateImageUrl TEXT,"
+        "\n presenceRank INTEGER);";
 
 static const char *createGuidsTable =
         "\n CREATE TABLE Guids ("
@@ -225,14 +233,19 @@ static const char *createNamesTable =
         "\n middleName TEXT,"
         "\n prefix TEXT,"
         "\n suffix TEXT,"
-        "\n customLabel TEXT)";
+        "\n customLabel TEXT,"
+        "\n keypadFirstName TEXT,"
+        "\n keypadLastName TEXT,"
+        "\n sortFirstName BLOB,"
+        "\n sortLastName BLOB)";
 
 static const char *createNicknamesTable =
         "\n CREATE TABLE Nicknames ("
         "\n detailId INTEGER PRIMARY KEY ASC REFERENCES Details (detailId),"
         "\n contactId INTEGER KEY,"
         "\n nickname TEXT,"
-        "\n lowerNickname TEXT);";
+        "\n lowerNickname TEXT,"
+        "\n keypadNickname TEXT);";
 
 static const char *createNotesTable =
         "\n CREATE TABLE Notes ("
@@ -274,7 +287,8 @@ static const char *createPhoneNumbersTable =
         "\n contactId INTEGER KEY,"
         "\n phoneNumber TEXT,"
         "\n subTypes TEXT,"                     // Contains INTEGER values represented as TEXT, separated by ';'
-        "\n normalizedNumber TEXT);";
+        "\n normalizedNumber TEXT,"
+        "\n reversedNumber TEXT);";
 
 static const char *createPresencesTable =
         "\n CREATE TABLE Presences ("
@@ -384,6 +398,85 @@ static const char *createDbSettingsTable =
         "\n name TEXT PRIMARY KEY,"
         "\n value TEXT );";
 
+// The full-text search index of each contact's searchable text; the rowid is the contactId
+static const char *createContactsSearchTable =
+        "\n CREATE VIRTUAL TABLE ContactsSearch USING fts5("
+        "\n name,"
+        "\n nickname,"
+        "\n emailAddress,"
+        "\n phoneNumber,"
+        "\n organization,"
+        "\n note,"
+        "\n tokenize = 'unicode61',"
+        "\n prefix = '2 3');";
+
+static const char *createContactsSearchRemoveTrigger =
+        "\n CREATE TRIGGER RemoveContactsSearch"
+        "\n BEFORE DELETE"
+        "\n ON Contacts"
+        "\n BEGIN"
+        "\n  DELETE FROM ContactsSearch WHERE rowid = old.contactId;"
+        "\n END;";
+
+// The spatial index of geolocation coordinates; the id is the detailId of the GeoLocations row
+static const char *createGeoLocationsIndexTable =
+        "\n CREATE VIRTUAL TABLE GeoLocationsIndex USING rtree("
+        "\n detailId,"
+        "\n minLatitude, maxLatitude,"
+        "\n minLongitude, maxLongitude);";
+
+static const char *createGeoLocationsIndexInsertTrigger =
+        "\n CREATE TRIGGER InsertGeoLocationsIndex"
+        "\n AFTER INSERT"
+        "\n ON GeoLocations"
+        "\n WHEN new.latitude IS NOT NULL AND new.longitude IS NOT NULL"
+        "\n BEGIN"
+        "\n  INSERT INTO GeoLocationsIndex (detailId, minLatitude, maxLatitude, minLongitude, maxLongitude)"
+        "\n   VALUES (new.detailId, new.latitude, new.latitude, new.longitude, new.longitude);"
+        "\n END;";
+
+static const char *createGeoLocationsIndexUpdateTrigger =
+        "\n CREATE TRIGGER UpdateGeoLocationsIndex"
+        "\n AFTER UPDATE OF latitude, longitude"
+        "\n ON GeoLocations"
+        "\n BEGIN"
+        "\n  DELETE FROM GeoLocationsIndex WHERE detailId = old.detailId;"
+        "\n  INSERT INTO GeoLocationsIndex (detailId, minLatitude, maxLatitude, minLongitude, maxLongitude)"
+        "\n   SELECT new.detailId, new.latitude, new.latitude, new.longitude, new.longitude"
+        "\n   WHERE new.latitude IS NOT NULL AND new.longitude IS NOT NULL;"
+        "\n END;";
+
+static const char *createGeoLocationsIndexRemoveTrigger =
+        "\n CREATE TRIGGER RemoveGeoLocationsIndex"
+        "\n AFTER DELETE"
+        "\n ON GeoLocations"
+        "\n BEGIN"
+        "\n  DELETE FROM GeoLocationsIndex WHERE detailId = old.detailId;"
+        "\n END;";
+
+static const char *populateGeoLocationsIndex =
+        "\n INSERT INTO GeoLocationsIndex (detailId, minLatitude, maxLatitude, minLongitude, maxLongitude)"
+        "\n  SELECT detailId, latitude, latitude, longitude, longitude FROM GeoLocations"
+        "\n  WHERE latitude IS NOT NULL AND longitude IS NOT NULL;";
+
+// The display label sort key is mirrored to Contacts, so that a sorted selection can be read from an index.
+// A display label is only removed along with its contact, or to be replaced by an insert.
+static const char *createDisplayLabelsSortKeyInsertTrigger =
+        "\n CREATE TRIGGER InsertDisplayLabelsSortKey"
+        "\n AFTER INSERT"
+        "\n ON DisplayLabels"
+        "\n BEGIN"
+        "\n  UPDATE Contacts SET sortDisplayLabel = new.sortDisplayLabel WHERE contactId = new.contactId;"
+        "\n END;";
+
+static const char *createDisplayLabelsSortKeyUpdateTrigger =
+        "\n CREATE TRIGGER UpdateDisplayLabelsSortKey"
+        "\n AFTER UPDATE OF sortDisplayLabel"
+        "\n ON DisplayLabels"
+        "\n BEGIN"
+        "\n  UPDATE Contacts SET sortDisplayLabel = new.sortDisplayLabel WHERE contactId = new.contactId;"
+        "\n END;";
+
 // as at b8084fa7
 static const char *createRemoveTrigger_0 =
         "\n CREATE TRIGGER RemoveContactDetails"
@@ -587,6 +680,43 @@ static const char *createRemoveDetailsTrigger_22 =
 
 static const char *createRemoveDetailsTrigger = createRemoveDetailsTrigger_22;
 
+// Select the searchable text of each contact, excluding the text of deleted details
+static const char *selectContactsSearchContent =
+        "\n SELECT"
+        "\n  Contacts.contactId,"
+        "\n  (SELECT group_concat(COALESCE(Names.prefix, '') || ' ' || COALESCE(Names.firstName, '') || ' ' || COALESCE(Names.middleName, '') || ' ' ||"
+        "\n                       COALESCE(Names.lastName, '') || ' ' || COALESCE(Names.suffix, '') || ' ' || COALESCE(Names.customLabel, ''), ' ')"
+        "\n   FROM Names JOIN Details ON Details.detailId = Names.detailId"
+        "\n   WHERE Names.contactId = Contacts.contactId AND Details.changeFlags < 4) AS name,"
+        "\n  (SELECT group_concat(Nicknames.nickname, ' ')"
+        "\n   FROM Nicknames JOIN Details ON Details.detailId = Nicknames.detailId"
+        "\n   WHERE Nicknames.contactId = Contacts.contactId AND Details.changeFlags < 4) AS nickname,"
+        "\n  (SELECT group_concat(EmailAddresses.emailAddress, ' ')"
+        "\n   FROM EmailAddresses JOIN Details ON Details.detailId = EmailAddresses.detailId"
+        "\n   WHERE EmailAddresses.contactId = Contacts.contactId AND Details.changeFlags < 4) AS emailAddress,"
+        // Index the digits of each number as a single token, so that partial numbers can be matched by prefix
+        "\n  (SELECT group_concat(replace(replace(replace(replace(replace(replace(PhoneNumbers.phoneNumber, '+', ''), '-', ''), '#', ''), '(', ''), ')', ''), ' ', ''), ' ')"
+        "\n   FROM PhoneNumbers JOIN Details ON Details.detailId = PhoneNumbers.detailId"
+        "\n   WHERE PhoneNumbers.contactId = Contacts.contactId AND Details.changeFlags < 4) AS phoneNumber,"
+        "\n  (SELECT group_concat(COALESCE(Organizations.name, '') || ' ' || COALESCE(Organizations.department, '') || ' ' ||"
+        "\n                       COALESCE(Organizations.title, '') || ' ' || COALESCE(Organizations.role, ''), ' ')"
+        "\n   FROM Organizations JOIN Details ON Details.detailId = Organizations.detailId"
+        "\n   WHERE Organizations.contactId = Contacts.contactId AND Details.changeFlags < 4) AS organization,"
+        "\n  (SELECT group_concat(Notes.note, ' ')"
+        "\n   FROM Notes JOIN Details ON Details.detailId = Notes.detailId"
+        "\n   WHERE Notes.contactId = Contacts.contactId AND Details.changeFlags < 4) AS note"
+        "\n FROM Contacts";
+
+static const char *insertContactsSearchContent =
+        "\n INSERT INTO ContactsSearch ("
+        "\n  rowid,"
+        "\n  name,"
+        "\n  nickname,"
+        "\n  emailAddress,"
+        "\n  phoneNumber,"
+        "\n  organization,"
+        "\n  note)";
+
 static const char *createLocalSelfContact =
         "\n INSERT INTO Contacts ("
         "\n contactId,"
@@ -670,6 +800,25 @@ static const char *createFirstNameIndex =
 static const char *createLastNameIndex =
         "\n CREATE INDEX LastNameIndex ON Names(lowerLastName);";
 
+static const char *createKeypadFirstNameIndex =
+        "\n CREATE INDEX KeypadFirstNameIndex ON Names(keypadFirstName);";
+
+static const char *createKeypadLastNameIndex =
+        "\n CREATE INDEX KeypadLastNameIndex ON Names(keypadLastName);";
+
+static const char *createSortFirstNameIndex =
+        "\n CREATE INDEX SortFirstNameIndex ON Names(sortFirstName);";
+
+static const char *createSortLastNameIndex =
+        "\n CREATE INDEX SortLastNameIndex ON Names(sortLastName);";
+
+static const char *createSortDisplayLabelIndex =
+        "\n CREATE INDEX SortDisplayLabelIndex ON DisplayLabels(sortDisplayLabel);";
+
+// Aggregate contacts are selected by collection, so the collection prefixes the sort key
+static const char *createContactsSortDisplayLabelIndex =
+        "\n CREATE INDEX ContactsSortDisplayLabelIndex ON Contacts(collectionId, sortDisplayLabel);";
+
 static const char *createContactsModifiedIndex =
         "\n CREATE INDEX ContactsModifiedIndex ON Contacts(modified);";
 
@@ -685,6 +834,15 @@ static const char *createRelationshipsSecondIdIndex =
 static const char *createPhoneNumbersIndex =
         "\n CREATE INDEX PhoneNumbersIndex ON PhoneNumbers(normalizedNumber);";
 
+static const char *createPhoneNumbersReversedIndex =
+        "\n CREATE INDEX PhoneNumbersReversedIndex ON PhoneNumbers(reversedNumber);";
+
+static const char *createBirthdaysMonthDayIndex =
+        "\n CREATE INDEX BirthdaysMonthDayIndex ON Birthdays(monthDay);";
+
+static const char *createAnniversariesMonthDayIndex =
+        "\n CREATE INDEX AnniversariesMonthDayIndex ON Anniversaries(monthDay);";
+
 static const char *createEmailAddressesIndex =
         "\n CREATE INDEX EmailAddressesIndex ON EmailAddresses(lowerEmailAddress);";
 
@@ -694,6 +852,9 @@ static const char *createOnlineAccountsIndex =
 static const char *createNicknamesIndex =
         "\n CREATE INDEX NicknamesIndex ON Nicknames(lowerNickname);";
 
+static const char *createKeypadNicknamesIndex =
+        "\n CREATE INDEX KeypadNicknamesIndex ON Nicknames(keypadNickname);";
+
 static const char *createOriginMetadataIdIndex =
         "\n CREATE INDEX OriginMetadataIdIndex ON OriginMetadata(id);";
 
@@ -734,18 +895,26 @@ static const char *createAnalyzeData3 =
         "\n   ('Contacts','ContactsModifiedIndex','5000 30'),"
         "\n   ('Contacts','ContactsChangeFlagsIndex','5000 200'),"
         "\n   ('Contacts','ContactsCollectionIdIndex','5000 500'),"
+        "\n   ('Contacts','ContactsSortDisplayLabelIndex','5000 500 2'),"
         "\n   ('Details', 'DetailsRemoveIndex', '25000 6 2'),"
         "\n   ('Details', 'DetailsContactIdIndex', '25000 6 2'),"
         "\n   ('Favorites','sqlite_autoindex_Favorites_1','100 2'),"
         "\n   ('Names','LastNameIndex','3000 50'),"
         "\n   ('Names','FirstNameIndex','3000 80'),"
+        "\n   ('Names','KeypadLastNameIndex','3000 50'),"
+        "\n   ('Names','KeypadFirstNameIndex','3000 80'),"
+        "\n   ('Names','SortLastNameIndex','3000 2'),"
+        "\n   ('Names','SortFirstNameIndex','3000 4'),"
         "\n   ('Names','sqlite_autoindex_Names_1','3000 1'),"
         "\n   ('DisplayLabels','sqlite_autoindex_DisplayLabels_1','5000 1'),"
+        "\n   ('DisplayLabels','SortDisplayLabelIndex','5000 2'),"
         "\n   ('OnlineAccounts','OnlineAccountsIndex','1000 3'),"
         "\n   ('Nicknames','NicknamesIndex','2000 4'),"
+        "\n   ('Nicknames','KeypadNicknamesIndex','2000 4'),"
         "\n   ('OriginMetadata','OriginMetadataGroupIdIndex','2500 500'),"
         "\n   ('OriginMetadata','OriginMetadataIdIndex','2500 6'),"
         "\n   ('PhoneNumbers','PhoneNumbersIndex','4500 7'),"
+        "\n   ('PhoneNumbers','PhoneNumbersReversedIndex','4500 2'),"
         "\n   ('EmailAddresses','EmailAddressesIndex','4000 5'),"
         "\n   ('OOB','sqlite_autoindex_OOB_1','29 1');";
 
@@ -790,16 +959,28 @@ static const char *createStatements[] =
     createDbSettingsTable,
     createRemoveTrigger,
     createRemoveDetailsTrigger,
+    createDisplayLabelsSortKeyInsertTrigger,
+    createDisplayLabelsSortKeyUpdateTrigger,
     createContactsCollectionIdIndex,
     createContactsChangeFlagsIndex,
     createFirstNameIndex,
     createLastNameIndex,
+    createKeypadFirstNameIndex,
+    createKeypadLastNameIndex,
+    createSortFirstNameIndex,
+    createSortLastNameIndex,
+    createSortDisplayLabelIndex,
+    createContactsSortDisplayLabelIndex,
     createRelationshipsFirstIdIndex,
     createRelationshipsSecondIdIndex,
     createPhoneNumbersIndex,
+    createPhoneNumbersReversedIndex,
+    createBirthdaysMonthDayIndex,
+    createAnniversariesMonthDayIndex,
     createEmailAddressesIndex,
     createOnlineAccountsIndex,
     createNicknamesIndex,
+    createKeypadNicknamesIndex,
     createOriginMetadataIdIndex,
     createOriginMetadataGroupIdIndex,
     createContactsModifiedIndex,
@@ -1689,6 +1870,48 @@ static const char *upgradeVersion23[] = {
     "PRAGMA user_version=24",
     0 // NULL-terminated
 };
+// The search index is created when the database is opened, if the FTS5 module is available
+static const char *upgradeVersion24[] = {
+    "PRAGMA user_version=25",
+    0 // NULL-terminated
+};
+static const char *upgradeVersion25[] = {
+    createPhoneNumbersReversedIndex,
+    "PRAGMA user_version=26",
+    0 // NULL-terminated
+};
+static const char *upgradeVersion26[] = {
+    createKeypadFirstNameIndex,
+    createKeypadLastNameIndex,
+    createKeypadNicknamesIndex,
+    "PRAGMA user_version=27",
+    0 // NULL-terminated
+};
+static const char *upgradeVersion27[] = {
+    createSortFirstNameIndex,
+    createSortLastNameIndex,
+    createSortDisplayLabelIndex,
+    "PRAGMA user_version=28",
+    0 // NULL-terminated
+};
+// The spatial index is created when the database is opened, if the R*Tree module is available
+static const char *upgradeVersion28[] = {
+    "PRAGMA user_version=29",
+    0 // NULL-terminated
+};
+static const char *upgradeVersion29[] = {
+    createBirthdaysMonthDayIndex,
+    createAnniversariesMonthDayIndex,
+    "PRAGMA user_version=30",
+    0 // NULL-terminated
+};
+static const char *upgradeVersion30[] = {
+    createContactsSortDisplayLabelIndex,
+    createDisplayLabelsSortKeyInsertTrigger,
+    createDisplayLabelsSortKeyUpdateTrigger,
+    "PRAGMA user_version=31",
+    0 // NULL-terminated
+};
 
 typedef bool (*UpgradeFunction)(QSqlDatabase &database);
 
@@ -2182,6 +2405,204 @@ static bool forceRegenDisplayLabelGroups(QSqlDatabase &database)
 }
 
 
+// Adds the column to the table, unless the table was already recreated with it
+static bool addColumn(QSqlDatabase &database, const QString &table, const QString &column, const QString &type)
+{
+    if (database.record(table).contains(column))
+        return true;
+
+    QSqlQuery alterQuery(database);
+    const QString statement = QStringLiteral("ALTER TABLE %1 ADD COLUMN %2 %3").arg(table).arg(column).arg(type);
+    if (!alterQuery.prepare(statement)) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to prepare add column query: %1\n%2")
+                .arg(alterQuery.lastError().text())
+                .arg(statement));
+        return false;
+    }
+    if (!alterQuery.exec()) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to add column: %1\n%2")
+                .arg(alterQuery.lastError().text())
+                .arg(statement));
+        return false;
+    }
+    alterQuery.finish();
+    return true;
+}
+
+// Populates the column with the value function applied to each existing value of the source column
+static bool backfillColumn(QSqlDatabase &database, const QString &table, const QString &column,
+                           const QString &sourceColumn, QString (*value)(const QString &))
+{
+    QList<QPair<quint32, QString> > updates;
+    {
+        QSqlQuery selectQuery(database);
+        selectQuery.setForwardOnly(true);
+        const QString statement = QStringLiteral("SELECT detailId, %1 FROM %2 WHERE %1 IS NOT NULL").arg(sourceColumn).arg(table);
+        if (!selectQuery.exec(statement)) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Query failed: %1\n%2")
+                    .arg(selectQuery.lastError().text())
+                    .arg(statement));
+            return false;
+        }
+        while (selectQuery.next()) {
+            const quint32 detailId(selectQuery.value(0).value<quint32>());
+            updates.append(qMakePair(detailId, value(selectQuery.value(1).value<QString>())));
+        }
+        selectQuery.finish();
+    }
+
+    if (updates.isEmpty())
+        return true;
+
+    QSqlQuery updateQuery(database);
+    const QString statement = QStringLiteral("UPDATE %1 SET %2 = :value WHERE detailId = :detailId").arg(table).arg(column);
+    if (!updateQuery.prepare(statement)) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to prepare data upgrade query: %1\n%2")
+                .arg(updateQuery.lastError().text())
+                .arg(statement));
+        return false;
+    }
+
+    typedef QPair<quint32, QString> Update;
+    foreach (const Update &update, updates) {
+        updateQuery.bindValue(":value", update.second);
+        updateQuery.bindValue(":detailId", update.first);
+        if (!updateQuery.exec()) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to upgrade data: %1\n%2")
+                    .arg(updateQuery.lastError().text())
+                    .arg(statement));
+            return false;
+        }
+        updateQuery.finish();
+    }
+
+    return true;
+}
+
+static bool addReversedPhoneNumbers(QSqlDatabase &database)
+{
+    return addColumn(database, QStringLiteral("PhoneNumbers"), QStringLiteral("reversedNumber"), QStringLiteral("TEXT"))
+        && backfillColumn(database, QStringLiteral("PhoneNumbers"), QStringLiteral("reversedNumber"),
+                          QStringLiteral("phoneNumber"), ContactsEngine::reversedPhoneNumber);
+}
+
+struct KeypadColumn
+{
+    const char *table;
+    const char *column;
+    const char *sourceColumn;
+};
+static bool addKeypadColumns(QSqlDatabase &database)
+{
+    static const KeypadColumn keypadColumns[] = {
+        { "Names",     "keypadFirstName", "firstName" },
+        { "Names",     "keypadLastName",  "lastName" },
+        { "Nicknames", "keypadNickname",  "nickname" },
+    };
+
+    for (size_t i = 0; i < sizeof(keypadColumns) / sizeof(keypadColumns[0]); ++i) {
+        const QString table(QString::fromLatin1(keypadColumns[i].table));
+        const QString column(QString::fromLatin1(keypadColumns[i].column));
+
+        if (!addColumn(database, table, column, QStringLiteral("TEXT"))
+                || !backfillColumn(database, table, column, QString::fromLatin1(keypadColumns[i].sourceColumn), ContactsEngine::keypadDigits)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Populates the column with a value the database can compute from the existing values
+static bool backfillColumn(QSqlDatabase &database, const QString &table, const QString &column,
+                           const QString &expression, const QString &where = QString())
+{
+    QString statement = QStringLiteral("UPDATE %1 SET %2 = %3").arg(table).arg(column).arg(expression);
+    if (!where.isEmpty())
+        statement.append(QStringLiteral(" WHERE ") + where);
+
+    QSqlQuery updateQuery(database);
+    if (!updateQuery.exec(statement)) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to upgrade data: %1\n%2")
+                .arg(updateQuery.lastError().text())
+                .arg(statement));
+        return false;
+    }
+    updateQuery.finish();
+    return true;
+}
+
+struct SortKeyColumn
+{
+    const char *table;
+    const char *column;
+    const char *type;
+};
+static bool addSortKeyColumns(QSqlDatabase &database)
+{
+    // The collation keys are populated when the database locale is next checked
+    static const SortKeyColumn sortKeyColumns[] = {
+        { "Names",           "sortFirstName",    "BLOB" },
+        { "Names",           "sortLastName",     "BLOB" },
+        { "DisplayLabels",   "sortDisplayLabel", "BLOB" },
+        { "GlobalPresences", "presenceRank",     "INTEGER" },
+    };
+
+    for (size_t i = 0; i < sizeof(sortKeyColumns) / sizeof(sortKeyColumns[0]); ++i) {
+        if (!addColumn(database, QString::fromLatin1(sortKeyColumns[i].table),
+                       QString::fromLatin1(sortKeyColumns[i].column),
+                       QString::fromLatin1(sortKeyColumns[i].type))) {
+            return false;
+        }
+    }
+
+    // The rank of each presence state is mapped by the database; a null state ranks as unknown
+    QStringList ranks;
+    for (int state = QContactPresence::PresenceUnknown; state <= QContactPresence::PresenceOffline; ++state) {
+        ranks.append(QStringLiteral("WHEN %1 THEN %2").arg(state).arg(ContactsDatabase::presenceRank(state)));
+    }
+    const QString rank(QStringLiteral("CASE presenceState %1 ELSE %2 END")
+            .arg(ranks.join(QChar::fromLatin1(' ')))
+            .arg(ContactsDatabase::presenceRank(QContactPresence::PresenceUnknown)));
+
+    return backfillColumn(database, QStringLiteral("GlobalPresences"), QStringLiteral("presenceRank"), rank);
+}
+
+struct MonthDayColumn
+{
+    const char *table;
+    const char *sourceColumn;
+};
+static bool addMonthDayColumns(QSqlDatabase &database)
+{
+    static const MonthDayColumn monthDayColumns[] = {
+        { "Birthdays",     "birthday" },
+        { "Anniversaries", "originalDateTime" },
+    };
+
+    for (size_t i = 0; i < sizeof(monthDayColumns) / sizeof(monthDayColumns[0]); ++i) {
+        const QString table(QString::fromLatin1(monthDayColumns[i].table));
+
+        // Only a valid date is unchanged by date(), which otherwise normalizes it or yields null
+        const QString date(QStringLiteral("substr(%1, 1, 10)").arg(QString::fromLatin1(monthDayColumns[i].sourceColumn)));
+        if (!addColumn(database, table, QStringLiteral("monthDay"), QStringLiteral("INTEGER"))
+                || !backfillColumn(database, table, QStringLiteral("monthDay"),
+                                   QStringLiteral("CAST(strftime('%m%d', %1) AS INTEGER)").arg(date),
+                                   QStringLiteral("date(%1) = %1").arg(date))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool addContactsSortKeyColumn(QSqlDatabase &database)
+{
+    return addColumn(database, QStringLiteral("Contacts"), QStringLiteral("sortDisplayLabel"), QStringLiteral("BLOB"))
+        && backfillColumn(database, QStringLiteral("Contacts"), QStringLiteral("sortDisplayLabel"),
+                          QStringLiteral("(SELECT sortDisplayLabel FROM DisplayLabels WHERE DisplayLabels.contactId = Contacts.contactId)"));
+}
+
 struct UpgradeOperation {
     UpgradeFunction fn;
     const char **statements;
@@ -2212,9 +2633,16 @@ static UpgradeOperation upgradeVersions[] = {
     { 0,                            upgradeVersion21 },
     { 0,                            upgradeVersion22 },
     { 0,                            upgradeVersion23 },
+    { 0,                            upgradeVersion24 },
+    { addReversedPhoneNumbers,      upgradeVersion25 },
+    { addKeypadColumns,             upgradeVersion26 },
+    { addSortKeyColumns,            upgradeVersion27 },
+    { 0,                            upgradeVersion28 },
+    { addMonthDayColumns,           upgradeVersion29 },
+    { addContactsSortKeyColumn,     upgradeVersion30 },
 };
 
-static const int currentSchemaVersion = 24;
+static const int currentSchemaVersion = 31;
 
 static bool execute(QSqlDatabase &database, const QString &statement)
 {
@@ -2453,6 +2881,121 @@ static bool executeDisplayLabelGroupLocalizationStatements(QSqlDatabase &databas
     return true;
 }
 
+struct SortKeySource
+{
+    const char *table;
+    const char *column;
+    const char *sourceColumn;
+};
+static bool executeSortKeyLocalizationStatements(QSqlDatabase &database, ContactsDatabase *cdb)
+{
+    // determine if the collation keys were generated for the current collation locale.
+    // if not, regenerate them all.
+    bool settingExists = false;
+    const QString localeName = cdb->sortKeyLocale();
+    {
+        QSqlQuery selectQuery(database);
+        selectQuery.setForwardOnly(true);
+        const QString statement = QStringLiteral("SELECT Value FROM DbSettings WHERE Name = 'SortKeyLocale'");
+        if (!selectQuery.prepare(statement)) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to prepare sort key locale setting selection query: %1\n%2")
+                    .arg(selectQuery.lastError().text())
+                    .arg(statement));
+            return false;
+        }
+        if (!selectQuery.exec()) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to select sort key locale setting value: %1\n%2")
+                    .arg(selectQuery.lastError().text())
+                    .arg(statement));
+            return false;
+        }
+        if (selectQuery.next()) {
+            settingExists = true;
+            if (selectQuery.value(0).toString() == localeName) {
+                return true; // the existing keys are valid
+            }
+        }
+    }
+
+    {
+        QSqlQuery setLocaleQuery(database);
+        const QString statement = settingExists
+                                ? QStringLiteral("UPDATE DbSettings SET Value = ? WHERE Name = 'SortKeyLocale'")
+                                : QStringLiteral("INSERT INTO DbSettings (Name, Value) VALUES ('SortKeyLocale', ?)");
+        if (!setLocaleQuery.prepare(statement)) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to prepare sort key locale setting update query: %1\n%2")
+                    .arg(setLocaleQuery.lastError().text())
+                    .arg(statement));
+            return false;
+        }
+        setLocaleQuery.addBindValue(QVariant(localeName));
+        if (!setLocaleQuery.exec()) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to update sort key locale setting value: %1\n%2")
+                    .arg(setLocaleQuery.lastError().text())
+                    .arg(statement));
+            return false;
+        }
+    }
+
+    static const SortKeySource sortKeySources[] = {
+        { "Names",         "sortFirstName",    "firstName" },
+        { "Names",         "sortLastName",     "lastName" },
+        { "DisplayLabels", "sortDisplayLabel", "displayLabel" },
+    };
+
+    for (size_t i = 0; i < sizeof(sortKeySources) / sizeof(sortKeySources[0]); ++i) {
+        const QString table(QString::fromLatin1(sortKeySources[i].table));
+        const QString column(QString::fromLatin1(sortKeySources[i].column));
+        const QString sourceColumn(QString::fromLatin1(sortKeySources[i].sourceColumn));
+
+        QVariantList detailIds;
+        QVariantList sortKeys;
+        {
+            QSqlQuery selectQuery(database);
+            selectQuery.setForwardOnly(true);
+            const QString statement = QStringLiteral("SELECT detailId, %1 FROM %2").arg(sourceColumn).arg(table);
+            if (!selectQuery.exec(statement)) {
+                QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to select sort key data: %1\n%2")
+                        .arg(selectQuery.lastError().text())
+                        .arg(statement));
+                return false;
+            }
+            while (selectQuery.next()) {
+                const QByteArray key(cdb->sortKey(selectQuery.value(1).toString()));
+                detailIds.append(selectQuery.value(0));
+                sortKeys.append(key.isEmpty() ? QVariant(QVariant::ByteArray) : QVariant(key));
+            }
+            selectQuery.finish();
+        }
+
+        // do it in batches, otherwise it can fail if any single batch is too big.
+        for (int j = 0; j < detailIds.size(); j += 250) {
+            const QVariantList keys = sortKeys.mid(j, qMin(detailIds.size() - j, 250));
+            const QVariantList ids = detailIds.mid(j, qMin(detailIds.size() - j, 250));
+
+            QSqlQuery updateQuery(database);
+            const QString statement = QStringLiteral("UPDATE %1 SET %2 = ? WHERE detailId = ?").arg(table).arg(column);
+            if (!updateQuery.prepare(statement)) {
+                QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to prepare update sort keys query: %1\n%2")
+                        .arg(updateQuery.lastError().text())
+                        .arg(statement));
+                return false;
+            }
+            updateQuery.addBindValue(keys);
+            updateQuery.addBindValue(ids);
+            if (!updateQuery.execBatch()) {
+                QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to update sort keys: %1\n%2")
+                        .arg(updateQuery.lastError().text())
+                        .arg(statement));
+                return false;
+            }
+            updateQuery.finish();
+        }
+    }
+
+    return true;
+}
+
 static bool executeUpgradeStatements(QSqlDatabase &database)
 {
     // Check that the defined schema matches the array of upgrade scripts
@@ -2513,6 +3056,102 @@ static bool executeUpgradeStatements(QSqlDatabase &database)
     return true;
 }
 
+// A virtual table module may be omitted from the SQLite library, so it is tested by creating a table
+static bool moduleAvailable(QSqlDatabase &database, const QString &module, const QString &columns)
+{
+    QSqlQuery query(database);
+    if (!query.exec(QStringLiteral("CREATE VIRTUAL TABLE temp.ModuleProbe USING %1(%2)").arg(module).arg(columns))) {
+        QTCONTACTS_SQLITE_DEBUG(QString::fromLatin1("SQLite module %1 is not available: %2").arg(module).arg(query.lastError().text()));
+        return false;
+    }
+    query.finish();
+
+    return execute(database, QStringLiteral("DROP TABLE temp.ModuleProbe"));
+}
+
+// NULLS FIRST and NULLS LAST are supported from SQLite 3.30
+static bool nullsOrderingAvailable(QSqlDatabase &database)
+{
+    QSqlQuery query(database);
+    if (!query.prepare(QStringLiteral("SELECT 1 ORDER BY 1 NULLS LAST"))) {
+        QTCONTACTS_SQLITE_DEBUG(QString::fromLatin1("SQLite does not support NULLS ordering: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    return true;
+}
+
+// An optional index is present while the trigger maintaining it exists, and its module is available
+static bool optionalIndexPresent(QSqlDatabase &database, const QString &module, const QString &columns,
+                                 const QString &trigger, bool *available, bool *present)
+{
+    *available = moduleAvailable(database, module, columns);
+
+    QSqlQuery query(database);
+    query.prepare(QStringLiteral("SELECT COUNT(*) FROM sqlite_master WHERE type = 'trigger' AND name = :name"));
+    query.bindValue(QStringLiteral(":name"), trigger);
+    if (!query.exec() || !query.next()) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to query trigger %1: %2").arg(trigger).arg(query.lastError().text()));
+        return false;
+    }
+
+    *present = *available && query.value(0).toInt() > 0;
+    return true;
+}
+
+static bool updateOptionalIndex(QSqlDatabase &database, const QString &module, const QString &columns, const QString &trigger,
+                                const QStringList &createStatements, const QStringList &removeStatements)
+{
+    bool available = false;
+    bool present = false;
+    if (!optionalIndexPresent(database, module, columns, trigger, &available, &present))
+        return false;
+
+    // The index is not maintained while its module is unavailable, so it is rebuilt in full once available
+    QStringList statements;
+    if (available && !present) {
+        statements = createStatements;
+    } else if (!available) {
+        statements = removeStatements;
+    }
+
+    foreach (const QString &statement, statements) {
+        if (!execute(database, statement))
+            return false;
+    }
+    return true;
+}
+
+static bool executeOptionalIndexStatements(QSqlDatabase &database)
+{
+    QStringList createSearchIndex;
+    createSearchIndex.append(QStringLiteral("DROP TABLE IF EXISTS ContactsSearch"));
+    createSearchIndex.append(QLatin1String(createContactsSearchTable));
+    createSearchIndex.append(QStringLiteral("%1 %2").arg(QLatin1String(insertContactsSearchContent)).arg(QLatin1String(selectContactsSearchContent)));
+    createSearchIndex.append(QLatin1String(createContactsSearchRemoveTrigger));
+
+    QStringList removeSearchIndex;
+    removeSearchIndex.append(QStringLiteral("DROP TRIGGER IF EXISTS RemoveContactsSearch"));
+
+    QStringList createSpatialIndex;
+    createSpatialIndex.append(QStringLiteral("DROP TABLE IF EXISTS GeoLocationsIndex"));
+    createSpatialIndex.append(QLatin1String(createGeoLocationsIndexTable));
+    createSpatialIndex.append(QLatin1String(populateGeoLocationsIndex));
+    createSpatialIndex.append(QLatin1String(createGeoLocationsIndexInsertTrigger));
+    createSpatialIndex.append(QLatin1String(createGeoLocationsIndexUpdateTrigger));
+    createSpatialIndex.append(QLatin1String(createGeoLocationsIndexRemoveTrigger));
+
+    QStringList removeSpatialIndex;
+    removeSpatialIndex.append(QStringLiteral("DROP TRIGGER IF EXISTS InsertGeoLocationsIndex"));
+    removeSpatialIndex.append(QStringLiteral("DROP TRIGGER IF EXISTS UpdateGeoLocationsIndex"));
+    removeSpatialIndex.append(QStringLiteral("DROP TRIGGER IF EXISTS RemoveGeoLocationsIndex"));
+
+    return updateOptionalIndex(database, QStringLiteral("fts5"), QStringLiteral("content"), QStringLiteral("RemoveContactsSearch"),
+                               createSearchIndex, removeSearchIndex)
+        && updateOptionalIndex(database, QStringLiteral("rtree"), QStringLiteral("id, minX, maxX"), QStringLiteral("InsertGeoLocationsIndex"),
+                               createSpatialIndex, removeSpatialIndex);
+}
+
 static bool checkDatabase(QSqlDatabase &database)
 {
     QSqlQuery query(database);
@@ -2535,9 +3174,15 @@ static bool upgradeDatabase(QSqlDatabase &database, ContactsDatabase *cdb)
         return false;
 
     bool success = executeUpgradeStatements(database);
+    if (success) {
+        success = executeOptionalIndexStatements(database);
+    }
     if (success) {
         success = executeDisplayLabelGroupLocalizationStatements(database, cdb);
     }
+    if (success) {
+        success = executeSortKeyLocalizationStatements(database, cdb);
+    }
 
     return finalizeTransaction(database, success);
 }
@@ -2672,6 +3317,9 @@ static bool prepareDatabase(QSqlDatabase &database, ContactsDatabase *cdb, const
         return false;
 
     bool success = executeCreationStatements(database);
+    if (success) {
+        success = executeOptionalIndexStatements(database);
+    }
     if (success) {
         success = executeBuiltInCollectionsStatements(database, aggregating);
     }
@@ -2681,6 +3329,9 @@ static bool prepareDatabase(QSqlDatabase &database, ContactsDatabase *cdb, const
     if (success) {
         success = executeDisplayLabelGroupLocalizationStatements(database, cdb);
     }
+    if (success) {
+        success = executeSortKeyLocalizationStatements(database, cdb);
+    }
 
     return finalizeTransaction(database, success);
 }
@@ -2940,7 +3591,8 @@ bool createTemporaryContactPresenceTable(ContactsDatabase &cdb, QSqlDatabase &,
     static const QString createStatement(QStringLiteral("CREATE TABLE IF NOT EXISTS temp.%1 ("
                                                             "contactId INTEGER PRIMARY KEY ASC,"
                                                             "presenceState INTEGER,"
-                                                            "isOnline BOOL"
+                                                            "isOnline BOOL,"
+                                                            "presenceRank INTEGER"
                                                         ")"));
 
     // Create the temporary table (if we haven't already).
@@ -2962,9 +3614,9 @@ bool createTemporaryContactPresenceTable(ContactsDatabase &cdb, QSqlDatabase &,
             quint32 count = std::min<quint32>(remainder, 167);
             QList<QPair<quint32, qint64> >::const_iterator batchEnd = it + count;
 
-            QString insertStatement = QStringLiteral("INSERT INTO temp.%1 (contactId, presenceState, isOnline) VALUES ").arg(table);
+            QString insertStatement = QStringLiteral("INSERT INTO temp.%1 (contactId, presenceState, isOnline, presenceRank) VALUES ").arg(table);
             while (true) {
-                insertStatement.append(QStringLiteral("(?,?,?)"));
+                insertStatement.append(QStringLiteral("(?,?,?,?)"));
                 if (++it == batchEnd) {
                     break;
                 } else {
@@ -2983,6 +3635,7 @@ bool createTemporaryContactPresenceTable(ContactsDatabase &cdb, QSqlDatabase &,
                 const int state(pair.second);
                 insertQuery.addBindValue(QVariant(state));
                 insertQuery.addBindValue(QVariant(state >= QContactPresence::PresenceAvailable && state <= QContactPresence::PresenceExtendedAway));
+                insertQuery.addBindValue(QVariant(ContactsDatabase::presenceRank(state)));
             }
 
             if (!ContactsDatabase::execute(insertQuery)) {
@@ -2995,6 +3648,41 @@ bool createTemporaryContactPresenceTable(ContactsDatabase &cdb, QSqlDatabase &,
     return true;
 }
 
+bool deriveTemporaryAggregatePresence(ContactsDatabase &cdb, QSqlDatabase &, const QString &table)
+{
+    // The presence of an aggregate is that of its best constituent, whose transient state supersedes
+    // the stored state; an unknown state is ranked below any known state, as it is when the aggregate
+    // global presence is derived from its constituents.
+    static const QString insertStatement(QStringLiteral(
+        " INSERT OR REPLACE INTO temp.%1 (contactId, presenceState, isOnline, presenceRank)"
+        " SELECT aggregateId, presenceState, presenceState BETWEEN %2 AND %3, presenceRank FROM ("
+          " SELECT Relationships.firstId AS aggregateId,"
+                 " COALESCE(temp.%1.presenceState, GlobalPresences.presenceState) AS presenceState,"
+                 " COALESCE(temp.%1.presenceRank, GlobalPresences.presenceRank) AS presenceRank,"
+                 " MIN(CASE WHEN COALESCE(temp.%1.presenceState, GlobalPresences.presenceState) = %4"
+                          " THEN 1000 ELSE COALESCE(temp.%1.presenceRank, GlobalPresences.presenceRank) END)"
+          " FROM Relationships"
+          " JOIN Contacts ON Contacts.contactId = Relationships.secondId AND Contacts.isDeactivated = 0"
+          " LEFT JOIN temp.%1 ON temp.%1.contactId = Relationships.secondId"
+          " LEFT JOIN GlobalPresences ON GlobalPresences.contactId = Relationships.secondId"
+          " WHERE Relationships.type = 'Aggregates'"
+          " AND Relationships.firstId IN ("
+            " SELECT firstId FROM Relationships WHERE type = 'Aggregates' AND secondId IN (SELECT contactId FROM temp.%1))"
+          " AND COALESCE(temp.%1.presenceState, GlobalPresences.presenceState) IS NOT NULL"
+          " GROUP BY Relationships.firstId)"));
+
+    ContactsDatabase::Query insertQuery(cdb.prepare(insertStatement.arg(table)
+                                                    .arg(static_cast<int>(QContactPresence::PresenceAvailable))
+                                                    .arg(static_cast<int>(QContactPresence::PresenceExtendedAway))
+                                                    .arg(static_cast<int>(QContactPresence::PresenceUnknown))));
+    if (!ContactsDatabase::execute(insertQuery)) {
+        insertQuery.reportError(QString::fromLatin1("Failed to derive temporary aggregate presence values into table %1").arg(table));
+        return false;
+    }
+
+    return true;
+}
+
 void clearTemporaryContactPresenceTable(ContactsDatabase &cdb, QSqlDatabase &db, const QString &table)
 {
     dropOrDeleteTable(cdb, db, table);
@@ -3260,10 +3948,19 @@ void ContactsDatabase::Query::reportError(const char *text) const
 
 ContactsDatabase::ContactsDatabase(ContactsEngine *engine)
     : m_engine(engine)
+    , m_attributeIndex(nullptr)
+    , m_refinementCache(nullptr)
+    , m_aggregationCandidateIndex(nullptr)
     , m_mutex(QMutex::Recursive)
     , m_nonprivileged(false)
     , m_autoTest(false)
+    , m_fullTextSearch(false)
+    , m_spatialIndex(false)
+    , m_nullsOrdering(false)
     , m_localeName(QLocale().name())
+#ifdef QTCONTACTS_SQLITE_LOAD_ICU
+    , m_collator(nullptr)
+#endif
     , m_defaultGenerator(new DefaultDlgGenerator)
 #ifdef HAS_MLITE
     , m_groupPropertyConf(QStringLiteral("/org/nemomobile/contacts/group_property"))
@@ -3295,6 +3992,12 @@ ContactsDatabase::~ContactsDatabase()
         }
     }
     m_database.close();
+
+#ifdef QTCONTACTS_SQLITE_LOAD_ICU
+    if (m_collator) {
+        ucol_close(m_collator);
+    }
+#endif
 }
 
 QMutex *ContactsDatabase::accessMutex() const
@@ -3373,6 +4076,23 @@ bool ContactsDatabase::open(const QString &connectionName, bool nonprivileged, b
         return false;
     }
 
+#ifdef QTCONTACTS_SQLITE_LOAD_ICU
+    if (!m_collator && localized()) {
+        // Use the same collator as the localeCollation sequence loaded into sqlite.
+        // It is opened here so that the reader and writer threads only ever use it for const operations.
+        UErrorCode status = U_ZERO_ERROR;
+        m_collator = ucol_open(m_localeName.toLatin1().constData(), &status);
+        if (U_FAILURE(status)) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to open collator for locale %1: %2")
+                    .arg(m_localeName).arg(QString::fromLatin1(u_errorName(status))));
+            if (m_collator) {
+                ucol_close(m_collator);
+                m_collator = nullptr;
+            }
+        }
+    }
+#endif
+
     const QString systemDataDirPath(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/system/");
     const QString privilegedDataDirPath(systemDataDirPath + QTCONTACTS_SQLITE_PRIVILEGED_DIR + "/");
 
@@ -3480,6 +4200,17 @@ bool ContactsDatabase::open(const QString &connectionName, bool nonprivileged, b
         }
     }
 
+    // The optional indexes are used only if this connection can query them, and they have been maintained
+    bool available = false;
+    if (!optionalIndexPresent(m_database, QStringLiteral("fts5"), QStringLiteral("content"), QStringLiteral("RemoveContactsSearch"),
+                              &available, &m_fullTextSearch)
+            || !optionalIndexPresent(m_database, QStringLiteral("rtree"), QStringLiteral("id, minX, maxX"), QStringLiteral("InsertGeoLocationsIndex"),
+                                     &available, &m_spatialIndex)) {
+        m_database.close();
+        return false;
+    }
+    m_nullsOrdering = nullsOrderingAvailable(m_database);
+
     // Attach to the transient store - any process can create it, but only the primary connection of each
     if (!m_transientStore.open(nonprivileged, !secondaryConnection, !databasePreexisting)) {
         QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to open contacts transient store"));
@@ -3521,6 +4252,88 @@ bool ContactsDatabase::localized() const
     return (m_localeName != QStringLiteral("C"));
 }
 
+bool ContactsDatabase::hasSortKeys() const
+{
+#ifdef QTCONTACTS_SQLITE_LOAD_ICU
+    // The collator is opened before the database, and is not modified afterwards
+    return m_collator != nullptr;
+#else
+    return false;
+#endif
+}
+
+bool ContactsDatabase::hasFullTextSearch() const
+{
+    return m_fullTextSearch;
+}
+
+bool ContactsDatabase::hasSpatialIndex() const
+{
+    return m_spatialIndex;
+}
+
+bool ContactsDatabase::hasNullsOrdering() const
+{
+    return m_nullsOrdering;
+}
+
+QString ContactsDatabase::searchContentSelect()
+{
+    return QLatin1String(selectContactsSearchContent);
+}
+
+QString ContactsDatabase::sortKeyLocale() const
+{
+    return hasSortKeys() ? m_localeName : QString();
+}
+
+QByteArray ContactsDatabase::sortKey(const QString &value) const
+{
+    // A blank value has no key, so that blanks can be sorted separately
+    if (value.isEmpty() || !hasSortKeys())
+        return QByteArray();
+
+#ifdef QTCONTACTS_SQLITE_LOAD_ICU
+    QByteArray key(64, Qt::Uninitialized);
+    const UChar *source = reinterpret_cast<const UChar *>(value.utf16());
+    int32_t length = ucol_getSortKey(m_collator, source, value.length(), reinterpret_cast<uint8_t *>(key.data()), key.size());
+    if (length > key.size()) {
+        key.resize(length);
+        length = ucol_getSortKey(m_collator, source, value.length(), reinterpret_cast<uint8_t *>(key.data()), key.size());
+    }
+
+    // Exclude the terminating NUL from the stored key
+    key.resize(length > 0 ? length - 1 : 0);
+    return key;
+#else
+    return QByteArray();
+#endif
+}
+
+int ContactsDatabase::presenceRank(int presenceState)
+{
+#ifdef SORT_PRESENCE_BY_AVAILABILITY
+    // The order we want is Available(1),Away(4),ExtendedAway(5),Busy(3),Hidden(2),Offline(6),Unknown(0)
+    switch (presenceState) {
+        case QContactPresence::PresenceAvailable: return 0;
+        case QContactPresence::PresenceAway: return 1;
+        case QContactPresence::PresenceExtendedAway: return 2;
+        case QContactPresence::PresenceBusy: return 3;
+        case QContactPresence::PresenceHidden: return 4;
+        case QContactPresence::PresenceOffline: return 5;
+        default: return 6;
+    }
+#else
+    return presenceState;
+#endif
+}
+
+int ContactsDatabase::monthDay(const QDate &date)
+{
+    // Ordered by month, then day: 101 for the first of January, through 1231
+    return date.month() * 100 + date.day();
+}
+
 bool ContactsDatabase::aggregating() const
 {
     // Currently true only in the privileged database
@@ -3545,11 +4358,19 @@ bool ContactsDatabase::beginTransaction()
     return false;
 }
 
+static QAtomicInt commitCount;
+
+quint32 ContactsDatabase::commitGeneration()
+{
+    return static_cast<quint32>(commitCount.load());
+}
+
 bool ContactsDatabase::commitTransaction()
 {
     ProcessMutex *mutex(processMutex());
 
     if (::commitTransaction(m_database)) {
+        commitCount.ref();
         if (mutex->isLocked()) {
             mutex->unlock();
         } else {
@@ -3567,6 +4388,10 @@ bool ContactsDatabase::rollbackTransaction()
 
     const bool rv = ::rollbackTransaction(m_database);
 
+    // A result read within the transaction may include writes which are now undone,
+    // so the generation it was cached against must not remain current
+    commitCount.ref();
+
     if (mutex->isLocked()) {
         mutex->unlock();
     } else {
@@ -3601,6 +4426,12 @@ ContactsDatabase::Query ContactsDatabase::prepare(const QString &statement)
     return Query(*it);
 }
 
+bool ContactsDatabase::hasTransientDetails() const
+{
+    ContactsTransientStore::DataLock lock(m_transientStore.dataLock());
+    return m_transientStore.constBegin(lock) != m_transientStore.constEnd(lock);
+}
+
 bool ContactsDatabase::hasTransientDetails(quint32 contactId)
 {
     return m_transientStore.contains(contactId);
@@ -3611,19 +4442,33 @@ QPair<QDateTime, QList<QContactDetail> > ContactsDatabase::transientDetails(quin
     return m_transientStore.contactDetails(contactId);
 }
 
+QHash<quint32, QPair<QDateTime, QList<QContactDetail> > > ContactsDatabase::transientDetails(const QList<quint32> &contactIds) const
+{
+    return m_transientStore.contactDetails(contactIds);
+}
+
 bool ContactsDatabase::setTransientDetails(quint32 contactId, const QDateTime &timestamp, const QList<QContactDetail> &details)
 {
-    return m_transientStore.setContactDetails(contactId, timestamp, details);
+    // Transient details are not written in a transaction, but they still change the results
+    // of queries; the generation is advanced after the change, so that no result read before
+    // it can be stored against the new generation
+    const bool rv = m_transientStore.setContactDetails(contactId, timestamp, details);
+    commitCount.ref();
+    return rv;
 }
 
 bool ContactsDatabase::removeTransientDetails(quint32 contactId)
 {
-    return m_transientStore.remove(contactId);
+    const bool rv = m_transientStore.remove(contactId);
+    commitCount.ref();
+    return rv;
 }
 
 bool ContactsDatabase::removeTransientDetails(const QList<quint32> &contactIds)
 {
-    return m_transientStore.remove(contactIds);
+    const bool rv = m_transientStore.remove(contactIds);
+    commitCount.ref();
+    return rv;
 }
 
 bool ContactsDatabase::execute(QSqlQuery &query)
@@ -3817,10 +4662,110 @@ bool ContactsDatabase::populateTemporaryTransientState(bool timestamps, bool glo
         rv = false;
     } else if (globalPresence && !::createTemporaryContactPresenceTable(*this, m_database, presenceTable, presenceValues)) {
         rv = false;
+    } else if (globalPresence && !presenceValues.isEmpty() && aggregating()
+               && !::deriveTemporaryAggregatePresence(*this, m_database, presenceTable)) {
+        rv = false;
     }
     return rv;
 }
 
+void ContactsDatabase::setAttributeIndex(ContactAttributeIndex *index)
+{
+    m_attributeIndex = index;
+}
+
+ContactAttributeIndex *ContactsDatabase::attributeIndex() const
+{
+    return m_attributeIndex;
+}
+
+void ContactsDatabase::setRefinementCache(ContactRefinementCache *cache)
+{
+    m_refinementCache = cache;
+}
+
+ContactRefinementCache *ContactsDatabase::refinementCache() const
+{
+    return m_refinementCache;
+}
+
+void ContactsDatabase::setAggregationCandidateIndex(AggregationCandidateIndex *index)
+{
+    m_aggregationCandidateIndex = index;
+}
+
+AggregationCandidateIndex *ContactsDatabase::aggregationCandidateIndex() const
+{
+    return m_aggregationCandidateIndex;
+}
+
+bool ContactsDatabase::updateSearchIndex(quint32 contactId)
+{
+    if (!m_fullTextSearch)
+        return true;
+
+    // Replace the indexed content for this contact with its current detail values
+    const QString removeStatement(QStringLiteral("DELETE FROM ContactsSearch WHERE rowid = :contactId"));
+    const QString insertStatement(QStringLiteral("%1 %2 WHERE Contacts.contactId = :contactId")
+            .arg(QLatin1String(insertContactsSearchContent))
+            .arg(QLatin1String(selectContactsSearchContent)));
+
+    ContactsDatabase::Query removeQuery(prepare(removeStatement));
+    removeQuery.bindValue(QStringLiteral(":contactId"), contactId);
+    if (!ContactsDatabase::execute(removeQuery)) {
+        removeQuery.reportError(QString::fromLatin1("Failed to remove search index content for contact %1").arg(contactId));
+        return false;
+    }
+
+    ContactsDatabase::Query insertQuery(prepare(insertStatement));
+    insertQuery.bindValue(QStringLiteral(":contactId"), contactId);
+    if (!ContactsDatabase::execute(insertQuery)) {
+        insertQuery.reportError(QString::fromLatin1("Failed to update search index content for contact %1").arg(contactId));
+        return false;
+    }
+
+    return true;
+}
+
+bool ContactsDatabase::updateSearchIndex(const QList<quint32> &contactIds)
+{
+    if (!m_fullTextSearch)
+        return true;
+
+    // Replace the indexed content for all of the contacts with a single pass over each table
+    const QString table(QStringLiteral("updateSearchIndex"));
+
+    QVariantList boundIds;
+    foreach (quint32 contactId, contactIds) {
+        boundIds.append(contactId);
+    }
+    if (!createTemporaryContactIdsTable(table, boundIds)) {
+        return false;
+    }
+
+    const QString removeStatement(QStringLiteral("DELETE FROM ContactsSearch WHERE rowid IN (SELECT contactId FROM temp.%1)").arg(table));
+    const QString insertStatement(QStringLiteral("%1 %2 WHERE Contacts.contactId IN (SELECT contactId FROM temp.%3)")
+            .arg(QLatin1String(insertContactsSearchContent))
+            .arg(QLatin1String(selectContactsSearchContent))
+            .arg(table));
+
+    bool rv = true;
+    ContactsDatabase::Query removeQuery(prepare(removeStatement));
+    if (!ContactsDatabase::execute(removeQuery)) {
+        removeQuery.reportError(QString::fromLatin1("Failed to remove search index content for %1 contacts").arg(contactIds.count()));
+        rv = false;
+    } else {
+        ContactsDatabase::Query insertQuery(prepare(insertStatement));
+        if (!ContactsDatabase::execute(insertQuery)) {
+            insertQuery.reportError(QString::fromLatin1("Failed to update search index content for %1 contacts").arg(contactIds.count()));
+            rv = false;
+        }
+    }
+
+    clearTemporaryContactIdsTable(table);
+    return rv;
+}
+
 QString ContactsDatabase::dateTimeString(const QDateTime &qdt)
 {
     // Input must be UTC
@@ -41,6 +41,7 @@
 #include <mgconfitem.h>
 #endif
 
+#include <QDate>
 #include <QHash>
 #include <QMutex>
 #include <QScopedPointer>
@@ -52,7 +53,14 @@
 
 #include <QContact>
 
+#ifdef QTCONTACTS_SQLITE_LOAD_ICU
+struct UCollator;
+#endif
+
 class ContactsEngine;
+class AggregationCandidateIndex;
+class ContactAttributeIndex;
+class ContactRefinementCache;
 class ContactsDatabase
 {
 public:
@@ -143,10 +151,34 @@ public:
     bool aggregating() const;
     bool localized() const;
 
+    // Binary collation keys are stored for localized sorting, when an ICU collator is available
+    bool hasSortKeys() const;
+    QString sortKeyLocale() const;
+    QByteArray sortKey(const QString &value) const;
+
+    // The full-text search and spatial indexes exist only where SQLite provides their modules
+    bool hasFullTextSearch() const;
+    bool hasSpatialIndex() const;
+
+    // Whether ORDER BY terms can place NULL values explicitly, which an index can serve
+    bool hasNullsOrdering() const;
+
+    // Selects the contactId and the searchable text columns of each contact, as indexed for full-text search
+    static QString searchContentSelect();
+
+    static int presenceRank(int presenceState);
+
+    // The ordinal of the date within any year, ignoring the year itself
+    static int monthDay(const QDate &date);
+
     bool beginTransaction();
     bool commitTransaction();
     bool rollbackTransaction();
 
+    // Incremented whenever any connection in this process commits a transaction,
+    // or changes the transient details which may be filtered or sorted on
+    static quint32 commitGeneration();
+
     bool createTemporaryContactIdsTable(const QString &table, const QVariantList &boundIds, int limit = 0);
     bool createTemporaryContactIdsTable(const QString &table, const QString &join, const QString &where, const QString &orderBy, const QVariantList &boundValues, int limit = 0);
     bool createTemporaryContactIdsTable(const QString &table, const QString &join, const QString &where, const QString &orderBy, const QMap<QString, QVariant> &boundValues, int limit = 0);
@@ -161,12 +193,25 @@ public:
 
     bool populateTemporaryTransientState(bool timestamps, bool globalPresence);
 
+    // The index is shared by the connections of an engine, which must outlive them
+    void setAttributeIndex(ContactAttributeIndex *index);
+    ContactAttributeIndex *attributeIndex() const;
+    void setRefinementCache(ContactRefinementCache *cache);
+    ContactRefinementCache *refinementCache() const;
+    void setAggregationCandidateIndex(AggregationCandidateIndex *index);
+    AggregationCandidateIndex *aggregationCandidateIndex() const;
+
+    bool updateSearchIndex(quint32 contactId);
+    bool updateSearchIndex(const QList<quint32> &contactIds);
+
     Query prepare(const char *statement);
     Query prepare(const QString &statement);
 
+    bool hasTransientDetails() const;
     bool hasTransientDetails(quint32 contactId);
 
     QPair<QDateTime, QList<QContactDetail> > transientDetails(quint32 contactId) const;
+    QHash<quint32, QPair<QDateTime, QList<QContactDetail> > > transientDetails(const QList<quint32> &contactIds) const;
     bool setTransientDetails(quint32 contactId, const QDateTime &timestamp, const QList<QContactDetail> &details);
 
     bool removeTransientDetails(quint32 contactId);
@@ -194,13 +239,22 @@ public:
 
 private:
     ContactsEngine *m_engine;
+    ContactAttributeIndex *m_attributeIndex;
+    ContactRefinementCache *m_refinementCache;
+    AggregationCandidateIndex *m_aggregationCandidateIndex;
     QSqlDatabase m_database;
     ContactsTransientStore m_transientStore;
     QMutex m_mutex;
     mutable QScopedPointer<ProcessMutex> m_processMutex;
     bool m_nonprivileged;
     bool m_autoTest;
+    bool m_fullTextSearch;
+    bool m_spatialIndex;
+    bool m_nullsOrdering;
     QString m_localeName;
+#ifdef QTCONTACTS_SQLITE_LOAD_ICU
+    UCollator *m_collator;
+#endif
     QHash<QString, QSqlQuery> m_preparedQueries;
     QVector<QtContactsSqliteExtensions::DisplayLabelGroupGenerator*> m_dlgGenerators;
     QScopedPointer<QtContactsSqliteExtensions::DisplayLabelGroupGenerator> m_defaultGenerator;
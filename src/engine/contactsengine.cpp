@@ -45,6 +45,7 @@
 #include "qcontactchangesfetchrequest_p.h"
 #include "qcontactchangessaverequest_p.h"
 #include "qcontactclearchangeflagsrequest_p.h"
+#include "qcontactduplicatefetchrequest_p.h"
 #include "displaylabelgroupgenerator.h"
 
 #include <QCoreApplication>
@@ -121,6 +122,7 @@ public:
     virtual void contactsAvailable(const QList<QContact> &) {}
     virtual void contactIdsAvailable(const QList<QContactId> &) {}
     virtual void collectionsAvailable(const QList<QContactCollection> &) {}
+    virtual void duplicatesAvailable(const QList<ContactReader::Duplicate> &) {}
 
     virtual QString description() const = 0;
     virtual QContactManager::Error error() const = 0;
@@ -296,17 +298,30 @@ private:
 class IdFetchJob : public TemplateJob<QContactIdFetchRequest>
 {
 public:
-    IdFetchJob(QContactIdFetchRequest *request)
+    IdFetchJob(QContactIdFetchRequest *request, ContactIdCache *cache)
         : TemplateJob(request)
         , m_filter(request->filter())
         , m_sorting(request->sorting())
+        , m_cache(cache)
     {
     }
 
     void execute(ContactReader *reader, WriterProxy &) override
     {
+        const QByteArray cacheKey(ContactIdCache::key(m_filter, m_sorting));
+        quint64 cacheGeneration = 0;
+
         QList<QContactId> contactIds;
+        if (m_cache->find(cacheKey, &contactIds, &cacheGeneration)) {
+            m_contactIds = contactIds;
+            m_error = QContactManager::NoError;
+            return;
+        }
+
         m_error = reader->readContactIds(&contactIds, m_filter, m_sorting);
+        if (m_error == QContactManager::NoError) {
+            m_cache->insert(cacheKey, contactIds, cacheGeneration);
+        }
     }
 
     void update(QMutex *mutex) override
@@ -344,6 +359,7 @@ private:
     QContactFilter m_filter;
     QList<QContactSortOrder> m_sorting;
     QList<QContactId> m_contactIds;
+    ContactIdCache *m_cache;
 };
 
 class ContactFetchByIdJob : public TemplateJob<QContactFetchByIdRequest>
@@ -957,6 +973,77 @@ private:
     const QList<QContactId> m_contactIds;
 };
 
+class DuplicateFetchJob : public TemplateJob<QContactDuplicateFetchRequest>
+{
+public:
+    DuplicateFetchJob(QContactDuplicateFetchRequest *request, QContactDuplicateFetchRequestPrivate *d)
+        : TemplateJob(request)
+        , m_minimumScore(d->minimumScore)
+    {
+    }
+
+    void execute(ContactReader *, WriterProxy &writer) override
+    {
+        m_error = writer->findDuplicates(m_minimumScore);
+    }
+
+    void update(QMutex *mutex) override
+    {
+        QList<ContactReader::Duplicate> duplicates;
+        {
+            QMutexLocker locker(mutex);
+            duplicates = m_duplicates;
+        }
+        if (m_request) {
+            QContactDuplicateFetchRequestPrivate * const d = QContactDuplicateFetchRequestPrivate::get(m_request);
+
+            d->duplicates = requestDuplicates(duplicates);
+            emit (m_request->*(d->resultsAvailable))();
+        }
+    }
+
+    void updateState(QContactAbstractRequest::State state) override
+    {
+        if (m_request) {
+            QContactDuplicateFetchRequestPrivate * const d = QContactDuplicateFetchRequestPrivate::get(m_request);
+
+            d->duplicates = requestDuplicates(m_duplicates);
+            d->error = m_error;
+            d->state = state;
+
+            if (state == QContactAbstractRequest::FinishedState) {
+                emit (m_request->*(d->resultsAvailable))();
+            }
+            emit (m_request->*(d->stateChanged))(state);
+        }
+    }
+
+    void duplicatesAvailable(const QList<ContactReader::Duplicate> &duplicates) override
+    {
+        m_duplicates = duplicates;
+    }
+
+    QString description() const override
+    {
+        QString s(QLatin1String("Duplicate Fetch"));
+        return s;
+    }
+
+private:
+    static QList<QContactDuplicateFetchRequest::Duplicate> requestDuplicates(const QList<ContactReader::Duplicate> &duplicates)
+    {
+        QList<QContactDuplicateFetchRequest::Duplicate> rv;
+        foreach (const ContactReader::Duplicate &duplicate, duplicates) {
+            const QContactDuplicateFetchRequest::Duplicate requestDuplicate = { duplicate.firstId, duplicate.secondId, duplicate.score };
+            rv.append(requestDuplicate);
+        }
+        return rv;
+    }
+
+    const int m_minimumScore;
+    QList<ContactReader::Duplicate> m_duplicates;
+};
+
 class JobThread : public QThread
 {
     struct MutexUnlocker {
@@ -973,7 +1060,9 @@ class JobThread : public QThread
     };
 
 public:
-    JobThread(ContactsEngine *engine, const QString &databaseUuid, bool nonprivileged, bool autoTest)
+    JobThread(ContactsEngine *engine, const QString &databaseUuid, bool nonprivileged, bool autoTest,
+              ContactAttributeIndex *attributeIndex, ContactRefinementCache *refinementCache,
+              AggregationCandidateIndex *aggregationCandidateIndex)
         : m_currentJob(0)
         , m_engine(engine)
         , m_database(engine)
@@ -983,6 +1072,10 @@ public:
         , m_nonprivileged(nonprivileged)
         , m_autoTest(autoTest)
     {
+        m_database.setAttributeIndex(attributeIndex);
+        m_database.setRefinementCache(refinementCache);
+        m_database.setAggregationCandidateIndex(aggregationCandidateIndex);
+
         start(QThread::IdlePriority);
 
         // Don't return until the started thread has indicated it is running
@@ -1158,6 +1251,13 @@ public:
         postUpdate();
     }
 
+    void duplicatesAvailable(const QList<ContactReader::Duplicate> &duplicates)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_currentJob->duplicatesAvailable(duplicates);
+        postUpdate();
+    }
+
     bool event(QEvent *event)
     {
         if (event->type() == QEvent::UpdateRequest) {
@@ -1236,6 +1336,11 @@ public:
         m_thread->collectionsAvailable(collections);
     }
 
+    void duplicatesAvailable(const QList<Duplicate> &duplicates) override
+    {
+        m_thread->duplicatesAvailable(duplicates);
+    }
+
 private:
     JobThread *m_thread;
 };
@@ -1299,9 +1404,14 @@ void JobThread::run()
     }
 }
 
+// The interval for which writes must be idle before deferred aggregates are regenerated
+static const int AggregateRegenerationIdleInterval = 500;
+
 ContactsEngine::ContactsEngine(const QString &name, const QMap<QString, QString> &parameters)
     : m_name(name)
     , m_parameters(parameters)
+    , m_deferAggregateRegeneration(false)
+    , m_useAggregationCandidateIndex(true)
 {
     static bool registered = qRegisterMetaType<QList<int> >("QList<int>") &&
                              qRegisterMetaType<QList<QContactDetail::DetailType> >("QList<QContactDetail::DetailType>") &&
@@ -1328,6 +1438,26 @@ ContactsEngine::ContactsEngine(const QString &name, const QMap<QString, QString>
         setAutoTest(true);
     }
 
+    // A writer which is not used interactively (such as a sync daemon) can defer
+    // the regeneration of aggregates until its writes are idle
+    QString deferAggregateRegeneration = m_parameters.value(QString::fromLatin1("deferAggregateRegeneration"));
+    if (deferAggregateRegeneration.toLower() == QLatin1String("true") ||
+        deferAggregateRegeneration.toInt() == 1) {
+        m_deferAggregateRegeneration = true;
+    }
+
+    // Aggregates are matched by the SQL heuristic alone if the candidate index is disabled;
+    // this is an undocumented setting, which allows the tests to compare the two
+    QString aggregationCandidateIndex = m_parameters.value(QString::fromLatin1("aggregationCandidateIndex"));
+    if (aggregationCandidateIndex.toLower() == QLatin1String("false") ||
+        aggregationCandidateIndex == QLatin1String("0")) {
+        m_useAggregationCandidateIndex = false;
+    }
+
+    m_aggregateRegenerationTimer.setSingleShot(true);
+    m_aggregateRegenerationTimer.setInterval(AggregateRegenerationIdleInterval);
+    connect(&m_aggregateRegenerationTimer, SIGNAL(timeout()), this, SLOT(_q_regenerateDeferredAggregates()));
+
     /* Store the engine into a property of QCoreApplication, so that it can be
      * retrieved by the extension code */
     QCoreApplication *app = QCoreApplication::instance();
@@ -1340,6 +1470,12 @@ ContactsEngine::ContactsEngine(const QString &name, const QMap<QString, QString>
 
 ContactsEngine::~ContactsEngine()
 {
+    if (m_synchronousWriter) {
+        // Don't leave any aggregate out of date
+        m_aggregateRegenerationTimer.stop();
+        m_synchronousWriter->regenerateDeferredAggregates();
+    }
+
     QCoreApplication *app = QCoreApplication::instance();
     QList<QVariant> engines = app->property(CONTACT_MANAGER_ENGINE_PROP).toList();
     for (int i = 0; i < engines.size(); ++i) {
@@ -1365,7 +1501,7 @@ QContactManager::Error ContactsEngine::open()
 {
     // Start the async thread, and wait to see if it can open the database
     if (!m_jobThread) {
-        m_jobThread.reset(new JobThread(this, databaseUuid(), m_nonprivileged, m_autoTest));
+        m_jobThread.reset(new JobThread(this, databaseUuid(), m_nonprivileged, m_autoTest, &m_attributeIndex, &m_refinementCache, aggregationCandidateIndex()));
 
         if (m_jobThread->databaseOpen()) {
             // We may not have got privileged access if we requested it
@@ -1375,12 +1511,12 @@ QContactManager::Error ContactsEngine::open()
                 m_notifier.reset(new ContactNotifier(m_nonprivileged));
                 m_notifier->connect("collectionsAdded", "au", this, SLOT(_q_collectionsAdded(QVector<quint32>)));
                 m_notifier->connect("collectionsChanged", "au", this, SLOT(_q_collectionsChanged(QVector<quint32>)));
-                m_notifier->connect("collectionsRemoved", "au", this, SLOT(_q_collectionsRemoved(QVector<quint32>)));
-                m_notifier->connect("collectionContactsChanged", "au", this, SLOT(_q_collectionContactsChanged(QVector<quint32>)));
-                m_notifier->connect("contactsAdded", "au", this, SLOT(_q_contactsAdded(QVector<quint32>)));
-                m_notifier->connect("contactsChanged", "au", this, SLOT(_q_contactsChanged(QVector<quint32>)));
+                m_notifier->connect("collectionsRemoved", "au", this, SLOT(_q_collectionsRemoved(QVector<quint32>,QDBusMessage)));
+                m_notifier->connect("collectionContactsChanged", "au", this, SLOT(_q_collectionContactsChanged(QVector<quint32>,QDBusMessage)));
+                m_notifier->connect("contactsAdded", "au", this, SLOT(_q_contactsAdded(QVector<quint32>,QDBusMessage)));
+                m_notifier->connect("contactsChanged", "au", this, SLOT(_q_contactsChanged(QVector<quint32>,QDBusMessage)));
                 m_notifier->connect("contactsPresenceChanged", "au", this, SLOT(_q_contactsPresenceChanged(QVector<quint32>)));
-                m_notifier->connect("contactsRemoved", "au", this, SLOT(_q_contactsRemoved(QVector<quint32>)));
+                m_notifier->connect("contactsRemoved", "au", this, SLOT(_q_contactsRemoved(QVector<quint32>,QDBusMessage)));
                 m_notifier->connect("selfContactIdChanged", "uu", this, SLOT(_q_selfContactIdChanged(quint32,quint32)));
                 m_notifier->connect("relationshipsAdded", "au", this, SLOT(_q_relationshipsAdded(QVector<quint32>)));
                 m_notifier->connect("relationshipsRemoved", "au", this, SLOT(_q_relationshipsRemoved(QVector<quint32>)));
@@ -1439,9 +1575,20 @@ QList<QContactId> ContactsEngine::contactIds(
             const QList<QContactSortOrder> &sortOrders,
             QContactManager::Error* error) const
 {
+    const QByteArray cacheKey(ContactIdCache::key(filter, sortOrders));
+    quint64 cacheGeneration = 0;
+
     QList<QContactId> contactIds;
+    if (m_contactIdCache.find(cacheKey, &contactIds, &cacheGeneration)) {
+        if (error)
+            *error = QContactManager::NoError;
+        return contactIds;
+    }
 
     QContactManager::Error err = reader()->readContactIds(&contactIds, filter, sortOrders);
+    if (err == QContactManager::NoError) {
+        m_contactIdCache.insert(cacheKey, contactIds, cacheGeneration);
+    }
     if (error)
         *error = err;
     return contactIds;
@@ -1546,6 +1693,7 @@ bool ContactsEngine::removeContacts(
             QContactManager::Error* error)
 {
     QContactManager::Error err = writer()->remove(contactIds, errorMap, false, false);
+
     if (error)
         *error = err;
     return err == QContactManager::NoError;
@@ -1738,7 +1886,7 @@ bool ContactsEngine::startRequest(QContactAbstractRequest* request)
         job = new ContactFetchJob(qobject_cast<QContactFetchRequest *>(request));
         break;
     case QContactAbstractRequest::ContactIdFetchRequest:
-        job = new IdFetchJob(qobject_cast<QContactIdFetchRequest *>(request));
+        job = new IdFetchJob(qobject_cast<QContactIdFetchRequest *>(request), &m_contactIdCache);
         break;
     case QContactAbstractRequest::ContactFetchByIdRequest:
         job = new ContactFetchByIdJob(qobject_cast<QContactFetchByIdRequest *>(request));
@@ -1821,6 +1969,16 @@ bool ContactsEngine::startRequest(QContactClearChangeFlagsRequest* request)
     return true;
 }
 
+bool ContactsEngine::startRequest(QContactDuplicateFetchRequest* request)
+{
+    Job *job = new DuplicateFetchJob(request, QContactDuplicateFetchRequestPrivate::get(request));
+
+    job->updateState(QContactAbstractRequest::ActiveState);
+    m_jobThread->enqueue(job);
+
+    return true;
+}
+
 bool ContactsEngine::cancelRequest(QContactAbstractRequest* req)
 {
     return cancelRequest(static_cast<QObject *>(req));
@@ -1995,6 +2153,164 @@ QStringList ContactsEngine::displayLabelGroups()
     return database().displayLabelGroups();
 }
 
+bool ContactsEngine::contactCount(const QContactFilter &filter, int *count, QContactManager::Error *error)
+{
+    *count = 0;
+    *error = reader()->readContactCount(count, filter);
+    return *error == QContactManager::NoError;
+}
+
+bool ContactsEngine::displayLabelGroupCounts(const QContactFilter &filter, QList<QtContactsSqliteExtensions::DisplayLabelGroupCount> *counts, QContactManager::Error *error)
+{
+    QList<QPair<QString, int> > groupCounts;
+    *error = reader()->readDisplayLabelGroupCounts(&groupCounts, filter);
+    if (*error != QContactManager::NoError) {
+        return false;
+    }
+
+    int offset = 0;
+    QList<QPair<QString, int> >::const_iterator it = groupCounts.constBegin(), end = groupCounts.constEnd();
+    for ( ; it != end; ++it) {
+        QtContactsSqliteExtensions::DisplayLabelGroupCount groupCount;
+        groupCount.group = it->first;
+        groupCount.count = it->second;
+        groupCount.offset = offset;
+        counts->append(groupCount);
+
+        offset += it->second;
+    }
+
+    return true;
+}
+
+bool ContactsEngine::profileContactQuery(const QContactFilter &filter, const QList<QContactSortOrder> &sortOrders, const QContactFetchHint &fetchHint, QList<QtContactsSqliteExtensions::QueryProfileStep> *steps, QContactManager::Error *error)
+{
+    *error = reader()->profileContacts(steps, filter, sortOrders, fetchHint);
+    return *error == QContactManager::NoError;
+}
+
+bool ContactsEngine::upcomingDates(const QDate &startDate, int maximumCount, bool includeDisplayLabels, QList<QtContactsSqliteExtensions::UpcomingDate> *dates, QContactManager::Error *error)
+{
+    *error = reader()->readUpcomingDates(dates, startDate, maximumCount, includeDisplayLabels);
+    return *error == QContactManager::NoError;
+}
+
+void ContactsEngine::contactIdCacheStatistics(int *hits, int *misses)
+{
+    *hits = m_contactIdCache.hits();
+    *misses = m_contactIdCache.misses();
+}
+
+void ContactsEngine::refinementCacheStatistics(int *hits, int *misses)
+{
+    *hits = m_refinementCache.hits();
+    *misses = m_refinementCache.misses();
+}
+
+bool ContactsEngine::lookupPhoneNumber(const QString &phoneNumber, QContactId *contactId, QString *displayLabel, QContactManager::Error *error)
+{
+    const QString normalized(normalizedPhoneNumber(phoneNumber));
+    if (normalized.isEmpty()) {
+        *error = QContactManager::BadArgumentError;
+        return false;
+    }
+
+    if (!m_phoneNumberIndex.isValid()) {
+        *error = reader()->readPhoneNumberIndex(&m_phoneNumberIndex);
+        if (*error != QContactManager::NoError) {
+            return false;
+        }
+    }
+
+    PhoneNumberIndex::Entry entry;
+    if (!m_phoneNumberIndex.lookup(normalized, &entry)) {
+        *error = QContactManager::DoesNotExistError;
+        return false;
+    }
+
+    *contactId = ContactId::apiId(entry.contactId, m_managerUri);
+    *displayLabel = entry.displayLabel;
+    *error = QContactManager::NoError;
+    return true;
+}
+
+bool ContactsEngine::aggregationMatch(const QContact &contact, QContactId *aggregateId, int *score, QContactManager::Error *error)
+{
+    quint32 dbId = 0;
+    *error = writer()->aggregationMatch(contact, &dbId, score);
+    if (*error != QContactManager::NoError)
+        return false;
+
+    *aggregateId = dbId ? ContactId::apiId(dbId, m_managerUri) : QContactId();
+    return true;
+}
+
+static int presenceOrder(QContactPresence::PresenceState state)
+{
+#ifdef SORT_PRESENCE_BY_AVAILABILITY
+    if (state == QContactPresence::PresenceAvailable) {
+        return 0;
+    } else if (state == QContactPresence::PresenceAway) {
+        return 1;
+    } else if (state == QContactPresence::PresenceExtendedAway) {
+        return 2;
+    } else if (state == QContactPresence::PresenceBusy) {
+        return 3;
+    } else if (state == QContactPresence::PresenceHidden) {
+        return 4;
+    } else if (state == QContactPresence::PresenceOffline) {
+        return 5;
+    }
+    return 6;
+#else
+    return static_cast<int>(state);
+#endif
+}
+
+static bool betterPresence(const QContactPresence &detail, const QContactPresence &best)
+{
+    if (best.isEmpty())
+        return true;
+
+    QContactPresence::PresenceState detailState(detail.presenceState());
+    if (detailState == QContactPresence::PresenceUnknown)
+        return false;
+
+    return ((presenceOrder(detailState) < presenceOrder(best.presenceState())) ||
+            best.presenceState() == QContactPresence::PresenceUnknown);
+}
+
+bool ContactsEngine::updateGlobalPresence(QContact *contact)
+{
+    QContactGlobalPresence globalPresence = contact->detail<QContactGlobalPresence>();
+
+    const QList<QContactPresence> details = contact->details<QContactPresence>();
+    if (details.isEmpty()) {
+        // No presence - remove global presence if present
+        if (!globalPresence.isEmpty()) {
+            contact->removeDetail(&globalPresence);
+        }
+        return true;
+    }
+
+    QContactPresence bestPresence;
+
+    foreach (const QContactPresence &detail, details) {
+        if (betterPresence(detail, bestPresence)) {
+            bestPresence = detail;
+        }
+    }
+
+    globalPresence.setPresenceState(bestPresence.presenceState());
+    globalPresence.setPresenceStateText(bestPresence.presenceStateText());
+    globalPresence.setTimestamp(bestPresence.timestamp());
+    globalPresence.setNickname(bestPresence.nickname());
+    globalPresence.setCustomMessage(bestPresence.customMessage());
+
+    contact->saveDetail(&globalPresence, QContact::IgnoreAccessConstraints);
+    return true;
+}
+
 bool ContactsEngine::setContactDisplayLabel(QContact *contact, const QString &label, const QString &group, int sortOrder)
 {
     QContactDisplayLabel detail(contact->detail<QContactDisplayLabel>());
@@ -2027,6 +2343,47 @@ QString ContactsEngine::normalizedPhoneNumber(const QString &input)
     return QtContactsSqliteExtensions::minimizePhoneNumber(input, maxCharacters);
 }
 
+QString ContactsEngine::reversedPhoneNumber(const QString &input)
+{
+    // Remove the same punctuation that is ignored by unnormalized phone number matches,
+    // and reverse the remainder so that number suffixes can be matched as prefixes
+    static const QString ignoredChars(QStringLiteral("+-#() "));
+
+    QString reversed;
+    reversed.reserve(input.length());
+    for (int i = input.length() - 1; i >= 0; --i) {
+        const QChar &c(input.at(i));
+        if (!ignoredChars.contains(c)) {
+            reversed.append(c);
+        }
+    }
+    return reversed;
+}
+
+QString ContactsEngine::keypadDigits(const QString &input)
+{
+    // ITU-T standard keypad collation:
+    // 2 = abc, 3 = def, 4 = ghi, 5 = jkl, 6 = mno, 7 = pqrs, 8 = tuv, 9 = wxyz, 0 = space
+    static const char keypad[] = "22233344455566677778889999";
+
+    // Decompose accented characters so that they collate with their base letter
+    const QString decomposed(input.normalized(QString::NormalizationForm_KD));
+
+    QString digits;
+    digits.reserve(decomposed.length());
+    foreach (const QChar &c, decomposed) {
+        const ushort lower = c.toLower().unicode();
+        if (lower >= 'a' && lower <= 'z') {
+            digits.append(QChar::fromLatin1(keypad[lower - 'a']));
+        } else if (lower >= '0' && lower <= '9') {
+            digits.append(c);
+        } else if (c.isSpace()) {
+            digits.append(QChar::fromLatin1('0'));
+        }
+    }
+    return digits;
+}
+
 QString ContactsEngine::synthesizedDisplayLabel(const QContact &contact, QContactManager::Error *error) const
 {
     *error = QContactManager::NoError;
@@ -2112,6 +2469,15 @@ static QList<QContactCollectionId> collectionIdList(const QVector<quint32> &coll
     return ids;
 }
 
+void ContactsEngine::invalidateAttributeIndex(const QDBusMessage &message)
+{
+    // The changes written by this process are applied to the index by its writers; those of
+    // other processes are only reported by notification, and require the index to be read again
+    if (!ContactNotifier::sentByThisProcess(message)) {
+        m_attributeIndex.invalidate();
+    }
+}
+
 void ContactsEngine::_q_collectionsAdded(const QVector<quint32> &collectionIds)
 {
     emit collectionsAdded(collectionIdList(collectionIds, m_managerUri));
@@ -2122,24 +2488,40 @@ void ContactsEngine::_q_collectionsChanged(const QVector<quint32> &collectionIds
     emit collectionsChanged(collectionIdList(collectionIds, m_managerUri));
 }
 
-void ContactsEngine::_q_collectionsRemoved(const QVector<quint32> &collectionIds)
+void ContactsEngine::_q_collectionsRemoved(const QVector<quint32> &collectionIds, const QDBusMessage &message)
 {
+    m_contactIdCache.invalidate();
+    m_refinementCache.invalidate();
+    invalidateAttributeIndex(message);
+    m_phoneNumberIndex.invalidate();
     emit collectionsRemoved(collectionIdList(collectionIds, m_managerUri));
 }
 
-void ContactsEngine::_q_contactsAdded(const QVector<quint32> &contactIds)
+void ContactsEngine::_q_contactsAdded(const QVector<quint32> &contactIds, const QDBusMessage &message)
 {
+    m_contactIdCache.invalidate();
+    m_refinementCache.invalidate();
+    invalidateAttributeIndex(message);
+    m_phoneNumberIndex.invalidate();
+    m_aggregationCandidateIndex.invalidate();
     emit contactsAdded(idList(contactIds, m_managerUri));
 }
 
-void ContactsEngine::_q_contactsChanged(const QVector<quint32> &contactIds)
+void ContactsEngine::_q_contactsChanged(const QVector<quint32> &contactIds, const QDBusMessage &message)
 {
+    m_contactIdCache.invalidate();
+    m_refinementCache.invalidate();
+    invalidateAttributeIndex(message);
+    m_phoneNumberIndex.invalidate();
+    m_aggregationCandidateIndex.invalidate();
     // TODO: also emit the detail types..
     emit contactsChanged(idList(contactIds, m_managerUri), QList<QContactDetail::DetailType>());
 }
 
 void ContactsEngine::_q_contactsPresenceChanged(const QVector<quint32> &contactIds)
 {
+    m_contactIdCache.invalidate();
+    m_refinementCache.invalidate();
     if (m_mergePresenceChanges) {
         // TODO: also emit the detail types..
         emit contactsChanged(idList(contactIds, m_managerUri), QList<QContactDetail::DetailType>());
@@ -2148,33 +2530,67 @@ void ContactsEngine::_q_contactsPresenceChanged(const QVector<quint32> &contactI
     }
 }
 
-void ContactsEngine::_q_collectionContactsChanged(const QVector<quint32> &collectionIds)
+void ContactsEngine::_q_collectionContactsChanged(const QVector<quint32> &collectionIds, const QDBusMessage &message)
 {
+    m_contactIdCache.invalidate();
+    m_refinementCache.invalidate();
+    invalidateAttributeIndex(message);
+    m_phoneNumberIndex.invalidate();
     emit collectionContactsChanged(collectionIdList(collectionIds, m_managerUri));
 }
 
 void ContactsEngine::_q_displayLabelGroupsChanged()
 {
+    m_contactIdCache.invalidate();
+    m_refinementCache.invalidate();
+    m_phoneNumberIndex.invalidate();
     emit displayLabelGroupsChanged(displayLabelGroups());
 }
 
-void ContactsEngine::_q_contactsRemoved(const QVector<quint32> &contactIds)
+void ContactsEngine::aggregateRegenerationDeferred()
+{
+    // Restarting the timer delays the regeneration until writes are idle
+    m_aggregateRegenerationTimer.start();
+}
+
+void ContactsEngine::_q_regenerateDeferredAggregates()
+{
+    if (m_synchronousWriter
+            && m_synchronousWriter->regenerateDeferredAggregates() != QContactManager::NoError) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to regenerate deferred aggregates"));
+    }
+}
+
+void ContactsEngine::_q_contactsRemoved(const QVector<quint32> &contactIds, const QDBusMessage &message)
 {
+    m_contactIdCache.invalidate();
+    m_refinementCache.invalidate();
+    invalidateAttributeIndex(message);
+    m_phoneNumberIndex.invalidate();
+    m_aggregationCandidateIndex.invalidate();
     emit contactsRemoved(idList(contactIds, m_managerUri));
 }
 
 void ContactsEngine::_q_selfContactIdChanged(quint32 oldId, quint32 newId)
 {
+    m_contactIdCache.invalidate();
+    m_refinementCache.invalidate();
     emit selfContactIdChanged(ContactId::apiId(oldId, m_managerUri), ContactId::apiId(newId, m_managerUri));
 }
 
 void ContactsEngine::_q_relationshipsAdded(const QVector<quint32> &contactIds)
 {
+    m_contactIdCache.invalidate();
+    m_refinementCache.invalidate();
+    m_aggregationCandidateIndex.invalidate();
     emit relationshipsAdded(idList(contactIds, m_managerUri));
 }
 
 void ContactsEngine::_q_relationshipsRemoved(const QVector<quint32> &contactIds)
 {
+    m_contactIdCache.invalidate();
+    m_refinementCache.invalidate();
+    m_aggregationCandidateIndex.invalidate();
     emit relationshipsRemoved(idList(contactIds, m_managerUri));
 }
 
@@ -2185,6 +2601,9 @@ ContactsDatabase &ContactsEngine::database()
         dbId = dbId.arg(m_autoTest ? QStringLiteral("-test") : QString()).arg(databaseUuid());
 
         m_database.reset(new ContactsDatabase(this));
+        m_database->setAttributeIndex(&m_attributeIndex);
+        m_database->setRefinementCache(&m_refinementCache);
+        m_database->setAggregationCandidateIndex(aggregationCandidateIndex());
         if (!m_database->open(dbId, m_nonprivileged, m_autoTest, true)) {
             QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to open synchronous engine database connection"));
         } else if (!m_nonprivileged && !regenerateAggregatesIfNeeded()) {
@@ -2194,6 +2613,11 @@ ContactsDatabase &ContactsEngine::database()
     return *m_database;
 }
 
+AggregationCandidateIndex *ContactsEngine::aggregationCandidateIndex()
+{
+    return m_useAggregationCandidateIndex ? &m_aggregationCandidateIndex : nullptr;
+}
+
 bool ContactsEngine::regenerateAggregatesIfNeeded()
 {
     QContactManager::Error err = QContactManager::NoError;
@@ -2207,38 +2631,31 @@ bool ContactsEngine::regenerateAggregatesIfNeeded()
         return false;
     }
 
-    if (!aggregateIds.isEmpty()) {
-        // if we already have aggregates, then aggregates must
-        // have been regenerated already.
-        return true;
-    }
-
-    const QList<QContactId> localIds = contactIds(localsFilter, QList<QContactSortOrder>(), &err);
-    if (err != QContactManager::NoError) {
-        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to read local contact ids during attempt to regenerate aggregates"));
-        return false;
-    }
+    // If we already have aggregates, then aggregates must have been regenerated
+    // already, unless that was interrupted; the writer resumes an interrupted rebuild.
+    bool required = false;
+    if (aggregateIds.isEmpty()) {
+        const QList<QContactId> localIds = contactIds(localsFilter, QList<QContactSortOrder>(), &err);
+        if (err != QContactManager::NoError) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to read local contact ids during attempt to regenerate aggregates"));
+            return false;
+        }
 
-    if (localIds.isEmpty()) {
-        // no local contacts in database to be aggregated.
-        return true;
+        // We need to regenerate aggregates for our local contacts, due to
+        // the database schema upgrade from version 20 to version 21.
+        required = !localIds.isEmpty();
     }
 
-    // We need to regenerate aggregates for our local contacts, due to
-    // the database schema upgrade from version 20 to version 21.
-    QList<QContact> localContacts = contacts(
-            localsFilter,
-            QList<QContactSortOrder>(),
-            QContactFetchHint(),
-            &err);
+    err = writer()->rebuildAggregates(required);
     if (err != QContactManager::NoError) {
-        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to read local contacts during attempt to regenerate aggregates"));
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to rebuild aggregates"));
         return false;
     }
 
-    // Simply save them all; this should regenerate aggregates as required.
-    if (!saveContacts(&localContacts, nullptr, &err)) {
-        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to save local contacts during attempt to regenerate aggregates"));
+    // Regenerate any aggregates whose deferred regeneration did not complete
+    err = writer()->resumeDeferredAggregates();
+    if (err != QContactManager::NoError) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to regenerate deferred aggregates"));
         return false;
     }
 
@@ -2257,6 +2674,7 @@ ContactWriter *ContactsEngine::writer()
 {
     if (!m_synchronousWriter) {
         m_synchronousWriter.reset(new ContactWriter(*this, database(), m_notifier.data(), reader()));
+        m_synchronousWriter->setDeferAggregateRegeneration(m_deferAggregateRegeneration);
     }
     return m_synchronousWriter.data();
 }
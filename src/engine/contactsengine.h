@@ -41,11 +41,18 @@
 #include <QList>
 #include <QMap>
 #include <QString>
+#include <QTimer>
+#include <QDBusMessage>
 
 #include "contactsdatabase.h"
 #include "contactnotifier.h"
 #include "contactreader.h"
 #include "contactwriter.h"
+#include "contactidcache_p.h"
+#include "contactattributeindex_p.h"
+#include "contactrefinementcache_p.h"
+#include "aggregationcandidateindex_p.h"
+#include "phonenumberindex_p.h"
 
 // QList<int> is widely used in qtpim
 Q_DECLARE_METATYPE(QList<int>)
@@ -145,6 +152,7 @@ public:
     bool startRequest(QContactChangesFetchRequest* request) override;
     bool startRequest(QContactChangesSaveRequest* request) override;
     bool startRequest(QContactClearChangeFlagsRequest* request) override;
+    bool startRequest(QContactDuplicateFetchRequest* request) override;
     bool cancelRequest(QContactAbstractRequest* req) override;
     bool cancelRequest(QObject* request) override;
     bool waitForRequestFinished(QContactAbstractRequest* req, int msecs) override;
@@ -195,25 +203,64 @@ public:
 
     QStringList displayLabelGroups() override;
 
+    bool contactCount(const QContactFilter &filter,
+                      int *count,
+                      QContactManager::Error *error) override;
+    bool displayLabelGroupCounts(const QContactFilter &filter,
+                                 QList<QtContactsSqliteExtensions::DisplayLabelGroupCount> *counts,
+                                 QContactManager::Error *error) override;
+
+    bool profileContactQuery(const QContactFilter &filter,
+                             const QList<QContactSortOrder> &sortOrders,
+                             const QContactFetchHint &fetchHint,
+                             QList<QtContactsSqliteExtensions::QueryProfileStep> *steps,
+                             QContactManager::Error *error) override;
+
+    bool upcomingDates(const QDate &startDate,
+                       int maximumCount,
+                       bool includeDisplayLabels,
+                       QList<QtContactsSqliteExtensions::UpcomingDate> *dates,
+                       QContactManager::Error *error) override;
+
+    void contactIdCacheStatistics(int *hits, int *misses) override;
+    void refinementCacheStatistics(int *hits, int *misses) override;
+
+    bool lookupPhoneNumber(const QString &phoneNumber,
+                           QContactId *contactId,
+                           QString *displayLabel,
+                           QContactManager::Error *error) override;
+    bool aggregationMatch(const QContact &contact,
+                          QContactId *aggregateId,
+                          int *score,
+                          QContactManager::Error *error) override;
+
     QString synthesizedDisplayLabel(const QContact &contact, QContactManager::Error *error) const;
     static bool setContactDisplayLabel(QContact *contact, const QString &label, const QString &group, int sortOrder);
+    static bool updateGlobalPresence(QContact *contact);
     static QString normalizedPhoneNumber(const QString &input);
+    static QString reversedPhoneNumber(const QString &input);
+    static QString keypadDigits(const QString &input);
+
+    void aggregateRegenerationDeferred();
 
 private slots:
     void _q_collectionsAdded(const QVector<quint32> &collectionIds);
     void _q_collectionsChanged(const QVector<quint32> &collectionIds);
-    void _q_collectionsRemoved(const QVector<quint32> &collectionIds);
-    void _q_collectionContactsChanged(const QVector<quint32> &collectionIds);
-    void _q_contactsChanged(const QVector<quint32> &contactIds);
+    void _q_collectionsRemoved(const QVector<quint32> &collectionIds, const QDBusMessage &message);
+    void _q_collectionContactsChanged(const QVector<quint32> &collectionIds, const QDBusMessage &message);
+    void _q_contactsChanged(const QVector<quint32> &contactIds, const QDBusMessage &message);
     void _q_contactsPresenceChanged(const QVector<quint32> &contactIds);
-    void _q_contactsAdded(const QVector<quint32> &contactIds);
-    void _q_contactsRemoved(const QVector<quint32> &contactIds);
+    void _q_contactsAdded(const QVector<quint32> &contactIds, const QDBusMessage &message);
+    void _q_contactsRemoved(const QVector<quint32> &contactIds, const QDBusMessage &message);
     void _q_selfContactIdChanged(quint32,quint32);
     void _q_relationshipsAdded(const QVector<quint32> &contactIds);
     void _q_relationshipsRemoved(const QVector<quint32> &contactIds);
     void _q_displayLabelGroupsChanged();
+    void _q_regenerateDeferredAggregates();
 
 private:
+    AggregationCandidateIndex *aggregationCandidateIndex();
+    void invalidateAttributeIndex(const QDBusMessage &message);
     bool regenerateAggregatesIfNeeded();
     QString databaseUuid();
     ContactsDatabase &database();
@@ -225,11 +272,20 @@ private:
     const QString m_name;
     QMap<QString, QString> m_parameters;
     QString m_managerUri;
+    // Shared with the job thread, so they are destroyed after it
+    mutable ContactIdCache m_contactIdCache;
+    ContactAttributeIndex m_attributeIndex;
+    ContactRefinementCache m_refinementCache;
+    AggregationCandidateIndex m_aggregationCandidateIndex;
     QScopedPointer<ContactsDatabase> m_database;
     mutable QScopedPointer<ContactReader> m_synchronousReader;
     QScopedPointer<ContactWriter> m_synchronousWriter;
     QScopedPointer<ContactNotifier> m_notifier;
     QScopedPointer<JobThread> m_jobThread;
+    PhoneNumberIndex m_phoneNumberIndex;
+    QTimer m_aggregateRegenerationTimer;
+    bool m_deferAggregateRegeneration;
+    bool m_useAggregationCandidateIndex;
 
     Q_DISABLE_COPY(ContactsEngine);
 };
@@ -689,6 +689,38 @@ QPair<QDateTime, QList<QContactDetail> > ContactsTransientStore::contactDetails(
     return qMakePair(QDateTime(), QList<QContactDetail>());
 }
 
+QHash<quint32, QPair<QDateTime, QList<QContactDetail> > > ContactsTransientStore::contactDetails(const QList<quint32> &contactIds) const
+{
+    QHash<quint32, QPair<QDateTime, QList<QContactDetail> > > rv;
+
+    // Copy the stored data while holding the lock once, and deserialize it after releasing.
+    // The table returns raw data referencing the shared memory, so it must be deep-copied here.
+    QList<QPair<quint32, QByteArray> > values;
+    {
+        const SharedMemoryManager::TableHandle table(sharedMemory()->table(m_identifier));
+        if (!table || table->count() == 0)
+            return rv;
+
+        foreach (quint32 contactId, contactIds) {
+            const QByteArray data(table->value(contactId));
+            if (!data.isEmpty()) {
+                values.append(qMakePair(contactId, QByteArray(data.constData(), data.size())));
+            }
+        }
+    }
+
+    QList<QPair<quint32, QByteArray> >::const_iterator it = values.constBegin(), end = values.constEnd();
+    for ( ; it != end; ++it) {
+        QDataStream is(it->second);
+        QDateTime dt;
+        QList<QContactDetail> details;
+        is >> dt >> details;
+        rv.insert(it->first, qMakePair(dt, details));
+    }
+
+    return rv;
+}
+
 bool ContactsTransientStore::setContactDetails(quint32 contactId, const QDateTime &timestamp, const QList<QContactDetail> &details)
 {
     SharedMemoryManager::TableHandle table(sharedMemory()->table(m_identifier));
@@ -39,6 +39,7 @@
 #include <QContactDetail>
 
 #include <QDateTime>
+#include <QHash>
 #include <QPair>
 #include <QSharedPointer>
 
@@ -89,6 +90,7 @@ public:
     bool contains(quint32 contactId) const;
 
     QPair<QDateTime, QList<QContactDetail> > contactDetails(quint32 contactId) const;
+    QHash<quint32, QPair<QDateTime, QList<QContactDetail> > > contactDetails(const QList<quint32> &contactIds) const;
     bool setContactDetails(quint32 contactId, const QDateTime &timestamp, const QList<QContactDetail> &details);
 
     bool remove(quint32 contactId);
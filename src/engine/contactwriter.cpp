@@ -190,6 +190,200 @@ static const QString possibleAggregatesTable(QStringLiteral("possibleAggregates"
 static const QString matchEmailAddressesTable(QStringLiteral("matchEmailAddresses"));
 static const QString matchPhoneNumbersTable(QStringLiteral("matchPhoneNumbers"));
 static const QString matchOnlineAccountsTable(QStringLiteral("matchOnlineAccounts"));
+static const QString aggregationCandidatesTable(QStringLiteral("aggregationCandidates"));
+
+/*
+    The columns and values of a row of a detail table, from which the statement
+    inserting or updating the row is built.  A row is updated where its detailId
+    and contactId columns match.
+*/
+class DetailRow
+{
+public:
+    explicit DetailRow(const QString &table);
+
+    void bind(const QString &column, const QVariant &value);
+
+    QString table() const { return m_table; }
+    const QStringList &columns() const { return m_columns; }
+    const QVariantList &values() const { return m_values; }
+
+    ContactsDatabase::Query prepare(ContactsDatabase &database, bool update) const;
+
+private:
+    QString m_table;
+    QStringList m_columns;
+    QVariantList m_values;
+};
+
+DetailRow::DetailRow(const QString &table)
+    : m_table(table)
+{
+}
+
+void DetailRow::bind(const QString &column, const QVariant &value)
+{
+    m_columns.append(column);
+    m_values.append(value);
+}
+
+ContactsDatabase::Query DetailRow::prepare(ContactsDatabase &database, bool update) const
+{
+    const QString detailIdColumn(QStringLiteral("detailId"));
+    const QString contactIdColumn(QStringLiteral("contactId"));
+
+    QStringList terms;
+    QString statement;
+    if (update) {
+        foreach (const QString &column, m_columns) {
+            if (column != detailIdColumn && column != contactIdColumn)
+                terms.append(QStringLiteral("%1 = :%1").arg(column));
+        }
+        statement = QStringLiteral(" UPDATE %1 SET %2 WHERE detailId = :detailId AND contactId = :contactId")
+                .arg(m_table).arg(terms.join(QStringLiteral(", ")));
+    } else {
+        foreach (const QString &column, m_columns) {
+            terms.append(QStringLiteral(":") + column);
+        }
+        statement = QStringLiteral(" INSERT INTO %1 (%2) VALUES (%3)")
+                .arg(m_table).arg(m_columns.join(QStringLiteral(", "))).arg(terms.join(QStringLiteral(", ")));
+    }
+
+    ContactsDatabase::Query query(database.prepare(statement));
+    for (int i = 0; i < m_columns.count(); ++i) {
+        query.bindValue(QStringLiteral(":") + m_columns.at(i), m_values.at(i));
+    }
+    return query;
+}
+
+/*
+    Accumulates the rows inserted for new details, and the Aggregates
+    relationships of new aggregates, so that the rows of each table can be
+    written with multi-row INSERT statements once the batch is complete.
+    The ids of the Details rows are allocated in advance, since the rows are
+    not written until the batch is flushed.
+*/
+class DetailInsertBatch
+{
+public:
+    explicit DetailInsertBatch(ContactsDatabase &database);
+
+    quint32 allocateDetailId(QContactManager::Error *error);
+    void append(const DetailRow &row);
+    bool flush();
+
+private:
+    struct Statement
+    {
+        QString prefix;     // the statement text preceding the VALUES clause
+        int columnCount;
+        QList<QVariantList> rows;
+    };
+
+    ContactsDatabase &m_database;
+    quint32 m_nextDetailId;
+    QStringList m_order;
+    QHash<QString, Statement> m_statements;
+};
+
+DetailInsertBatch::DetailInsertBatch(ContactsDatabase &database)
+    : m_database(database)
+    , m_nextDetailId(0)
+{
+}
+
+quint32 DetailInsertBatch::allocateDetailId(QContactManager::Error *error)
+{
+    if (m_nextDetailId == 0) {
+        // Continue from the AUTOINCREMENT sequence, as an insertion without an id would
+        const QString statement(QStringLiteral(
+            " SELECT MAX("
+                " COALESCE((SELECT seq FROM sqlite_sequence WHERE name = 'Details'), 0),"
+                " COALESCE((SELECT MAX(detailId) FROM Details), 0))"));
+
+        ContactsDatabase::Query query(m_database.prepare(statement));
+        if (!ContactsDatabase::execute(query) || !query.next()) {
+            query.reportError("Failed to determine the next detail id");
+            *error = QContactManager::UnspecifiedError;
+            return 0;
+        }
+        m_nextDetailId = query.value<quint32>(0) + 1;
+    }
+
+    return m_nextDetailId++;
+}
+
+void DetailInsertBatch::append(const DetailRow &row)
+{
+    const QString prefix(QStringLiteral(" INSERT INTO %1 (%2) ").arg(row.table()).arg(row.columns().join(QStringLiteral(", "))));
+
+    QHash<QString, Statement>::iterator it = m_statements.find(prefix);
+    if (it == m_statements.end()) {
+        Statement statement;
+        statement.prefix = prefix;
+        statement.columnCount = row.columns().count();
+
+        it = m_statements.insert(prefix, statement);
+        m_order.append(prefix);
+    }
+
+    it->rows.append(row.values());
+}
+
+bool DetailInsertBatch::flush()
+{
+    // The statements are written in order of first use, so the Details rows precede the others
+    bool rv = true;
+    foreach (const QString &prefix, m_order) {
+        const Statement &statement(m_statements[prefix]);
+
+        QStringList terms;
+        for (int i = 0; i < statement.columnCount; ++i) {
+            terms.append(QStringLiteral("?"));
+        }
+        const QString row(QStringLiteral("(%1)").arg(terms.join(QChar::fromLatin1(','))));
+
+        // SQLite allows up to 999 bound values, and 500 rows per insert
+        const int batchSize = qMax(1, qMin(500, 999 / qMax(1, statement.columnCount)));
+
+        QList<QVariantList>::const_iterator it = statement.rows.constBegin(), end = statement.rows.constEnd();
+        while (rv && it != end) {
+            const int count = qMin<int>(batchSize, end - it);
+
+            QStringList rows;
+            for (int i = 0; i < count; ++i)
+                rows.append(row);
+            const QString insertStatement(statement.prefix + QStringLiteral("VALUES ") + rows.join(QChar::fromLatin1(',')));
+
+            QSqlQuery query(m_database);
+            if (!query.prepare(insertStatement)) {
+                QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to prepare batched detail insert: %1\n%2")
+                        .arg(query.lastError().text())
+                        .arg(insertStatement));
+                rv = false;
+                break;
+            }
+            for (QList<QVariantList>::const_iterator batchEnd = it + count; it != batchEnd; ++it) {
+                foreach (const QVariant &value, *it)
+                    query.addBindValue(value);
+            }
+            if (!ContactsDatabase::execute(query)) {
+                QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to insert batched details: %1\n%2")
+                        .arg(query.lastError().text())
+                        .arg(insertStatement));
+                rv = false;
+            }
+            query.finish();
+        }
+        if (!rv)
+            break;
+    }
+
+    m_order.clear();
+    m_statements.clear();
+    m_nextDetailId = 0;
+    return rv;
+}
 
 ContactWriter::ContactWriter(ContactsEngine &engine, ContactsDatabase &database, ContactNotifier *notifier, ContactReader *reader)
     : m_engine(engine)
@@ -197,6 +391,13 @@ ContactWriter::ContactWriter(ContactsEngine &engine, ContactsDatabase &database,
     , m_notifier(notifier)
     , m_reader(reader)
     , m_managerUri(engine.managerUri())
+    , m_detailBatch(nullptr)
+    , m_aggregationCandidatesGeneration(0)
+    , m_staleIsNotRelationships(false)
+    , m_isNotRelationshipsWritten(false)
+    , m_prescoredMatches(nullptr)
+    , m_attributeIndexStale(false)
+    , m_deferAggregateRegeneration(false)
     , m_displayLabelGroupsChanged(false)
 {
     Q_ASSERT(notifier);
@@ -207,6 +408,88 @@ ContactWriter::~ContactWriter()
 {
 }
 
+static bool readDeferredAggregateIds(ContactsDatabase &database, QSet<quint32> *aggregateIds)
+{
+    ContactsDatabase::Query query(database.prepare("SELECT Value FROM DbSettings WHERE Name = 'DeferredAggregateIds'"));
+    if (!ContactsDatabase::execute(query)) {
+        query.reportError("Failed to query deferred aggregate ids");
+        return false;
+    }
+
+    if (query.next()) {
+        foreach (const QString &id, query.value<QString>(0).split(QLatin1Char(' '), QString::SkipEmptyParts)) {
+            aggregateIds->insert(id.toUInt());
+        }
+    }
+    query.finish();
+    return true;
+}
+
+static bool storeDeferredAggregateIds(ContactsDatabase &database, const QSet<quint32> &aggregateIds)
+{
+    if (aggregateIds.isEmpty()) {
+        ContactsDatabase::Query query(database.prepare("DELETE FROM DbSettings WHERE Name = 'DeferredAggregateIds'"));
+        if (!ContactsDatabase::execute(query)) {
+            query.reportError("Failed to clear deferred aggregate ids");
+            return false;
+        }
+        return true;
+    }
+
+    QStringList ids;
+    foreach (quint32 aggregateId, aggregateIds) {
+        ids.append(QString::number(aggregateId));
+    }
+
+    ContactsDatabase::Query query(database.prepare("INSERT OR REPLACE INTO DbSettings (Name, Value) VALUES ('DeferredAggregateIds', :value)"));
+    query.bindValue(":value", ids.join(QLatin1Char(' ')));
+    if (!ContactsDatabase::execute(query)) {
+        query.reportError("Failed to store deferred aggregate ids");
+        return false;
+    }
+    return true;
+}
+
+/*
+    The ids of deferred aggregates are recorded in the database, in the same
+    transaction as the constituent changes which they are deferred for, so
+    that a regeneration lost with the process is performed when the database
+    is next opened.  The record is shared by every writer: an aggregate is
+    removed from it by whichever regenerates the aggregate first, since the
+    regeneration includes every change committed before it.
+*/
+bool ContactWriter::recordDeferredAggregates(const QHash<quint32, DetailList> &deferredAggregates)
+{
+    QSet<quint32> added;
+    QSet<quint32> regenerated;
+    for (QHash<quint32, DetailList>::const_iterator it = deferredAggregates.constBegin(); it != deferredAggregates.constEnd(); ++it) {
+        if (!m_deferredAggregates.contains(it.key()))
+            added.insert(it.key());
+    }
+    for (QHash<quint32, DetailList>::const_iterator it = m_deferredAggregates.constBegin(); it != m_deferredAggregates.constEnd(); ++it) {
+        if (!deferredAggregates.contains(it.key()))
+            regenerated.insert(it.key());
+    }
+    foreach (quint32 aggregateId, m_regeneratedAggregateIds) {
+        if (!deferredAggregates.contains(aggregateId))
+            regenerated.insert(aggregateId);
+    }
+    if (added.isEmpty() && regenerated.isEmpty())
+        return true;
+
+    QSet<quint32> aggregateIds;
+    if (!readDeferredAggregateIds(m_database, &aggregateIds))
+        return false;
+
+    const QSet<quint32> recorded(aggregateIds);
+    aggregateIds.subtract(regenerated);
+    aggregateIds.unite(added);
+    if (aggregateIds == recorded)
+        return true;
+
+    return storeDeferredAggregateIds(m_database, aggregateIds);
+}
+
 bool ContactWriter::beginTransaction()
 {
     return m_database.beginTransaction();
@@ -214,12 +497,66 @@ bool ContactWriter::beginTransaction()
 
 bool ContactWriter::commitTransaction()
 {
+    QHash<quint32, DetailList> deferredAggregates(m_deferredAggregates);
+    if (m_deferAggregateRegeneration) {
+        // The aggregates are regenerated once the writer is idle
+        for (QHash<quint32, DetailList>::const_iterator it = m_queuedAggregates.constBegin(); it != m_queuedAggregates.constEnd(); ++it) {
+            queueAggregateRegeneration(&deferredAggregates, it.key(), it.value());
+        }
+        m_queuedAggregates.clear();
+    } else if (regenerateQueuedAggregates() != QContactManager::NoError) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to regenerate aggregates before commit"));
+        rollbackTransaction();
+        return false;
+    }
+
+    foreach (quint32 aggregateId, m_regeneratedAggregateIds) {
+        deferredAggregates.remove(aggregateId);
+    }
+    foreach (const QContactId &id, m_removedIds) {
+        deferredAggregates.remove(ContactId::databaseId(id));
+    }
+    if (!recordDeferredAggregates(deferredAggregates)) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to record deferred aggregates before commit"));
+        rollbackTransaction();
+        return false;
+    }
+
+    QSharedPointer<const ContactAttributeIndex::Entries> attributeEntries;
+    quint64 attributeGeneration = 0;
+    updatedAttributeIndexEntries(&attributeEntries, &attributeGeneration);
+
     if (!m_database.commitTransaction()) {
         QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Commit error: %1").arg(m_database.lastError().text()));
         rollbackTransaction();
         return false;
     }
 
+    if (attributeEntries) {
+        // Entries which are up to date with this commit are valid for the following generation
+        m_database.attributeIndex()->update(attributeEntries, attributeGeneration + 1);
+    }
+    m_writtenAttributeIds.clear();
+    m_attributeIndexStale = false;
+
+    m_deferredAggregates = deferredAggregates;
+    m_regeneratedAggregateIds.clear();
+    if (!m_deferredAggregates.isEmpty()) {
+        m_engine.aggregateRegenerationDeferred();
+    }
+
+    if (m_aggregationCandidates) {
+        // Entries which are up to date with this commit are valid for the following generation
+        if (m_staleAggregationCandidates.isEmpty() && !m_staleIsNotRelationships) {
+            m_database.aggregationCandidateIndex()->update(m_aggregationCandidates, m_aggregationCandidatesGeneration + 1);
+        }
+        m_aggregationCandidates.clear();
+    }
+    m_staleAggregationCandidates.clear();
+    m_staleIsNotRelationships = false;
+    m_writtenAggregationCandidates.clear();
+    m_isNotRelationshipsWritten = false;
+
     if (m_displayLabelGroupsChanged) {
         m_notifier->displayLabelGroupsChanged();
         m_displayLabelGroupsChanged = false;
@@ -279,6 +616,15 @@ void ContactWriter::rollbackTransaction()
 {
     m_database.rollbackTransaction();
 
+    m_queuedAggregates.clear();
+    m_regeneratedAggregateIds.clear();
+    m_aggregationCandidates.clear();
+    m_staleAggregationCandidates.clear();
+    m_staleIsNotRelationships = false;
+    m_writtenAggregationCandidates.clear();
+    m_isNotRelationshipsWritten = false;
+    m_writtenAttributeIds.clear();
+    m_attributeIndexStale = false;
     m_addedCollectionIds.clear();
     m_changedCollectionIds.clear();
     m_removedCollectionIds.clear();
@@ -424,6 +770,9 @@ QString relationshipString(T type)
 QContactManager::Error ContactWriter::saveRelationships(
         const QList<QContactRelationship> &relationships, QMap<int, QContactManager::Error> *errorMap, bool withinAggregateUpdate)
 {
+    // IsNot relationships prevent aggregation, so they must be read again before matching
+    aggregationCandidateRelationshipsWritten();
+
     // in order to perform duplicate detection we build up the following datastructure.
     QMultiMap<quint32, QPair<QString, quint32> > bucketedRelationships; // first id to <type, second id>.
     {
@@ -547,10 +896,7 @@ QContactManager::Error ContactWriter::saveRelationships(
     }
 
     if (m_database.aggregating() && !aggregatesAffected.isEmpty() && !withinAggregateUpdate) {
-        QContactManager::Error writeError = regenerateAggregates(aggregatesAffected.toList(), DetailList(), true);
-        if (writeError != QContactManager::NoError) {
-            return writeError;
-        }
+        queueAggregateRegeneration(aggregatesAffected.toList(), DetailList());
     }
 
     return QContactManager::NoError;
@@ -589,6 +935,9 @@ QContactManager::Error ContactWriter::remove(
 QContactManager::Error ContactWriter::removeRelationships(
         const QList<QContactRelationship> &relationships, QMap<int, QContactManager::Error> *errorMap)
 {
+    // IsNot relationships prevent aggregation, so they must be read again before matching
+    aggregationCandidateRelationshipsWritten();
+
     // in order to perform existence detection we build up the following datastructure.
     QMultiMap<quint32, QPair<QString, quint32> > bucketedRelationships; // first id to <type, second id>.
     {
@@ -677,9 +1026,7 @@ QContactManager::Error ContactWriter::removeRelationships(
         }
 
         if (!aggregatesAffected.isEmpty()) {
-            QContactManager::Error writeError = regenerateAggregates(aggregatesAffected.toList(), DetailList(), true);
-            if (writeError != QContactManager::NoError)
-                return writeError;
+            queueAggregateRegeneration(aggregatesAffected.toList(), DetailList());
         }
 
         // Some contacts may need to have new aggregates created
@@ -847,6 +1194,7 @@ QContactManager::Error ContactWriter::deleteCollection(const QContactCollectionI
         deleteCollectionContacts.reportError("Failed to delete collection contacts");
         return QContactManager::UnspecifiedError;
     }
+    m_attributeIndexStale = true;
 
     return QContactManager::NoError;
 }
@@ -944,6 +1292,13 @@ QContactManager::Error ContactWriter::removeContacts(const QVariantList &ids, bo
     ).arg(onlyIfFlagged ? QStringLiteral("AND changeFlags >= 4 AND unhandledChangeFlags < 4") // ChangeFlags::IsDeleted
                         : QString()));
 
+    // Relationships of the removed contacts are removed with them
+    foreach (const QVariant &id, ids) {
+        aggregationCandidateWritten(id.value<quint32>());
+    }
+    aggregationCandidateRelationshipsWritten();
+    contactAttributesWritten(ids);
+
     // do it in batches, otherwise the query can fail due to too many bound values.
     for (int i = 0; i < ids.size(); i += 167) {
         const QVariantList cids = ids.mid(i, qMin(ids.size() - i, 167));
@@ -1224,14 +1579,7 @@ QContactManager::Error ContactWriter::remove(const QList<QContactId> &contactIds
 
     // Now regenerate our remaining aggregates as required.
     if (aggregatesOfRemoved.size() > 0) {
-        QContactManager::Error writeError = regenerateAggregates(aggregatesOfRemoved, DetailList(), true);
-        if (writeError != QContactManager::NoError) {
-            if (!withinTransaction) {
-                // only rollback the transaction if we created it
-                rollbackTransaction();
-            }
-            return writeError;
-        }
+        queueAggregateRegeneration(aggregatesOfRemoved, DetailList());
     }
 
     foreach (const QContactId &id, realRemoveIds) {
@@ -1382,6 +1730,25 @@ static ContactWriter::DetailList getPresenceUpdateDetailTypes()
     return rv;
 }
 
+// The number of new contacts in a single save which are imported in bulk
+static const int BulkImportMinimumCount = 50;
+
+// The number of contacts in a single save whose aggregates are matched before the transaction
+static const int PrescoredMatchMinimumCount = 16;
+
+static ContactWriter::DetailList getSearchIndexDetailTypes()
+{
+    // The list of types for details whose values are stored in the full-text search index
+    ContactWriter::DetailList rv;
+    rv << detailType<QContactName>();
+    rv << detailType<QContactNickname>();
+    rv << detailType<QContactEmailAddress>();
+    rv << detailType<QContactPhoneNumber>();
+    rv << detailType<QContactOrganization>();
+    rv << detailType<QContactNote>();
+    return rv;
+}
+
 template<typename T>
 static bool detailListContains(const ContactWriter::DetailList &list)
 {
@@ -1398,6 +1765,20 @@ static bool detailListContains(const ContactWriter::DetailList &list, const QCon
     return list.contains(detailType(detail));
 }
 
+static bool searchContentChanged(const ContactWriter::DetailList &definitionMask)
+{
+    static const ContactWriter::DetailList searchIndexDetailTypes(getSearchIndexDetailTypes());
+
+    if (definitionMask.isEmpty())
+        return true;
+
+    foreach (QContactDetail::DetailType type, definitionMask) {
+        if (detailListContains(searchIndexDetailTypes, type))
+            return true;
+    }
+    return false;
+}
+
 bool removeCommonDetails(ContactsDatabase &db, quint32 contactId, const QString &typeName, QContactManager::Error *error)
 {
     const QString statement(QStringLiteral("DELETE FROM Details WHERE contactId = :contactId AND detail = :detail"));
@@ -1427,6 +1808,20 @@ QVariant detailValue(const T &detail, F field)
     return detail.value(field);
 }
 
+static QVariant sortKeyValue(const ContactsDatabase &db, const QString &value)
+{
+    // Blank values are stored as NULL
+    const QByteArray key(db.sortKey(value));
+    return key.isEmpty() ? QVariant(QVariant::ByteArray) : QVariant(key);
+}
+
+static QVariant monthDayValue(const QVariant &value)
+{
+    // Dates which cannot be interpreted are stored as NULL
+    const QDate date(value.toDate());
+    return date.isValid() ? QVariant(ContactsDatabase::monthDay(date)) : QVariant(QVariant::Int);
+}
+
 /*
  Steps:
  - begin transaction
@@ -1484,6 +1879,7 @@ QContactManager::Error ContactWriter::clearChangeFlags(const QList<QContactId> &
             }
             return QContactManager::UnspecifiedError;
         }
+        contactAttributesWritten(cids);
 
         // fourth, clear any added/modified change flags for details of contacts specified in the list.
         const QString detstatement(QStringLiteral("UPDATE Details SET changeFlags = unhandledChangeFlags, unhandledChangeFlags = 0 WHERE contactId = :contactId"));
@@ -2064,57 +2460,15 @@ QVariant detailContexts(const QContactDetail &detail)
 
 quint32 writeCommonDetails(ContactsDatabase &db, quint32 contactId, quint32 detailId, const QContactDetail &detail,
                            bool syncable, bool wasLocal, bool aggregateContact, bool recordUnhandledChangeFlags,
-                           const QString &typeName, QContactManager::Error *error)
-{
-    const QString statement(detailId == 0
-        ? QStringLiteral(
-            " INSERT INTO Details ("
-            "  contactId,"
-            "  detail,"
-            "  detailUri,"
-            "  linkedDetailUris,"
-            "  contexts,"
-            "  accessConstraints,"
-            "  provenance,"
-            "  modifiable,"
-            "  nonexportable,"
-            "  changeFlags,"
-            "  unhandledChangeFlags,"
-            "  created,"
-            "  modified)"
-            " VALUES ("
-            "  :contactId,"
-            "  :detail,"
-            "  :detailUri,"
-            "  :linkedDetailUris,"
-            "  :contexts,"
-            "  :accessConstraints,"
-            "  :provenance,"
-            "  :modifiable,"
-            "  :nonexportable,"
-            "  %1,"
-            "  %2,"
-            "  :created,"
-            "  :modified)"
-              ).arg(aggregateContact ? QStringLiteral("0") : QStringLiteral("1"))  // ChangeFlags::IsAdded
-                    .arg((aggregateContact || !recordUnhandledChangeFlags) ? QStringLiteral("0") : QStringLiteral("1"))
-        : QStringLiteral(
-            " UPDATE Details SET"
-            "  detail = :detail,"
-            "  detailUri = :detailUri,"
-            "  linkedDetailUris = :linkedDetailUris,"
-            "  contexts = :contexts,"
-            "  accessConstraints = :accessConstraints,"
-            "  provenance = :provenance,"
-            "  modifiable = :modifiable,"
-            "  nonexportable = :nonexportable"
-            "  %1 %2,"
-            "  modified = :modified"
-            " WHERE contactId = :contactId AND detailId = :detailId")
-                .arg(aggregateContact ? QString() : QStringLiteral(", ChangeFlags = ChangeFlags | 2")) // ChangeFlags::IsModified
-                .arg((aggregateContact || !recordUnhandledChangeFlags) ? QString() : QStringLiteral(", UnhandledChangeFlags = UnhandledChangeFlags | 2")));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+                           const QString &typeName, DetailInsertBatch *batch, QContactManager::Error *error)
+{
+    const bool insert = (detailId == 0);
+    if (insert && batch) {
+        // The row is written when the batch is flushed, so its id must be allocated now
+        detailId = batch->allocateDetailId(error);
+        if (detailId == 0)
+            return 0;
+    }
 
     const QVariant detailUri = detailValue(detail, QContactDetail::FieldDetailUri);
     const QVariant linkedDetailUris = QVariant(detail.linkedDetailUris().join(QStringLiteral(";")));
@@ -2129,12 +2483,60 @@ quint32 writeCommonDetails(ContactsDatabase &db, quint32 contactId, quint32 deta
             ? detailValue(detail, QContactDetail__FieldModified)
             : ContactsDatabase::dateTimeString(QDateTime::currentDateTimeUtc());
 
-    if (detailId > 0) {
-        query.bindValue(":detailId", detailId);
-    } else {
-        query.bindValue(":created", modified);
+    if (insert) {
+        DetailRow row(QStringLiteral("Details"));
+        if (batch) {
+            row.bind(QStringLiteral("detailId"), detailId);
+        }
+        row.bind(QStringLiteral("contactId"), contactId);
+        row.bind(QStringLiteral("detail"), typeName);
+        row.bind(QStringLiteral("detailUri"), detailUri);
+        row.bind(QStringLiteral("linkedDetailUris"), linkedDetailUris);
+        row.bind(QStringLiteral("contexts"), contexts);
+        row.bind(QStringLiteral("accessConstraints"), accessConstraints);
+        row.bind(QStringLiteral("provenance"), provenance);
+        row.bind(QStringLiteral("modifiable"), modifiable);
+        row.bind(QStringLiteral("nonexportable"), nonexportable);
+        row.bind(QStringLiteral("changeFlags"), aggregateContact ? 0 : 1); // ChangeFlags::IsAdded
+        row.bind(QStringLiteral("unhandledChangeFlags"), (aggregateContact || !recordUnhandledChangeFlags) ? 0 : 1);
+        row.bind(QStringLiteral("created"), modified);
+        row.bind(QStringLiteral("modified"), modified);
+
+        if (batch) {
+            batch->append(row);
+            return detailId;
+        }
+
+        ContactsDatabase::Query query(row.prepare(db, false));
+        if (!ContactsDatabase::execute(query)) {
+            query.reportError(QStringLiteral("Failed to write common details for %1\ndetailUri: %2, linkedDetailUris: %3")
+                    .arg(typeName)
+                    .arg(detailUri.value<QString>())
+                    .arg(linkedDetailUris.value<QString>()));
+            *error = QContactManager::UnspecifiedError;
+            return 0;
+        }
+        return query.lastInsertId().value<quint32>();
     }
 
+    const QString statement(QStringLiteral(
+            " UPDATE Details SET"
+            "  detail = :detail,"
+            "  detailUri = :detailUri,"
+            "  linkedDetailUris = :linkedDetailUris,"
+            "  contexts = :contexts,"
+            "  accessConstraints = :accessConstraints,"
+            "  provenance = :provenance,"
+            "  modifiable = :modifiable,"
+            "  nonexportable = :nonexportable"
+            "  %1 %2,"
+            "  modified = :modified"
+            " WHERE contactId = :contactId AND detailId = :detailId")
+                .arg(aggregateContact ? QString() : QStringLiteral(", ChangeFlags = ChangeFlags | 2")) // ChangeFlags::IsModified
+                .arg((aggregateContact || !recordUnhandledChangeFlags) ? QString() : QStringLiteral(", UnhandledChangeFlags = UnhandledChangeFlags | 2")));
+
+    ContactsDatabase::Query query(db.prepare(statement));
+    query.bindValue(":detailId", detailId);
     query.bindValue(":contactId", contactId);
     query.bindValue(":detail", typeName);
     query.bindValue(":detailUri", detailUri);
@@ -2155,7 +2557,7 @@ quint32 writeCommonDetails(ContactsDatabase &db, quint32 contactId, quint32 deta
         return 0;
     }
 
-    return detailId == 0 ? query.lastInsertId().value<quint32>() : detailId;
+    return detailId;
 }
 
 template <typename T> quint32 ContactWriter::writeCommonDetails(
@@ -2166,7 +2568,7 @@ template <typename T> quint32 ContactWriter::writeCommonDetails(
     return ::writeCommonDetails(
             m_database, contactId, detailId, detail,
             syncable, wasLocal, aggregateContact, recordUnhandledChangeFlags,
-            detailTypeName<T>(), error);
+            detailTypeName<T>(), m_detailBatch, error);
 }
 
 // Define the type that another type is generated from
@@ -2183,25 +2585,38 @@ QContactDetail::DetailType generatorType(QContactDetail::DetailType type)
     return type;
 }
 
-bool deleteDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, const QString &typeName, bool recordUnhandledChangeFlags, QContactManager::Error *error)
+bool deleteDetails(ContactsDatabase &db, quint32 contactId, const QList<quint32> &detailIds, const QString &typeName, bool recordUnhandledChangeFlags, QContactManager::Error *error)
 {
-    const QString deleteDetailStatement(QStringLiteral(
-            "UPDATE Details SET"
-            " ChangeFlags = ChangeFlags | 4" // ChangeFlags::IsDeleted
-            " %1"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId").arg(recordUnhandledChangeFlags
-                    ? QStringLiteral(", unhandledChangeFlags = unhandledChangeFlags | 4")
-                    : QString()));
+    // Mark all of the details deleted with a single statement, up to SQLite's limit of bound values
+    QList<quint32>::const_iterator it = detailIds.constBegin(), end = detailIds.constEnd();
+    while (it != end) {
+        const int count = qMin<int>(500, end - it);
+
+        QStringList placeholders;
+        for (int i = 0; i < count; ++i)
+            placeholders.append(QStringLiteral("?"));
+
+        const QString deleteDetailsStatement(QStringLiteral(
+                "UPDATE Details SET"
+                " ChangeFlags = ChangeFlags | 4" // ChangeFlags::IsDeleted
+                " %1"
+                " WHERE contactId = ?"
+                " AND detailId IN (%2)").arg(recordUnhandledChangeFlags
+                        ? QStringLiteral(", unhandledChangeFlags = unhandledChangeFlags | 4")
+                        : QString())
+                                        .arg(placeholders.join(QChar::fromLatin1(','))));
+
+        ContactsDatabase::Query query(db.prepare(deleteDetailsStatement));
+        int index = 0;
+        query.bindValue(index++, contactId);
+        for (QList<quint32>::const_iterator batchEnd = it + count; it != batchEnd; ++it)
+            query.bindValue(index++, *it);
 
-    ContactsDatabase::Query query(db.prepare(deleteDetailStatement));
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":detailId", detailId);
-
-    if (!ContactsDatabase::execute(query)) {
-        query.reportError(QStringLiteral("Failed to delete existing detail of type %1 with id %2 for contact %3").arg(typeName).arg(detailId).arg(contactId));
-        *error = QContactManager::UnspecifiedError;
-        return false;
+        if (!ContactsDatabase::execute(query)) {
+            query.reportError(QStringLiteral("Failed to delete %1 existing details of type %2 for contact %3").arg(count).arg(typeName).arg(contactId));
+            *error = QContactManager::UnspecifiedError;
+            return false;
+        }
     }
 
     return true;
@@ -2358,976 +2773,371 @@ QStringList subTypeList(const QList<int> &subTypes)
     return rv;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactAddress &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Addresses SET"
-            "  street = :street,"
-            "  postOfficeBox = :postOfficeBox,"
-            "  region = :region,"
-            "  locality = :locality,"
-            "  postCode = :postCode,"
-            "  country = :country,"
-            "  subTypes = :subTypes"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Addresses ("
-            "  detailId,"
-            "  contactId,"
-            "  street,"
-            "  postOfficeBox,"
-            "  region,"
-            "  locality,"
-            "  postCode,"
-            "  country,"
-            "  subTypes)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :street,"
-            "  :postOfficeBox,"
-            "  :region,"
-            "  :locality,"
-            "  :postCode,"
-            "  :country,"
-            "  :subTypes)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactAddress &detail)
+{
+    DetailRow row(QStringLiteral("Addresses"));
 
     typedef QContactAddress T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":street", detail.value<QString>(T::FieldStreet).trimmed());
-    query.bindValue(":postOfficeBox", detail.value<QString>(T::FieldPostOfficeBox).trimmed());
-    query.bindValue(":region", detail.value<QString>(T::FieldRegion).trimmed());
-    query.bindValue(":locality", detail.value<QString>(T::FieldLocality).trimmed());
-    query.bindValue(":postCode", detail.value<QString>(T::FieldPostcode).trimmed());
-    query.bindValue(":country", detail.value<QString>(T::FieldCountry).trimmed());
-    query.bindValue(":subTypes", subTypeList(detail.subTypes()).join(QStringLiteral(";")));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("street"), detail.value<QString>(T::FieldStreet).trimmed());
+    row.bind(QStringLiteral("postOfficeBox"), detail.value<QString>(T::FieldPostOfficeBox).trimmed());
+    row.bind(QStringLiteral("region"), detail.value<QString>(T::FieldRegion).trimmed());
+    row.bind(QStringLiteral("locality"), detail.value<QString>(T::FieldLocality).trimmed());
+    row.bind(QStringLiteral("postCode"), detail.value<QString>(T::FieldPostcode).trimmed());
+    row.bind(QStringLiteral("country"), detail.value<QString>(T::FieldCountry).trimmed());
+    row.bind(QStringLiteral("subTypes"), subTypeList(detail.subTypes()).join(QStringLiteral(";")));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactAnniversary &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Anniversaries SET"
-            "  originalDateTime = :originalDateTime,"
-            "  calendarId = :calendarId,"
-            "  subType = :subType,"
-            "  event = :event"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Anniversaries ("
-            "  detailId,"
-            "  contactId,"
-            "  originalDateTime,"
-            "  calendarId,"
-            "  subType,"
-            "  event)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :originalDateTime,"
-            "  :calendarId,"
-            "  :subType,"
-            "  :event)"
-        ));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactAnniversary &detail)
+{
+    DetailRow row(QStringLiteral("Anniversaries"));
 
     typedef QContactAnniversary T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":originalDateTime", detailValue(detail, T::FieldOriginalDate));
-    query.bindValue(":calendarId", detailValue(detail, T::FieldCalendarId));
-    query.bindValue(":subType", detail.hasValue(T::FieldSubType) ? QString::number(detail.subType()) : QString());
-    query.bindValue(":event", detail.value<QString>(T::FieldEvent).trimmed());
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("originalDateTime"), detailValue(detail, T::FieldOriginalDate));
+    row.bind(QStringLiteral("calendarId"), detailValue(detail, T::FieldCalendarId));
+    row.bind(QStringLiteral("subType"), detail.hasValue(T::FieldSubType) ? QString::number(detail.subType()) : QString());
+    row.bind(QStringLiteral("event"), detail.value<QString>(T::FieldEvent).trimmed());
+    row.bind(QStringLiteral("monthDay"), monthDayValue(detailValue(detail, T::FieldOriginalDate)));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactAvatar &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Avatars SET"
-            "  imageUrl = :imageUrl,"
-            "  videoUrl = :videoUrl,"
-            "  avatarMetadata = :avatarMetadata"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Avatars ("
-            "  detailId,"
-            "  contactId,"
-            "  imageUrl,"
-            "  videoUrl,"
-            "  avatarMetadata)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :imageUrl,"
-            "  :videoUrl,"
-            "  :avatarMetadata)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactAvatar &detail)
+{
+    DetailRow row(QStringLiteral("Avatars"));
 
     typedef QContactAvatar T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":imageUrl", detail.value<QString>(T::FieldImageUrl).trimmed());
-    query.bindValue(":videoUrl", detail.value<QString>(T::FieldVideoUrl).trimmed());
-    query.bindValue(":avatarMetadata", detailValue(detail, QContactAvatar::FieldMetaData));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("imageUrl"), detail.value<QString>(T::FieldImageUrl).trimmed());
+    row.bind(QStringLiteral("videoUrl"), detail.value<QString>(T::FieldVideoUrl).trimmed());
+    row.bind(QStringLiteral("avatarMetadata"), detailValue(detail, QContactAvatar::FieldMetaData));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactBirthday &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Birthdays SET"
-            "  birthday = :birthday,"
-            "  calendarId = :calendarId"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Birthdays ("
-            "  detailId,"
-            "  contactId,"
-            "  birthday,"
-            "  calendarId)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :birthday,"
-            "  :calendarId)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactBirthday &detail)
+{
+    DetailRow row(QStringLiteral("Birthdays"));
 
     typedef QContactBirthday T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":birthday", detailValue(detail, T::FieldBirthday));
-    query.bindValue(":calendarId", detailValue(detail, T::FieldCalendarId));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("birthday"), detailValue(detail, T::FieldBirthday));
+    row.bind(QStringLiteral("calendarId"), detailValue(detail, T::FieldCalendarId));
+    row.bind(QStringLiteral("monthDay"), monthDayValue(detailValue(detail, T::FieldBirthday)));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactDisplayLabel &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE DisplayLabels SET"
-            "  displayLabel = :displayLabel,"
-            "  displayLabelGroup = :displayLabelGroup,"
-            "  displayLabelGroupSortOrder = :displayLabelGroupSortOrder"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO DisplayLabels ("
-            "  detailId,"
-            "  contactId,"
-            "  displayLabel,"
-            "  displayLabelGroup,"
-            "  displayLabelGroupSortOrder)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :displayLabel,"
-            "  :displayLabelGroup,"
-            "  :displayLabelGroupSortOrder)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
-
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":displayLabel", detail.label());
-    query.bindValue(":displayLabelGroup", detail.value<QString>(QContactDisplayLabel__FieldLabelGroup));
-    query.bindValue(":displayLabelGroupSortOrder", detail.value<int>(QContactDisplayLabel__FieldLabelGroupSortOrder));
-    return query;
+DetailRow detailRow(ContactsDatabase &db, quint32 contactId, quint32 detailId, const QContactDisplayLabel &detail)
+{
+    DetailRow row(QStringLiteral("DisplayLabels"));
+
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("displayLabel"), detail.label());
+    row.bind(QStringLiteral("displayLabelGroup"), detail.value<QString>(QContactDisplayLabel__FieldLabelGroup));
+    row.bind(QStringLiteral("displayLabelGroupSortOrder"), detail.value<int>(QContactDisplayLabel__FieldLabelGroupSortOrder));
+    row.bind(QStringLiteral("sortDisplayLabel"), sortKeyValue(db, detail.label()));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactEmailAddress &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE EmailAddresses SET"
-            "  emailAddress = :emailAddress,"
-            "  lowerEmailAddress = :lowerEmailAddress"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO EmailAddresses ("
-            "  detailId,"
-            "  contactId,"
-            "  emailAddress,"
-            "  lowerEmailAddress)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :emailAddress,"
-            "  :lowerEmailAddress)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactEmailAddress &detail)
+{
+    DetailRow row(QStringLiteral("EmailAddresses"));
 
     typedef QContactEmailAddress T;
     const QString address(detail.value<QString>(T::FieldEmailAddress).trimmed());
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":emailAddress", address);
-    query.bindValue(":lowerEmailAddress", address.toLower());
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("emailAddress"), address);
+    row.bind(QStringLiteral("lowerEmailAddress"), address.toLower());
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactFamily &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Families SET"
-            "  spouse = :spouse,"
-            "  children = :children"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Families ("
-            "  detailId,"
-            "  contactId,"
-            "  spouse,"
-            "  children)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :spouse,"
-            "  :children)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactFamily &detail)
+{
+    DetailRow row(QStringLiteral("Families"));
 
     typedef QContactFamily T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":spouse", detail.value<QString>(T::FieldSpouse).trimmed());
-    query.bindValue(":children", detail.value<QStringList>(T::FieldChildren).join(QStringLiteral(";")));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("spouse"), detail.value<QString>(T::FieldSpouse).trimmed());
+    row.bind(QStringLiteral("children"), detail.value<QStringList>(T::FieldChildren).join(QStringLiteral(";")));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactFavorite &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Favorites SET"
-            "  isFavorite = :isFavorite"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Favorites ("
-            "  detailId,"
-            "  contactId,"
-            "  isFavorite)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :isFavorite)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactFavorite &detail)
+{
+    DetailRow row(QStringLiteral("Favorites"));
 
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":isFavorite", detail.isFavorite());
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("isFavorite"), detail.isFavorite());
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactGender &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Genders SET"
-            "  gender = :gender"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Genders ("
-            "  detailId,"
-            "  contactId,"
-            "  gender)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :gender)"));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactGender &detail)
+{
+    DetailRow row(QStringLiteral("Genders"));
 
-    ContactsDatabase::Query query(db.prepare(statement));
-
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":gender", QString::number(static_cast<int>(detail.gender())));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("gender"), QString::number(static_cast<int>(detail.gender())));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactGeoLocation &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE GeoLocations SET"
-            "  label = :label,"
-            "  latitude = :latitude,"
-            "  longitude = :longitude,"
-            "  accuracy = :accuracy,"
-            "  altitude = :altitude,"
-            "  altitudeAccuracy = :altitudeAccuracy,"
-            "  heading = :heading,"
-            "  speed = :speed,"
-            "  timestamp = :timestamp)"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO GeoLocations ("
-            "  detailId,"
-            "  contactId,"
-            "  label,"
-            "  latitude,"
-            "  longitude,"
-            "  accuracy,"
-            "  altitude,"
-            "  altitudeAccuracy,"
-            "  heading,"
-            "  speed,"
-            "  timestamp)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :label,"
-            "  :latitude,"
-            "  :longitude,"
-            "  :accuracy,"
-            "  :altitude,"
-            "  :altitudeAccuracy,"
-            "  :heading,"
-            "  :speed,"
-            "  :timestamp)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactGeoLocation &detail)
+{
+    DetailRow row(QStringLiteral("GeoLocations"));
 
     typedef QContactGeoLocation T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":label", detail.value<QString>(T::FieldLabel).trimmed());
-    query.bindValue(":latitude", detail.value<double>(T::FieldLatitude));
-    query.bindValue(":longitude", detail.value<double>(T::FieldLongitude));
-    query.bindValue(":accuracy", detail.value<double>(T::FieldAccuracy));
-    query.bindValue(":altitude", detail.value<double>(T::FieldAltitude));
-    query.bindValue(":altitudeAccuracy", detail.value<double>(T::FieldAltitudeAccuracy));
-    query.bindValue(":heading", detail.value<double>(T::FieldHeading));
-    query.bindValue(":speed", detail.value<double>(T::FieldSpeed));
-    query.bindValue(":timestamp", ContactsDatabase::dateTimeString(detail.value<QDateTime>(T::FieldTimestamp).toUTC()));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("label"), detail.value<QString>(T::FieldLabel).trimmed());
+    row.bind(QStringLiteral("latitude"), detail.value<double>(T::FieldLatitude));
+    row.bind(QStringLiteral("longitude"), detail.value<double>(T::FieldLongitude));
+    row.bind(QStringLiteral("accuracy"), detail.value<double>(T::FieldAccuracy));
+    row.bind(QStringLiteral("altitude"), detail.value<double>(T::FieldAltitude));
+    row.bind(QStringLiteral("altitudeAccuracy"), detail.value<double>(T::FieldAltitudeAccuracy));
+    row.bind(QStringLiteral("heading"), detail.value<double>(T::FieldHeading));
+    row.bind(QStringLiteral("speed"), detail.value<double>(T::FieldSpeed));
+    row.bind(QStringLiteral("timestamp"), ContactsDatabase::dateTimeString(detail.value<QDateTime>(T::FieldTimestamp).toUTC()));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactGlobalPresence &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE GlobalPresences SET"
-            "  presenceState = :presenceState,"
-            "  timestamp = :timestamp,"
-            "  nickname = :nickname,"
-            "  customMessage = :customMessage,"
-            "  presenceStateText = :presenceStateText,"
-            "  presenceStateImageUrl = :presenceStateImageUrl"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO GlobalPresences ("
-            "  detailId,"
-            "  contactId,"
-            "  presenceState,"
-            "  timestamp,"
-            "  nickname,"
-            "  customMessage,"
-            "  presenceStateText,"
-            "  presenceStateImageUrl)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :presenceState,"
-            "  :timestamp,"
-            "  :nickname,"
-            "  :customMessage,"
-            "  :presenceStateText,"
-            "  :presenceStateImageUrl)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactGlobalPresence &detail)
+{
+    DetailRow row(QStringLiteral("GlobalPresences"));
 
     typedef QContactGlobalPresence T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":presenceState", detailValue(detail, T::FieldPresenceState));
-    query.bindValue(":timestamp", ContactsDatabase::dateTimeString(detail.value<QDateTime>(T::FieldTimestamp).toUTC()));
-    query.bindValue(":nickname", detail.value<QString>(T::FieldNickname).trimmed());
-    query.bindValue(":customMessage", detail.value<QString>(T::FieldCustomMessage).trimmed());
-    query.bindValue(":presenceStateText", detail.value<QString>(T::FieldPresenceStateText).trimmed());
-    query.bindValue(":presenceStateImageUrl", detail.value<QString>(T::FieldPresenceStateImageUrl).trimmed());
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("presenceState"), detailValue(detail, T::FieldPresenceState));
+    row.bind(QStringLiteral("timestamp"), ContactsDatabase::dateTimeString(detail.value<QDateTime>(T::FieldTimestamp).toUTC()));
+    row.bind(QStringLiteral("nickname"), detail.value<QString>(T::FieldNickname).trimmed());
+    row.bind(QStringLiteral("customMessage"), detail.value<QString>(T::FieldCustomMessage).trimmed());
+    row.bind(QStringLiteral("presenceStateText"), detail.value<QString>(T::FieldPresenceStateText).trimmed());
+    row.bind(QStringLiteral("presenceStateImageUrl"), detail.value<QString>(T::FieldPresenceStateImageUrl).trimmed());
+    row.bind(QStringLiteral("presenceRank"), ContactsDatabase::presenceRank(detail.value<int>(T::FieldPresenceState)));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactGuid &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Guids SET"
-            "  guid = :guid"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Guids ("
-            "  detailId,"
-            "  contactId,"
-            "  guid)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :guid)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactGuid &detail)
+{
+    DetailRow row(QStringLiteral("Guids"));
 
     typedef QContactGuid T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":guid", detailValue(detail, T::FieldGuid));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("guid"), detailValue(detail, T::FieldGuid));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactHobby &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Hobbies SET"
-            "  hobby = :hobby"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Hobbies ("
-            "  detailId,"
-            "  contactId,"
-            "  hobby)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :hobby)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactHobby &detail)
+{
+    DetailRow row(QStringLiteral("Hobbies"));
 
     typedef QContactHobby T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":hobby", detailValue(detail, T::FieldHobby));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("hobby"), detailValue(detail, T::FieldHobby));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactName &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Names SET"
-            "  firstName = :firstName,"
-            "  lowerFirstName = :lowerFirstName,"
-            "  lastName = :lastName,"
-            "  lowerLastName = :lowerLastName,"
-            "  middleName = :middleName,"
-            "  prefix = :prefix,"
-            "  suffix = :suffix,"
-            "  customLabel = :customLabel"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Names ("
-            "  detailId,"
-            "  contactId,"
-            "  firstName,"
-            "  lowerFirstName,"
-            "  lastName,"
-            "  lowerLastName,"
-            "  middleName,"
-            "  prefix,"
-            "  suffix,"
-            "  customLabel)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :firstName,"
-            "  :lowerFirstName,"
-            "  :lastName,"
-            "  :lowerLastName,"
-            "  :middleName,"
-            "  :prefix,"
-            "  :suffix,"
-            "  :customLabel)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &db, quint32 contactId, quint32 detailId, const QContactName &detail)
+{
+    DetailRow row(QStringLiteral("Names"));
 
     const QString firstName(detail.value<QString>(QContactName::FieldFirstName).trimmed());
     const QString lastName(detail.value<QString>(QContactName::FieldLastName).trimmed());
 
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":firstName", firstName);
-    query.bindValue(":lowerFirstName", firstName.toLower());
-    query.bindValue(":lastName", lastName);
-    query.bindValue(":lowerLastName", lastName.toLower());
-    query.bindValue(":middleName", detail.value<QString>(QContactName::FieldMiddleName).trimmed());
-    query.bindValue(":prefix", detail.value<QString>(QContactName::FieldPrefix).trimmed());
-    query.bindValue(":suffix", detail.value<QString>(QContactName::FieldSuffix).trimmed());
-    query.bindValue(":customLabel", detail.value<QString>(QContactName::FieldCustomLabel).trimmed());
-
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("firstName"), firstName);
+    row.bind(QStringLiteral("lowerFirstName"), firstName.toLower());
+    row.bind(QStringLiteral("lastName"), lastName);
+    row.bind(QStringLiteral("lowerLastName"), lastName.toLower());
+    row.bind(QStringLiteral("middleName"), detail.value<QString>(QContactName::FieldMiddleName).trimmed());
+    row.bind(QStringLiteral("prefix"), detail.value<QString>(QContactName::FieldPrefix).trimmed());
+    row.bind(QStringLiteral("suffix"), detail.value<QString>(QContactName::FieldSuffix).trimmed());
+    row.bind(QStringLiteral("customLabel"), detail.value<QString>(QContactName::FieldCustomLabel).trimmed());
+    row.bind(QStringLiteral("keypadFirstName"), ContactsEngine::keypadDigits(firstName));
+    row.bind(QStringLiteral("keypadLastName"), ContactsEngine::keypadDigits(lastName));
+    row.bind(QStringLiteral("sortFirstName"), sortKeyValue(db, firstName));
+    row.bind(QStringLiteral("sortLastName"), sortKeyValue(db, lastName));
+
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactNickname &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Nicknames SET"
-            "  nickname = :nickname,"
-            "  lowerNickname = :lowerNickname"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Nicknames ("
-            "  detailId,"
-            "  contactId,"
-            "  nickname,"
-            "  lowerNickname)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :nickname,"
-            "  :lowerNickname)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactNickname &detail)
+{
+    DetailRow row(QStringLiteral("Nicknames"));
 
     typedef QContactNickname T;
     const QString nickname(detail.value<QString>(T::FieldNickname).trimmed());
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":nickname", nickname);
-    query.bindValue(":lowerNickname", nickname.toLower());
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("nickname"), nickname);
+    row.bind(QStringLiteral("lowerNickname"), nickname.toLower());
+    row.bind(QStringLiteral("keypadNickname"), ContactsEngine::keypadDigits(nickname));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactNote &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Notes SET"
-            "  note = :note"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Notes ("
-            "  detailId,"
-            "  contactId,"
-            "  note)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :note)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactNote &detail)
+{
+    DetailRow row(QStringLiteral("Notes"));
 
     typedef QContactNote T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":note", detailValue(detail, T::FieldNote));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("note"), detailValue(detail, T::FieldNote));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactOnlineAccount &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE OnlineAccounts SET"
-            "  accountUri = :accountUri,"
-            "  lowerAccountUri = :lowerAccountUri,"
-            "  protocol = :protocol,"
-            "  serviceProvider = :serviceProvider,"
-            "  capabilities = :capabilities,"
-            "  subTypes = :subTypes,"
-            "  accountPath = :accountPath,"
-            "  accountIconPath = :accountIconPath,"
-            "  enabled = :enabled,"
-            "  accountDisplayName = :accountDisplayName,"
-            "  serviceProviderDisplayName = :serviceProviderDisplayName"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO OnlineAccounts ("
-            "  detailId,"
-            "  contactId,"
-            "  accountUri,"
-            "  lowerAccountUri,"
-            "  protocol,"
-            "  serviceProvider,"
-            "  capabilities,"
-            "  subTypes,"
-            "  accountPath,"
-            "  accountIconPath,"
-            "  enabled,"
-            "  accountDisplayName,"
-            "  serviceProviderDisplayName)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :accountUri,"
-            "  :lowerAccountUri,"
-            "  :protocol,"
-            "  :serviceProvider,"
-            "  :capabilities,"
-            "  :subTypes,"
-            "  :accountPath,"
-            "  :accountIconPath,"
-            "  :enabled,"
-            "  :accountDisplayName,"
-            "  :serviceProviderDisplayName)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactOnlineAccount &detail)
+{
+    DetailRow row(QStringLiteral("OnlineAccounts"));
 
     typedef QContactOnlineAccount T;
     const QString uri(detail.value<QString>(T::FieldAccountUri).trimmed());
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":accountUri", uri);
-    query.bindValue(":lowerAccountUri", uri.toLower());
-    query.bindValue(":protocol", QString::number(detail.protocol()));
-    query.bindValue(":serviceProvider", detailValue(detail, T::FieldServiceProvider));
-    query.bindValue(":capabilities", detailValue(detail, T::FieldCapabilities).value<QStringList>().join(QStringLiteral(";")));
-    query.bindValue(":subTypes", subTypeList(detail.subTypes()).join(QStringLiteral(";")));
-    query.bindValue(":accountPath", detailValue(detail, QContactOnlineAccount__FieldAccountPath));
-    query.bindValue(":accountIconPath", detailValue(detail, QContactOnlineAccount__FieldAccountIconPath));
-    query.bindValue(":enabled", detailValue(detail, QContactOnlineAccount__FieldEnabled));
-    query.bindValue(":accountDisplayName", detailValue(detail, QContactOnlineAccount__FieldAccountDisplayName));
-    query.bindValue(":serviceProviderDisplayName", detailValue(detail, QContactOnlineAccount__FieldServiceProviderDisplayName));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("accountUri"), uri);
+    row.bind(QStringLiteral("lowerAccountUri"), uri.toLower());
+    row.bind(QStringLiteral("protocol"), QString::number(detail.protocol()));
+    row.bind(QStringLiteral("serviceProvider"), detailValue(detail, T::FieldServiceProvider));
+    row.bind(QStringLiteral("capabilities"), detailValue(detail, T::FieldCapabilities).value<QStringList>().join(QStringLiteral(";")));
+    row.bind(QStringLiteral("subTypes"), subTypeList(detail.subTypes()).join(QStringLiteral(";")));
+    row.bind(QStringLiteral("accountPath"), detailValue(detail, QContactOnlineAccount__FieldAccountPath));
+    row.bind(QStringLiteral("accountIconPath"), detailValue(detail, QContactOnlineAccount__FieldAccountIconPath));
+    row.bind(QStringLiteral("enabled"), detailValue(detail, QContactOnlineAccount__FieldEnabled));
+    row.bind(QStringLiteral("accountDisplayName"), detailValue(detail, QContactOnlineAccount__FieldAccountDisplayName));
+    row.bind(QStringLiteral("serviceProviderDisplayName"), detailValue(detail, QContactOnlineAccount__FieldServiceProviderDisplayName));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactOrganization &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Organizations SET"
-            "  name = :name,"
-            "  role = :role,"
-            "  title = :title,"
-            "  location = :location,"
-            "  department = :department,"
-            "  logoUrl = :logoUrl,"
-            "  assistantName = :assistantName"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Organizations ("
-            "  detailId,"
-            "  contactId,"
-            "  name,"
-            "  role,"
-            "  title,"
-            "  location,"
-            "  department,"
-            "  logoUrl,"
-            "  assistantName)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :name,"
-            "  :role,"
-            "  :title,"
-            "  :location,"
-            "  :department,"
-            "  :logoUrl,"
-            "  :assistantName)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactOrganization &detail)
+{
+    DetailRow row(QStringLiteral("Organizations"));
 
     typedef QContactOrganization T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":name", detail.value<QString>(T::FieldName).trimmed());
-    query.bindValue(":role", detail.value<QString>(T::FieldRole).trimmed());
-    query.bindValue(":title", detail.value<QString>(T::FieldTitle).trimmed());
-    query.bindValue(":location", detail.value<QString>(T::FieldLocation).trimmed());
-    query.bindValue(":department", detail.department().join(QStringLiteral(";")));
-    query.bindValue(":logoUrl", detail.value<QString>(T::FieldLogoUrl).trimmed());
-    query.bindValue(":assistantName", detail.value<QString>(T::FieldAssistantName).trimmed());
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("name"), detail.value<QString>(T::FieldName).trimmed());
+    row.bind(QStringLiteral("role"), detail.value<QString>(T::FieldRole).trimmed());
+    row.bind(QStringLiteral("title"), detail.value<QString>(T::FieldTitle).trimmed());
+    row.bind(QStringLiteral("location"), detail.value<QString>(T::FieldLocation).trimmed());
+    row.bind(QStringLiteral("department"), detail.department().join(QStringLiteral(";")));
+    row.bind(QStringLiteral("logoUrl"), detail.value<QString>(T::FieldLogoUrl).trimmed());
+    row.bind(QStringLiteral("assistantName"), detail.value<QString>(T::FieldAssistantName).trimmed());
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactPhoneNumber &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE PhoneNumbers SET"
-            "  phoneNumber = :phoneNumber,"
-            "  subTypes = :subTypes,"
-            "  normalizedNumber = :normalizedNumber"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO PhoneNumbers ("
-            "  detailId,"
-            "  contactId,"
-            "  phoneNumber,"
-            "  subTypes,"
-            "  normalizedNumber)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :phoneNumber,"
-            "  :subTypes,"
-            "  :normalizedNumber)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactPhoneNumber &detail)
+{
+    DetailRow row(QStringLiteral("PhoneNumbers"));
 
     typedef QContactPhoneNumber T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":phoneNumber", detail.value<QString>(T::FieldNumber).trimmed());
-    query.bindValue(":subTypes", subTypeList(detail.subTypes()).join(QStringLiteral(";")));
-    query.bindValue(":normalizedNumber", QVariant(ContactsEngine::normalizedPhoneNumber(detail.number())));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("phoneNumber"), detail.value<QString>(T::FieldNumber).trimmed());
+    row.bind(QStringLiteral("subTypes"), subTypeList(detail.subTypes()).join(QStringLiteral(";")));
+    row.bind(QStringLiteral("normalizedNumber"), QVariant(ContactsEngine::normalizedPhoneNumber(detail.number())));
+    row.bind(QStringLiteral("reversedNumber"), QVariant(ContactsEngine::reversedPhoneNumber(detail.value<QString>(T::FieldNumber).trimmed())));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactPresence &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Presences SET"
-            "  presenceState = :presenceState,"
-            "  timestamp = :timestamp,"
-            "  nickname = :nickname,"
-            "  customMessage = :customMessage,"
-            "  presenceStateText = :presenceStateText,"
-            "  presenceStateImageUrl = :presenceStateImageUrl"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Presences ("
-            "  detailId,"
-            "  contactId,"
-            "  presenceState,"
-            "  timestamp,"
-            "  nickname,"
-            "  customMessage,"
-            "  presenceStateText,"
-            "  presenceStateImageUrl)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :presenceState,"
-            "  :timestamp,"
-            "  :nickname,"
-            "  :customMessage,"
-            "  :presenceStateText,"
-            "  :presenceStateImageUrl)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactPresence &detail)
+{
+    DetailRow row(QStringLiteral("Presences"));
 
     typedef QContactPresence T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":presenceState", detailValue(detail, T::FieldPresenceState));
-    query.bindValue(":timestamp", ContactsDatabase::dateTimeString(detail.value<QDateTime>(T::FieldTimestamp).toUTC()));
-    query.bindValue(":nickname", detail.value<QString>(T::FieldNickname).trimmed());
-    query.bindValue(":customMessage", detail.value<QString>(T::FieldCustomMessage).trimmed());
-    query.bindValue(":presenceStateText", detail.value<QString>(T::FieldPresenceStateText).trimmed());
-    query.bindValue(":presenceStateImageUrl", detail.value<QString>(T::FieldPresenceStateImageUrl).trimmed());
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("presenceState"), detailValue(detail, T::FieldPresenceState));
+    row.bind(QStringLiteral("timestamp"), ContactsDatabase::dateTimeString(detail.value<QDateTime>(T::FieldTimestamp).toUTC()));
+    row.bind(QStringLiteral("nickname"), detail.value<QString>(T::FieldNickname).trimmed());
+    row.bind(QStringLiteral("customMessage"), detail.value<QString>(T::FieldCustomMessage).trimmed());
+    row.bind(QStringLiteral("presenceStateText"), detail.value<QString>(T::FieldPresenceStateText).trimmed());
+    row.bind(QStringLiteral("presenceStateImageUrl"), detail.value<QString>(T::FieldPresenceStateImageUrl).trimmed());
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactRingtone &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Ringtones SET"
-            "  audioRingtone = :audioRingtone,"
-            "  videoRingtone = :videoRingtone,"
-            "  vibrationRingtone = :vibrationRingtone"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Ringtones ("
-            "  detailId,"
-            "  contactId,"
-            "  audioRingtone,"
-            "  videoRingtone,"
-            "  vibrationRingtone)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :audioRingtone,"
-            "  :videoRingtone,"
-            "  :vibrationRingtone)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactRingtone &detail)
+{
+    DetailRow row(QStringLiteral("Ringtones"));
 
     typedef QContactRingtone T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":audioRingtone", detail.value<QString>(T::FieldAudioRingtoneUrl).trimmed());
-    query.bindValue(":videoRingtone", detail.value<QString>(T::FieldVideoRingtoneUrl).trimmed());
-    query.bindValue(":vibrationRingtone", detail.value<QString>(T::FieldVibrationRingtoneUrl).trimmed());
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("audioRingtone"), detail.value<QString>(T::FieldAudioRingtoneUrl).trimmed());
+    row.bind(QStringLiteral("videoRingtone"), detail.value<QString>(T::FieldVideoRingtoneUrl).trimmed());
+    row.bind(QStringLiteral("vibrationRingtone"), detail.value<QString>(T::FieldVibrationRingtoneUrl).trimmed());
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactSyncTarget &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE SyncTargets SET"
-            "  syncTarget = :syncTarget"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO SyncTargets ("
-            "  detailId,"
-            "  contactId,"
-            "  syncTarget)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :syncTarget)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactSyncTarget &detail)
+{
+    DetailRow row(QStringLiteral("SyncTargets"));
 
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":syncTarget", detail.syncTarget());
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("syncTarget"), detail.syncTarget());
 
-    return query;
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactTag &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Tags SET"
-            "  tag = :tag"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Tags ("
-            "  detailId,"
-            "  contactId,"
-            "  tag)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :tag)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactTag &detail)
+{
+    DetailRow row(QStringLiteral("Tags"));
 
     typedef QContactTag T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":tag", detail.value<QString>(T::FieldTag).trimmed());
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("tag"), detail.value<QString>(T::FieldTag).trimmed());
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactUrl &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE Urls SET"
-            "  url = :url,"
-            "  subTypes = :subTypes"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO Urls ("
-            "  detailId,"
-            "  contactId,"
-            "  url,"
-            "  subTypes)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :url,"
-            "  :subTypes)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactUrl &detail)
+{
+    DetailRow row(QStringLiteral("Urls"));
 
     typedef QContactUrl T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":url", detail.value<QString>(T::FieldUrl).trimmed());
-    query.bindValue(":subTypes", detail.hasValue(T::FieldSubType) ? QString::number(detail.subType()) : QString());
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("url"), detail.value<QString>(T::FieldUrl).trimmed());
+    row.bind(QStringLiteral("subTypes"), detail.hasValue(T::FieldSubType) ? QString::number(detail.subType()) : QString());
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactOriginMetadata &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE OriginMetadata SET"
-            "  id = :id,"
-            "  groupId = :groupId,"
-            "  enabled = :enabled"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO OriginMetadata ("
-            "  detailId,"
-            "  contactId,"
-            "  id,"
-            "  groupId,"
-            "  enabled)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :id,"
-            "  :groupId,"
-            "  :enabled)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactOriginMetadata &detail)
+{
+    DetailRow row(QStringLiteral("OriginMetadata"));
 
     typedef QContactOriginMetadata T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":id", detailValue(detail, T::FieldId));
-    query.bindValue(":groupId", detailValue(detail, T::FieldGroupId));
-    query.bindValue(":enabled", detailValue(detail, T::FieldEnabled));
-    return query;
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("id"), detailValue(detail, T::FieldId));
+    row.bind(QStringLiteral("groupId"), detailValue(detail, T::FieldGroupId));
+    row.bind(QStringLiteral("enabled"), detailValue(detail, T::FieldEnabled));
+    return row;
 }
 
-ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const QContactExtendedDetail &detail)
-{
-    const QString statement(update
-        ? QStringLiteral(
-            " UPDATE ExtendedDetails SET"
-            "  name = :name,"
-            "  data = :data"
-            " WHERE detailId = :detailId"
-            " AND contactId = :contactId")
-        : QStringLiteral(
-            " INSERT INTO ExtendedDetails ("
-            "  detailId,"
-            "  contactId,"
-            "  name,"
-            "  data)"
-            " VALUES ("
-            "  :detailId,"
-            "  :contactId,"
-            "  :name,"
-            "  :data)"));
-
-    ContactsDatabase::Query query(db.prepare(statement));
+DetailRow detailRow(ContactsDatabase &, quint32 contactId, quint32 detailId, const QContactExtendedDetail &detail)
+{
+    DetailRow row(QStringLiteral("ExtendedDetails"));
 
     typedef QContactExtendedDetail T;
-    query.bindValue(":detailId", detailId);
-    query.bindValue(":contactId", contactId);
-    query.bindValue(":name", detailValue(detail, T::FieldName));
+    row.bind(QStringLiteral("detailId"), detailId);
+    row.bind(QStringLiteral("contactId"), contactId);
+    row.bind(QStringLiteral("name"), detailValue(detail, T::FieldName));
 
     const QVariant variantValue = detailValue(detail, T::FieldData);
     if (variantValue.isNull()) {
-        query.bindValue(":data", variantValue);
+        row.bind(QStringLiteral("data"), variantValue);
     } else {
         QByteArray serialized;
         QBuffer buffer(&serialized);
@@ -3335,10 +3145,15 @@ ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quin
         QDataStream out(&buffer);
         out.setVersion(QDataStream::Qt_5_6);
         out << detailValue(detail, T::FieldData);
-        query.bindValue(":data", serialized);
+        row.bind(QStringLiteral("data"), serialized);
     }
 
-    return query;
+    return row;
+}
+
+template <typename T> ContactsDatabase::Query bindDetail(ContactsDatabase &db, quint32 contactId, quint32 detailId, bool update, const T &detail)
+{
+    return detailRow(db, contactId, detailId, detail).prepare(db, update);
 }
 
 template <typename T> void removeDuplicateDetails(QList<T> *details)
@@ -3379,6 +3194,7 @@ template <typename T> bool ContactWriter::writeDetails(
     if (delta.isValid) {
         // perform delta update.
         QList<T> deletions(delta.deleted<T>());
+        QList<quint32> deletedIds;
         typename QList<T>::iterator dit = deletions.begin(), dend = deletions.end();
         for ( ; dit != dend; ++dit) {
             T &detail(*dit);
@@ -3386,9 +3202,11 @@ template <typename T> bool ContactWriter::writeDetails(
             if (detailId == 0) {
                 QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Invalid detail deletion specified for %1 in contact %2").arg(detailTypeName<T>()).arg(contactId));
                 return false;
-            } else if (!deleteDetail(m_database, contactId, detailId, detailTypeName<T>(), recordUnhandledChangeFlags, error)) {
-                return false;
             }
+            deletedIds.append(detailId);
+        }
+        if (!deletedIds.isEmpty() && !deleteDetails(m_database, contactId, deletedIds, detailTypeName<T>(), recordUnhandledChangeFlags, error)) {
+            return false;
         }
 
         QList<T> modifications(delta.modified<T>());
@@ -3446,11 +3264,15 @@ template <typename T> bool ContactWriter::writeDetails(
                 detail.setValue(QContactDetail::FieldProvenance, provenance);
             }
 
-            ContactsDatabase::Query query = bindDetail(m_database, contactId, detailId, false, detail);
-            if (!ContactsDatabase::execute(query)) {
-                query.reportError(QStringLiteral("Failed to add %1 detail %2 for contact %3").arg(detailTypeName<T>()).arg(detailId).arg(contactId));
-                *error = QContactManager::UnspecifiedError;
-                return false;
+            if (m_detailBatch) {
+                m_detailBatch->append(detailRow(m_database, contactId, detailId, detail));
+            } else {
+                ContactsDatabase::Query query = bindDetail(m_database, contactId, detailId, false, detail);
+                if (!ContactsDatabase::execute(query)) {
+                    query.reportError(QStringLiteral("Failed to add %1 detail %2 for contact %3").arg(detailTypeName<T>()).arg(detailId).arg(contactId));
+                    *error = QContactManager::UnspecifiedError;
+                    return false;
+                }
             }
 
             contact->saveDetail(&detail, QContact::IgnoreAccessConstraints);
@@ -3461,10 +3283,13 @@ template <typename T> bool ContactWriter::writeDetails(
         }
     } else {
         // clobber all detail values for this contact.
-        if (!removeSpecificDetails<T>(m_database, contactId, error))
-            return false;
-        if (!removeCommonDetails<T>(contactId, error))
-            return false;
+        // A contact whose details are batched is new, so it has no existing values.
+        if (!m_detailBatch) {
+            if (!removeSpecificDetails<T>(m_database, contactId, error))
+                return false;
+            if (!removeCommonDetails<T>(contactId, error))
+                return false;
+        }
 
         QList<T> contactDetails(contact->details<T>());
         if (aggregateContact) {
@@ -3488,11 +3313,15 @@ template <typename T> bool ContactWriter::writeDetails(
                 detail.setValue(QContactDetail::FieldProvenance, provenance);
             }
 
-            ContactsDatabase::Query query = bindDetail(m_database, contactId, detailId, false, detail);
-            if (!ContactsDatabase::execute(query)) {
-                query.reportError(QStringLiteral("Failed to write details for %1").arg(detailTypeName<T>()));
-                *error = QContactManager::UnspecifiedError;
-                return false;
+            if (m_detailBatch) {
+                m_detailBatch->append(detailRow(m_database, contactId, detailId, detail));
+            } else {
+                ContactsDatabase::Query query = bindDetail(m_database, contactId, detailId, false, detail);
+                if (!ContactsDatabase::execute(query)) {
+                    query.reportError(QStringLiteral("Failed to write details for %1").arg(detailTypeName<T>()));
+                    *error = QContactManager::UnspecifiedError;
+                    return false;
+                }
             }
 
             contact->saveDetail(&detail, QContact::IgnoreAccessConstraints);
@@ -3506,41 +3335,6 @@ template <typename T> bool ContactWriter::writeDetails(
     return true;
 }
 
-static int presenceOrder(QContactPresence::PresenceState state)
-{
-#ifdef SORT_PRESENCE_BY_AVAILABILITY
-    if (state == QContactPresence::PresenceAvailable) {
-        return 0;
-    } else if (state == QContactPresence::PresenceAway) {
-        return 1;
-    } else if (state == QContactPresence::PresenceExtendedAway) {
-        return 2;
-    } else if (state == QContactPresence::PresenceBusy) {
-        return 3;
-    } else if (state == QContactPresence::PresenceHidden) {
-        return 4;
-    } else if (state == QContactPresence::PresenceOffline) {
-        return 5;
-    }
-    return 6;
-#else
-    return static_cast<int>(state);
-#endif
-}
-
-static bool betterPresence(const QContactPresence &detail, const QContactPresence &best)
-{
-    if (best.isEmpty())
-        return true;
-
-    QContactPresence::PresenceState detailState(detail.presenceState());
-    if (detailState == QContactPresence::PresenceUnknown)
-        return false;
-
-    return ((presenceOrder(detailState) < presenceOrder(best.presenceState())) ||
-            best.presenceState() == QContactPresence::PresenceUnknown);
-}
-
 QContactManager::Error ContactWriter::save(
             QList<QContact> *contacts,
             const DetailList &definitionMask,
@@ -3599,12 +3393,36 @@ QContactManager::Error ContactWriter::save(
         return QContactManager::UnspecifiedError;
     }
 
+    // The aggregates of a large batch are matched in parallel, before the transaction is begun
+    QVector<AggregationCandidateIndex::Scores> prescoredMatches;
+    quint64 prescoredGeneration = 0;
+    qint64 prescoredDataVersion = 0;
+    if (m_database.aggregating() && !withinTransaction && !withinAggregateUpdate
+            && contacts->count() >= PrescoredMatchMinimumCount) {
+        bool aggregable = true;
+        if (!collectionId.isNull()
+                && collectionId != ContactCollectionId::apiId(ContactsDatabase::LocalAddressbookCollectionId, m_managerUri)
+                && collectionIsAggregable(collectionId, &aggregable) != QContactManager::NoError) {
+            aggregable = false;
+        }
+        if (aggregable
+                && prescoreAggregation(*contacts, &prescoredMatches, &prescoredGeneration, &prescoredDataVersion) != QContactManager::NoError) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to match aggregates before saving contacts"));
+            prescoredMatches.clear();
+        }
+    }
+
     if (!withinTransaction && !beginTransaction()) {
         // only create a transaction if we're not within one already
         QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to begin database transaction while saving contacts"));
         return QContactManager::UnspecifiedError;
     }
 
+    if (!prescoredMatches.isEmpty() && !prescoredMatchesCurrent(prescoredGeneration, prescoredDataVersion)) {
+        // The contacts will be matched within the transaction instead
+        prescoredMatches.clear();
+    }
+
     static const DetailList presenceUpdateDetailTypes(getPresenceUpdateDetailTypes());
 
     bool presenceOnlyUpdate = false;
@@ -3620,6 +3438,21 @@ QContactManager::Error ContactWriter::save(
         }
     }
 
+    // A large batch of new contacts is imported in bulk: the search index and the aggregates
+    // are brought up to date once all of the contacts have been written
+    bool bulkImport = !withinAggregateUpdate && contacts->count() >= BulkImportMinimumCount;
+    for (QList<QContact>::const_iterator it = contacts->constBegin(), end = contacts->constEnd(); bulkImport && it != end; ++it) {
+        if (ContactId::databaseId(*it) != 0) {
+            bulkImport = false;
+        }
+    }
+
+    // The details of an imported batch are inserted together, once all of the contacts are created
+    DetailInsertBatch detailBatch(m_database);
+    if (bulkImport) {
+        m_detailBatch = &detailBatch;
+    }
+
     bool possibleReactivation = false;
     QContactManager::Error worstError = QContactManager::NoError;
     QContactManager::Error err = QContactManager::NoError;
@@ -3630,7 +3463,9 @@ QContactManager::Error ContactWriter::save(
 
         bool aggregateUpdated = false;
         if (dbId == 0) {
-            err = create(&contact, definitionMask, true, withinAggregateUpdate, withinSyncUpdate, recordUnhandledChangeFlags);
+            m_prescoredMatches = prescoredMatches.isEmpty() ? nullptr : &prescoredMatches.at(i);
+            err = create(&contact, definitionMask, true, withinAggregateUpdate, withinSyncUpdate, recordUnhandledChangeFlags, bulkImport);
+            m_prescoredMatches = nullptr;
             if (err == QContactManager::NoError) {
                 contactId = ContactId::apiId(contact);
                 dbId = ContactId::databaseId(contactId);
@@ -3673,6 +3508,18 @@ QContactManager::Error ContactWriter::save(
         }
     }
 
+    if (bulkImport) {
+        m_detailBatch = nullptr;
+
+        if (worstError == QContactManager::NoError) {
+            QContactManager::Error importError = detailBatch.flush()
+                    ? completeBulkImport(contacts, prescoredMatches, definitionMask, withinSyncUpdate)
+                    : QContactManager::UnspecifiedError;
+            if (importError != QContactManager::NoError)
+                worstError = importError;
+        }
+    }
+
     if (m_database.aggregating() && !withinAggregateUpdate && possibleReactivation && worstError == QContactManager::NoError) {
         // Some contacts may need to have new aggregates created
         // if they previously had a QContactDeactivated detail
@@ -3950,139 +3797,621 @@ static void promoteDetailsToAggregate(const QContact &contact, QContact *aggrega
    aggregate contacts are searched for a match, and the matching
    one updated if it exists; or a new aggregate is created.
 */
-QContactManager::Error ContactWriter::updateOrCreateAggregate(QContact *contact, const DetailList &definitionMask, bool withinTransaction, bool withinSyncUpdate, bool createOnly, quint32 *aggregateContactId)
+static AggregationCandidateIndex::Contact aggregationCandidate(const QContact &contact)
 {
-    // 1) search for match
-    // 2) if exists, update the existing aggregate (by default, non-clobber:
-    //    only update empty fields of details, or promote non-existent details.  Never delete or replace details.)
-    // 3) otherwise, create new aggregate, consisting of all details of contact, return.
-
-    quint32 existingAggregateId = 0;
-    QContact matchingAggregate;
+    AggregationCandidateIndex::Contact candidate;
+    candidate.contactId = ContactId::databaseId(contact);
 
-    // We need to search to find an appropriate aggregate
-    QString firstName;
-    QString lastName;
-    QString nickname;
-    QVariantList phoneNumbers;
-    QVariantList emailAddresses;
-    QVariantList accountUris;
-    QString syncTarget;
-    QString excludeGender;
-
-    foreach (const QContactName &detail, contact->details<QContactName>()) {
-        firstName = detail.firstName().toLower();
-        lastName = detail.lastName().toLower();
+    foreach (const QContactName &detail, contact.details<QContactName>()) {
+        candidate.firstName = detail.firstName().toLower();
+        candidate.lastName = detail.lastName().toLower();
         break;
     }
-    foreach (const QContactNickname &detail, contact->details<QContactNickname>()) {
-        nickname = detail.nickname().toLower();
+    foreach (const QContactNickname &detail, contact.details<QContactNickname>()) {
+        candidate.nickname = detail.nickname().toLower();
         break;
     }
-    foreach (const QContactPhoneNumber &detail, contact->details<QContactPhoneNumber>()) {
-        phoneNumbers.append(ContactsEngine::normalizedPhoneNumber(detail.number()));
+    foreach (const QContactPhoneNumber &detail, contact.details<QContactPhoneNumber>()) {
+        candidate.phoneNumbers.append(ContactsEngine::normalizedPhoneNumber(detail.number()));
     }
-    foreach (const QContactEmailAddress &detail, contact->details<QContactEmailAddress>()) {
-        emailAddresses.append(detail.emailAddress().toLower());
+    foreach (const QContactEmailAddress &detail, contact.details<QContactEmailAddress>()) {
+        candidate.emailAddresses.append(detail.emailAddress().toLower());
     }
-    foreach (const QContactOnlineAccount &detail, contact->details<QContactOnlineAccount>()) {
-        accountUris.append(detail.accountUri().toLower());
+    foreach (const QContactOnlineAccount &detail, contact.details<QContactOnlineAccount>()) {
+        candidate.accountUris.append(detail.accountUri().toLower());
     }
-    syncTarget = contact->detail<QContactSyncTarget>().syncTarget();
 
-    const QContactGender gender(contact->detail<QContactGender>());
+    const QContactGender gender(contact.detail<QContactGender>());
     if (gender.gender() == QContactGender::GenderMale) {
-        excludeGender = QString::number(static_cast<int>(QContactGender::GenderFemale));
+        candidate.excludeGender = QString::number(static_cast<int>(QContactGender::GenderFemale));
     } else if (gender.gender() == QContactGender::GenderFemale) {
-        excludeGender = QString::number(static_cast<int>(QContactGender::GenderMale));
+        candidate.excludeGender = QString::number(static_cast<int>(QContactGender::GenderMale));
     } else {
-        excludeGender = QStringLiteral("none");
+        candidate.excludeGender = QStringLiteral("none");
     }
 
-    /*
-    Aggregation heuristic.
+    return candidate;
+}
 
-    Search existing aggregate contacts, for matchability.
-    The aggregate with the highest match score (over the threshold)
-    represents the same "actual person".
-    The newly saved contact then becomes a constituent of that
-    aggregate.
+// The entry read for the aggregate once its details are written, as stored by the detail rows
+static AggregationCandidateIndex::Aggregate aggregationCandidateEntry(const QContact &aggregate)
+{
+    AggregationCandidateIndex::Aggregate entry;
 
-    Note that individual contacts from the same sync collection can
-    represent the same actual person (eg, Telepathy might provide
-    buddies from different Jabber servers/rosters and thus if
-    you have the same buddy on multiple services, they need to
-    be aggregated together.
+    foreach (const QContactName &detail, aggregate.details<QContactName>()) {
+        entry.names.append(qMakePair(detail.value<QString>(QContactName::FieldFirstName).trimmed().toLower(),
+                                     detail.value<QString>(QContactName::FieldLastName).trimmed().toLower()));
+    }
+    foreach (const QContactNickname &detail, aggregate.details<QContactNickname>()) {
+        const QString nickname(detail.value<QString>(QContactNickname::FieldNickname).trimmed().toLower());
+        entry.hasNickname = true;
+        if (!nickname.isNull())
+            entry.nicknames.insert(nickname);
+    }
+    foreach (const QContactEmailAddress &detail, aggregate.details<QContactEmailAddress>()) {
+        const QString address(detail.value<QString>(QContactEmailAddress::FieldEmailAddress).trimmed().toLower());
+        if (!address.isNull())
+            entry.emailAddresses.insert(address);
+    }
+    foreach (const QContactPhoneNumber &detail, aggregate.details<QContactPhoneNumber>()) {
+        const QString number(ContactsEngine::normalizedPhoneNumber(detail.number()));
+        if (!number.isNull())
+            entry.phoneNumbers.insert(number);
+    }
+    foreach (const QContactOnlineAccount &detail, aggregate.details<QContactOnlineAccount>()) {
+        const QString uri(detail.value<QString>(QContactOnlineAccount::FieldAccountUri).trimmed().toLower());
+        if (!uri.isNull())
+            entry.accountUris.insert(uri);
+    }
+    foreach (const QContactGender &detail, aggregate.details<QContactGender>()) {
+        entry.gender = QString::number(static_cast<int>(detail.gender()));
+    }
 
-    Stages:
-    1) select all possible aggregate ids
-    2) join those ids on the tables of interest to get the data we match against
-    3) perform the heuristic matching, ordered by "best score"
-    4) select highest score; if over threshold, select that as aggregate.
-    */
-    static const QString possibleAggregatesWhere(QStringLiteral(
-        /* SELECT contactId FROM Contacts ... */
-        " WHERE Contacts.collectionId = 1" // AggregateAddressbookCollectionId
-        " AND Contacts.contactId IN ("
-            " SELECT contactId FROM Names"
-            " WHERE COALESCE(:lastName, '') = ''"
-            "    OR COALESCE(lowerLastName, '') = ''"
-            "    OR lowerLastName = :lastName"
-            " UNION"
-            " SELECT contactId FROM Nicknames"
-            " WHERE contactId NOT IN (SELECT contactId FROM Names))"
-        " AND Contacts.contactId NOT IN ("
-            " SELECT contactId FROM Genders"
-            " WHERE gender = :excludeGender)"
-        " AND contactId > 2" // exclude self contact
-        " AND isDeactivated = 0" // exclude deactivated
-        " AND contactId NOT IN ("
-            " SELECT secondId FROM Relationships WHERE firstId = :contactId AND type = 'IsNot'"
-            " UNION"
-            " SELECT firstId FROM Relationships WHERE secondId = :contactId AND type = 'IsNot'"
-        " )"));
+    return entry;
+}
 
-    // Use a simple match algorithm, looking for exact matches on name fields,
-    // or accumulating points for name matches (including partial matches of first name).
+static QVariantList variantList(const QStringList &values)
+{
+    QVariantList rv;
+    foreach (const QString &value, values) {
+        rv.append(value);
+    }
+    return rv;
+}
 
-    // step one: build the temporary table which contains all "possible" aggregate contact ids.
-    m_database.clearTemporaryContactIdsTable(possibleAggregatesTable);
+void ContactWriter::aggregationCandidateWritten(quint32 contactId)
+{
+    m_staleAggregationCandidates.insert(contactId);
+    m_writtenAggregationCandidates.insert(contactId);
+}
 
-    const QString orderBy = QStringLiteral("contactId ASC ");
-    const QString where = possibleAggregatesWhere;
-    QMap<QString, QVariant> bindings;
-    bindings.insert(":lastName", lastName);
-    bindings.insert(":contactId", ContactId::databaseId(*contact));
-    bindings.insert(":excludeGender", excludeGender);
-    if (!m_database.createTemporaryContactIdsTable(possibleAggregatesTable,
-                                                   QString(), where, orderBy, bindings)) {
-        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Error creating possibleAggregates temporary table"));
-        return QContactManager::UnspecifiedError;
+void ContactWriter::aggregationCandidateRelationshipsWritten()
+{
+    m_staleIsNotRelationships = true;
+    m_isNotRelationshipsWritten = true;
+}
+
+// Records contacts whose attributes are written without being reported as added, changed or removed
+void ContactWriter::contactAttributesWritten(const QVariantList &contactIds)
+{
+    foreach (const QVariant &id, contactIds) {
+        m_writtenAttributeIds.insert(id.value<quint32>());
     }
+}
 
-    // step two: query matching data.
-    const QString heuristicallyMatchData(QStringLiteral(
-        " SELECT Matches.contactId, sum(Matches.score) AS total FROM ("
-            " SELECT Names.contactId, 20 AS score FROM Names"
-            " INNER JOIN temp.possibleAggregates ON Names.contactId = temp.possibleAggregates.contactId"
-                " WHERE lowerLastName  != '' AND lowerLastName  = :lastName"
-                "   AND lowerFirstName != '' AND lowerFirstName = :firstName"
-            " UNION"
-            " SELECT Names.contactId, 15 AS score FROM Names"
-            " INNER JOIN temp.possibleAggregates ON Names.contactId = temp.possibleAggregates.contactId"
-                " WHERE COALESCE(lowerFirstName,'') = '' AND COALESCE(:firstName,'') = ''"
-                "   AND COALESCE(lowerLastName, '') = '' AND COALESCE(:lastName, '') = ''"
-                "   AND EXISTS ("
-                      " SELECT * FROM Nicknames"
-                      " WHERE Nicknames.contactId = Names.contactId"
-                      "   AND lowerNickName = :nickname)"
-            " UNION"
-            " SELECT Nicknames.contactId, 15 AS score FROM Nicknames"
-            " INNER JOIN temp.possibleAggregates ON Nicknames.contactId = temp.possibleAggregates.contactId"
-                " WHERE lowerNickName = :nickname"
-                "   AND COALESCE(:firstName,'') = ''"
-                "   AND COALESCE(:lastName, '') = ''"
-                "   AND NOT EXISTS ("
+/*
+    If the attribute index holds entries for the current generation, the
+    changes of the transaction are applied to a copy of them before it is
+    committed: the rows of the contacts added, changed or removed are read
+    again.  Once the transaction is committed, the copy is valid for the
+    following generation.  A write affecting contacts which are not known
+    by ID leaves the index to be read in full when it is next used.
+*/
+void ContactWriter::updatedAttributeIndexEntries(QSharedPointer<const ContactAttributeIndex::Entries> *entries, quint64 *generation)
+{
+    ContactAttributeIndex *index = m_database.attributeIndex();
+    if (!index || m_attributeIndexStale)
+        return;
+
+    const QSharedPointer<const ContactAttributeIndex::Entries> currentEntries(index->entries(generation));
+    if (!currentEntries)
+        return;
+
+    QSet<QContactId> reportedIds(m_addedIds);
+    reportedIds.unite(m_changedIds).unite(m_presenceChangedIds).unite(m_removedIds);
+
+    QSet<quint32> writtenIds(m_writtenAttributeIds);
+    foreach (const QContactId &id, reportedIds) {
+        writtenIds.insert(ContactId::databaseId(id));
+    }
+    if (writtenIds.isEmpty()) {
+        *entries = currentEntries;
+        return;
+    }
+
+    QSharedPointer<ContactAttributeIndex::Entries> updatedEntries(new ContactAttributeIndex::Entries(*currentEntries));
+    QVariantList contactIds;
+    foreach (quint32 contactId, writtenIds) {
+        updatedEntries->remove(contactId);
+        contactIds.append(contactId);
+    }
+
+    // A removed contact is not read again
+    if (!updatedEntries->read(m_database, contactIds)) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to update the contact attribute index"));
+        return;
+    }
+
+    *entries = updatedEntries;
+}
+
+static bool readDataVersion(ContactsDatabase &database, qint64 *dataVersion)
+{
+    // The version changes whenever another connection commits a change to the database
+    ContactsDatabase::Query query(database.prepare("PRAGMA data_version"));
+    if (!ContactsDatabase::execute(query) || !query.next()) {
+        query.reportError("Failed to query database data version");
+        return false;
+    }
+
+    *dataVersion = query.value<qint64>(0);
+    query.finish();
+    return true;
+}
+
+/*
+    The aggregates of a batch of contacts are matched before the transaction
+    in which they are saved is begun, scoring the contacts on the threads of
+    the global thread pool.  The scores remain valid if nothing is committed to
+    the database before the transaction begins; within the transaction, only
+    the aggregates written since the contacts were scored must be scored
+    again, so a contact matching an aggregate created for an earlier contact
+    of the same batch is aggregated as if the contacts were matched in turn.
+*/
+QContactManager::Error ContactWriter::prescoreAggregation(
+        const QList<QContact> &contacts,
+        QVector<AggregationCandidateIndex::Scores> *scores,
+        quint64 *generation,
+        qint64 *dataVersion)
+{
+    AggregationCandidateIndex *index = m_database.aggregationCandidateIndex();
+    if (!index)
+        return QContactManager::NoError;
+
+    // The version is read first, so that a change committed while the entries are read is detected
+    if (!readDataVersion(m_database, dataVersion))
+        return QContactManager::UnspecifiedError;
+
+    QSharedPointer<const AggregationCandidateIndex::Entries> entries;
+    QContactManager::Error error = currentAggregationCandidates(index, &entries, generation);
+    if (error != QContactManager::NoError)
+        return error;
+
+    // Only new contacts are matched; the values of any other contact are left empty
+    scores->resize(contacts.count());
+    for (int i = 0; i < contacts.count(); ++i) {
+        if (ContactId::databaseId(contacts.at(i)) == 0) {
+            (*scores)[i].contact = aggregationCandidate(contacts.at(i));
+        }
+    }
+
+    entries->matchAll(scores);
+    return QContactManager::NoError;
+}
+
+// The entries of the candidate index, which are read and stored in the index if they are not current
+QContactManager::Error ContactWriter::currentAggregationCandidates(
+        AggregationCandidateIndex *index,
+        QSharedPointer<const AggregationCandidateIndex::Entries> *entries,
+        quint64 *generation)
+{
+    *entries = index->entries(generation);
+    if (!*entries) {
+        QSharedPointer<AggregationCandidateIndex::Entries> readEntries(new AggregationCandidateIndex::Entries);
+        QContactManager::Error error = readAggregationCandidates(readEntries.data(), QVariantList());
+        if (error == QContactManager::NoError)
+            error = readIsNotRelationships(readEntries.data());
+        if (error != QContactManager::NoError)
+            return error;
+
+        index->update(readEntries, *generation);
+        *entries = readEntries;
+    }
+
+    return QContactManager::NoError;
+}
+
+bool ContactWriter::prescoredMatchesCurrent(quint64 generation, qint64 dataVersion)
+{
+    // Nothing may have been committed since the contacts were scored
+    quint64 currentGeneration = 0;
+    m_database.aggregationCandidateIndex()->entries(&currentGeneration);
+
+    qint64 currentDataVersion = 0;
+    return currentGeneration == generation
+        && readDataVersion(m_database, &currentDataVersion)
+        && currentDataVersion == dataVersion;
+}
+
+/*
+    The aggregation candidate entries are copied from the engine's index for
+    the transaction, and the aggregates and IsNot relationships written during
+    the transaction are read again before a contact is matched against them.
+    The entries are read in full if the index holds none for the current
+    generation; either way, they can be stored in the index once the
+    transaction is committed.
+*/
+QContactManager::Error ContactWriter::prepareAggregationCandidates()
+{
+    // Any aggregate to be read must first be written from the detail batch
+    if (m_detailBatch && (!m_aggregationCandidates || !m_staleAggregationCandidates.isEmpty())) {
+        if (!m_detailBatch->flush())
+            return QContactManager::UnspecifiedError;
+    }
+
+    if (!m_aggregationCandidates) {
+        AggregationCandidateIndex *index = m_database.aggregationCandidateIndex();
+        QSharedPointer<const AggregationCandidateIndex::Entries> entries(index->entries(&m_aggregationCandidatesGeneration));
+        if (entries) {
+            m_aggregationCandidates.reset(new AggregationCandidateIndex::Entries(*entries));
+        } else {
+            QSharedPointer<AggregationCandidateIndex::Entries> readEntries(new AggregationCandidateIndex::Entries);
+            QContactManager::Error error = readAggregationCandidates(readEntries.data(), QVariantList());
+            if (error == QContactManager::NoError)
+                error = readIsNotRelationships(readEntries.data());
+            if (error != QContactManager::NoError)
+                return error;
+
+            m_aggregationCandidates = readEntries;
+            m_staleAggregationCandidates.clear();
+            m_staleIsNotRelationships = false;
+        }
+    }
+
+    if (!m_staleAggregationCandidates.isEmpty()) {
+        QVariantList aggregateIds;
+        foreach (quint32 aggregateId, m_staleAggregationCandidates) {
+            aggregateIds.append(aggregateId);
+        }
+
+        QContactManager::Error error = readAggregationCandidates(m_aggregationCandidates.data(), aggregateIds);
+        if (error != QContactManager::NoError)
+            return error;
+
+        m_staleAggregationCandidates.clear();
+    }
+
+    if (m_staleIsNotRelationships) {
+        QContactManager::Error error = readIsNotRelationships(m_aggregationCandidates.data());
+        if (error != QContactManager::NoError)
+            return error;
+
+        m_staleIsNotRelationships = false;
+    }
+
+    return QContactManager::NoError;
+}
+
+// Reads the aggregates with the specified IDs into the entries, or every aggregate if no IDs are specified
+QContactManager::Error ContactWriter::readAggregationCandidates(AggregationCandidateIndex::Entries *entries, const QVariantList &aggregateIds)
+{
+    enum ValueKind {
+        ContactRow = 0,
+        NameValues,
+        NicknameValue,
+        EmailAddressValue,
+        PhoneNumberValue,
+        AccountUriValue,
+        GenderValue
+    };
+
+    static const QString candidateValues(QStringLiteral(
+        " SELECT Contacts.contactId, 0, NULL, NULL FROM Contacts%1"
+        " UNION ALL"
+        " SELECT Names.contactId, 1, Names.lowerFirstName, Names.lowerLastName FROM Names"
+        " JOIN Contacts ON Contacts.contactId = Names.contactId%1"
+        " UNION ALL"
+        " SELECT Nicknames.contactId, 2, Nicknames.lowerNickname, NULL FROM Nicknames"
+        " JOIN Contacts ON Contacts.contactId = Nicknames.contactId%1"
+        " UNION ALL"
+        " SELECT EmailAddresses.contactId, 3, EmailAddresses.lowerEmailAddress, NULL FROM EmailAddresses"
+        " JOIN Contacts ON Contacts.contactId = EmailAddresses.contactId%1"
+        " UNION ALL"
+        " SELECT PhoneNumbers.contactId, 4, PhoneNumbers.normalizedNumber, NULL FROM PhoneNumbers"
+        " JOIN Contacts ON Contacts.contactId = PhoneNumbers.contactId%1"
+        " UNION ALL"
+        " SELECT OnlineAccounts.contactId, 5, OnlineAccounts.lowerAccountUri, NULL FROM OnlineAccounts"
+        " JOIN Contacts ON Contacts.contactId = OnlineAccounts.contactId%1"
+        " UNION ALL"
+        " SELECT Genders.contactId, 6, Genders.gender, NULL FROM Genders"
+        " JOIN Contacts ON Contacts.contactId = Genders.contactId%1"));
+
+    // The same aggregates are excluded as by the possibleAggregates query of the SQL heuristic
+    QString where(QStringLiteral(
+        " WHERE Contacts.collectionId = 1" // AggregateAddressbookCollectionId
+        " AND Contacts.contactId > 2" // exclude self contact
+        " AND Contacts.isDeactivated = 0"));
+
+    if (!aggregateIds.isEmpty()) {
+        m_database.clearTemporaryContactIdsTable(aggregationCandidatesTable);
+        if (!m_database.createTemporaryContactIdsTable(aggregationCandidatesTable, aggregateIds)) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Error creating aggregationCandidates temporary table"));
+            return QContactManager::UnspecifiedError;
+        }
+        where.append(QStringLiteral(" AND Contacts.contactId IN (SELECT contactId FROM temp.aggregationCandidates)"));
+    }
+
+    ContactsDatabase::Query query(m_database.prepare(candidateValues.arg(where)));
+    if (!ContactsDatabase::execute(query)) {
+        query.reportError("Failed to read aggregation candidates");
+        return QContactManager::UnspecifiedError;
+    }
+
+    QHash<quint32, AggregationCandidateIndex::Aggregate> aggregates;
+    while (query.next()) {
+        AggregationCandidateIndex::Aggregate &aggregate(aggregates[query.value<quint32>(0)]);
+
+        // Null values are not stored, as they match nothing
+        const QVariant value(query.value(2));
+        switch (query.value<int>(1)) {
+        case NameValues:
+            aggregate.names.append(qMakePair(value.toString(), query.value(3).toString()));
+            break;
+        case NicknameValue:
+            aggregate.hasNickname = true;
+            if (!value.isNull())
+                aggregate.nicknames.insert(value.toString());
+            break;
+        case EmailAddressValue:
+            if (!value.isNull())
+                aggregate.emailAddresses.insert(value.toString());
+            break;
+        case PhoneNumberValue:
+            if (!value.isNull())
+                aggregate.phoneNumbers.insert(value.toString());
+            break;
+        case AccountUriValue:
+            if (!value.isNull())
+                aggregate.accountUris.insert(value.toString());
+            break;
+        case GenderValue:
+            aggregate.gender = value.toString();
+            break;
+        default:
+            break;
+        }
+    }
+    query.finish();
+
+    // An aggregate which is no longer a candidate is removed from the entries
+    foreach (const QVariant &aggregateId, aggregateIds) {
+        entries->remove(aggregateId.value<quint32>());
+    }
+
+    QHash<quint32, AggregationCandidateIndex::Aggregate>::const_iterator it = aggregates.constBegin(), end = aggregates.constEnd();
+    for ( ; it != end; ++it) {
+        entries->insert(it.key(), *it);
+    }
+
+    return QContactManager::NoError;
+}
+
+QContactManager::Error ContactWriter::readIsNotRelationships(AggregationCandidateIndex::Entries *entries)
+{
+    const QString statement(QStringLiteral(
+        " SELECT firstId, secondId FROM Relationships WHERE type = 'IsNot'"));
+
+    ContactsDatabase::Query query(m_database.prepare(statement));
+    if (!ContactsDatabase::execute(query)) {
+        query.reportError("Failed to read IsNot relationships");
+        return QContactManager::UnspecifiedError;
+    }
+
+    entries->clearIsNot();
+    while (query.next()) {
+        entries->insertIsNot(query.value<quint32>(0), query.value<quint32>(1));
+    }
+    query.finish();
+
+    return QContactManager::NoError;
+}
+
+QContactManager::Error ContactWriter::aggregationMatch(const QContact &contact, quint32 *aggregateId, int *score)
+{
+    if (!m_database.aggregating())
+        return QContactManager::NotSupportedError;
+
+    QMutexLocker locker(m_database.accessMutex());
+
+    // The match is found within a transaction, as it is when the contact is saved
+    if (!beginTransaction()) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to begin database transaction while matching aggregates"));
+        return QContactManager::UnspecifiedError;
+    }
+
+    const QContactManager::Error error = findAggregate(contact, aggregateId, score);
+    rollbackTransaction();
+    return error;
+}
+
+// The duplicates found by a scan are reported progressively, after this many aggregates are compared
+static const int DuplicateScanReportInterval = 500;
+
+/*
+    Finds the pairs of aggregates which may represent the same person, without
+    comparing every pair of aggregates: only the aggregates grouped together by
+    a blocking key are scored, using the weights of the aggregation heuristic.
+    A pair with an IsNot relationship is never reported.  The duplicates found
+    are reported through the reader as the scan progresses.
+*/
+QContactManager::Error ContactWriter::findDuplicates(int minimumScore)
+{
+    if (!m_database.aggregating())
+        return QContactManager::NotSupportedError;
+
+    AggregationCandidateIndex *index = m_database.aggregationCandidateIndex();
+    if (!index)
+        return QContactManager::NotSupportedError;
+
+    QSharedPointer<const AggregationCandidateIndex::Entries> entries;
+    quint64 generation = 0;
+    {
+        QMutexLocker locker(m_database.accessMutex());
+
+        QContactManager::Error error = currentAggregationCandidates(index, &entries, &generation);
+        if (error != QContactManager::NoError)
+            return error;
+    }
+
+    QList<ContactReader::Duplicate> duplicates;
+    int reportedCount = 0;
+
+    const QList<quint32> aggregateIds(entries->aggregateIds());
+    for (int i = 0; i < aggregateIds.count(); ++i) {
+        const quint32 aggregateId = aggregateIds.at(i);
+        foreach (const AggregationCandidateIndex::Match &match, entries->duplicates(aggregateId)) {
+            if (match.score >= minimumScore) {
+                const ContactReader::Duplicate duplicate = {
+                    ContactId::apiId(aggregateId, m_managerUri),
+                    ContactId::apiId(match.aggregateId, m_managerUri),
+                    match.score
+                };
+                duplicates.append(duplicate);
+            }
+        }
+
+        if ((i + 1) % DuplicateScanReportInterval == 0 && duplicates.count() > reportedCount) {
+            m_reader->duplicatesAvailable(duplicates);
+            reportedCount = duplicates.count();
+        }
+    }
+
+    if (duplicates.count() > reportedCount) {
+        m_reader->duplicatesAvailable(duplicates);
+    }
+
+    return QContactManager::NoError;
+}
+
+QContactManager::Error ContactWriter::findAggregate(const QContact &contact, quint32 *aggregateId, int *score)
+{
+    *aggregateId = 0;
+    *score = 0;
+
+    const AggregationCandidateIndex::Contact candidate(aggregationCandidate(contact));
+    if (m_database.aggregationCandidateIndex()) {
+        QContactManager::Error error = prepareAggregationCandidates();
+        if (error != QContactManager::NoError)
+            return error;
+
+        const AggregationCandidateIndex::Scores *prescored = m_prescoredMatches;
+        if (prescored && !m_isNotRelationshipsWritten && prescored->contact.sameValues(candidate)) {
+            // Only the aggregates written since the contact was scored need to be scored again
+            QList<AggregationCandidateIndex::Match> matches;
+            foreach (const AggregationCandidateIndex::Match &match, prescored->matches) {
+                if (!m_writtenAggregationCandidates.contains(match.aggregateId))
+                    matches.append(match);
+            }
+            matches.append(m_aggregationCandidates->matches(candidate, m_writtenAggregationCandidates));
+            AggregationCandidateIndex::Entries::bestMatch(matches, aggregateId, score);
+        } else {
+            m_aggregationCandidates->bestMatch(candidate, aggregateId, score);
+        }
+        return QContactManager::NoError;
+    }
+
+    if (m_detailBatch && !m_detailBatch->flush())
+        return QContactManager::UnspecifiedError;
+
+    return queryAggregate(candidate, aggregateId, score);
+}
+
+QContactManager::Error ContactWriter::queryAggregate(const AggregationCandidateIndex::Contact &candidate, quint32 *aggregateId, int *score)
+{
+    /*
+    Aggregation heuristic.
+
+    Search existing aggregate contacts, for matchability.
+    The aggregate with the highest match score (over the threshold)
+    represents the same "actual person".
+    The newly saved contact then becomes a constituent of that
+    aggregate.
+
+    Note that individual contacts from the same sync collection can
+    represent the same actual person (eg, Telepathy might provide
+    buddies from different Jabber servers/rosters and thus if
+    you have the same buddy on multiple services, they need to
+    be aggregated together.
+
+    Stages:
+    1) select all possible aggregate ids
+    2) join those ids on the tables of interest to get the data we match against
+    3) perform the heuristic matching, ordered by "best score"
+    4) select highest score; if over threshold, select that as aggregate.
+    */
+    static const QString possibleAggregatesWhere(QStringLiteral(
+        /* SELECT contactId FROM Contacts ... */
+        " WHERE Contacts.collectionId = 1" // AggregateAddressbookCollectionId
+        " AND Contacts.contactId IN ("
+            " SELECT contactId FROM Names"
+            " WHERE COALESCE(:lastName, '') = ''"
+            "    OR COALESCE(lowerLastName, '') = ''"
+            "    OR lowerLastName = :lastName"
+            " UNION"
+            " SELECT contactId FROM Nicknames"
+            " WHERE contactId NOT IN (SELECT contactId FROM Names))"
+        " AND Contacts.contactId NOT IN ("
+            " SELECT contactId FROM Genders"
+            " WHERE gender = :excludeGender)"
+        " AND contactId > 2" // exclude self contact
+        " AND isDeactivated = 0" // exclude deactivated
+        " AND contactId NOT IN ("
+            " SELECT secondId FROM Relationships WHERE firstId = :contactId AND type = 'IsNot'"
+            " UNION"
+            " SELECT firstId FROM Relationships WHERE secondId = :contactId AND type = 'IsNot'"
+        " )"));
+
+    // Use a simple match algorithm, looking for exact matches on name fields,
+    // or accumulating points for name matches (including partial matches of first name).
+
+    // step one: build the temporary table which contains all "possible" aggregate contact ids.
+    m_database.clearTemporaryContactIdsTable(possibleAggregatesTable);
+
+    const QString orderBy = QStringLiteral("contactId ASC ");
+    const QString where = possibleAggregatesWhere;
+    QMap<QString, QVariant> bindings;
+    bindings.insert(":lastName", candidate.lastName);
+    bindings.insert(":contactId", candidate.contactId);
+    bindings.insert(":excludeGender", candidate.excludeGender);
+    if (!m_database.createTemporaryContactIdsTable(possibleAggregatesTable,
+                                                   QString(), where, orderBy, bindings)) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Error creating possibleAggregates temporary table"));
+        return QContactManager::UnspecifiedError;
+    }
+
+    // step two: query matching data.
+    const QString heuristicallyMatchData(QStringLiteral(
+        " SELECT Matches.contactId, sum(Matches.score) AS total FROM ("
+            " SELECT Names.contactId, 20 AS score FROM Names"
+            " INNER JOIN temp.possibleAggregates ON Names.contactId = temp.possibleAggregates.contactId"
+                " WHERE lowerLastName  != '' AND lowerLastName  = :lastName"
+                "   AND lowerFirstName != '' AND lowerFirstName = :firstName"
+            " UNION"
+            " SELECT Names.contactId, 15 AS score FROM Names"
+            " INNER JOIN temp.possibleAggregates ON Names.contactId = temp.possibleAggregates.contactId"
+                " WHERE COALESCE(lowerFirstName,'') = '' AND COALESCE(:firstName,'') = ''"
+                "   AND COALESCE(lowerLastName, '') = '' AND COALESCE(:lastName, '') = ''"
+                "   AND EXISTS ("
+                      " SELECT * FROM Nicknames"
+                      " WHERE Nicknames.contactId = Names.contactId"
+                      "   AND lowerNickName = :nickname)"
+            " UNION"
+            " SELECT Nicknames.contactId, 15 AS score FROM Nicknames"
+            " INNER JOIN temp.possibleAggregates ON Nicknames.contactId = temp.possibleAggregates.contactId"
+                " WHERE lowerNickName = :nickname"
+                "   AND COALESCE(:firstName,'') = ''"
+                "   AND COALESCE(:lastName, '') = ''"
+                "   AND NOT EXISTS ("
                     " SELECT * FROM Names WHERE Names.contactId = Nicknames.contactId )"
             " UNION"
             " SELECT Names.contactId, 12 AS score FROM Names"
@@ -4112,7 +4441,7 @@ QContactManager::Error ContactWriter::updateOrCreateAggregate(QContact *contact,
                 " WHERE lowerNickName != '' AND lowerNickName = :nickname"
         " ) AS Matches"
         " GROUP BY Matches.contactId"
-        " ORDER BY total DESC"
+        " ORDER BY total DESC, Matches.contactId ASC"
         " LIMIT 1"
     ));
 
@@ -4120,31 +4449,56 @@ QContactManager::Error ContactWriter::updateOrCreateAggregate(QContact *contact,
     m_database.clearTemporaryValuesTable(matchPhoneNumbersTable);
     m_database.clearTemporaryValuesTable(matchOnlineAccountsTable);
 
-    if (!m_database.createTemporaryValuesTable(matchEmailAddressesTable, emailAddresses) ||
-        !m_database.createTemporaryValuesTable(matchPhoneNumbersTable, phoneNumbers) ||
-        !m_database.createTemporaryValuesTable(matchOnlineAccountsTable, accountUris)) {
+    if (!m_database.createTemporaryValuesTable(matchEmailAddressesTable, variantList(candidate.emailAddresses)) ||
+        !m_database.createTemporaryValuesTable(matchPhoneNumbersTable, variantList(candidate.phoneNumbers)) ||
+        !m_database.createTemporaryValuesTable(matchOnlineAccountsTable, variantList(candidate.accountUris))) {
         QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Error creating possibleAggregates match tables"));
         return QContactManager::UnspecifiedError;
     }
 
     ContactsDatabase::Query query(m_database.prepare(heuristicallyMatchData));
 
-    query.bindValue(":firstName", firstName);
-    query.bindValue(":lastName", lastName);
-    query.bindValue(":nickname", nickname);
+    query.bindValue(":firstName", candidate.firstName);
+    query.bindValue(":lastName", candidate.lastName);
+    query.bindValue(":nickname", candidate.nickname);
 
     if (!ContactsDatabase::execute(query)) {
         query.reportError("Error finding match for updated local contact");
         return QContactManager::UnspecifiedError;
     }
     if (query.next()) {
-        const quint32 aggregateId = query.value<quint32>(0);
-        const quint32 score = query.value<quint32>(1);
+        *aggregateId = query.value<quint32>(0);
+        *score = query.value<int>(1);
+    }
 
-        static const quint32 MinimumMatchScore = 15;
-        if (score >= MinimumMatchScore) {
-            existingAggregateId = aggregateId;
-        }
+    return QContactManager::NoError;
+}
+
+QContactManager::Error ContactWriter::updateOrCreateAggregate(QContact *contact, const DetailList &definitionMask, bool withinTransaction, bool withinSyncUpdate, bool createOnly, quint32 *aggregateContactId)
+{
+    // 1) search for match
+    // 2) if exists, update the existing aggregate (by default, non-clobber:
+    //    only update empty fields of details, or promote non-existent details.  Never delete or replace details.)
+    // 3) otherwise, create new aggregate, consisting of all details of contact, return.
+
+    quint32 existingAggregateId = 0;
+    QContact matchingAggregate;
+
+    // The aggregates must be up to date before they are matched
+    QContactManager::Error regenerateError = regenerateQueuedAggregates();
+    if (regenerateError != QContactManager::NoError)
+        return regenerateError;
+
+    // We need to search to find an appropriate aggregate
+    quint32 aggregateId = 0;
+    int score = 0;
+    QContactManager::Error matchError = findAggregate(*contact, &aggregateId, &score);
+    if (matchError != QContactManager::NoError)
+        return matchError;
+
+    static const int MinimumMatchScore = 15;
+    if (aggregateId && score >= MinimumMatchScore) {
+        existingAggregateId = aggregateId;
     }
 
     if (!existingAggregateId) {
@@ -4165,78 +4519,295 @@ QContactManager::Error ContactWriter::updateOrCreateAggregate(QContact *contact,
             return QContactManager::UnspecifiedError;
         }
 
-        matchingAggregate = readList.at(0);
-    }
-
-    QContactManager::Error err = QContactManager::NoError;
-    QMap<int, QContactManager::Error> errorMap;
-    QContactId matchingAggregateId;
-    if (existingAggregateId && createOnly) {
-        // the caller has specified that we should not update existing aggregates.
-        // this is because it will manually regenerate the aggregates themselves,
-        // with specific detail promotion order (e.g. prefer local contact details).
-        matchingAggregateId = QContactId(ContactId::apiId(existingAggregateId, m_managerUri));
-    } else {
-        // whether it's an existing or new contact, we promote details.
-        // TODO: promote non-Aggregates relationships!
-        promoteDetailsToAggregate(*contact, &matchingAggregate, definitionMask, false);
-
-        // now save in database.
-        QList<QContact> saveContactList;
-        saveContactList.append(matchingAggregate);
-        err = save(&saveContactList, DetailList(), 0, &errorMap, withinTransaction, true, false); // we're updating (or creating) the aggregate
-        if (err != QContactManager::NoError) {
-            if (!existingAggregateId) {
-                QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Could not create new aggregate contact"));
-            } else {
-                QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Could not update existing aggregate contact"));
-            }
-            return err;
+        matchingAggregate = readList.at(0);
+    }
+
+    QContactManager::Error err = QContactManager::NoError;
+    QMap<int, QContactManager::Error> errorMap;
+    QContactId matchingAggregateId;
+    if (existingAggregateId && createOnly) {
+        // the caller has specified that we should not update existing aggregates.
+        // this is because it will manually regenerate the aggregates themselves,
+        // with specific detail promotion order (e.g. prefer local contact details).
+        matchingAggregateId = QContactId(ContactId::apiId(existingAggregateId, m_managerUri));
+    } else {
+        // whether it's an existing or new contact, we promote details.
+        // TODO: promote non-Aggregates relationships!
+        promoteDetailsToAggregate(*contact, &matchingAggregate, definitionMask, false);
+
+        // now save in database.
+        QList<QContact> saveContactList;
+        saveContactList.append(matchingAggregate);
+        err = save(&saveContactList, DetailList(), 0, &errorMap, withinTransaction, true, false); // we're updating (or creating) the aggregate
+        if (err != QContactManager::NoError) {
+            if (!existingAggregateId) {
+                QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Could not create new aggregate contact"));
+            } else {
+                QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Could not update existing aggregate contact"));
+            }
+            return err;
+        }
+        matchingAggregateId = saveContactList.at(0).id();
+    }
+
+    if (m_detailBatch) {
+        // The relationship is written with the details of the batch
+        DetailRow row(QStringLiteral("Relationships"));
+        row.bind(QStringLiteral("firstId"), ContactId::databaseId(matchingAggregateId));
+        row.bind(QStringLiteral("secondId"), ContactId::databaseId(*contact));
+        row.bind(QStringLiteral("type"), relationshipString(QContactRelationship::Aggregates));
+        m_detailBatch->append(row);
+    } else {
+        // add the relationship and save in the database.
+        // Note: we DON'T use the existing save(relationshipList, ...) function
+        // as it does (expensive) aggregate regeneration which we have already
+        // done above (via the detail promotion and aggregate save).
+        // Instead, we simply add the "aggregates" relationship directly.
+        const QString insertRelationship(QStringLiteral(
+            " INSERT INTO Relationships (firstId, secondId, type)"
+            " VALUES (:firstId, :secondId, :type)"
+        ));
+
+        ContactsDatabase::Query query(m_database.prepare(insertRelationship));
+        query.bindValue(":firstId", ContactId::databaseId(matchingAggregateId));
+        query.bindValue(":secondId", ContactId::databaseId(*contact));
+        query.bindValue(":type", relationshipString(QContactRelationship::Aggregates));
+        if (!ContactsDatabase::execute(query)) {
+            query.reportError("Error inserting Aggregates relationship");
+            err = QContactManager::UnspecifiedError;
+        }
+    }
+
+    if (err == QContactManager::NoError) {
+        if (aggregateContactId) {
+            *aggregateContactId = ContactId::databaseId(matchingAggregateId);
+        }
+    } else {
+        // if the aggregation relationship fails, the entire save has failed.
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to save aggregation relationship!"));
+
+        if (!existingAggregateId) {
+            // clean up the newly created contact.
+            QList<QContactId> removeList;
+            removeList.append(matchingAggregateId);
+            QContactManager::Error cleanupErr = remove(removeList, &errorMap, withinTransaction, withinSyncUpdate);
+            if (cleanupErr != QContactManager::NoError) {
+                QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to cleanup newly created aggregate contact!"));
+            }
+        }
+    }
+
+    return err;
+}
+
+void ContactWriter::setDeferAggregateRegeneration(bool defer)
+{
+    m_deferAggregateRegeneration = defer;
+}
+
+static ContactWriter::DetailList combinedDefinitionMask(const ContactWriter::DetailList &mask, const ContactWriter::DetailList &other)
+{
+    // An empty mask includes every detail type
+    if (mask.isEmpty() || other.isEmpty())
+        return ContactWriter::DetailList();
+
+    ContactWriter::DetailList combined(mask);
+    foreach (QContactDetail::DetailType type, other) {
+        if (!combined.contains(type))
+            combined.append(type);
+    }
+    return combined;
+}
+
+/*
+    When the changes to a constituent are known, only the changed detail types
+    of its aggregates need to be regenerated.  A change to a detail identifying
+    the constituent, or to its deactivation, affects every detail that it
+    contributes, and requires a full regeneration.
+*/
+static ContactWriter::DetailList aggregateRegenerationMask(const ContactWriter::DetailList &changedDetailTypes)
+{
+    static const ContactWriter::DetailList identityDetailTypes(getIdentityDetailTypes());
+
+    foreach (QContactDetail::DetailType type, changedDetailTypes) {
+        if (identityDetailTypes.contains(type) || type == detailType<QContactDeactivated>())
+            return ContactWriter::DetailList();
+    }
+    return changedDetailTypes;
+}
+
+void ContactWriter::queueAggregateRegeneration(QHash<quint32, DetailList> *aggregates, quint32 aggregateId, const DetailList &definitionMask)
+{
+    QHash<quint32, DetailList>::iterator it = aggregates->find(aggregateId);
+    if (it == aggregates->end()) {
+        aggregates->insert(aggregateId, definitionMask);
+    } else {
+        *it = combinedDefinitionMask(*it, definitionMask);
+    }
+}
+
+void ContactWriter::queueAggregateRegeneration(const QList<quint32> &aggregateIds, const DetailList &definitionMask)
+{
+    foreach (quint32 aggregateId, aggregateIds) {
+        queueAggregateRegeneration(&m_queuedAggregates, aggregateId, definitionMask);
+    }
+}
+
+/*
+    Aggregates are not regenerated as soon as one of their constituents
+    changes; instead they are queued, and each is regenerated once when the
+    transaction is committed, however many of its constituents were written.
+    An aggregate may be matched against another contact within the
+    transaction, so the queue is also regenerated before any matching.
+
+    A writer which is not used interactively can defer regeneration beyond
+    the end of the transaction: the aggregates are then regenerated once
+    writes have been idle for a short interval, so that a series of saves
+    regenerates each affected aggregate only once.  Any deferred aggregate
+    is included whenever the queue is regenerated.
+*/
+QContactManager::Error ContactWriter::regenerateQueuedAggregates()
+{
+    QMap<quint32, DetailList> aggregates;
+    for (QHash<quint32, DetailList>::const_iterator it = m_deferredAggregates.constBegin(); it != m_deferredAggregates.constEnd(); ++it) {
+        if (!m_regeneratedAggregateIds.contains(it.key()))
+            aggregates.insert(it.key(), it.value());
+    }
+    for (QHash<quint32, DetailList>::const_iterator it = m_queuedAggregates.constBegin(); it != m_queuedAggregates.constEnd(); ++it) {
+        QMap<quint32, DetailList>::iterator ait = aggregates.find(it.key());
+        if (ait == aggregates.end()) {
+            aggregates.insert(it.key(), it.value());
+        } else {
+            *ait = combinedDefinitionMask(*ait, it.value());
+        }
+    }
+    m_queuedAggregates.clear();
+
+    // Aggregates removed since they were queued are not regenerated
+    foreach (const QContactId &id, m_removedIds) {
+        aggregates.remove(ContactId::databaseId(id));
+    }
+    if (aggregates.isEmpty())
+        return QContactManager::NoError;
+
+    // Aggregates sharing the same definition mask are regenerated together, in order of id
+    QList<DetailList> masks;
+    QList<QList<quint32> > aggregateIds;
+    for (QMap<quint32, DetailList>::const_iterator it = aggregates.constBegin(); it != aggregates.constEnd(); ++it) {
+        int index = masks.indexOf(it.value());
+        if (index == -1) {
+            index = masks.count();
+            masks.append(it.value());
+            aggregateIds.append(QList<quint32>());
+        }
+        aggregateIds[index].append(it.key());
+        m_regeneratedAggregateIds.insert(it.key());
+    }
+
+    // The aggregates are regenerated from their constituents as written to the database
+    DetailInsertBatch *detailBatch = m_detailBatch;
+    if (detailBatch && !detailBatch->flush())
+        return QContactManager::UnspecifiedError;
+    m_detailBatch = nullptr;
+
+    QContactManager::Error error = QContactManager::NoError;
+    for (int i = 0; i < masks.count() && error == QContactManager::NoError; ++i) {
+        error = regenerateAggregates(aggregateIds.at(i), masks.at(i), true);
+        if (error != QContactManager::NoError) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to regenerate %1 queued aggregate contacts").arg(aggregateIds.at(i).count()));
+        }
+    }
+
+    m_detailBatch = detailBatch;
+    return error;
+}
+
+QContactManager::Error ContactWriter::regenerateDeferredAggregates()
+{
+    QMutexLocker locker(m_database.accessMutex());
+
+    if (m_deferredAggregates.isEmpty())
+        return QContactManager::NoError;
+
+    if (!beginTransaction()) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to begin database transaction while regenerating deferred aggregates"));
+        return QContactManager::UnspecifiedError;
+    }
+
+    // The aggregates remain deferred if they cannot be regenerated, to be retried
+    QContactManager::Error error = regenerateQueuedAggregates();
+    if (error != QContactManager::NoError) {
+        rollbackTransaction();
+        return error;
+    }
+
+    if (!commitTransaction()) {
+        return QContactManager::UnspecifiedError;
+    }
+
+    return QContactManager::NoError;
+}
+
+/*
+    Aggregates whose deferred regeneration was recorded but not performed,
+    because the process writing them ended first, are regenerated in full.
+*/
+QContactManager::Error ContactWriter::resumeDeferredAggregates()
+{
+    {
+        QMutexLocker locker(m_database.accessMutex());
+
+        // The record is read within a transaction, as other processes may be writing it
+        if (!beginTransaction()) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to begin database transaction while resuming deferred aggregates"));
+            return QContactManager::UnspecifiedError;
+        }
+
+        QSet<quint32> aggregateIds;
+        if (!readDeferredAggregateIds(m_database, &aggregateIds)) {
+            rollbackTransaction();
+            return QContactManager::UnspecifiedError;
+        }
+        if (aggregateIds.isEmpty()) {
+            rollbackTransaction();
+            return QContactManager::NoError;
         }
-        matchingAggregateId = saveContactList.at(0).id();
-    }
 
-    {
-        // add the relationship and save in the database.
-        // Note: we DON'T use the existing save(relationshipList, ...) function
-        // as it does (expensive) aggregate regeneration which we have already
-        // done above (via the detail promotion and aggregate save).
-        // Instead, we simply add the "aggregates" relationship directly.
-        const QString insertRelationship(QStringLiteral(
-            " INSERT INTO Relationships (firstId, secondId, type)"
-            " VALUES (:firstId, :secondId, :type)"
-        ));
+        // The ids are formatted from integers, so they can be included in the statement
+        QStringList ids;
+        foreach (quint32 aggregateId, aggregateIds) {
+            ids.append(QString::number(aggregateId));
+        }
 
-        ContactsDatabase::Query query(m_database.prepare(insertRelationship));
-        query.bindValue(":firstId", ContactId::databaseId(matchingAggregateId));
-        query.bindValue(":secondId", ContactId::databaseId(*contact));
-        query.bindValue(":type", relationshipString(QContactRelationship::Aggregates));
+        ContactsDatabase::Query query(m_database.prepare(QStringLiteral(
+            "SELECT contactId FROM Contacts WHERE collectionId = 1 AND contactId IN (%1)").arg(ids.join(QLatin1Char(',')))));
         if (!ContactsDatabase::execute(query)) {
-            query.reportError("Error inserting Aggregates relationship");
-            err = QContactManager::UnspecifiedError;
+            query.reportError("Failed to query deferred aggregates");
+            rollbackTransaction();
+            return QContactManager::UnspecifiedError;
         }
-    }
 
-    if (err == QContactManager::NoError) {
-        if (aggregateContactId) {
-            *aggregateContactId = ContactId::databaseId(matchingAggregateId);
+        QSet<quint32> existingIds;
+        while (query.next()) {
+            existingIds.insert(query.value<quint32>(0));
         }
-    } else {
-        // if the aggregation relationship fails, the entire save has failed.
-        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to save aggregation relationship!"));
+        query.finish();
 
-        if (!existingAggregateId) {
-            // clean up the newly created contact.
-            QList<QContactId> removeList;
-            removeList.append(matchingAggregateId);
-            QContactManager::Error cleanupErr = remove(removeList, &errorMap, withinTransaction, withinSyncUpdate);
-            if (cleanupErr != QContactManager::NoError) {
-                QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to cleanup newly created aggregate contact!"));
-            }
+        // Aggregates removed since they were recorded are no longer regenerated
+        if (existingIds != aggregateIds && !storeDeferredAggregateIds(m_database, existingIds)) {
+            rollbackTransaction();
+            return QContactManager::UnspecifiedError;
+        }
+        if (!commitTransaction()) {
+            return QContactManager::UnspecifiedError;
+        }
+
+        foreach (quint32 aggregateId, existingIds) {
+            queueAggregateRegeneration(&m_deferredAggregates, aggregateId, DetailList());
         }
     }
 
-    return err;
+    return regenerateDeferredAggregates();
 }
 
 /*
@@ -4490,35 +5061,247 @@ QContactManager::Error ContactWriter::aggregateOrphanedContacts(bool withinTrans
     return QContactManager::NoError;
 }
 
-static bool updateGlobalPresence(QContact *contact)
+// The contacts of an aggregate rebuild are aggregated and committed in chunks of this size
+static const int AggregateRebuildChunkSize = 250;
+
+static bool readAggregateRebuildPosition(ContactsDatabase &database, bool *pending, quint32 *lastContactId)
+{
+    ContactsDatabase::Query query(database.prepare("SELECT Value FROM DbSettings WHERE Name = 'AggregateRebuildContactId'"));
+    if (!ContactsDatabase::execute(query)) {
+        query.reportError("Failed to query aggregate rebuild position");
+        return false;
+    }
+
+    *pending = query.next();
+    *lastContactId = *pending ? query.value<QString>(0).toUInt() : 0;
+    query.finish();
+    return true;
+}
+
+static bool storeAggregateRebuildPosition(ContactsDatabase &database, quint32 lastContactId)
 {
-    QContactGlobalPresence globalPresence = contact->detail<QContactGlobalPresence>();
+    ContactsDatabase::Query query(database.prepare("INSERT OR REPLACE INTO DbSettings (Name, Value) VALUES ('AggregateRebuildContactId', :value)"));
+    query.bindValue(":value", QString::number(lastContactId));
+    if (!ContactsDatabase::execute(query)) {
+        query.reportError("Failed to store aggregate rebuild position");
+        return false;
+    }
+    return true;
+}
 
-    const QList<QContactPresence> details = contact->details<QContactPresence>();
-    if (details.isEmpty()) {
-        // No presence - remove global presence if present
-        if (!globalPresence.isEmpty()) {
-            contact->removeDetail(&globalPresence);
-        }
+static bool clearAggregateRebuildPosition(ContactsDatabase &database)
+{
+    ContactsDatabase::Query query(database.prepare("DELETE FROM DbSettings WHERE Name = 'AggregateRebuildContactId'"));
+    if (!ContactsDatabase::execute(query)) {
+        query.reportError("Failed to clear aggregate rebuild position");
+        return false;
+    }
+    return true;
+}
+
+// Generates the search index content of the aggregates created beyond the specified id
+static bool updateRebuiltSearchIndex(ContactsDatabase &database, quint32 maximumContactId)
+{
+    if (!database.hasFullTextSearch())
         return true;
+
+    ContactsDatabase::Query query(database.prepare("SELECT contactId FROM Contacts WHERE contactId > :maximumContactId"));
+    query.bindValue(":maximumContactId", maximumContactId);
+    if (!ContactsDatabase::execute(query)) {
+        query.reportError("Failed to fetch rebuilt aggregate ids");
+        return false;
+    }
+
+    QList<quint32> contactIds;
+    while (query.next()) {
+        contactIds.append(query.value<quint32>(0));
+    }
+    query.finish();
+
+    return contactIds.isEmpty() || database.updateSearchIndex(contactIds);
+}
+
+// Reads the ids of the next chunk of contacts to aggregate, or else those up to the end of a chunk already read
+static bool readAggregateRebuildChunk(ContactsDatabase &database, const QString &unaggregatedContacts,
+                                      quint32 lastContactId, quint32 chunkEndContactId, QList<quint32> *contactIds)
+{
+    QString statement(QStringLiteral("SELECT contactId") + unaggregatedContacts);
+    if (chunkEndContactId) {
+        statement.append(QStringLiteral(" AND contactId <= :chunkEndContactId ORDER BY contactId"));
+    } else {
+        statement.append(QStringLiteral(" ORDER BY contactId LIMIT %1").arg(AggregateRebuildChunkSize));
+    }
+
+    ContactsDatabase::Query query(database.prepare(statement));
+    query.bindValue(":lastContactId", lastContactId);
+    if (chunkEndContactId) {
+        query.bindValue(":chunkEndContactId", chunkEndContactId);
+    }
+    if (!ContactsDatabase::execute(query)) {
+        query.reportError("Failed to fetch contact ids for aggregate rebuild");
+        return false;
+    }
+    while (query.next()) {
+        contactIds->append(query.value<quint32>(0));
+    }
+    return true;
+}
+
+/*
+    Aggregates are rebuilt for every aggregable contact without one, as is
+    required after a schema upgrade removes the aggregates.  Rather than saving
+    each contact again, the contacts are aggregated in chunks ordered by id:
+    each chunk is matched in parallel from the aggregation candidate index, its
+    new aggregates are inserted with their details and relationships in bulk,
+    and it is committed in its own transaction with the position reached; the
+    chunk is read again if another connection has changed it in the meantime.  If
+    the rebuild is interrupted, it is resumed from that position the next time
+    it is invoked, whether or not it is still required.
+*/
+QContactManager::Error ContactWriter::rebuildAggregates(bool required)
+{
+    if (!m_database.aggregating()) {
+        return QContactManager::NoError;
     }
 
-    QContactPresence bestPresence;
+    bool pending = false;
+    quint32 lastContactId = 0;
+    if (!readAggregateRebuildPosition(m_database, &pending, &lastContactId)) {
+        return QContactManager::UnspecifiedError;
+    }
+    if (!pending && !required) {
+        return QContactManager::NoError;
+    }
+
+    const QString unaggregatedContacts(QStringLiteral(
+        " FROM Contacts"
+            " WHERE contactId > :lastContactId"
+            " AND isDeactivated = 0"
+            " AND changeFlags < 4" // ChangeFlags::IsDeleted
+            " AND collectionId IN ("
+                " SELECT collectionId FROM Collections WHERE aggregable = 1"
+            " )"
+            " AND contactId NOT IN ("
+                " SELECT DISTINCT secondId FROM Relationships WHERE type = 'Aggregates'"
+            " )"
+    ));
 
-    foreach (const QContactPresence &detail, details) {
-        if (betterPresence(detail, bestPresence)) {
-            bestPresence = detail;
+    int remainingCount = 0;
+    {
+        ContactsDatabase::Query query(m_database.prepare(QStringLiteral("SELECT COUNT(*)") + unaggregatedContacts));
+        query.bindValue(":lastContactId", lastContactId);
+        if (!ContactsDatabase::execute(query) || !query.next()) {
+            query.reportError("Failed to count contacts for aggregate rebuild");
+            return QContactManager::UnspecifiedError;
         }
+        remainingCount = query.value<int>(0);
     }
 
-    globalPresence.setPresenceState(bestPresence.presenceState());
-    globalPresence.setPresenceStateText(bestPresence.presenceStateText());
-    globalPresence.setTimestamp(bestPresence.timestamp());
-    globalPresence.setNickname(bestPresence.nickname());
-    globalPresence.setCustomMessage(bestPresence.customMessage());
+    QContactFetchHint hint;
+    hint.setOptimizationHints(QContactFetchHint::NoRelationships);
 
-    contact->saveDetail(&globalPresence, QContact::IgnoreAccessConstraints);
-    return true;
+    int rebuiltCount = 0;
+    while (true) {
+        QList<quint32> contactIds;
+        if (!readAggregateRebuildChunk(m_database, unaggregatedContacts, lastContactId, 0, &contactIds)) {
+            return QContactManager::UnspecifiedError;
+        }
+        if (contactIds.isEmpty()) {
+            break;
+        }
+
+        QList<QContact> readList;
+        QContactManager::Error error = m_reader->readContacts(QStringLiteral("RebuildAggregates"), &readList, contactIds, hint);
+        if (error != QContactManager::NoError || readList.size() != contactIds.size()) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to read contacts for aggregate rebuild"));
+            return QContactManager::UnspecifiedError;
+        }
+
+        QVector<AggregationCandidateIndex::Scores> prescoredMatches;
+        quint64 prescoredGeneration = 0;
+        qint64 prescoredDataVersion = 0;
+        if (prescoreAggregation(readList, &prescoredMatches, &prescoredGeneration, &prescoredDataVersion) != QContactManager::NoError) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to match aggregates before rebuilding them"));
+            prescoredMatches.clear();
+        }
+
+        if (!beginTransaction()) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to begin database transaction while rebuilding aggregates"));
+            return QContactManager::UnspecifiedError;
+        }
+
+        // Another connection may have aggregated or removed contacts of the chunk since they were read
+        QList<quint32> currentIds;
+        if (!readAggregateRebuildChunk(m_database, unaggregatedContacts, lastContactId, contactIds.last(), &currentIds)) {
+            rollbackTransaction();
+            return QContactManager::UnspecifiedError;
+        }
+        if (currentIds != contactIds) {
+            rollbackTransaction();
+            continue;
+        }
+
+        if (!prescoredMatches.isEmpty() && !prescoredMatchesCurrent(prescoredGeneration, prescoredDataVersion)) {
+            prescoredMatches.clear();
+        }
+
+        // Any aggregate beyond the current maximum id is created for the contacts of this chunk
+        quint32 maximumContactId = 0;
+        {
+            ContactsDatabase::Query query(m_database.prepare("SELECT MAX(contactId) FROM Contacts"));
+            if (!ContactsDatabase::execute(query) || !query.next()) {
+                query.reportError("Failed to query maximum contact id for aggregate rebuild");
+                error = QContactManager::UnspecifiedError;
+            } else {
+                maximumContactId = query.value<quint32>(0);
+            }
+        }
+
+        if (error == QContactManager::NoError) {
+            // The aggregates created for the chunk are inserted together with their relationships
+            DetailInsertBatch detailBatch(m_database);
+            m_detailBatch = &detailBatch;
+            error = aggregateContacts(&readList, prescoredMatches, maximumContactId, DetailList(), false);
+            m_detailBatch = nullptr;
+
+            if (error == QContactManager::NoError && !detailBatch.flush()) {
+                error = QContactManager::UnspecifiedError;
+            }
+        }
+        if (error == QContactManager::NoError && !updateRebuiltSearchIndex(m_database, maximumContactId)) {
+            error = QContactManager::UnspecifiedError;
+        }
+        if (error == QContactManager::NoError && !storeAggregateRebuildPosition(m_database, contactIds.last())) {
+            error = QContactManager::UnspecifiedError;
+        }
+        if (error != QContactManager::NoError) {
+            rollbackTransaction();
+            return error;
+        }
+        if (!commitTransaction()) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to commit rebuilt aggregates"));
+            return QContactManager::UnspecifiedError;
+        }
+
+        lastContactId = contactIds.last();
+        rebuiltCount += contactIds.count();
+        QTCONTACTS_SQLITE_DEBUG(QString::fromLatin1("Rebuilt aggregates for %1 of %2 contacts").arg(rebuiltCount).arg(remainingCount));
+    }
+
+    if (!beginTransaction()) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Unable to begin database transaction while completing aggregate rebuild"));
+        return QContactManager::UnspecifiedError;
+    }
+    if (!clearAggregateRebuildPosition(m_database)) {
+        rollbackTransaction();
+        return QContactManager::UnspecifiedError;
+    }
+    if (!commitTransaction()) {
+        QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to commit aggregate rebuild completion"));
+        return QContactManager::UnspecifiedError;
+    }
+
+    return QContactManager::NoError;
 }
 
 static bool updateTimestamp(QContact *contact, bool setCreationTimestamp)
@@ -4536,7 +5319,7 @@ static bool updateTimestamp(QContact *contact, bool setCreationTimestamp)
     return contact->saveDetail(&timestamp, QContact::IgnoreAccessConstraints);
 }
 
-QContactManager::Error ContactWriter::create(QContact *contact, const DetailList &definitionMask, bool withinTransaction, bool withinAggregateUpdate, bool withinSyncUpdate, bool recordUnhandledChangeFlags)
+QContactManager::Error ContactWriter::create(QContact *contact, const DetailList &definitionMask, bool withinTransaction, bool withinAggregateUpdate, bool withinSyncUpdate, bool recordUnhandledChangeFlags, bool bulkImport)
 {
     // If not specified, this contact is a "local device" contact
     bool contactIsLocal = false;
@@ -4559,7 +5342,7 @@ QContactManager::Error ContactWriter::create(QContact *contact, const DetailList
             || detailListContains<QContactPresence>(definitionMask)
             || detailListContains<QContactGlobalPresence>(definitionMask)) {
         // update the global presence (display label may be derived from it)
-        updateGlobalPresence(contact);
+        ContactsEngine::updateGlobalPresence(contact);
     }
 
     // update the display label for this contact
@@ -4591,12 +5374,13 @@ QContactManager::Error ContactWriter::create(QContact *contact, const DetailList
         contactId = query.lastInsertId().toUInt();
     }
 
-    writeErr = write(contactId, QContact(), contact, definitionMask, recordUnhandledChangeFlags);
+    writeErr = write(contactId, QContact(), contact, definitionMask, recordUnhandledChangeFlags, bulkImport, nullptr);
     if (writeErr == QContactManager::NoError) {
         // successfully saved all data.  Update id.
         contact->setId(ContactId::apiId(contactId, m_managerUri));
 
-        if (m_database.aggregating() && !withinAggregateUpdate) {
+        // a bulk import aggregates all of its contacts once they have been created
+        if (m_database.aggregating() && !withinAggregateUpdate && !bulkImport) {
             // and either update the aggregate contact (if it exists) or create a new one
             // (unless it is an aggregate contact, or should otherwise not be aggregated).
             bool aggregable = contactIsLocal; // local contacts are always aggregable.
@@ -4629,6 +5413,8 @@ QContactManager::Error ContactWriter::create(QContact *contact, const DetailList
         if (!ContactsDatabase::execute(query)) {
             query.reportError("Unable to remove stale contact after failed save");
         }
+        aggregationCandidateWritten(contactId);
+        aggregationCandidateRelationshipsWritten();
     }
 
     return writeErr;
@@ -4676,6 +5462,10 @@ QContactManager::Error ContactWriter::update(QContact *contact, const DetailList
         return QContactManager::UnspecifiedError;
     }
 
+    // The types of the details changed by the update, if they can be determined
+    DetailList changedDetailTypes;
+    bool changesDetected = false;
+
     // check to see if this is an attempted undeletion.
     QContactManager::Error writeError = QContactManager::NoError;
     if (changeFlags >= ContactsDatabase::IsDeleted) {
@@ -4739,7 +5529,7 @@ QContactManager::Error ContactWriter::update(QContact *contact, const DetailList
                 || detailListContains<QContactPresence>(definitionMask)
                 || detailListContains<QContactGlobalPresence>(definitionMask)) {
             // update the global presence (display label may be derived from it)
-            updateGlobalPresence(contact);
+            ContactsEngine::updateGlobalPresence(contact);
         }
 
         // update the display label for this contact
@@ -4775,7 +5565,15 @@ QContactManager::Error ContactWriter::update(QContact *contact, const DetailList
                 }
             }
 
-            // This update invalidates any details that may be present in the transient store
+            // This update invalidates any details that may be present in the transient store;
+            // their types must be regenerated in the aggregate, which did not store them
+            DetailList transientDetailTypes;
+            if (!withinAggregateUpdate && m_database.hasTransientDetails(contactId)) {
+                foreach (const QContactDetail &detail, m_database.transientDetails(contactId).second) {
+                    if (!transientDetailTypes.contains(detail.type()))
+                        transientDetailTypes.append(detail.type());
+                }
+            }
             m_database.removeTransientDetails(contactId);
 
             // Store updated details to the database
@@ -4787,7 +5585,17 @@ QContactManager::Error ContactWriter::update(QContact *contact, const DetailList
                 }
             }
 
-            writeError = write(contactId, withinAggregateUpdate ? QContact() : oldContacts.first(), contact, definitionMask, recordUnhandledChangeFlags);
+            writeError = write(contactId, withinAggregateUpdate ? QContact() : oldContacts.first(), contact, definitionMask, recordUnhandledChangeFlags, false, &changedDetailTypes);
+            changesDetected = !withinAggregateUpdate;
+            foreach (QContactDetail::DetailType type, transientDetailTypes) {
+                if (!changedDetailTypes.contains(type))
+                    changedDetailTypes.append(type);
+            }
+            if (changesDetected
+                    && oldContacts.first().details<QContactDeactivated>().isEmpty() != contact->details<QContactDeactivated>().isEmpty()) {
+                // Deactivation determines whether the contact contributes to its aggregate at all
+                changedDetailTypes.append(detailType<QContactDeactivated>());
+            }
         }
     }
 
@@ -4818,7 +5626,16 @@ QContactManager::Error ContactWriter::update(QContact *contact, const DetailList
                 }
 
                 if (aggregatesOfUpdated.size() > 0) {
-                    writeError = regenerateAggregates(aggregatesOfUpdated, definitionMask, withinTransaction);
+                    if (transientUpdate) {
+                        // The presence of the aggregates is derived from their constituents when read
+                        foreach (quint32 aggregateId, aggregatesOfUpdated) {
+                            m_presenceChangedIds.insert(ContactId::apiId(aggregateId, m_managerUri));
+                        }
+                    } else if (!changesDetected) {
+                        queueAggregateRegeneration(aggregatesOfUpdated, definitionMask);
+                    } else if (!changedDetailTypes.isEmpty()) {
+                        queueAggregateRegeneration(aggregatesOfUpdated, aggregateRegenerationMask(changedDetailTypes));
+                    }
                 } else if (oldCollectionId == ContactCollectionId::apiId(ContactsDatabase::LocalAddressbookCollectionId, m_managerUri)) {
                     writeError = setAggregate(contact, contactId, true, definitionMask, withinTransaction, withinSyncUpdate);
                 }
@@ -4865,10 +5682,7 @@ QContactManager::Error ContactWriter::setAggregate(QContact *contact, quint32 co
     if ((writeErr == QContactManager::NoError) && (update || (aggregateId < contactId))) {
         // The aggregate pre-dates the new contact - it probably had a local constituent already.
         // We must regenerate the aggregate, because the precedence order of the details may have changed.
-        writeErr = regenerateAggregates(QList<quint32>() << aggregateId, definitionMask, withinTransaction);
-        if (writeErr != QContactManager::NoError) {
-            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to regenerate aggregate contact %1 for local insertion").arg(aggregateId));
-        }
+        queueAggregateRegeneration(QList<quint32>() << aggregateId, definitionMask);
     }
 
     return writeErr;
@@ -4879,7 +5693,9 @@ QContactManager::Error ContactWriter::write(
         const QContact &oldContact,
         QContact *contact,
         const DetailList &definitionMask,
-        bool recordUnhandledChangeFlags)
+        bool recordUnhandledChangeFlags,
+        bool deferSearchIndex,
+        DetailList *changedDetailTypes)
 {
     // Does this contact belong to a synced addressbook?
     const QContactCollectionId collectionId = contact->collectionId();
@@ -4887,6 +5703,17 @@ QContactManager::Error ContactWriter::write(
     const bool syncable = (ContactCollectionId::databaseId(collectionId) != ContactsDatabase::AggregateAddressbookCollectionId) &&
                           (ContactCollectionId::databaseId(collectionId) != ContactsDatabase::LocalAddressbookCollectionId);
 
+    if (ContactCollectionId::databaseId(collectionId) == ContactsDatabase::AggregateAddressbookCollectionId) {
+        if (m_detailBatch && m_aggregationCandidates && definitionMask.isEmpty()) {
+            // The details are not written until the batch is flushed, so the entry is taken from the contact
+            m_aggregationCandidates->insert(contactId, aggregationCandidateEntry(*contact));
+            m_writtenAggregationCandidates.insert(contactId);
+        } else {
+            // The aggregation candidate entries must be read again before they are matched
+            aggregationCandidateWritten(contactId);
+        }
+    }
+
     // if the oldContact doesn't match this one,
     // don't perform delta detection and update;
     // instead, clobber all detail values for this contact.
@@ -4897,6 +5724,17 @@ QContactManager::Error ContactWriter::write(
                         oldContact.details(), contact->details())
             : QtContactsSqliteExtensions::ContactDetailDelta();
 
+    if (changedDetailTypes && delta.isValid) {
+        // Only the changes to the types in the mask are written
+        const QList<QContactDetail> changes(delta.deletions + delta.modifications + delta.additions);
+        foreach (const QContactDetail &detail, changes) {
+            if ((definitionMask.isEmpty() || definitionMask.contains(detail.type()))
+                    && !changedDetailTypes->contains(detail.type())) {
+                changedDetailTypes->append(detail.type());
+            }
+        }
+    }
+
     QContactManager::Error error = QContactManager::NoError;
     if (writeDetails<QContactAddress>(contactId, delta, contact, definitionMask, collectionId, syncable, wasLocal, false, recordUnhandledChangeFlags, &error)
             && writeDetails<QContactAnniversary>(contactId, delta, contact, definitionMask, collectionId, syncable, wasLocal, false, recordUnhandledChangeFlags, &error)
@@ -4925,11 +5763,99 @@ QContactManager::Error ContactWriter::write(
             && writeDetails<QContactOriginMetadata>(contactId, delta, contact, definitionMask, collectionId, syncable, wasLocal, false, recordUnhandledChangeFlags, &error)
             && writeDetails<QContactExtendedDetail>(contactId, delta, contact, definitionMask, collectionId, syncable, wasLocal, false, recordUnhandledChangeFlags, &error)
             ) {
+        // The search index content of batched details is generated once the batch is flushed
+        if (!deferSearchIndex && !m_detailBatch && searchContentChanged(definitionMask) && !m_database.updateSearchIndex(contactId)) {
+            return QContactManager::UnspecifiedError;
+        }
         return QContactManager::NoError;
     }
     return error;
 }
 
+/*
+    This function is called once all of the contacts of a bulk import have
+    been created.  The search index content of the contacts is generated in a
+    single pass, and the contacts are then aggregated; any existing aggregate
+    which gained a constituent is regenerated once, however many of the
+    imported contacts it aggregates.
+*/
+QContactManager::Error ContactWriter::completeBulkImport(QList<QContact> *contacts, const QVector<AggregationCandidateIndex::Scores> &prescoredMatches, const DetailList &definitionMask, bool withinSyncUpdate)
+{
+    QList<quint32> contactIds;
+    quint32 lastContactId = 0;
+    foreach (const QContact &contact, *contacts) {
+        const quint32 contactId = ContactId::databaseId(contact);
+        contactIds.append(contactId);
+        lastContactId = qMax(lastContactId, contactId);
+    }
+
+    if (searchContentChanged(definitionMask) && !m_database.updateSearchIndex(contactIds)) {
+        return QContactManager::UnspecifiedError;
+    }
+
+    if (!m_database.aggregating()) {
+        return QContactManager::NoError;
+    }
+
+    return aggregateContacts(contacts, prescoredMatches, lastContactId, definitionMask, withinSyncUpdate);
+}
+
+/*
+    Aggregates each of the contacts, which must not already be aggregated.
+    Any aggregate with an id greater than lastContactId was created during the
+    aggregation and already contains the details of its constituents; the
+    existing aggregates that the contacts were added to are regenerated.
+*/
+QContactManager::Error ContactWriter::aggregateContacts(QList<QContact> *contacts, const QVector<AggregationCandidateIndex::Scores> &prescoredMatches, quint32 lastContactId, const DetailList &definitionMask, bool withinSyncUpdate)
+{
+    const QContactCollectionId localAddressbookId(ContactCollectionId::apiId(ContactsDatabase::LocalAddressbookCollectionId, m_managerUri));
+    QHash<QContactCollectionId, bool> aggregableCollections;
+    QSet<quint32> regenerateIds;
+
+    QList<QContact>::iterator it = contacts->begin(), end = contacts->end();
+    for ( ; it != end; ++it) {
+        QContact &contact(*it);
+
+        QHash<QContactCollectionId, bool>::const_iterator ait = aggregableCollections.constFind(contact.collectionId());
+        if (ait == aggregableCollections.constEnd()) {
+            bool aggregable = (contact.collectionId() == localAddressbookId); // local contacts are always aggregable.
+            if (!aggregable) {
+                QContactManager::Error error = collectionIsAggregable(contact.collectionId(), &aggregable);
+                if (error != QContactManager::NoError) {
+                    return error;
+                }
+            }
+            ait = aggregableCollections.insert(contact.collectionId(), aggregable);
+        }
+        if (!*ait) {
+            continue;
+        }
+
+        quint32 aggregateId = 0;
+        m_prescoredMatches = prescoredMatches.isEmpty() ? nullptr : &prescoredMatches.at(it - contacts->begin());
+        QContactManager::Error error = updateOrCreateAggregate(&contact, definitionMask, true, withinSyncUpdate, true, &aggregateId);
+        m_prescoredMatches = nullptr;
+        if (error != QContactManager::NoError) {
+            QTCONTACTS_SQLITE_WARNING(QString::fromLatin1("Failed to aggregate imported contact: %1").arg(ContactId::toString(contact)));
+            return error;
+        }
+
+        if (aggregateId > lastContactId) {
+            // This aggregate was created for the contact, and already contains its details
+            lastContactId = aggregateId;
+        } else {
+            // The contact was added to an existing aggregate, whose details must be regenerated
+            regenerateIds.insert(aggregateId);
+        }
+    }
+
+    if (!regenerateIds.isEmpty()) {
+        queueAggregateRegeneration(regenerateIds.toList(), definitionMask);
+    }
+
+    return QContactManager::NoError;
+}
+
 ContactsDatabase::Query ContactWriter::bindContactDetails(const QContact &contact, bool keepChangeFlags, bool recordUnhandledChangeFlags, const DetailList &definitionMask, quint32 contactId)
 {
     const QString insertContact(QStringLiteral(
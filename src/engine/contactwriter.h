@@ -36,6 +36,8 @@
 #include "contactsdatabase.h"
 #include "contactnotifier.h"
 #include "contactid_p.h"
+#include "aggregationcandidateindex_p.h"
+#include "contactattributeindex_p.h"
 
 #include "../extensions/qtcontacts-extensions.h"
 #include "../extensions/qcontactoriginmetadata.h"
@@ -69,6 +71,7 @@ QTCONTACTS_USE_NAMESPACE
 class ProcessMutex;
 class ContactsEngine;
 class ContactReader;
+class DetailInsertBatch;
 class ContactWriter
 {
 public:
@@ -142,14 +145,25 @@ public:
     bool storeOOB(const QString &scope, const QMap<QString, QVariant> &values);
     bool removeOOB(const QString &scope, const QStringList &keys);
 
+    QContactManager::Error aggregationMatch(const QContact &contact, quint32 *aggregateId, int *score);
+    QContactManager::Error findDuplicates(int minimumScore);
+
+    void setDeferAggregateRegeneration(bool defer);
+    QContactManager::Error regenerateDeferredAggregates();
+    QContactManager::Error resumeDeferredAggregates();
+
+    QContactManager::Error rebuildAggregates(bool required);
+
 private:
     bool beginTransaction();
     bool commitTransaction();
     void rollbackTransaction();
 
-    QContactManager::Error create(QContact *contact, const DetailList &definitionMask, bool withinTransaction, bool withinAggregateUpdate, bool withinSyncUpdate, bool recordUnhandledChangeFlags);
+    QContactManager::Error create(QContact *contact, const DetailList &definitionMask, bool withinTransaction, bool withinAggregateUpdate, bool withinSyncUpdate, bool recordUnhandledChangeFlags, bool bulkImport);
     QContactManager::Error update(QContact *contact, const DetailList &definitionMask, bool *aggregateUpdated, bool withinTransaction, bool withinAggregateUpdate, bool withinSyncUpdate, bool recordUnhandledChangeFlags, bool transientUpdate);
-    QContactManager::Error write(quint32 contactId, const QContact &oldContact, QContact *contact, const DetailList &definitionMask, bool recordUnhandledChangeFlags);
+    QContactManager::Error write(quint32 contactId, const QContact &oldContact, QContact *contact, const DetailList &definitionMask, bool recordUnhandledChangeFlags, bool deferSearchIndex, DetailList *changedDetailTypes);
+    QContactManager::Error completeBulkImport(QList<QContact> *contacts, const QVector<AggregationCandidateIndex::Scores> &prescoredMatches, const DetailList &definitionMask, bool withinSyncUpdate);
+    QContactManager::Error aggregateContacts(QList<QContact> *contacts, const QVector<AggregationCandidateIndex::Scores> &prescoredMatches, quint32 lastContactId, const DetailList &definitionMask, bool withinSyncUpdate);
 
     QContactManager::Error saveRelationships(const QList<QContactRelationship> &relationships, QMap<int, QContactManager::Error> *errorMap, bool withinAggregateUpdate);
     QContactManager::Error removeRelationships(const QList<QContactRelationship> &relationships, QMap<int, QContactManager::Error> *errorMap);
@@ -165,9 +179,26 @@ private:
 
     QContactManager::Error collectionIsAggregable(const QContactCollectionId &collectionId, bool *aggregable);
     QContactManager::Error setAggregate(QContact *contact, quint32 contactId, bool update, const DetailList &definitionMask, bool withinTransaction, bool withinSyncUpdate);
+    QContactManager::Error findAggregate(const QContact &contact, quint32 *aggregateId, int *score);
+    QContactManager::Error queryAggregate(const AggregationCandidateIndex::Contact &candidate, quint32 *aggregateId, int *score);
+    QContactManager::Error prepareAggregationCandidates();
+    QContactManager::Error prescoreAggregation(const QList<QContact> &contacts, QVector<AggregationCandidateIndex::Scores> *scores, quint64 *generation, qint64 *dataVersion);
+    QContactManager::Error currentAggregationCandidates(AggregationCandidateIndex *index, QSharedPointer<const AggregationCandidateIndex::Entries> *entries, quint64 *generation);
+    bool prescoredMatchesCurrent(quint64 generation, qint64 dataVersion);
+    void aggregationCandidateWritten(quint32 contactId);
+    void aggregationCandidateRelationshipsWritten();
+    QContactManager::Error readAggregationCandidates(AggregationCandidateIndex::Entries *entries, const QVariantList &aggregateIds);
+    QContactManager::Error readIsNotRelationships(AggregationCandidateIndex::Entries *entries);
     QContactManager::Error updateOrCreateAggregate(QContact *contact, const DetailList &definitionMask, bool withinTransaction, bool withinSyncUpdate, bool createOnly = false, quint32 *aggregateContactId = 0);
 
+    void contactAttributesWritten(const QVariantList &contactIds);
+    void updatedAttributeIndexEntries(QSharedPointer<const ContactAttributeIndex::Entries> *entries, quint64 *generation);
+
     QContactManager::Error regenerateAggregates(const QList<quint32> &aggregateIds, const DetailList &definitionMask, bool withinTransaction);
+    void queueAggregateRegeneration(QHash<quint32, DetailList> *aggregates, quint32 aggregateId, const DetailList &definitionMask);
+    void queueAggregateRegeneration(const QList<quint32> &aggregateIds, const DetailList &definitionMask);
+    QContactManager::Error regenerateQueuedAggregates();
+    bool recordDeferredAggregates(const QHash<quint32, DetailList> &deferredAggregates);
     QContactManager::Error removeChildlessAggregates(QList<QContactId> *realRemoveIds);
     QContactManager::Error aggregateOrphanedContacts(bool withinTransaction, bool withinSyncUpdate);
 
@@ -206,6 +237,24 @@ private:
 
     QString m_managerUri;
 
+    DetailInsertBatch *m_detailBatch;
+
+    QSharedPointer<AggregationCandidateIndex::Entries> m_aggregationCandidates;
+    quint64 m_aggregationCandidatesGeneration;
+    QSet<quint32> m_staleAggregationCandidates;
+    bool m_staleIsNotRelationships;
+    QSet<quint32> m_writtenAggregationCandidates;
+    bool m_isNotRelationshipsWritten;
+    const AggregationCandidateIndex::Scores *m_prescoredMatches;
+
+    QSet<quint32> m_writtenAttributeIds;
+    bool m_attributeIndexStale;
+
+    QHash<quint32, DetailList> m_queuedAggregates;
+    QHash<quint32, DetailList> m_deferredAggregates;
+    QSet<quint32> m_regeneratedAggregateIds;
+    bool m_deferAggregateRegeneration;
+
     bool m_displayLabelGroupsChanged;
     QSet<QContactId> m_addedIds;
     QSet<QContactId> m_removedIds;
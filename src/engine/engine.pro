@@ -26,7 +26,7 @@ isEmpty(PKGCONFIG_LIB) {
 }
 
 CONFIG(load_icu) {
-    PKGCONFIG += sqlite3
+    PKGCONFIG += sqlite3 icu-i18n
     DEFINES += QTCONTACTS_SQLITE_LOAD_ICU
 }
 
@@ -45,10 +45,15 @@ INCLUDEPATH += \
 HEADERS += \
         defaultdlggenerator.h \
         memorytable_p.h \
+        phonenumberindex_p.h \
+        aggregationcandidateindex_p.h \
         semaphore_p.h \
         trace_p.h \
         conversion_p.h \
         contactid_p.h \
+        contactidcache_p.h \
+        contactattributeindex_p.h \
+        contactrefinementcache_p.h \
         contactsdatabase.h \
         contactsengine.h \
         contactstransientstore.h \
@@ -60,9 +65,14 @@ HEADERS += \
 SOURCES += \
         defaultdlggenerator.cpp \
         memorytable.cpp \
+        phonenumberindex.cpp \
+        aggregationcandidateindex.cpp \
         semaphore_p.cpp \
         conversion.cpp \
         contactid.cpp \
+        contactidcache.cpp \
+        contactattributeindex.cpp \
+        contactrefinementcache.cpp \
         contactsdatabase.cpp \
         contactsengine.cpp \
         contactstransientstore.cpp \
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "phonenumberindex_p.h"
+#include "contactsdatabase.h"
+
+namespace {
+
+const int FilterHashCount = 3;
+const int FilterBitsPerEntry = 10;
+const int MinimumFilterSize = 1024;
+
+void filterPositions(const QString &key, int size, int *positions)
+{
+    // Derive the positions from two independent hashes (Kirsch-Mitzenmacher)
+    const uint h1 = qHash(key);
+    const uint h2 = qHash(key, 0x9e3779b9u) | 1u;
+    for (int i = 0; i < FilterHashCount; ++i) {
+        positions[i] = static_cast<int>((h1 + i * h2) % static_cast<uint>(size));
+    }
+}
+
+}
+
+PhoneNumberIndex::PhoneNumberIndex()
+    : m_generation(0)
+    , m_invalidations(0)
+    , m_valid(false)
+{
+}
+
+bool PhoneNumberIndex::isValid() const
+{
+    return m_valid && m_generation == generation();
+}
+
+void PhoneNumberIndex::invalidate()
+{
+    ++m_invalidations;
+    m_valid = false;
+}
+
+void PhoneNumberIndex::clear()
+{
+    // The index reflects the state of the database no later than this point
+    m_generation = generation();
+    m_entries.clear();
+    m_filter.clear();
+    m_valid = false;
+}
+
+void PhoneNumberIndex::insert(const QString &normalizedNumber, quint32 contactId, const QString &displayLabel)
+{
+    const QString numberKey(key(normalizedNumber));
+    if (numberKey.isEmpty())
+        return;
+
+    // Where a number is shared, report the earliest contact consistently
+    QHash<QString, Entry>::iterator it = m_entries.find(numberKey);
+    if (it == m_entries.end()) {
+        Entry entry = { contactId, displayLabel };
+        m_entries.insert(numberKey, entry);
+    } else if (contactId < it->contactId) {
+        it->contactId = contactId;
+        it->displayLabel = displayLabel;
+    }
+}
+
+void PhoneNumberIndex::finalize()
+{
+    int size = MinimumFilterSize;
+    while (size < m_entries.count() * FilterBitsPerEntry) {
+        size *= 2;
+    }
+
+    m_filter = QBitArray(size);
+
+    int positions[FilterHashCount];
+    QHash<QString, Entry>::const_iterator it = m_entries.constBegin(), end = m_entries.constEnd();
+    for ( ; it != end; ++it) {
+        filterPositions(it.key(), size, positions);
+        for (int i = 0; i < FilterHashCount; ++i) {
+            m_filter.setBit(positions[i]);
+        }
+    }
+
+    m_valid = true;
+}
+
+bool PhoneNumberIndex::lookup(const QString &normalizedNumber, Entry *entry) const
+{
+    const QString numberKey(key(normalizedNumber));
+    if (numberKey.isEmpty() || !mayContain(numberKey))
+        return false;
+
+    QHash<QString, Entry>::const_iterator it = m_entries.constFind(numberKey);
+    if (it == m_entries.constEnd())
+        return false;
+
+    *entry = *it;
+    return true;
+}
+
+QString PhoneNumberIndex::key(const QString &normalizedNumber)
+{
+    // Numbers with and without an international prefix must produce the same key
+    QString rv(normalizedNumber);
+    if (rv.startsWith(QChar('+'))) {
+        rv.remove(0, 1);
+    }
+    return rv;
+}
+
+bool PhoneNumberIndex::mayContain(const QString &key) const
+{
+    if (m_filter.isEmpty())
+        return false;
+
+    int positions[FilterHashCount];
+    filterPositions(key, m_filter.size(), positions);
+    for (int i = 0; i < FilterHashCount; ++i) {
+        if (!m_filter.testBit(positions[i]))
+            return false;
+    }
+    return true;
+}
+
+quint64 PhoneNumberIndex::generation() const
+{
+    return (static_cast<quint64>(m_invalidations) << 32) | ContactsDatabase::commitGeneration();
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef PHONENUMBERINDEX_P_H
+#define PHONENUMBERINDEX_P_H
+
+#include <QBitArray>
+#include <QHash>
+#include <QString>
+
+// An in-memory map of minimized phone numbers to the contacts that own them,
+// with a Bloom filter to reject numbers that are not present.  Like the contact
+// ID cache, the index is stale once it is invalidated, or once any transaction
+// is committed to the database by this process.
+class PhoneNumberIndex
+{
+public:
+    struct Entry
+    {
+        quint32 contactId;
+        QString displayLabel;
+    };
+
+    PhoneNumberIndex();
+
+    bool isValid() const;
+    void invalidate();
+
+    void clear();
+    void insert(const QString &normalizedNumber, quint32 contactId, const QString &displayLabel);
+    void finalize();
+
+    bool lookup(const QString &normalizedNumber, Entry *entry) const;
+
+private:
+    static QString key(const QString &normalizedNumber);
+
+    bool mayContain(const QString &key) const;
+
+    quint64 generation() const;
+
+    QHash<QString, Entry> m_entries;
+    QBitArray m_filter;
+    quint64 m_generation;
+    quint32 m_invalidations;
+    bool m_valid;
+};
+
+#endif
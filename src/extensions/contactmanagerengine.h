@@ -41,6 +41,7 @@ class QContactChangesFetchRequest;
 class QContactCollectionChangesFetchRequest;
 class QContactChangesSaveRequest;
 class QContactClearChangeFlagsRequest;
+class QContactDuplicateFetchRequest;
 QT_END_NAMESPACE_CONTACTS
 
 QTCONTACTS_USE_NAMESPACE
@@ -60,6 +61,31 @@ namespace QtContactsSqliteExtensions {
  *                           path used by non-auto-test applications
  */
 
+struct DisplayLabelGroupCount
+{
+    QString group;
+    int count;
+    int offset; // position of the group's first contact when sorted by display label group
+};
+
+struct QueryProfileStep
+{
+    QString description;
+    QString statement;      // bound values are expanded into the statement text
+    QStringList queryPlan;  // the detail of each row of the EXPLAIN QUERY PLAN output
+    qint64 elapsedUsecs;
+    int rowCount;
+};
+
+struct UpcomingDate
+{
+    QContactId contactId;
+    QContactDetail::DetailType detailType; // QContactBirthday::Type or QContactAnniversary::Type
+    QDate date;                            // the date stored in the detail
+    QDate nextOccurrence;
+    QString displayLabel;                  // only reported if requested
+};
+
 class Q_DECL_EXPORT ContactManagerEngine
     : public QContactManagerEngine
 {
@@ -130,6 +156,53 @@ public:
     virtual bool cancelRequest(QObject* request) = 0;
     virtual bool waitForRequestFinished(QObject* req, int msecs) = 0;
 
+    // Functions added since must be appended here, so that the vtable offsets
+    // of the functions declared earlier remain unchanged
+
+    // doesn't touch the database unless the in-memory number index is stale
+    virtual bool lookupPhoneNumber(const QString &phoneNumber,
+                                   QContactId *contactId,
+                                   QString *displayLabel,
+                                   QContactManager::Error *error) = 0;
+
+    // reports the use of the in-process cache of contactIds() and QContactIdFetchRequest results
+    virtual void contactIdCacheStatistics(int *hits, int *misses) = 0;
+
+    // counts the contacts matching the filter without reading them
+    virtual bool contactCount(const QContactFilter &filter,
+                              int *count,
+                              QContactManager::Error *error) = 0;
+    // the groups are reported in display label group sort order, with ungrouped contacts last
+    virtual bool displayLabelGroupCounts(const QContactFilter &filter,
+                                         QList<DisplayLabelGroupCount> *counts,
+                                         QContactManager::Error *error) = 0;
+
+    // executes each step of a contact fetch for the filter, measuring it; no contacts are reported
+    virtual bool profileContactQuery(const QContactFilter &filter,
+                                     const QList<QContactSortOrder> &sortOrders,
+                                     const QContactFetchHint &fetchHint,
+                                     QList<QueryProfileStep> *steps,
+                                     QContactManager::Error *error) = 0;
+
+    // reports the use of earlier results to evaluate queries refining them, such as extended search prefixes
+    virtual void refinementCacheStatistics(int *hits, int *misses) = 0;
+
+    // the birthdays and anniversaries next occurring on or after the start date, in order of occurrence
+    virtual bool upcomingDates(const QDate &startDate,
+                               int maximumCount,
+                               bool includeDisplayLabels,
+                               QList<UpcomingDate> *dates,
+                               QContactManager::Error *error) = 0;
+
+    // the aggregate best matching the contact, which it is aggregated into when saved if the score
+    // is at least 15; found from the in-memory candidate index, or else by the SQL heuristic
+    virtual bool aggregationMatch(const QContact &contact,
+                                  QContactId *aggregateId,
+                                  int *score,
+                                  QContactManager::Error *error) = 0;
+
+    virtual bool startRequest(QContactDuplicateFetchRequest* request) = 0;
+
 Q_SIGNALS:
     void contactsPresenceChanged(const QList<QContactId> &contactsIds);
     void collectionContactsChanged(const QList<QContactCollectionId> &collectionIds);
@@ -34,6 +34,7 @@
 #define QTCONTACTS_EXTENSIONS_H
 
 #include <QContactDetail>
+#include <QContactFilter>
 #include <QContactCollectionId>
 #include <QContactId>
 #include <QContactManager>
@@ -88,6 +89,14 @@ static const QContactDetail::DetailType QContactDetail__TypeDeactivated = static
 // We support the QContactUndelete detail type
 static const QContactDetail::DetailType QContactDetail__TypeUndelete = static_cast<QContactDetail::DetailType>(QContactDetail::TypeVersion + 4);
 
+// In QContactFilter, we support matching against the full-text search index of contact
+// names, nicknames, email addresses, phone numbers, organizations and notes.
+// The detail type of the filter selects the indexed text to match (or all text, if
+// the type is QContactDetail::TypeUndefined).  MatchExactly matches whole tokens,
+// while MatchStartsWith and MatchContains match token prefixes.  Results are ordered
+// by relevance unless a sort order is specified.
+static const QContactFilter::MatchFlag QContactFilter__MatchFullTextSearch = static_cast<QContactFilter::MatchFlag>(QContactFilter::MatchKeypadCollation << 1);
+
 static const QString COLLECTION_EXTENDEDMETADATA_KEY_AGGREGABLE = QString::fromLatin1("Aggregable");
 static const QString COLLECTION_EXTENDEDMETADATA_KEY_APPLICATIONNAME = QString::fromLatin1("ApplicationName");
 static const QString COLLECTION_EXTENDEDMETADATA_KEY_ACCOUNTID = QString::fromLatin1("AccountId");
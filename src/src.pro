@@ -36,7 +36,11 @@ EXTENSION_REQUESTS = \
     extensions/QContactChangesSaveRequest \
     extensions/qcontactchangessaverequest.h \
     extensions/qcontactchangessaverequest_p.h \
-    extensions/qcontactchangessaverequest_impl.h
+    extensions/qcontactchangessaverequest_impl.h \
+    extensions/QContactDuplicateFetchRequest \
+    extensions/qcontactduplicatefetchrequest.h \
+    extensions/qcontactduplicatefetchrequest_p.h \
+    extensions/qcontactduplicatefetchrequest_impl.h
 
 EXTENSION_PLUGIN_INTERFACES = \
     extensions/displaylabelgroupgenerator.h \
@@ -1,12 +1,15 @@
 TARGET = tst_aggregation
 include(../../common.pri)
 
+QT += sql
+
 INCLUDEPATH += \
     ../../../src/engine/
 
 HEADERS += \
     ../../../src/engine/contactid_p.h \
     ../../../src/extensions/contactmanagerengine.h \
+    ../../../src/extensions/qcontactduplicatefetchrequest.h \
     ../../util.h
 
 SOURCES += \
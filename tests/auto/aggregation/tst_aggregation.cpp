@@ -34,8 +34,13 @@
 
 #include "../../util.h"
 #include "qtcontacts-extensions.h"
+#include "../../../src/extensions/qcontactduplicatefetchrequest.h"
+#include "../../../src/extensions/qcontactduplicatefetchrequest_impl.h"
 
 #include <QLocale>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QStandardPaths>
 
 static const QString aggregatesRelationship(relationshipString(QContactRelationship::Aggregates));
 
@@ -60,6 +65,29 @@ QString detailProvenanceContact(const QContactDetail &detail)
     return provenance.left(provenance.indexOf(QChar::fromLatin1(':')));
 }
 
+// the path of the autoTest database, as opened by the engine
+QString testDatabasePath()
+{
+    const QString systemDataDirPath(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QStringLiteral("/system/"));
+    const QString databaseFile(QStringLiteral("Contacts/qtcontacts-sqlite-test/contacts.db"));
+    const QString privilegedPath(systemDataDirPath + QStringLiteral("privileged/") + databaseFile);
+    return QFile::exists(privilegedPath) ? privilegedPath : systemDataDirPath + databaseFile;
+}
+
+// contactManagerEngine() finds the first engine of a manager name; this finds the engine
+// constructed with the given parameter value
+QtContactsSqliteExtensions::ContactManagerEngine *engineWithParameter(const QString &name, const QString &value)
+{
+    const QList<QVariant> engines = QCoreApplication::instance()->property(CONTACT_MANAGER_ENGINE_PROP).toList();
+    foreach (const QVariant &v, engines) {
+        QContactManagerEngine *engine = static_cast<QContactManagerEngine*>(v.value<QObject*>());
+        if (engine && engine->managerParameters().value(name) == value) {
+            return static_cast<QtContactsSqliteExtensions::ContactManagerEngine *>(engine);
+        }
+    }
+    return 0;
+}
+
 }
 
 class tst_Aggregation : public QObject
@@ -113,6 +141,15 @@ private slots:
     void correctDetails();
 
     void batchSemantics();
+    void batchImport();
+    void aggregationCandidateIndex();
+    void prescoredAggregation();
+    void deferredRegeneration();
+    void resumeDeferredRegeneration();
+    void resumeAggregateRebuild();
+    void changedDetailRegeneration();
+    void constituentPresence();
+    void duplicateFetch();
 
     void customSemantics();
 
@@ -3437,6 +3474,751 @@ void tst_Aggregation::batchSemantics()
     QCOMPARE(newContactsCount, 9); // 5 local, 4 aggregate - d and e should have been aggregated into one.
 }
 
+void tst_Aggregation::batchImport()
+{
+    // a large batch of new contacts is aggregated once all of them are written
+    QContactCollectionFilter allCollections;
+    const int aggCount = m_cm->contactIds().size();
+    const int allCount = m_cm->contactIds(allCollections).size();
+
+    QContact local;
+    QContactName lname;
+    lname.setFirstName("Existing");
+    lname.setLastName("Bulkimport");
+    local.saveDetail(&lname);
+    QVERIFY(m_cm->saveContact(&local));
+
+    QContactCollection importAddressbook;
+    importAddressbook.setMetaData(QContactCollection::KeyName, QStringLiteral("import"));
+    importAddressbook.setExtendedMetaData(COLLECTION_EXTENDEDMETADATA_KEY_APPLICATIONNAME, "tst_aggregation");
+    importAddressbook.setExtendedMetaData(COLLECTION_EXTENDEDMETADATA_KEY_ACCOUNTID, 7);
+    importAddressbook.setExtendedMetaData(COLLECTION_EXTENDEDMETADATA_KEY_REMOTEPATH, "/addressbooks/import");
+    QVERIFY(m_cm->saveCollection(&importAddressbook));
+
+    // the first imported contact matches the existing local contact, and the last two match each other
+    const int importCount = 60;
+    QList<QContact> saveList;
+    for (int i = 0; i < importCount; ++i) {
+        QContact contact;
+        contact.setCollectionId(importAddressbook.id());
+        QContactName name;
+        name.setFirstName(i == 0 ? QStringLiteral("Existing")
+                                 : QStringLiteral("Imported%1").arg(qMin(i, importCount - 2)));
+        name.setLastName("Bulkimport");
+        contact.saveDetail(&name);
+        QContactEmailAddress email;
+        email.setEmailAddress(QStringLiteral("imported%1@example.com").arg(i));
+        contact.saveDetail(&email);
+        saveList.append(contact);
+    }
+
+    m_addAccumulatedIds.clear();
+    QVERIFY(m_cm->saveContacts(&saveList));
+    foreach (const QContact &contact, saveList) {
+        QVERIFY(!contact.id().isNull());
+    }
+
+    // one aggregate each, except for the contacts aggregated with another
+    QTRY_COMPARE(m_addAccumulatedIds.size(), importCount + importCount - 2);
+    QCOMPARE(m_cm->contactIds().size(), aggCount + 1 + importCount - 2);
+    QCOMPARE(m_cm->contactIds(allCollections).size(), allCount + 2 + importCount + importCount - 2);
+
+    // the existing aggregate was regenerated to include the imported details
+    QList<QContactId> aggregateIds(m_cm->contact(local.id()).relatedContacts(aggregatesRelationship, QContactRelationship::First));
+    QCOMPARE(aggregateIds.size(), 1);
+    QContact aggregate(m_cm->contact(aggregateIds.first()));
+    QCOMPARE(aggregate.relatedContacts(aggregatesRelationship, QContactRelationship::Second).size(), 2);
+    QCOMPARE(aggregate.detail<QContactEmailAddress>().emailAddress(), QStringLiteral("imported0@example.com"));
+
+    aggregateIds = m_cm->contact(saveList.last().id()).relatedContacts(aggregatesRelationship, QContactRelationship::First);
+    QCOMPARE(aggregateIds.size(), 1);
+    QContact pair(m_cm->contact(aggregateIds.first()));
+    QCOMPARE(pair.relatedContacts(aggregatesRelationship, QContactRelationship::Second).size(), 2);
+
+    // the imported contacts are searchable
+    QContactDetailFilter emailFilter;
+    emailFilter.setDetailType(QContactEmailAddress::Type, QContactEmailAddress::FieldEmailAddress);
+    emailFilter.setValue(QStringLiteral("imported1"));
+    emailFilter.setMatchFlags(QContactFilter::MatchContains);
+    QCOMPARE(m_cm->contactIds(emailFilter & allCollections).size(), 11 * 2); // imported1, imported10 - imported19
+
+    // the details written together are read back with their own ids
+    QContact imported(m_cm->contact(saveList.at(5).id()));
+    QCOMPARE(imported.detail<QContactName>().firstName(), QStringLiteral("Imported5"));
+    QCOMPARE(imported.details<QContactEmailAddress>().size(), 1);
+    QCOMPARE(imported.detail<QContactEmailAddress>().emailAddress(), QStringLiteral("imported5@example.com"));
+
+    // several details of a type are removed together
+    QContactPhoneNumber home, work;
+    home.setNumber("5551234");
+    work.setNumber("5554321");
+    imported.saveDetail(&home);
+    imported.saveDetail(&work);
+    QVERIFY(m_cm->saveContact(&imported));
+    imported = m_cm->contact(imported.id());
+    QCOMPARE(imported.details<QContactPhoneNumber>().size(), 2);
+
+    foreach (QContactPhoneNumber number, imported.details<QContactPhoneNumber>()) {
+        QVERIFY(imported.removeDetail(&number));
+    }
+    QVERIFY(m_cm->saveContact(&imported));
+    imported = m_cm->contact(imported.id());
+    QCOMPARE(imported.details<QContactPhoneNumber>().size(), 0);
+    QCOMPARE(imported.details<QContactEmailAddress>().size(), 1);
+}
+
+void tst_Aggregation::aggregationCandidateIndex()
+{
+    // the in-memory candidate index finds the same aggregates as the SQL heuristic
+    QtContactsSqliteExtensions::ContactManagerEngine *cme = QtContactsSqliteExtensions::contactManagerEngine(*m_cm);
+    QVERIFY(cme);
+
+    // a manager without the candidate index matches by the SQL heuristic
+    QMap<QString, QString> parameters;
+    parameters.insert(QString::fromLatin1("autoTest"), QString::fromLatin1("true"));
+    parameters.insert(QString::fromLatin1("mergePresenceChanges"), QString::fromLatin1("true"));
+    parameters.insert(QString::fromLatin1("aggregationCandidateIndex"), QString::fromLatin1("false"));
+    QContactManager queryingManager(QString::fromLatin1("org.nemomobile.contacts.sqlite"), parameters);
+    QtContactsSqliteExtensions::ContactManagerEngine *querying = engineWithParameter(QString::fromLatin1("aggregationCandidateIndex"), QString::fromLatin1("false"));
+    QVERIFY(querying);
+
+    QList<QContact> locals;
+    for (int i = 0; i < 5; ++i) {
+        QContact contact;
+        QContactName name;
+        QContactGender gender;
+        QContactNickname nickname;
+        QContactEmailAddress email;
+        QContactPhoneNumber phone;
+        QContactOnlineAccount account;
+        switch (i) {
+        case 0:
+            name.setFirstName("Candidate");
+            name.setLastName("Aaronson");
+            gender.setGender(QContactGender::GenderMale);
+            email.setEmailAddress("candidate@example.com");
+            contact.saveDetail(&name);
+            contact.saveDetail(&gender);
+            contact.saveDetail(&email);
+            break;
+        case 1:
+            nickname.setNickname("Candi");
+            phone.setNumber("5550001");
+            contact.saveDetail(&nickname);
+            contact.saveDetail(&phone);
+            break;
+        case 2:
+            name.setFirstName("Cleo");
+            account.setAccountUri("cleo@jabber.example");
+            contact.saveDetail(&name);
+            contact.saveDetail(&account);
+            break;
+        case 3:
+            name.setFirstName("Candidate");
+            name.setLastName("Bergman");
+            gender.setGender(QContactGender::GenderFemale);
+            contact.saveDetail(&name);
+            contact.saveDetail(&gender);
+            break;
+        default:
+            name.setFirstName("Cleo");
+            name.setLastName("Aaronson");
+            phone.setNumber("5550002");
+            contact.saveDetail(&name);
+            contact.saveDetail(&phone);
+            break;
+        }
+        QVERIFY(m_cm->saveContact(&contact));
+        locals.append(m_cm->contact(contact.id()));
+    }
+
+    QList<QContactId> aggregateIds;
+    foreach (const QContact &contact, locals) {
+        const QList<QContactId> related(contact.relatedContacts(aggregatesRelationship, QContactRelationship::First));
+        QCOMPARE(related.size(), 1);
+        aggregateIds.append(related.first());
+    }
+
+    QList<QContact> probes;
+    QList<QContactId> expectedIds;
+    QList<int> expectedScores;
+    {
+        // exact name, in a different case
+        QContact contact;
+        QContactName name;
+        name.setFirstName("CANDIDATE");
+        name.setLastName("aaronson");
+        contact.saveDetail(&name);
+        QContactEmailAddress email;
+        email.setEmailAddress("Candidate@Example.com");
+        contact.saveDetail(&email);
+        probes.append(contact);
+        expectedIds.append(aggregateIds.at(0));
+        expectedScores.append(20 + 3);
+    }
+    {
+        // first name only; the male aggregate is excluded by gender
+        QContact contact;
+        QContactName name;
+        name.setFirstName("Candidate");
+        contact.saveDetail(&name);
+        QContactGender gender;
+        gender.setGender(QContactGender::GenderFemale);
+        contact.saveDetail(&gender);
+        probes.append(contact);
+        expectedIds.append(aggregateIds.at(3));
+        expectedScores.append(12);
+    }
+    {
+        // nickname only
+        QContact contact;
+        QContactNickname nickname;
+        nickname.setNickname("CANDI");
+        contact.saveDetail(&nickname);
+        probes.append(contact);
+        expectedIds.append(aggregateIds.at(1));
+        expectedScores.append(15 + 1);
+    }
+    {
+        // last name only, with a phone number distinguishing the aggregates sharing it
+        QContact contact;
+        QContactName name;
+        name.setLastName("Aaronson");
+        contact.saveDetail(&name);
+        QContactPhoneNumber phone;
+        phone.setNumber("5550002");
+        contact.saveDetail(&phone);
+        probes.append(contact);
+        expectedIds.append(aggregateIds.at(4));
+        expectedScores.append(12 + 3);
+    }
+    {
+        // an account URI alone is below the threshold
+        QContact contact;
+        QContactOnlineAccount account;
+        account.setAccountUri("CLEO@jabber.example");
+        contact.saveDetail(&account);
+        probes.append(contact);
+        expectedIds.append(aggregateIds.at(2));
+        expectedScores.append(3);
+    }
+    {
+        // a different last name excludes the aggregates with other last names
+        QContact contact;
+        QContactName name;
+        name.setFirstName("Zelda");
+        name.setLastName("Zimmerman");
+        contact.saveDetail(&name);
+        QContactPhoneNumber phone;
+        phone.setNumber("5550001");
+        contact.saveDetail(&phone);
+        probes.append(contact);
+        expectedIds.append(aggregateIds.at(1));
+        expectedScores.append(3);
+    }
+    {
+        // nothing in common
+        QContact contact;
+        QContactName name;
+        name.setFirstName("Unmatched");
+        name.setLastName("Nobody");
+        contact.saveDetail(&name);
+        probes.append(contact);
+        expectedIds.append(QContactId());
+        expectedScores.append(0);
+    }
+
+    for (int i = 0; i < probes.size(); ++i) {
+        QContactId indexedId, queriedId;
+        int indexedScore = -1, queriedScore = -1;
+        QContactManager::Error err = QContactManager::NoError;
+        QVERIFY(cme->aggregationMatch(probes.at(i), &indexedId, &indexedScore, &err));
+        QVERIFY(querying->aggregationMatch(probes.at(i), &queriedId, &queriedScore, &err));
+        QCOMPARE(indexedId, queriedId);
+        QCOMPARE(indexedScore, queriedScore);
+        QCOMPARE(indexedId, expectedIds.at(i));
+        QCOMPARE(indexedScore, expectedScores.at(i));
+    }
+
+    // an IsNot relationship excludes the aggregate for that contact only
+    QContactRelationship relationship = makeRelationship(QString::fromLatin1("IsNot"), aggregateIds.at(0), locals.at(4).id());
+    QVERIFY(m_cm->saveRelationship(&relationship));
+
+    QContact renamed(locals.at(4));
+    QContactName name(renamed.detail<QContactName>());
+    name.setFirstName("Candidate");
+    renamed.saveDetail(&name);
+    QContact unsaved(renamed);
+    unsaved.setId(QContactId());
+
+    QContactId indexedId, queriedId;
+    int indexedScore = -1, queriedScore = -1;
+    QContactManager::Error err = QContactManager::NoError;
+    QVERIFY(cme->aggregationMatch(renamed, &indexedId, &indexedScore, &err));
+    QVERIFY(querying->aggregationMatch(renamed, &queriedId, &queriedScore, &err));
+    QCOMPARE(indexedId, queriedId);
+    QCOMPARE(indexedScore, queriedScore);
+    QCOMPARE(indexedId, aggregateIds.at(4));
+    QCOMPARE(indexedScore, 3);
+
+    QVERIFY(cme->aggregationMatch(unsaved, &indexedId, &indexedScore, &err));
+    QVERIFY(querying->aggregationMatch(unsaved, &queriedId, &queriedScore, &err));
+    QCOMPARE(indexedId, queriedId);
+    QCOMPARE(indexedScore, queriedScore);
+    QCOMPARE(indexedId, aggregateIds.at(0));
+    QCOMPARE(indexedScore, 20);
+
+    // an aggregate created earlier in the same batch is matched by later contacts
+    const int aggCount = m_cm->contactIds().size();
+    QList<QContact> saveList;
+    for (int i = 0; i < 2; ++i) {
+        QContact contact;
+        QContactName batchName;
+        batchName.setFirstName("Batched");
+        batchName.setLastName("Candidate");
+        contact.saveDetail(&batchName);
+        saveList.append(contact);
+    }
+    QVERIFY(m_cm->saveContacts(&saveList));
+    QCOMPARE(m_cm->contactIds().size(), aggCount + 1);
+    QCOMPARE(m_cm->contact(saveList.at(0).id()).relatedContacts(aggregatesRelationship, QContactRelationship::First),
+             m_cm->contact(saveList.at(1).id()).relatedContacts(aggregatesRelationship, QContactRelationship::First));
+}
+
+void tst_Aggregation::prescoredAggregation()
+{
+    // the aggregates of a batch are matched as if its contacts were saved in turn
+    const int aggCount = m_cm->contactIds().size();
+
+    QContact local;
+    QContactName lname;
+    lname.setFirstName("Prescored");
+    lname.setLastName("Existing");
+    local.saveDetail(&lname);
+    QVERIFY(m_cm->saveContact(&local));
+
+    const int batchCount = 20;
+    QList<QContact> saveList;
+    for (int i = 0; i < batchCount; ++i) {
+        QContact contact;
+        QContactName name;
+        QContactEmailAddress email;
+        if (i == 0) {
+            // matches the existing aggregate, which gains the email address
+            name.setFirstName("Prescored");
+            name.setLastName("Existing");
+            email.setEmailAddress("prescored@example.com");
+        } else if (i == 1) {
+            // matches only once the existing aggregate has gained the email address
+            name.setFirstName("Prescored");
+            email.setEmailAddress("prescored@example.com");
+        } else {
+            // the last two contacts match each other
+            name.setFirstName(QStringLiteral("Prescored%1").arg(qMin(i, batchCount - 2)));
+            name.setLastName("Batch");
+            email.setEmailAddress(QStringLiteral("prescored%1@example.com").arg(i));
+        }
+        contact.saveDetail(&name);
+        contact.saveDetail(&email);
+        saveList.append(contact);
+    }
+
+    QVERIFY(m_cm->saveContacts(&saveList));
+    QCOMPARE(m_cm->contactIds().size(), aggCount + 1 + batchCount - 3);
+
+    QList<QContactId> aggregateIds(m_cm->contact(local.id()).relatedContacts(aggregatesRelationship, QContactRelationship::First));
+    QCOMPARE(aggregateIds.size(), 1);
+    QCOMPARE(m_cm->contact(aggregateIds.first()).relatedContacts(aggregatesRelationship, QContactRelationship::Second).size(), 3);
+    QCOMPARE(m_cm->contact(saveList.at(1).id()).relatedContacts(aggregatesRelationship, QContactRelationship::First), aggregateIds);
+
+    aggregateIds = m_cm->contact(saveList.last().id()).relatedContacts(aggregatesRelationship, QContactRelationship::First);
+    QCOMPARE(aggregateIds.size(), 1);
+    QCOMPARE(m_cm->contact(aggregateIds.first()).relatedContacts(aggregatesRelationship, QContactRelationship::Second).size(), 2);
+}
+
+void tst_Aggregation::deferredRegeneration()
+{
+    // a writer may defer regenerating aggregates until its writes are idle
+    QMap<QString, QString> parameters;
+    parameters.insert(QString::fromLatin1("autoTest"), QString::fromLatin1("true"));
+    parameters.insert(QString::fromLatin1("mergePresenceChanges"), QString::fromLatin1("true"));
+    parameters.insert(QString::fromLatin1("deferAggregateRegeneration"), QString::fromLatin1("true"));
+    QContactManager deferring(QString::fromLatin1("org.nemomobile.contacts.sqlite"), parameters);
+
+    QContact local;
+    QContactName name;
+    name.setFirstName("Deferred");
+    name.setLastName("Regeneration");
+    local.saveDetail(&name);
+    QVERIFY(deferring.saveContact(&local));
+
+    QList<QContactId> aggregateIds(m_cm->contact(local.id()).relatedContacts(aggregatesRelationship, QContactRelationship::First));
+    QCOMPARE(aggregateIds.size(), 1);
+    const QContactId aggregateId(aggregateIds.first());
+
+    // several saves of the constituent are regenerated together
+    for (int i = 0; i < 3; ++i) {
+        local = deferring.contact(local.id());
+        QContactPhoneNumber phone;
+        phone.setNumber(QStringLiteral("555000%1").arg(i));
+        local.saveDetail(&phone);
+        QVERIFY(deferring.saveContact(&local));
+    }
+    QCOMPARE(m_cm->contact(local.id()).details<QContactPhoneNumber>().size(), 3);
+    QCOMPARE(m_cm->contact(aggregateId).details<QContactPhoneNumber>().size(), 0);
+
+    QTRY_COMPARE(m_cm->contact(aggregateId).details<QContactPhoneNumber>().size(), 3);
+
+    QVERIFY(m_cm->removeContact(local.id()));
+}
+
+void tst_Aggregation::resumeDeferredRegeneration()
+{
+    // deferred aggregates are recorded, so that another engine can regenerate them
+    QMap<QString, QString> parameters;
+    parameters.insert(QString::fromLatin1("autoTest"), QString::fromLatin1("true"));
+    parameters.insert(QString::fromLatin1("mergePresenceChanges"), QString::fromLatin1("true"));
+    parameters.insert(QString::fromLatin1("deferAggregateRegeneration"), QString::fromLatin1("true"));
+    QScopedPointer<QContactManager> deferring(new QContactManager(QString::fromLatin1("org.nemomobile.contacts.sqlite"), parameters));
+
+    QContact local;
+    QContactName name;
+    name.setFirstName("Resumed");
+    name.setLastName("Deferral");
+    local.saveDetail(&name);
+    QVERIFY(deferring->saveContact(&local));
+
+    QList<QContactId> aggregateIds(m_cm->contact(local.id()).relatedContacts(aggregatesRelationship, QContactRelationship::First));
+    QCOMPARE(aggregateIds.size(), 1);
+    const QContactId aggregateId(aggregateIds.first());
+
+    local = deferring->contact(local.id());
+    QContactPhoneNumber phone;
+    phone.setNumber(QStringLiteral("5550100"));
+    local.saveDetail(&phone);
+    QVERIFY(deferring->saveContact(&local));
+    QCOMPARE(m_cm->contact(aggregateId).details<QContactPhoneNumber>().size(), 0);
+
+    const QString connectionName(QStringLiteral("resumeDeferredRegeneration"));
+    {
+        QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+        database.setDatabaseName(testDatabasePath());
+        QVERIFY(database.open());
+
+        QSqlQuery query(database);
+        QVERIFY(query.exec(QStringLiteral("SELECT Value FROM DbSettings WHERE Name = 'DeferredAggregateIds'")));
+        QVERIFY(query.next());
+        QVERIFY(query.value(0).toString().split(QLatin1Char(' ')).contains(QString::number(ContactId::databaseId(aggregateId))));
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    // the recorded aggregates are regenerated when another engine opens the database
+    parameters.remove(QString::fromLatin1("deferAggregateRegeneration"));
+    QContactManager resuming(QString::fromLatin1("org.nemomobile.contacts.sqlite"), parameters);
+    QCOMPARE(resuming.contact(aggregateId).details<QContactPhoneNumber>().size(), 1);
+
+    {
+        QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+        database.setDatabaseName(testDatabasePath());
+        QVERIFY(database.open());
+
+        QSqlQuery query(database);
+        QVERIFY(query.exec(QStringLiteral("SELECT COUNT(*) FROM DbSettings WHERE Name = 'DeferredAggregateIds'")));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toInt(), 0);
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    deferring.reset();
+    QVERIFY(m_cm->removeContact(local.id()));
+}
+
+void tst_Aggregation::resumeAggregateRebuild()
+{
+    // an interrupted rebuild of aggregates is resumed from the position it reached
+    QList<QContactId> localIds;
+    QList<QContactId> aggregateIds;
+    for (int i = 0; i < 3; ++i) {
+        QContact local;
+        QContactName name;
+        name.setFirstName(QStringLiteral("Resumed%1").arg(i));
+        name.setLastName("Rebuild");
+        local.saveDetail(&name);
+        QVERIFY(m_cm->saveContact(&local));
+        localIds.append(local.id());
+
+        const QList<QContactId> related(m_cm->contact(local.id()).relatedContacts(aggregatesRelationship, QContactRelationship::First));
+        QCOMPARE(related.size(), 1);
+        aggregateIds.append(related.first());
+    }
+
+    const QString connectionName(QStringLiteral("resumeAggregateRebuild"));
+    {
+        QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+        database.setDatabaseName(testDatabasePath());
+        QVERIFY(database.open());
+
+        // detach the locals from their aggregates, as if the rebuild was interrupted after the first of them
+        QSqlQuery query(database);
+        QVERIFY(query.prepare(QStringLiteral("DELETE FROM Relationships WHERE type = 'Aggregates' AND secondId IN (?, ?, ?)")));
+        foreach (const QContactId &id, localIds) {
+            query.addBindValue(ContactId::databaseId(id));
+        }
+        QVERIFY(query.exec());
+
+        QVERIFY(query.prepare(QStringLiteral("INSERT OR REPLACE INTO DbSettings (Name, Value) VALUES ('AggregateRebuildContactId', ?)")));
+        query.addBindValue(QString::number(ContactId::databaseId(localIds.at(0))));
+        QVERIFY(query.exec());
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    // the rebuild is resumed when another engine opens the database
+    QMap<QString, QString> parameters;
+    parameters.insert(QString::fromLatin1("autoTest"), QString::fromLatin1("true"));
+    parameters.insert(QString::fromLatin1("mergePresenceChanges"), QString::fromLatin1("true"));
+    QContactManager resuming(QString::fromLatin1("org.nemomobile.contacts.sqlite"), parameters);
+
+    QCOMPARE(resuming.contact(localIds.at(0)).relatedContacts(aggregatesRelationship, QContactRelationship::First).size(), 0);
+    for (int i = 1; i < localIds.size(); ++i) {
+        QCOMPARE(resuming.contact(localIds.at(i)).relatedContacts(aggregatesRelationship, QContactRelationship::First).size(), 1);
+    }
+
+    {
+        QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+        database.setDatabaseName(testDatabasePath());
+        QVERIFY(database.open());
+
+        QSqlQuery query(database);
+        QVERIFY(query.exec(QStringLiteral("SELECT COUNT(*) FROM DbSettings WHERE Name = 'AggregateRebuildContactId'")));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toInt(), 0);
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    // the aggregate detached from the first local is no longer removed with it
+    QVERIFY(m_cm->removeContacts(localIds));
+    QContactIdFilter remainingFilter;
+    remainingFilter.setIds(aggregateIds);
+    const QList<QContactId> remainingIds(m_cm->contactIds(remainingFilter));
+    if (!remainingIds.isEmpty()) {
+        QVERIFY(m_cm->removeContacts(remainingIds));
+    }
+}
+
+void tst_Aggregation::changedDetailRegeneration()
+{
+    // only the detail types changed in a constituent are regenerated in its aggregate
+    QContactCollection testAddressbook;
+    testAddressbook.setMetaData(QContactCollection::KeyName, QStringLiteral("partial"));
+    testAddressbook.setExtendedMetaData(COLLECTION_EXTENDEDMETADATA_KEY_APPLICATIONNAME, "tst_aggregation");
+    testAddressbook.setExtendedMetaData(COLLECTION_EXTENDEDMETADATA_KEY_ACCOUNTID, 8);
+    testAddressbook.setExtendedMetaData(COLLECTION_EXTENDEDMETADATA_KEY_REMOTEPATH, "/addressbooks/partial");
+    QVERIFY(m_cm->saveCollection(&testAddressbook));
+
+    QContact local;
+    QContactName lname;
+    lname.setFirstName("Changed");
+    lname.setLastName("Detail");
+    local.saveDetail(&lname);
+    QContactPhoneNumber lphone;
+    lphone.setNumber("5556001");
+    local.saveDetail(&lphone);
+    QVERIFY(m_cm->saveContact(&local));
+
+    QContact synced;
+    synced.setCollectionId(testAddressbook.id());
+    QContactName sname;
+    sname.setFirstName("Changed");
+    sname.setLastName("Detail");
+    synced.saveDetail(&sname);
+    QContactNickname snick;
+    snick.setNickname("Before");
+    synced.saveDetail(&snick);
+    QContactEmailAddress semail;
+    semail.setEmailAddress("changed.detail@example.com");
+    synced.saveDetail(&semail);
+    QVERIFY(m_cm->saveContact(&synced));
+
+    QList<QContactId> aggregateIds(m_cm->contact(local.id()).relatedContacts(aggregatesRelationship, QContactRelationship::First));
+    QCOMPARE(aggregateIds.size(), 1);
+    QCOMPARE(m_cm->contact(synced.id()).relatedContacts(aggregatesRelationship, QContactRelationship::First), aggregateIds);
+    const QContactId aggregateId(aggregateIds.first());
+
+    // a changed nickname replaces the aggregated nickname, leaving the other details
+    synced = m_cm->contact(synced.id());
+    snick = synced.detail<QContactNickname>();
+    snick.setNickname("After");
+    synced.saveDetail(&snick);
+    QVERIFY(m_cm->saveContact(&synced));
+
+    QContact aggregate(m_cm->contact(aggregateId));
+    QCOMPARE(aggregate.details<QContactNickname>().size(), 1);
+    QCOMPARE(aggregate.detail<QContactNickname>().nickname(), QStringLiteral("After"));
+    QCOMPARE(aggregate.details<QContactPhoneNumber>().size(), 1);
+    QCOMPARE(aggregate.detail<QContactPhoneNumber>().number(), QStringLiteral("5556001"));
+    QCOMPARE(aggregate.details<QContactEmailAddress>().size(), 1);
+    QCOMPARE(aggregate.detail<QContactName>().firstName(), QStringLiteral("Changed"));
+
+    // a removed detail is removed from the aggregate
+    semail = synced.detail<QContactEmailAddress>();
+    QVERIFY(synced.removeDetail(&semail));
+    QVERIFY(m_cm->saveContact(&synced));
+
+    aggregate = m_cm->contact(aggregateId);
+    QCOMPARE(aggregate.details<QContactEmailAddress>().size(), 0);
+    QCOMPARE(aggregate.details<QContactPhoneNumber>().size(), 1);
+    QCOMPARE(aggregate.detail<QContactNickname>().nickname(), QStringLiteral("After"));
+
+    QVERIFY(m_cm->removeContact(synced.id()));
+    QVERIFY(m_cm->removeContact(local.id()));
+    QVERIFY(m_cm->removeCollection(testAddressbook.id()));
+}
+
+void tst_Aggregation::constituentPresence()
+{
+    // a presence-only update of a constituent is reflected in its aggregate without writing the aggregate
+    QContactCollection testAddressbook;
+    testAddressbook.setMetaData(QContactCollection::KeyName, QStringLiteral("presence"));
+    testAddressbook.setExtendedMetaData(COLLECTION_EXTENDEDMETADATA_KEY_APPLICATIONNAME, "tst_aggregation");
+    testAddressbook.setExtendedMetaData(COLLECTION_EXTENDEDMETADATA_KEY_ACCOUNTID, 9);
+    testAddressbook.setExtendedMetaData(COLLECTION_EXTENDEDMETADATA_KEY_REMOTEPATH, "/addressbooks/presence");
+    QVERIFY(m_cm->saveCollection(&testAddressbook));
+
+    QContact local;
+    QContactName lname;
+    lname.setFirstName("Constituent");
+    lname.setLastName("Presence");
+    local.saveDetail(&lname);
+    QContactPresence lpresence;
+    lpresence.setNickname("local");
+    lpresence.setPresenceState(QContactPresence::PresenceOffline);
+    local.saveDetail(&lpresence);
+    QVERIFY(m_cm->saveContact(&local));
+
+    QContact synced;
+    synced.setCollectionId(testAddressbook.id());
+    QContactName sname;
+    sname.setFirstName("Constituent");
+    sname.setLastName("Presence");
+    synced.saveDetail(&sname);
+    QContactPresence spresence;
+    spresence.setNickname("synced");
+    spresence.setPresenceState(QContactPresence::PresenceOffline);
+    synced.saveDetail(&spresence);
+    QVERIFY(m_cm->saveContact(&synced));
+
+    QList<QContactId> aggregateIds(m_cm->contact(local.id()).relatedContacts(aggregatesRelationship, QContactRelationship::First));
+    QCOMPARE(aggregateIds.size(), 1);
+    QCOMPARE(m_cm->contact(synced.id()).relatedContacts(aggregatesRelationship, QContactRelationship::First), aggregateIds);
+    const QContactId aggregateId(aggregateIds.first());
+
+    QContact aggregate(m_cm->contact(aggregateId));
+    QCOMPARE(aggregate.details<QContactPresence>().size(), 2);
+    QCOMPARE(aggregate.detail<QContactGlobalPresence>().presenceState(), QContactPresence::PresenceOffline);
+    QVERIFY(!aggregate.detail<QContactStatusFlags>().testFlag(QContactStatusFlags::IsOnline));
+    const QDateTime aggregateModified(aggregate.detail<QContactTimestamp>().lastModified());
+
+    QTest::qWait(1);
+
+    // update only the presence of the synced constituent
+    synced = m_cm->contact(synced.id());
+    spresence = synced.detail<QContactPresence>();
+    spresence.setPresenceState(QContactPresence::PresenceAvailable);
+    synced.saveDetail(&spresence);
+    QList<QContact> saveList;
+    saveList << synced;
+    QVERIFY(m_cm->saveContacts(&saveList, QList<QContactDetail::DetailType>() << QContactPresence::Type));
+
+    aggregate = m_cm->contact(aggregateId);
+    QCOMPARE(aggregate.details<QContactPresence>().size(), 2);
+    bool foundLocal = false, foundSynced = false;
+    foreach (const QContactPresence &presence, aggregate.details<QContactPresence>()) {
+        if (presence.nickname() == QStringLiteral("local")) {
+            QCOMPARE(presence.presenceState(), QContactPresence::PresenceOffline);
+            foundLocal = true;
+        } else if (presence.nickname() == QStringLiteral("synced")) {
+            QCOMPARE(presence.presenceState(), QContactPresence::PresenceAvailable);
+            foundSynced = true;
+        }
+    }
+    QVERIFY(foundLocal);
+    QVERIFY(foundSynced);
+    QCOMPARE(aggregate.detail<QContactGlobalPresence>().presenceState(), QContactPresence::PresenceAvailable);
+    QCOMPARE(aggregate.detail<QContactGlobalPresence>().nickname(), QStringLiteral("synced"));
+    QVERIFY(aggregate.detail<QContactStatusFlags>().testFlag(QContactStatusFlags::IsOnline));
+    QCOMPARE(aggregate.detail<QContactTimestamp>().lastModified(), aggregateModified);
+
+    // the derived presence of the aggregate is used by filters
+    QContactDetailFilter onlineFilter;
+    onlineFilter.setDetailType(QContactGlobalPresence::Type, QContactGlobalPresence::FieldPresenceState);
+    onlineFilter.setValue(static_cast<int>(QContactPresence::PresenceAvailable));
+    QVERIFY(m_cm->contactIds(onlineFilter).contains(aggregateId));
+
+    QVERIFY(m_cm->removeContact(synced.id()));
+    QVERIFY(m_cm->removeContact(local.id()));
+    QVERIFY(m_cm->removeCollection(testAddressbook.id()));
+}
+
+void tst_Aggregation::duplicateFetch()
+{
+    // contacts sharing only an address are not aggregated, but are reported as possible duplicates
+    QContact first;
+    QContactName fname;
+    fname.setFirstName("Dorothy");
+    fname.setLastName("Duplicate");
+    first.saveDetail(&fname);
+    QContactEmailAddress femail;
+    femail.setEmailAddress("dot@duplicate.example");
+    first.saveDetail(&femail);
+    QVERIFY(m_cm->saveContact(&first));
+
+    QContact second;
+    QContactName sname;
+    sname.setFirstName("Dot");
+    sname.setLastName("Duplicate");
+    second.saveDetail(&sname);
+    QContactEmailAddress semail;
+    semail.setEmailAddress("dot@duplicate.example");
+    second.saveDetail(&semail);
+    QVERIFY(m_cm->saveContact(&second));
+
+    QList<QContactId> firstAggregateIds(m_cm->contact(first.id()).relatedContacts(aggregatesRelationship, QContactRelationship::First));
+    QList<QContactId> secondAggregateIds(m_cm->contact(second.id()).relatedContacts(aggregatesRelationship, QContactRelationship::First));
+    QCOMPARE(firstAggregateIds.size(), 1);
+    QCOMPARE(secondAggregateIds.size(), 1);
+    QVERIFY(firstAggregateIds.first() != secondAggregateIds.first());
+
+    QSet<QContactId> expected;
+    expected << firstAggregateIds.first() << secondAggregateIds.first();
+
+    // the pair does not reach the default minimum score
+    QContactDuplicateFetchRequest request;
+    request.setManager(m_cm);
+    QVERIFY(request.start());
+    QVERIFY(request.waitForFinished(5000));
+    QCOMPARE(request.error(), QContactManager::NoError);
+    foreach (const QContactDuplicateFetchRequest::Duplicate &duplicate, request.duplicates()) {
+        QVERIFY(QSet<QContactId>() << duplicate.firstId << duplicate.secondId != expected);
+    }
+
+    // a shared address scores 3
+    request.setMinimumScore(3);
+    QVERIFY(request.start());
+    QVERIFY(request.waitForFinished(5000));
+    QCOMPARE(request.error(), QContactManager::NoError);
+    bool found = false;
+    foreach (const QContactDuplicateFetchRequest::Duplicate &duplicate, request.duplicates()) {
+        if (QSet<QContactId>() << duplicate.firstId << duplicate.secondId == expected) {
+            QCOMPARE(duplicate.score, 3);
+            found = true;
+        }
+    }
+    QVERIFY(found);
+
+    QVERIFY(m_cm->removeContact(second.id()));
+    QVERIFY(m_cm->removeContact(first.id()));
+}
+
 void tst_Aggregation::customSemantics()
 {
     // the qtcontacts-sqlite engine defines some custom semantics
@@ -36,3 +36,11 @@
 QString ContactsEngine::normalizedPhoneNumber(QString const& number) {
     return number;
 }
+
+QString ContactsEngine::reversedPhoneNumber(QString const& number) {
+    return number;
+}
+
+QString ContactsEngine::keypadDigits(QString const& input) {
+    return input;
+}
@@ -230,6 +230,9 @@ private slots:
     void contactType();
     void familyDetail();
     void geoLocationDetail();
+    void phoneNumberDetail();
+    void detailReadBack();
+    void parallelMaterialization();
     void lateDeletion();
     void compareVariant();
 
@@ -290,6 +293,9 @@ private slots:
     void contactType_data() {addManagers();}
     void familyDetail_data() {addManagers();}
     void geoLocationDetail_data() {addManagers();}
+    void phoneNumberDetail_data() {addManagers();}
+    void detailReadBack_data() {addManagers();}
+    void parallelMaterialization_data() {addManagers();}
     void lateDeletion_data() {addManagers();}
 
     void createCollection_data() {addManagers();}
@@ -4366,6 +4372,287 @@ void tst_QContactManager::onlineAccountFields()
     QCOMPARE(oa.value(QContactOnlineAccount__FieldServiceProviderDisplayName).value<QString>(), serviceProviderDisplayName);
 }
 
+void tst_QContactManager::phoneNumberDetail()
+{
+    QFETCH(QString, uri);
+    QScopedPointer<QContactManager> cm(QContactManager::fromUri(uri));
+
+    // The details read from the tables joined after PhoneNumbers must be unaffected by its indexing columns
+    QContact a;
+
+    QContactName n;
+    n.setFirstName("Alexander");
+    n.setLastName("Bell");
+    a.saveDetail(&n);
+
+    QContactPhoneNumber p;
+    p.setNumber("+61 2 9876 5432");
+    p.setSubTypes(QList<int>() << QContactPhoneNumber::SubTypeMobile);
+    a.saveDetail(&p);
+
+    QContactRingtone r;
+    r.setAudioRingtoneUrl(QUrl("http://example.com/ring.ogg"));
+    a.saveDetail(&r);
+
+    QContactTag t;
+    t.setTag("Inventor");
+    a.saveDetail(&t);
+
+    QContactUrl u;
+    u.setUrl("http://example.com/bell");
+    u.setSubType(QContactUrl::SubTypeHomePage);
+    a.saveDetail(&u);
+
+    QVERIFY(cm->saveContact(&a));
+
+    a = cm->contact(retrievalId(a));
+
+    QCOMPARE(a.details<QContactPhoneNumber>().count(), 1);
+    p = a.detail<QContactPhoneNumber>();
+    QCOMPARE(p.number(), QLatin1String("+61 2 9876 5432"));
+    QCOMPARE(p.subTypes(), QList<int>() << QContactPhoneNumber::SubTypeMobile);
+
+    QCOMPARE(a.details<QContactRingtone>().count(), 1);
+    QCOMPARE(a.detail<QContactRingtone>().audioRingtoneUrl(), QUrl("http://example.com/ring.ogg"));
+    QVERIFY(a.detail<QContactRingtone>().videoRingtoneUrl().isEmpty());
+
+    QCOMPARE(a.details<QContactTag>().count(), 1);
+    QCOMPARE(a.detail<QContactTag>().tag(), QLatin1String("Inventor"));
+
+    QCOMPARE(a.details<QContactUrl>().count(), 1);
+    QCOMPARE(a.detail<QContactUrl>().url(), QLatin1String("http://example.com/bell"));
+    QCOMPARE(a.detail<QContactUrl>().subType(), QContactUrl::SubTypeHomePage);
+
+    // The same values are read when only the later detail types are requested
+    QContactFetchHint hint;
+    hint.setDetailTypesHint(QList<QContactDetail::DetailType>() << QContactPhoneNumber::Type << QContactUrl::Type);
+    a = cm->contact(retrievalId(a), hint);
+
+    QCOMPARE(a.detail<QContactPhoneNumber>().number(), QLatin1String("+61 2 9876 5432"));
+    QCOMPARE(a.detail<QContactUrl>().url(), QLatin1String("http://example.com/bell"));
+    QCOMPARE(a.detail<QContactUrl>().subType(), QContactUrl::SubTypeHomePage);
+
+    QVERIFY(cm->removeContact(a.id()));
+}
+
+void tst_QContactManager::detailReadBack()
+{
+    QFETCH(QString, uri);
+    QScopedPointer<QContactManager> cm(QContactManager::fromUri(uri));
+
+    // Every detail table is joined to read this contact, so each table's columns must be skipped exactly
+    QContact a;
+
+    QContactAddress address;
+    address.setStreet("1 Main Street");
+    address.setCountry("Australia");
+    a.saveDetail(&address);
+
+    QContactAnniversary anniversary;
+    anniversary.setOriginalDate(QDate(2001, 6, 9));
+    anniversary.setEvent("Wedding");
+    a.saveDetail(&anniversary);
+
+    QContactAvatar avatar;
+    avatar.setImageUrl(QUrl("http://example.com/avatar.png"));
+    a.saveDetail(&avatar);
+
+    QContactBirthday birthday;
+    birthday.setDate(QDate(1975, 3, 14));
+    birthday.setCalendarId("calendar");
+    a.saveDetail(&birthday);
+
+    QContactEmailAddress email;
+    email.setEmailAddress("reader@example.com");
+    a.saveDetail(&email);
+
+    QContactFamily family;
+    family.setSpouse("Partner");
+    a.saveDetail(&family);
+
+    QContactFavorite favorite;
+    favorite.setFavorite(true);
+    a.saveDetail(&favorite);
+
+    QContactGender gender;
+    gender.setGender(QContactGender::GenderFemale);
+    a.saveDetail(&gender);
+
+    QContactGeoLocation location;
+    location.setLabel("Home");
+    location.setLatitude(-33.8688);
+    a.saveDetail(&location);
+
+    QContactGuid guid;
+    guid.setGuid("read-back-guid");
+    a.saveDetail(&guid);
+
+    QContactHobby hobby;
+    hobby.setHobby("Reading");
+    a.saveDetail(&hobby);
+
+    QContactName name;
+    name.setFirstName("Reader");
+    name.setLastName("Backwards");
+    name.setCustomLabel("Custom");
+    a.saveDetail(&name);
+
+    QContactNickname nickname;
+    nickname.setNickname("Bookworm");
+    a.saveDetail(&nickname);
+
+    QContactNote note;
+    note.setNote("Reads everything");
+    a.saveDetail(&note);
+
+    QContactOnlineAccount account;
+    account.setAccountUri("reader@im.example.com");
+    account.setServiceProvider("example");
+    a.saveDetail(&account);
+
+    QContactOrganization organization;
+    organization.setName("Library");
+    organization.setAssistantName("Assistant");
+    a.saveDetail(&organization);
+
+    QContactPhoneNumber phoneNumber;
+    phoneNumber.setNumber("+61 2 9123 4567");
+    a.saveDetail(&phoneNumber);
+
+    QContactPresence presence;
+    presence.setNickname("reading");
+    presence.setPresenceState(QContactPresence::PresenceBusy);
+    a.saveDetail(&presence);
+
+    QContactRingtone ringtone;
+    ringtone.setVibrationRingtoneUrl(QUrl("http://example.com/vibrate"));
+    a.saveDetail(&ringtone);
+
+    QContactTag tag;
+    tag.setTag("Bookish");
+    a.saveDetail(&tag);
+
+    QContactUrl url;
+    url.setUrl("http://example.com/reader");
+    a.saveDetail(&url);
+
+    QContactOriginMetadata metadata;
+    metadata.setId("origin");
+    metadata.setGroupId("group");
+    metadata.setEnabled(true);
+    a.saveDetail(&metadata);
+
+    QContactExtendedDetail extended;
+    extended.setName("Extended");
+    extended.setData(QVariant(42));
+    a.saveDetail(&extended);
+
+    QVERIFY(cm->saveContact(&a));
+
+    a = cm->contact(retrievalId(a));
+
+    QCOMPARE(a.detail<QContactAddress>().street(), QLatin1String("1 Main Street"));
+    QCOMPARE(a.detail<QContactAddress>().country(), QLatin1String("Australia"));
+    QCOMPARE(a.detail<QContactAnniversary>().originalDate(), QDate(2001, 6, 9));
+    QCOMPARE(a.detail<QContactAnniversary>().event(), QLatin1String("Wedding"));
+    QCOMPARE(a.detail<QContactAvatar>().imageUrl(), QUrl("http://example.com/avatar.png"));
+    QCOMPARE(a.detail<QContactBirthday>().date(), QDate(1975, 3, 14));
+    QCOMPARE(a.detail<QContactBirthday>().calendarId(), QLatin1String("calendar"));
+    QVERIFY(!a.detail<QContactDisplayLabel>().label().isEmpty());
+    QCOMPARE(a.detail<QContactEmailAddress>().emailAddress(), QLatin1String("reader@example.com"));
+    QCOMPARE(a.detail<QContactFamily>().spouse(), QLatin1String("Partner"));
+    QCOMPARE(a.detail<QContactFavorite>().isFavorite(), true);
+    QCOMPARE(a.detail<QContactGender>().gender(), QContactGender::GenderFemale);
+    QCOMPARE(a.detail<QContactGeoLocation>().label(), QLatin1String("Home"));
+    QCOMPARE(a.detail<QContactGeoLocation>().latitude(), -33.8688);
+    QCOMPARE(a.detail<QContactGuid>().guid(), QLatin1String("read-back-guid"));
+    QCOMPARE(a.detail<QContactHobby>().hobby(), QLatin1String("Reading"));
+    QCOMPARE(a.detail<QContactName>().firstName(), QLatin1String("Reader"));
+    QCOMPARE(a.detail<QContactName>().lastName(), QLatin1String("Backwards"));
+    QCOMPARE(a.detail<QContactName>().customLabel(), QLatin1String("Custom"));
+    QCOMPARE(a.detail<QContactNickname>().nickname(), QLatin1String("Bookworm"));
+    QCOMPARE(a.detail<QContactNote>().note(), QLatin1String("Reads everything"));
+    QCOMPARE(a.detail<QContactOnlineAccount>().accountUri(), QLatin1String("reader@im.example.com"));
+    QCOMPARE(a.detail<QContactOnlineAccount>().serviceProvider(), QLatin1String("example"));
+    QCOMPARE(a.detail<QContactOrganization>().name(), QLatin1String("Library"));
+    QCOMPARE(a.detail<QContactOrganization>().assistantName(), QLatin1String("Assistant"));
+    QCOMPARE(a.detail<QContactPhoneNumber>().number(), QLatin1String("+61 2 9123 4567"));
+    QCOMPARE(a.detail<QContactPresence>().nickname(), QLatin1String("reading"));
+    QCOMPARE(a.detail<QContactPresence>().presenceState(), QContactPresence::PresenceBusy);
+    QCOMPARE(a.detail<QContactRingtone>().vibrationRingtoneUrl(), QUrl("http://example.com/vibrate"));
+    QCOMPARE(a.detail<QContactTag>().tag(), QLatin1String("Bookish"));
+    QCOMPARE(a.detail<QContactUrl>().url(), QLatin1String("http://example.com/reader"));
+    QCOMPARE(a.detail<QContactOriginMetadata>().id(), QLatin1String("origin"));
+    QCOMPARE(a.detail<QContactOriginMetadata>().groupId(), QLatin1String("group"));
+    QCOMPARE(a.detail<QContactOriginMetadata>().enabled(), true);
+    QCOMPARE(a.detail<QContactGlobalPresence>().presenceState(), QContactPresence::PresenceBusy);
+    QCOMPARE(a.detail<QContactGlobalPresence>().nickname(), QLatin1String("reading"));
+    QCOMPARE(a.detail<QContactExtendedDetail>().name(), QLatin1String("Extended"));
+    QCOMPARE(a.detail<QContactExtendedDetail>().data(), QVariant(42));
+
+    QVERIFY(cm->removeContact(a.id()));
+}
+
+void tst_QContactManager::parallelMaterialization()
+{
+    QFETCH(QString, uri);
+    QScopedPointer<QContactManager> cm(QContactManager::fromUri(uri));
+
+    // A fetch of more than MinimumParallelBatchSize contacts is materialized on the worker pool,
+    // and must produce the same contacts, in the same order, as a serial read
+    const int contactCount = 20;
+    QList<QContact> saveList;
+    for (int i = 0; i < contactCount; ++i) {
+        QContact c;
+
+        // saved in the reverse of their sorted order
+        QContactName name;
+        name.setFirstName(QStringLiteral("Parallel%1").arg(contactCount - i, 2, 10, QLatin1Char('0')));
+        name.setLastName("Materialized");
+        c.saveDetail(&name);
+
+        QContactPhoneNumber phoneNumber;
+        phoneNumber.setNumber(QStringLiteral("5557%1").arg(i, 3, 10, QLatin1Char('0')));
+        c.saveDetail(&phoneNumber);
+
+        QContactEmailAddress email;
+        email.setEmailAddress(QStringLiteral("parallel%1@example.com").arg(i));
+        c.saveDetail(&email);
+
+        saveList.append(c);
+    }
+    QVERIFY(cm->saveContacts(&saveList));
+
+    QContactDetailFilter filter;
+    setFilterDetail<QContactName>(filter, QContactName::FieldLastName);
+    filter.setValue("Materialized");
+    filter.setMatchFlags(QContactFilter::MatchExactly);
+
+    QContactSortOrder byFirstName;
+    setSortDetail<QContactName>(byFirstName, QContactName::FieldFirstName);
+
+    const QList<QContact> fetched(cm->contacts(filter, QList<QContactSortOrder>() << byFirstName));
+    QCOMPARE(fetched.size(), contactCount);
+    for (int i = 0; i < fetched.size(); ++i) {
+        QCOMPARE(fetched.at(i).detail<QContactName>().firstName(), QStringLiteral("Parallel%1").arg(i + 1, 2, 10, QLatin1Char('0')));
+
+        // A single contact is below the parallel batch size, so it is materialized serially
+        const QContact serial(cm->contact(fetched.at(i).id()));
+        const QList<QContactDetail> fetchedDetails(fetched.at(i).details());
+        const QList<QContactDetail> serialDetails(serial.details());
+        QCOMPARE(fetchedDetails.size(), serialDetails.size());
+        for (int j = 0; j < fetchedDetails.size(); ++j) {
+            QVERIFY(detailsEquivalent(fetchedDetails.at(j), serialDetails.at(j)));
+        }
+    }
+
+    QList<QContactId> removeIds;
+    foreach (const QContact &c, saveList) {
+        removeIds.append(c.id());
+    }
+    QVERIFY(cm->removeContacts(removeIds));
+}
+
 void tst_QContactManager::lateDeletion()
 {
     // Create some engines, but make them get deleted at shutdown
@@ -2,6 +2,10 @@ TARGET = tst_qcontactmanagerfiltering
 
 include(../../common.pri)
 
+CONFIG(load_icu) {
+    DEFINES += QTCONTACTS_SQLITE_LOAD_ICU
+}
+
 INCLUDEPATH += \
     ../../../src/engine/
 
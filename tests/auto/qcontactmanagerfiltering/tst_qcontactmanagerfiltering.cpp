@@ -90,6 +90,16 @@ static bool validDetailInfo(const QPair<QContactDetail::DetailType, int> &info)
     return validDetailType(info.first) && validDetailField(info.second);
 }
 
+static QStringList matchingLastNames(QContactManager *cm, const QContactFilter &filter)
+{
+    QStringList names;
+    foreach (const QContact &contact, cm->contacts(filter)) {
+        names.append(contact.detail<QContactName>().lastName());
+    }
+    names.sort();
+    return names;
+}
+
 /*
  * Global variables:
  * These are the definition and field names used by the actions for their matching.
@@ -169,6 +179,38 @@ private slots:
     void deactivation();
     void deactivation_data();
 
+    void fullTextSearchFiltering();
+    void fullTextSearchFiltering_data();
+
+    void phoneNumberLookup();
+    void phoneNumberLookup_data();
+
+    void contactIdCaching();
+    void contactIdCaching_data();
+
+    void contactCounting();
+    void contactCounting_data();
+
+    void filterNormalization();
+    void filterNormalization_data();
+
+    void queryProfiling();
+    void queryProfiling_data();
+
+    void prefixRangeFiltering();
+    void prefixRangeFiltering_data();
+
+    void attributeIndexFiltering();
+    void attributeIndexFiltering_data();
+
+    void refinementCaching();
+    void refinementCaching_data();
+
+    void geoLocationFiltering();
+    void geoLocationFiltering_data();
+    void upcomingDates();
+    void upcomingDates_data();
+
     void detailVariantFiltering();
     void detailVariantFiltering_data();
 
@@ -199,6 +241,12 @@ private slots:
     void multiSorting();
     void multiSorting_data();
 
+    void collationKeySorting();
+    void collationKeySorting_data();
+
+    void presenceRankSorting();
+    void presenceRankSorting_data();
+
     void invalidFiltering_data();
     void invalidFiltering();
 
@@ -376,6 +424,26 @@ void tst_QContactManagerFiltering::detailStringFiltering_data()
         newMRow("Name == aar, begins", manager) << manager << name << firstname << QVariant("aar") << (int)(QContactFilter::MatchStartsWith) << "a";
         newMRow("Name == Aar, begins, case sensitive", manager) << manager << name << firstname << QVariant("Aar") << (int)(QContactFilter::MatchStartsWith | QContactFilter::MatchCaseSensitive) << "a";
         newMRow("Name == aar, begins, case sensitive", manager) << manager << name << firstname << QVariant("aar") << (int)(QContactFilter::MatchStartsWith | QContactFilter::MatchCaseSensitive) << es;
+        newMRow("Last name == aaronso, begins", manager) << manager << name << lastname << QVariant("aaronso") << (int)(QContactFilter::MatchStartsWith) << "a";
+        newMRow("Name == A*, begins", manager) << manager << name << firstname << QVariant("A*") << (int)(QContactFilter::MatchStartsWith) << es; // wildcards are matched literally
+        newMRow("Last name == aaronso, begins, fixed", manager) << manager << name << lastname << QVariant("aaronso") << (int)(QContactFilter::MatchFixedString | QContactFilter::MatchStartsWith) << "a";
+        newMRow("Last name == AARONS, begins, fixed", manager) << manager << name << lastname << QVariant("AARONS") << (int)(QContactFilter::MatchFixedString | QContactFilter::MatchStartsWith) << "abc";
+        newMRow("Nickname == sir b, begins, fixed", manager) << manager << nickname << nicknameField << QVariant("sir b") << (int)(QContactFilter::MatchFixedString | QContactFilter::MatchStartsWith) << "b";
+        newMRow("Email == aaron@AAR, begins, fixed", manager) << manager << emailaddr << emailfield << QVariant("aaron@AAR") << (int)(QContactFilter::MatchFixedString | QContactFilter::MatchStartsWith) << "a";
+        newMRow("Name == Aa%, begins, fixed", manager) << manager << name << firstname << QVariant("Aa%") << (int)(QContactFilter::MatchFixedString | QContactFilter::MatchStartsWith) << es; // LIKE wildcards are matched literally
+        newMRow("Name == A_ron, begins, fixed", manager) << manager << name << firstname << QVariant("A_ron") << (int)(QContactFilter::MatchFixedString | QContactFilter::MatchStartsWith) << es;
+        newMRow("Name == %, begins, fixed", manager) << manager << name << firstname << QVariant("%") << (int)(QContactFilter::MatchFixedString | QContactFilter::MatchStartsWith) << es;
+
+        const int mkc = (int)QContactFilter::MatchKeypadCollation;
+        newMRow("Name == 2, begins, keypad", manager) << manager << name << firstname << QVariant("2") << (mkc | QContactFilter::MatchStartsWith) << "abc";
+        newMRow("Name == 26, begins, keypad", manager) << manager << name << firstname << QVariant("26") << (mkc | QContactFilter::MatchStartsWith) << "bc";
+        newMRow("Name == 926, begins, keypad", manager) << manager << name << firstname << QVariant("926") << (mkc | QContactFilter::MatchStartsWith) << "hij";
+        newMRow("Name == 664, contains, keypad", manager) << manager << name << firstname << QVariant("664") << (mkc | QContactFilter::MatchContains) << "d";
+        newMRow("Name == 22766, keypad", manager) << manager << name << firstname << QVariant("22766") << mkc << "a";
+        newMRow("Name == Bo, begins, keypad", manager) << manager << name << firstname << QVariant("Bo") << (mkc | QContactFilter::MatchStartsWith) << "bc";
+        newMRow("Last name == 227667, begins, keypad", manager) << manager << name << lastname << QVariant("227667") << (mkc | QContactFilter::MatchStartsWith) << "abc";
+        newMRow("Nickname == 7470, begins, keypad", manager) << manager << nickname << nicknameField << QVariant("7470") << (mkc | QContactFilter::MatchStartsWith) << "ab";
+        newMRow("Nickname == 0262, contains, keypad", manager) << manager << nickname << nicknameField << QVariant("0262") << (mkc | QContactFilter::MatchContains) << "b";
 
         newMRow("Name == aro, contains", manager) << manager << name << firstname << QVariant("aro") << (int)(QContactFilter::MatchContains) << "a";
         newMRow("Name == ARO, contains", manager) << manager << name << firstname << QVariant("ARO") << (int)(QContactFilter::MatchContains) << "a";
@@ -515,6 +583,7 @@ void tst_QContactManagerFiltering::detailPhoneNumberFiltering_data()
 
     const int mpn = (int)QContactFilter::MatchPhoneNumber;
     const int msw = (int)QContactFilter::MatchStartsWith;
+    const int mew = (int)QContactFilter::MatchEndsWith;
 
     // purely to test phone number filtering.
     for (int i = 0; i < managers.size(); i++) {
@@ -573,6 +642,13 @@ void tst_QContactManagerFiltering::detailPhoneNumberFiltering_data()
         QTest::newRow("ab phone starts hyphen space") << manager << phoneDef << phoneField << QVariant(QString("5 55-")) << (mpn | msw) << "ab";
         QTest::newRow("ab phone starts hyphen space brackets") << manager << phoneDef << phoneField << QVariant(QString("5 (55)-")) << (mpn | msw) << "ab";
         QTest::newRow("ab phone starts hyphen space brackets plus") << manager << phoneDef << phoneField << QVariant(QString("+5 (55)-")) << (mpn | msw) << "ab";
+
+        // then match each of them via ends with
+        QTest::newRow("a phone ends nospace") << manager << phoneDef << phoneField << QVariant(QString("1212")) << (mpn | mew) << "a";
+        QTest::newRow("a phone ends hyphen") << manager << phoneDef << phoneField << QVariant(QString("5-1212")) << (mpn | mew) << "a";
+        QTest::newRow("b phone ends nospace") << manager << phoneDef << phoneField << QVariant(QString("3456")) << (mpn | mew) << "b";
+        QTest::newRow("b phone ends brackets") << manager << phoneDef << phoneField << QVariant(QString("(5)3456")) << (mpn | mew) << "b";
+        QTest::newRow("no phone ends") << manager << phoneDef << phoneField << QVariant(QString("9999")) << (mpn | mew) << "";
     }
 }
 
@@ -752,6 +828,948 @@ void tst_QContactManagerFiltering::deactivation()
     QVERIFY(ids.contains(bob.id()) == false);
 }
 
+void tst_QContactManagerFiltering::fullTextSearchFiltering_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::fullTextSearchFiltering()
+{
+    QFETCH(QContactManager*, cm);
+
+    QContact alice;
+    QContact bob;
+
+    QContactName an, bn;
+    an.setFirstName("Alice");
+    an.setLastName("Looking-Glass");
+    alice.saveDetail(&an);
+    bn.setFirstName("Bob");
+    bn.setLastName("Demolisher");
+    bob.saveDetail(&bn);
+
+    QContactEmailAddress ae;
+    ae.setEmailAddress("alice@wonderland.example");
+    alice.saveDetail(&ae);
+
+    QContactOrganization bo;
+    bo.setName("Wonderland Demolitions");
+    bob.saveDetail(&bo);
+
+    QContactNote note;
+    note.setNote("Met at the tea party");
+    alice.saveDetail(&note);
+
+    QVERIFY(cm->saveContact(&alice));
+    QVERIFY(cm->saveContact(&bob));
+    transientContacts.insert(cm, alice.id());
+    transientContacts.insert(cm, bob.id());
+
+    const QContactFilter::MatchFlags prefixFlags(QContactFilter::MatchStartsWith | QContactFilter__MatchFullTextSearch);
+
+    // Search all indexed details
+    QContactDetailFilter filter;
+    filter.setMatchFlags(prefixFlags);
+    filter.setValue(QStringLiteral("wonder"));
+    QList<QContactId> ids(cm->contactIds(filter));
+    QVERIFY(ids.contains(alice.id()));
+    QVERIFY(ids.contains(bob.id()));
+
+    // Every token must match
+    filter.setValue(QStringLiteral("wonder demol"));
+    ids = cm->contactIds(filter);
+    QVERIFY(ids.contains(alice.id()) == false);
+    QVERIFY(ids.contains(bob.id()));
+
+    // Search a single detail type
+    filter.setDetailType(QContactName::Type);
+    filter.setValue(QStringLiteral("ali"));
+    ids = cm->contactIds(filter);
+    QVERIFY(ids.contains(alice.id()));
+    QVERIFY(ids.contains(bob.id()) == false);
+
+    filter.setDetailType(QContactOrganization::Type);
+    filter.setValue(QStringLiteral("ali"));
+    ids = cm->contactIds(filter);
+    QVERIFY(ids.contains(alice.id()) == false);
+    QVERIFY(ids.contains(bob.id()) == false);
+
+    // Exact matches require whole tokens
+    filter.setDetailType(QContactNote::Type);
+    filter.setMatchFlags(QContactFilter::MatchExactly | QContactFilter__MatchFullTextSearch);
+    filter.setValue(QStringLiteral("tea"));
+    QList<QContact> contacts(cm->contacts(filter));
+    QCOMPARE(contacts.count(), 1);
+    QCOMPARE(contacts.at(0).id(), alice.id());
+
+    filter.setValue(QStringLiteral("te"));
+    ids = cm->contactIds(filter);
+    QVERIFY(ids.contains(alice.id()) == false);
+
+    // Modified details are reindexed
+    an = alice.detail<QContactName>();
+    an.setFirstName("Alicia");
+    alice.saveDetail(&an);
+    QVERIFY(cm->saveContact(&alice));
+
+    filter.setDetailType(QContactName::Type);
+    filter.setMatchFlags(prefixFlags);
+    filter.setValue(QStringLiteral("alicia"));
+    ids = cm->contactIds(filter);
+    QVERIFY(ids.contains(alice.id()));
+
+    // Removed contacts are removed from the index
+    QVERIFY(cm->removeContact(bob.id()));
+    transientContacts.remove(cm, bob.id());
+    filter.setDetailType(QContactDetail::TypeUndefined);
+    filter.setValue(QStringLiteral("demol"));
+    ids = cm->contactIds(filter);
+    QVERIFY(ids.contains(bob.id()) == false);
+}
+
+void tst_QContactManagerFiltering::phoneNumberLookup_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::phoneNumberLookup()
+{
+    QFETCH(QContactManager*, cm);
+
+    QtContactsSqliteExtensions::ContactManagerEngine *cme = QtContactsSqliteExtensions::contactManagerEngine(*cm);
+    QVERIFY(cme);
+
+    QContact alice;
+    QContactName an;
+    an.setFirstName("Alice");
+    an.setLastName("Caller");
+    alice.saveDetail(&an);
+    QContactPhoneNumber ap;
+    ap.setNumber("+61 7 3210 9876");
+    alice.saveDetail(&ap);
+
+    QVERIFY(cm->saveContact(&alice));
+    transientContacts.insert(cm, alice.id());
+
+    // The lookup should report the same contact as a phone number match
+    QContactDetailFilter filter;
+    filter.setDetailType(QContactPhoneNumber::Type, QContactPhoneNumber::FieldNumber);
+    filter.setMatchFlags(QContactFilter::MatchPhoneNumber);
+    filter.setValue(QStringLiteral("32109876"));
+    const QList<QContactId> ids(cm->contactIds(filter));
+    QCOMPARE(ids.count(), 1);
+
+    QContactId contactId;
+    QString displayLabel;
+    QContactManager::Error error = QContactManager::NoError;
+    QVERIFY(cme->lookupPhoneNumber(QStringLiteral("(07) 3210-9876"), &contactId, &displayLabel, &error));
+    QCOMPARE(error, QContactManager::NoError);
+    QCOMPARE(contactId, ids.first());
+    QCOMPARE(displayLabel, cm->contact(ids.first()).detail<QContactDisplayLabel>().label());
+
+    QVERIFY(cme->lookupPhoneNumber(QStringLiteral("+61732109876"), &contactId, &displayLabel, &error));
+    QCOMPARE(contactId, ids.first());
+
+    // Unknown numbers are not found
+    QVERIFY(!cme->lookupPhoneNumber(QStringLiteral("+61 7 3210 0000"), &contactId, &displayLabel, &error));
+    QCOMPARE(error, QContactManager::DoesNotExistError);
+
+    // Changes are reflected in subsequent lookups
+    ap = alice.detail<QContactPhoneNumber>();
+    ap.setNumber("+61 7 3210 5555");
+    alice.saveDetail(&ap);
+    QVERIFY(cm->saveContact(&alice));
+
+    QVERIFY(!cme->lookupPhoneNumber(QStringLiteral("+61 7 3210 9876"), &contactId, &displayLabel, &error));
+    QVERIFY(cme->lookupPhoneNumber(QStringLiteral("+61 7 3210 5555"), &contactId, &displayLabel, &error));
+    QCOMPARE(contactId, ids.first());
+
+    // Asynchronous writes are reflected without waiting for their change notification
+    ap = alice.detail<QContactPhoneNumber>();
+    ap.setNumber("+61 7 3210 7777");
+    alice.saveDetail(&ap);
+    QContactSaveRequest saveRequest;
+    saveRequest.setManager(cm);
+    saveRequest.setContacts(QList<QContact>() << alice);
+    QVERIFY(saveRequest.start());
+    QVERIFY(saveRequest.waitForFinished());
+    QCOMPARE(saveRequest.error(), QContactManager::NoError);
+
+    QVERIFY(!cme->lookupPhoneNumber(QStringLiteral("+61 7 3210 5555"), &contactId, &displayLabel, &error));
+    QVERIFY(cme->lookupPhoneNumber(QStringLiteral("+61 7 3210 7777"), &contactId, &displayLabel, &error));
+    QCOMPARE(contactId, ids.first());
+
+    QVERIFY(cm->removeContact(alice.id()));
+    transientContacts.remove(cm, alice.id());
+    QVERIFY(!cme->lookupPhoneNumber(QStringLiteral("+61 7 3210 7777"), &contactId, &displayLabel, &error));
+}
+
+void tst_QContactManagerFiltering::contactIdCaching_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::contactIdCaching()
+{
+    QFETCH(QContactManager*, cm);
+
+    QtContactsSqliteExtensions::ContactManagerEngine *cme = QtContactsSqliteExtensions::contactManagerEngine(*cm);
+    QVERIFY(cme);
+
+    QContactDetailFilter filter;
+    filter.setDetailType(QContactName::Type, QContactName::FieldLastName);
+    filter.setValue(QStringLiteral("Cachedname"));
+
+    QContactSortOrder sort;
+    sort.setDetailType(QContactName::Type, QContactName::FieldFirstName);
+    const QList<QContactSortOrder> sorting(QList<QContactSortOrder>() << sort);
+
+    const QList<QContactId> initialIds(cm->contactIds(filter, sorting));
+    QCOMPARE(initialIds.count(), 0);
+
+    int hits = 0, misses = 0;
+    cme->contactIdCacheStatistics(&hits, &misses);
+
+    // Repeating the same query should be answered from the cache
+    QCOMPARE(cm->contactIds(filter, sorting), initialIds);
+    int repeatHits = 0, repeatMisses = 0;
+    cme->contactIdCacheStatistics(&repeatHits, &repeatMisses);
+    QCOMPARE(repeatHits, hits + 1);
+    QCOMPARE(repeatMisses, misses);
+
+    // A write must not leave a stale result in the cache
+    QContact contact;
+    QContactName name;
+    name.setFirstName(QStringLiteral("Carl"));
+    name.setLastName(QStringLiteral("Cachedname"));
+    contact.saveDetail(&name);
+    QVERIFY(cm->saveContact(&contact));
+    transientContacts.insert(cm, contact.id());
+
+    QList<QContactId> ids(cm->contactIds(filter, sorting));
+    QCOMPARE(ids.count(), 1);
+
+    // The asynchronous request shares the same cache
+    QContactIdFetchRequest request;
+    request.setManager(cm);
+    request.setFilter(filter);
+    request.setSorting(sorting);
+    QVERIFY(request.start());
+    QVERIFY(request.waitForFinished());
+    QCOMPARE(request.error(), QContactManager::NoError);
+    QCOMPARE(request.ids(), ids);
+
+    // Nor must a change stored only in the transient store
+    QContactDetailFilter presenceFilter;
+    presenceFilter.setDetailType(QContactGlobalPresence::Type, QContactGlobalPresence::FieldPresenceState);
+    presenceFilter.setValue(static_cast<int>(QContactPresence::PresenceAway));
+    const QContactFilter awayFilter(filter & presenceFilter);
+    QCOMPARE(cm->contactIds(awayFilter).count(), 0);
+    QCOMPARE(cm->contactIds(awayFilter).count(), 0);
+
+    contact = cm->contact(contact.id());
+    QContactPresence presence;
+    presence.setPresenceState(QContactPresence::PresenceAway);
+    contact.saveDetail(&presence);
+    QList<QContact> saveList(QList<QContact>() << contact);
+    QVERIFY(cm->saveContacts(&saveList, QList<QContactDetail::DetailType>() << QContactPresence::Type));
+
+    QCOMPARE(cm->contactIds(awayFilter).count(), 1);
+    QCOMPARE(cm->contactIds(awayFilter, sorting).count(), 1);
+
+    QVERIFY(cm->removeContact(contact.id()));
+    transientContacts.remove(cm, contact.id());
+    QCOMPARE(cm->contactIds(filter, sorting).count(), 0);
+}
+
+void tst_QContactManagerFiltering::contactCounting_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::contactCounting()
+{
+    QFETCH(QContactManager*, cm);
+
+    QtContactsSqliteExtensions::ContactManagerEngine *cme = QtContactsSqliteExtensions::contactManagerEngine(*cm);
+    QVERIFY(cme);
+
+    QContactDetailFilter nameFilter;
+    nameFilter.setDetailType(QContactName::Type, QContactName::FieldFirstName);
+    nameFilter.setValue(QStringLiteral("A"));
+    nameFilter.setMatchFlags(QContactFilter::MatchStartsWith);
+
+    QList<QContactFilter> filters;
+    filters << QContactFilter() << nameFilter;
+
+    QContactSortOrder groupOrder;
+    groupOrder.setDetailType(QContactDisplayLabel::Type, QContactDisplayLabel__FieldLabelGroup);
+
+    foreach (const QContactFilter &filter, filters) {
+        const QList<QContactId> ids(cm->contactIds(filter, QList<QContactSortOrder>() << groupOrder));
+
+        int count = -1;
+        QContactManager::Error error = QContactManager::UnspecifiedError;
+        QVERIFY(cme->contactCount(filter, &count, &error));
+        QCOMPARE(error, QContactManager::NoError);
+        QCOMPARE(count, ids.count());
+
+        QList<QtContactsSqliteExtensions::DisplayLabelGroupCount> groupCounts;
+        QVERIFY(cme->displayLabelGroupCounts(filter, &groupCounts, &error));
+        QCOMPARE(error, QContactManager::NoError);
+
+        // Each group must begin at its position within the display label group order
+        int total = 0;
+        foreach (const QtContactsSqliteExtensions::DisplayLabelGroupCount &groupCount, groupCounts) {
+            QCOMPARE(groupCount.offset, total);
+            QVERIFY(groupCount.count > 0);
+            for (int i = groupCount.offset; i < groupCount.offset + groupCount.count; ++i) {
+                const QContact contact(cm->contact(ids.at(i)));
+                QCOMPARE(contact.detail<QContactDisplayLabel>().value<QString>(QContactDisplayLabel__FieldLabelGroup), groupCount.group);
+            }
+            total += groupCount.count;
+        }
+        QCOMPARE(total, ids.count());
+    }
+}
+
+void tst_QContactManagerFiltering::filterNormalization_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::filterNormalization()
+{
+    QFETCH(QContactManager*, cm);
+
+    QContactDetailFilter aaronFilter;
+    aaronFilter.setDetailType(QContactName::Type, QContactName::FieldFirstName);
+    aaronFilter.setValue(QStringLiteral("Aaron"));
+
+    QContactDetailFilter bFilter;
+    bFilter.setDetailType(QContactName::Type, QContactName::FieldFirstName);
+    bFilter.setValue(QStringLiteral("B"));
+    bFilter.setMatchFlags(QContactFilter::MatchStartsWith);
+
+    QContactDetailFilter phoneFilter;
+    phoneFilter.setDetailType(QContactPhoneNumber::Type);
+
+    const QSet<QContactId> aaronIds(cm->contactIds(aaronFilter).toSet());
+    const QSet<QContactId> bIds(cm->contactIds(bFilter).toSet());
+    const QSet<QContactId> phoneIds(cm->contactIds(phoneFilter).toSet());
+    QVERIFY(!aaronIds.isEmpty());
+    QVERIFY(!bIds.isEmpty());
+
+    // Nested and repeated alternatives select the same contacts as the flat union
+    QContactUnionFilter nestedUnion;
+    nestedUnion << aaronFilter << (QContactUnionFilter() << bFilter << aaronFilter) << bFilter;
+    QSet<QContactId> expected(aaronIds);
+    expected.unite(bIds);
+    QCOMPARE(cm->contactIds(nestedUnion).toSet(), expected);
+
+    // Nested intersections, including a permissive default filter, select the same contacts as the flat intersection
+    QContactIntersectionFilter nestedIntersection;
+    nestedIntersection << QContactFilter() << (QContactIntersectionFilter() << phoneFilter << nestedUnion) << phoneFilter;
+    expected.intersect(phoneIds);
+    QCOMPARE(cm->contactIds(nestedIntersection).toSet(), expected);
+
+    // Combined ID constraints select the common contacts
+    const QList<QContactId> allIds(cm->contactIds());
+    QContactIdFilter allIdsFilter;
+    allIdsFilter.setIds(allIds);
+    QContactIdFilter aaronIdsFilter;
+    aaronIdsFilter.setIds(aaronIds.toList());
+    QCOMPARE(cm->contactIds(allIdsFilter & aaronIdsFilter).toSet(), aaronIds);
+    QCOMPARE(cm->contactIds(aaronIdsFilter | allIdsFilter).toSet(), allIds.toSet());
+
+    // Detail predicates combined into one subquery select the same contacts alongside other alternatives
+    QContactDetailRangeFilter rangeFilter;
+    rangeFilter.setDetailType(QContactName::Type, QContactName::FieldFirstName);
+    rangeFilter.setRange(QStringLiteral("C"), QStringLiteral("D"));
+    const QSet<QContactId> rangeIds(cm->contactIds(rangeFilter).toSet());
+
+    QContactUnionFilter mixedUnion;
+    mixedUnion << aaronFilter << phoneFilter << rangeFilter << bFilter;
+    expected = aaronIds;
+    expected.unite(phoneIds);
+    expected.unite(rangeIds);
+    expected.unite(bIds);
+    QCOMPARE(cm->contactIds(mixedUnion).toSet(), expected);
+    QCOMPARE(cm->contactIds(mixedUnion & phoneFilter).toSet(), QSet<QContactId>(expected).intersect(phoneIds));
+}
+
+void tst_QContactManagerFiltering::queryProfiling_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::queryProfiling()
+{
+    QFETCH(QContactManager*, cm);
+
+    QtContactsSqliteExtensions::ContactManagerEngine *cme = QtContactsSqliteExtensions::contactManagerEngine(*cm);
+    QVERIFY(cme);
+
+    QContactDetailFilter filter;
+    filter.setDetailType(QContactName::Type, QContactName::FieldFirstName);
+    filter.setValue(QStringLiteral("A"));
+    filter.setMatchFlags(QContactFilter::MatchStartsWith);
+
+    QContactSortOrder sort;
+    sort.setDetailType(QContactName::Type, QContactName::FieldFirstName);
+    const QList<QContactSortOrder> sorting(QList<QContactSortOrder>() << sort);
+
+    QList<QtContactsSqliteExtensions::QueryProfileStep> steps;
+    QContactManager::Error error = QContactManager::UnspecifiedError;
+    QVERIFY(cme->profileContactQuery(filter, sorting, QContactFetchHint(), &steps, &error));
+    QCOMPARE(error, QContactManager::NoError);
+
+    // The selection, contact, detail and relationship statements are each measured
+    QCOMPARE(steps.count(), 4);
+    foreach (const QtContactsSqliteExtensions::QueryProfileStep &step, steps) {
+        QVERIFY(!step.description.isEmpty());
+        QVERIFY(step.statement.startsWith(QStringLiteral("SELECT")));
+        QVERIFY(!step.queryPlan.isEmpty());
+        QVERIFY(step.elapsedUsecs >= 0);
+    }
+
+    // Bound values are expanded into the statement text
+    QVERIFY(!steps.first().statement.contains(QChar('?')));
+
+    const int selectedCount = cm->contactIds(filter, sorting).count();
+    QCOMPARE(steps.at(0).rowCount, selectedCount);
+    QCOMPARE(steps.at(1).rowCount, selectedCount);
+}
+
+void tst_QContactManagerFiltering::prefixRangeFiltering_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::prefixRangeFiltering()
+{
+    QFETCH(QContactManager*, cm);
+
+    QtContactsSqliteExtensions::ContactManagerEngine *cme = QtContactsSqliteExtensions::contactManagerEngine(*cm);
+    QVERIFY(cme);
+
+    // Case-insensitive prefix matches are evaluated as ranges over the lower-cased columns
+    const QStringList firstNames(QStringList() << QStringLiteral("\u00d6laf") << QStringLiteral("\u00f6lander")
+                                               << QStringLiteral("Olaf") << QStringLiteral("\u00c9mile")
+                                               << QStringLiteral("100%Pure") << QStringLiteral("1000Pure")
+                                               << QStringLiteral("Under_score") << QStringLiteral("Under-score")
+                                               << QStringLiteral("Underscore"));
+    QList<QContactId> contactIds;
+    foreach (const QString &firstName, firstNames) {
+        QContact contact;
+        QContactName name;
+        name.setFirstName(firstName);
+        name.setLastName(QStringLiteral("Prefixrange"));
+        contact.saveDetail(&name);
+        QVERIFY(cm->saveContact(&contact));
+        transientContacts.insert(cm, contact.id());
+        contactIds.append(contact.id());
+    }
+
+    QContactDetailFilter lastNameFilter;
+    lastNameFilter.setDetailType(QContactName::Type, QContactName::FieldLastName);
+    lastNameFilter.setValue(QStringLiteral("Prefixrange"));
+    lastNameFilter.setMatchFlags(QContactFilter::MatchExactly);
+
+    typedef QPair<QString, QStringList> Case;
+    const QList<Case> cases(QList<Case>()
+        << qMakePair(QStringLiteral("\u00f6l"), QStringList() << QStringLiteral("\u00d6laf") << QStringLiteral("\u00f6lander"))
+        << qMakePair(QStringLiteral("\u00d6LA"), QStringList() << QStringLiteral("\u00d6laf") << QStringLiteral("\u00f6lander"))
+        << qMakePair(QStringLiteral("ol"), QStringList() << QStringLiteral("Olaf"))
+        << qMakePair(QStringLiteral("\u00e9"), QStringList() << QStringLiteral("\u00c9mile"))
+        << qMakePair(QStringLiteral("100%"), QStringList() << QStringLiteral("100%Pure"))
+        << qMakePair(QStringLiteral("10%"), QStringList())
+        << qMakePair(QStringLiteral("under_"), QStringList() << QStringLiteral("Under_score"))
+        << qMakePair(QStringLiteral("und_r"), QStringList())
+        << qMakePair(QStringLiteral("under"), QStringList() << QStringLiteral("Under_score") << QStringLiteral("Under-score") << QStringLiteral("Underscore")));
+
+    foreach (const Case &prefixCase, cases) {
+        QContactDetailFilter filter;
+        filter.setDetailType(QContactName::Type, QContactName::FieldFirstName);
+        filter.setValue(prefixCase.first);
+        filter.setMatchFlags(QContactFilter::MatchFixedString | QContactFilter::MatchStartsWith);
+
+        QStringList matched;
+        foreach (const QContact &contact, cm->contacts(filter & lastNameFilter)) {
+            matched.append(contact.detail<QContactName>().firstName());
+        }
+        matched.sort();
+        QStringList expected(prefixCase.second);
+        expected.sort();
+        QCOMPARE(matched, expected);
+    }
+
+    // The range is satisfied from the index of the lower-cased column
+    QContactDetailFilter filter;
+    filter.setDetailType(QContactName::Type, QContactName::FieldFirstName);
+    filter.setValue(QStringLiteral("\u00f6l"));
+    filter.setMatchFlags(QContactFilter::MatchFixedString | QContactFilter::MatchStartsWith);
+
+    QList<QtContactsSqliteExtensions::QueryProfileStep> steps;
+    QContactManager::Error error = QContactManager::UnspecifiedError;
+    QVERIFY(cme->profileContactQuery(filter, QList<QContactSortOrder>(), QContactFetchHint(), &steps, &error));
+    QCOMPARE(error, QContactManager::NoError);
+    QVERIFY(!steps.isEmpty());
+    QVERIFY(steps.first().statement.contains(QStringLiteral("lowerFirstName >= ")));
+
+    bool indexed = false;
+    foreach (const QString &detail, steps.first().queryPlan) {
+        if (detail.contains(QStringLiteral("INDEX FirstNameIndex"))) {
+            indexed = true;
+        }
+    }
+    QVERIFY2(indexed, qPrintable(steps.first().queryPlan.join(QStringLiteral("\n"))));
+}
+
+void tst_QContactManagerFiltering::attributeIndexFiltering_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::attributeIndexFiltering()
+{
+    QFETCH(QContactManager*, cm);
+
+    // Single predicates are evaluated by SQL; compounds of them are evaluated from the attribute index
+    const QContactFilter phoneFilter(QContactStatusFlags::matchFlag(QContactStatusFlags::HasPhoneNumber, QContactFilter::MatchContains));
+    const QContactFilter emailFilter(QContactStatusFlags::matchFlag(QContactStatusFlags::HasEmailAddress, QContactFilter::MatchContains));
+
+    QContactDetailFilter favoriteFilter;
+    favoriteFilter.setDetailType(QContactFavorite::Type, QContactFavorite::FieldFavorite);
+    favoriteFilter.setValue(true);
+
+    QContactCollectionFilter collectionFilter;
+    collectionFilter.setCollectionId(cm->defaultCollectionId());
+
+    QContactDetailFilter nameFilter;
+    nameFilter.setDetailType(QContactName::Type, QContactName::FieldFirstName);
+    nameFilter.setValue(QStringLiteral("A"));
+    nameFilter.setMatchFlags(QContactFilter::MatchStartsWith);
+
+    const QSet<QContactId> phoneIds(cm->contactIds(phoneFilter).toSet());
+    const QSet<QContactId> emailIds(cm->contactIds(emailFilter).toSet());
+    const QSet<QContactId> favoriteIds(cm->contactIds(favoriteFilter).toSet());
+    const QSet<QContactId> collectionIds(cm->contactIds(collectionFilter).toSet());
+    const QSet<QContactId> nameIds(cm->contactIds(nameFilter).toSet());
+
+    QSet<QContactId> expected(phoneIds);
+    expected.intersect(emailIds);
+    QCOMPARE(cm->contactIds(phoneFilter & emailFilter).toSet(), expected);
+
+    expected = phoneIds;
+    expected.unite(emailIds).unite(favoriteIds);
+    QCOMPARE(cm->contactIds(phoneFilter | emailFilter | favoriteFilter).toSet(), expected);
+
+    // Indexed predicates are combined with those evaluated by SQL
+    expected = phoneIds;
+    expected.unite(emailIds);
+    expected.intersect(collectionIds);
+    expected.intersect(nameIds);
+    QCOMPARE(cm->contactIds(QContactIntersectionFilter() << (phoneFilter | emailFilter) << collectionFilter << nameFilter).toSet(), expected);
+
+    QCOMPARE(cm->contactIds(QContactUnionFilter() << phoneFilter << nameFilter << emailFilter << phoneFilter).toSet(),
+             phoneIds + emailIds + nameIds);
+
+    // An alternative generating no SQL is ignored, as it is when no predicate is indexed
+    QCOMPARE(cm->contactIds(QContactUnionFilter() << phoneFilter << emailFilter << QContactIntersectionFilter()).toSet(),
+             phoneIds + emailIds);
+
+    expected = phoneIds;
+    expected.intersect(emailIds);
+    expected.unite(nameIds);
+    QCOMPARE(cm->contactIds((phoneFilter & emailFilter) | nameFilter).toSet(), expected);
+
+    // Changes are reflected in subsequent queries
+    QContact contact;
+    QContactPhoneNumber phoneNumber;
+    phoneNumber.setNumber(QStringLiteral("5551212"));
+    contact.saveDetail(&phoneNumber);
+    QContactEmailAddress emailAddress;
+    emailAddress.setEmailAddress(QStringLiteral("indexed@example.org"));
+    contact.saveDetail(&emailAddress);
+    QVERIFY(cm->saveContact(&contact));
+    transientContacts.insert(cm, contact.id());
+
+    const QSet<QContactId> savedIds(cm->contactIds(phoneFilter & emailFilter).toSet());
+    QCOMPARE(savedIds, cm->contactIds(phoneFilter).toSet() & cm->contactIds(emailFilter).toSet());
+    QCOMPARE(savedIds.count(), (phoneIds & emailIds).count() + 1);
+
+    // The index is updated with the changed contact, rather than read again
+    QContactFavorite favorite;
+    favorite.setFavorite(true);
+    contact.saveDetail(&favorite);
+    QVERIFY(cm->saveContact(&contact));
+    QVERIFY(cm->contactIds(phoneFilter & favoriteFilter).contains(contact.id()));
+    QCOMPARE(cm->contactIds(phoneFilter & favoriteFilter).toSet(),
+             cm->contactIds(phoneFilter).toSet() & cm->contactIds(favoriteFilter).toSet());
+
+    QContactPhoneNumber savedNumber(contact.detail<QContactPhoneNumber>());
+    QVERIFY(contact.removeDetail(&savedNumber));
+    QVERIFY(cm->saveContact(&contact));
+    QVERIFY(!cm->contactIds(phoneFilter & favoriteFilter).contains(contact.id()));
+    QVERIFY(cm->contactIds(emailFilter & favoriteFilter).contains(contact.id()));
+
+    QVERIFY(cm->removeContact(contact.id()));
+    transientContacts.remove(cm, contact.id());
+    QCOMPARE(cm->contactIds(phoneFilter & emailFilter).toSet(), phoneIds & emailIds);
+}
+
+void tst_QContactManagerFiltering::refinementCaching_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::refinementCaching()
+{
+    QFETCH(QContactManager*, cm);
+
+    QtContactsSqliteExtensions::ContactManagerEngine *cme = QtContactsSqliteExtensions::contactManagerEngine(*cm);
+    QVERIFY(cme);
+
+    const QStringList firstNames(QStringList() << QStringLiteral("Zyxwa") << QStringLiteral("Zyxwab") << QStringLiteral("Zyxwb"));
+    const QStringList lastNames(QStringList() << QStringLiteral("Alpha") << QStringLiteral("Beta") << QStringLiteral("Gamma"));
+    for (int i = 0; i < firstNames.count(); ++i) {
+        QContact contact;
+        QContactName name;
+        name.setFirstName(firstNames.at(i));
+        name.setLastName(lastNames.at(i));
+        contact.saveDetail(&name);
+        QVERIFY(cm->saveContact(&contact));
+        transientContacts.insert(cm, contact.id());
+    }
+
+    QContactDetailFilter filter;
+    filter.setDetailType(QContactName::Type, QContactName::FieldFirstName);
+    filter.setMatchFlags(QContactFilter::MatchStartsWith);
+
+    filter.setValue(QStringLiteral("Zyx"));
+    QCOMPARE(cm->contactIds(filter).count(), 3);
+
+    int hits = 0, misses = 0;
+    cme->refinementCacheStatistics(&hits, &misses);
+
+    // Each extended prefix is evaluated over the results of the previous search
+    filter.setValue(QStringLiteral("Zyxw"));
+    QCOMPARE(cm->contactIds(filter).count(), 3);
+    filter.setValue(QStringLiteral("Zyxwa"));
+    QCOMPARE(cm->contactIds(filter).count(), 2);
+    filter.setValue(QStringLiteral("Zyxwab"));
+    QCOMPARE(cm->contactIds(filter).count(), 1);
+
+    int refinedHits = 0, refinedMisses = 0;
+    cme->refinementCacheStatistics(&refinedHits, &refinedMisses);
+    QCOMPARE(refinedHits, hits + 3);
+    QCOMPARE(refinedMisses, misses);
+
+    // A different match type is not a refinement
+    filter.setMatchFlags(QContactFilter::MatchStartsWith | QContactFilter::MatchFixedString);
+    filter.setValue(QStringLiteral("zyxwa"));
+    QCOMPARE(cm->contactIds(filter).count(), 2);
+    cme->refinementCacheStatistics(&refinedHits, &refinedMisses);
+    QCOMPARE(refinedMisses, misses + 1);
+
+    // Substring matches are refined by extension in either direction, within compound filters
+    QContactDetailFilter lastNameFilter;
+    lastNameFilter.setDetailType(QContactName::Type, QContactName::FieldLastName);
+    lastNameFilter.setMatchFlags(QContactFilter::MatchContains);
+    lastNameFilter.setValue(QStringLiteral("a"));
+    filter.setMatchFlags(QContactFilter::MatchContains);
+    filter.setValue(QStringLiteral("xwa"));
+    QCOMPARE(cm->contactIds(filter & lastNameFilter).count(), 2);
+    filter.setValue(QStringLiteral("yxwab"));
+    QCOMPARE(cm->contactIds(filter & lastNameFilter).count(), 1);
+    lastNameFilter.setValue(QStringLiteral("ta"));
+    QCOMPARE(cm->contactIds(filter & lastNameFilter).count(), 1);
+
+    cme->refinementCacheStatistics(&hits, &misses);
+    QCOMPARE(hits, refinedHits + 2);
+
+    // Fetches are refined in the same way
+    filter.setMatchFlags(QContactFilter::MatchStartsWith);
+    filter.setValue(QStringLiteral("Zyxw"));
+    QCOMPARE(cm->contacts(filter).count(), 3);
+    filter.setValue(QStringLiteral("Zyxwb"));
+    const QList<QContact> refinedContacts(cm->contacts(filter));
+    QCOMPARE(refinedContacts.count(), 1);
+    QCOMPARE(refinedContacts.first().detail<QContactName>().lastName(), QStringLiteral("Gamma"));
+
+    // Results are discarded when the data changes
+    filter.setValue(QStringLiteral("Zyxw"));
+    QCOMPARE(cm->contactIds(filter).count(), 3);
+
+    QContact contact;
+    QContactName name;
+    name.setFirstName(QStringLiteral("Zyxwc"));
+    name.setLastName(QStringLiteral("Delta"));
+    contact.saveDetail(&name);
+    QVERIFY(cm->saveContact(&contact));
+    transientContacts.insert(cm, contact.id());
+
+    filter.setValue(QStringLiteral("Zyxwc"));
+    QCOMPARE(cm->contactIds(filter).count(), 1);
+
+    QVERIFY(cm->removeContact(contact.id()));
+    transientContacts.remove(cm, contact.id());
+    QCOMPARE(cm->contactIds(filter).count(), 0);
+}
+
+void tst_QContactManagerFiltering::geoLocationFiltering_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::geoLocationFiltering()
+{
+    QFETCH(QContactManager*, cm);
+
+    const QStringList lastNames(QStringList() << QStringLiteral("Geoa") << QStringLiteral("Geob") << QStringLiteral("Geoc"));
+    const double latitudes[] = { 10.0, 10.5, 40.0 };
+    const double longitudes[] = { 20.0, 25.0, 20.0 };
+
+    QList<QContact> contacts;
+    for (int i = 0; i < lastNames.count(); ++i) {
+        QContact contact;
+        QContactName name;
+        name.setLastName(lastNames.at(i));
+        contact.saveDetail(&name);
+        QContactGeoLocation location;
+        location.setLatitude(latitudes[i]);
+        location.setLongitude(longitudes[i]);
+        contact.saveDetail(&location);
+        QVERIFY(cm->saveContact(&contact));
+        transientContacts.insert(cm, contact.id());
+        contacts.append(contact);
+    }
+
+    QContactDetailFilter nameFilter;
+    nameFilter.setDetailType(QContactName::Type, QContactName::FieldLastName);
+    nameFilter.setValue(QStringLiteral("Geo"));
+    nameFilter.setMatchFlags(QContactFilter::MatchStartsWith);
+
+    QContactDetailRangeFilter latitudeFilter;
+    latitudeFilter.setDetailType(QContactGeoLocation::Type, QContactGeoLocation::FieldLatitude);
+    latitudeFilter.setRange(9.0, 11.0);
+
+    QContactDetailRangeFilter longitudeFilter;
+    longitudeFilter.setDetailType(QContactGeoLocation::Type, QContactGeoLocation::FieldLongitude);
+    longitudeFilter.setRange(19.0, 26.0);
+
+    // Single coordinate ranges are evaluated without the spatial index
+    QCOMPARE(matchingLastNames(cm, latitudeFilter & nameFilter), QStringList() << QStringLiteral("Geoa") << QStringLiteral("Geob"));
+    QCOMPARE(matchingLastNames(cm, longitudeFilter & nameFilter),
+             QStringList() << QStringLiteral("Geoa") << QStringLiteral("Geob") << QStringLiteral("Geoc"));
+
+    QCOMPARE(matchingLastNames(cm, latitudeFilter & longitudeFilter & nameFilter),
+             QStringList() << QStringLiteral("Geoa") << QStringLiteral("Geob"));
+
+    longitudeFilter.setRange(19.0, 21.0);
+    QCOMPARE(matchingLastNames(cm, latitudeFilter & longitudeFilter & nameFilter), QStringList() << QStringLiteral("Geoa"));
+
+    // The range flags are applied to the exact coordinates
+    latitudeFilter.setRange(10.0, 10.5);
+    longitudeFilter.setRange(20.0, 25.0);
+    QCOMPARE(matchingLastNames(cm, latitudeFilter & longitudeFilter & nameFilter), QStringList() << QStringLiteral("Geoa"));
+    latitudeFilter.setRange(10.0, 10.5, QContactDetailRangeFilter::IncludeLower | QContactDetailRangeFilter::IncludeUpper);
+    longitudeFilter.setRange(20.0, 25.0, QContactDetailRangeFilter::IncludeLower | QContactDetailRangeFilter::IncludeUpper);
+    QCOMPARE(matchingLastNames(cm, latitudeFilter & longitudeFilter & nameFilter),
+             QStringList() << QStringLiteral("Geoa") << QStringLiteral("Geob"));
+    latitudeFilter.setRange(10.0, 10.5, QContactDetailRangeFilter::ExcludeLower | QContactDetailRangeFilter::IncludeUpper);
+    QCOMPARE(matchingLastNames(cm, latitudeFilter & longitudeFilter & nameFilter), QStringList() << QStringLiteral("Geob"));
+
+    // Open ranges are supported
+    latitudeFilter.setRange(QVariant(), 11.0);
+    longitudeFilter.setRange(22.0, QVariant());
+    QCOMPARE(matchingLastNames(cm, latitudeFilter & longitudeFilter & nameFilter), QStringList() << QStringLiteral("Geob"));
+
+    // The index follows changes to the locations
+    latitudeFilter.setRange(9.0, 11.0);
+    longitudeFilter.setRange(19.0, 26.0);
+
+    QContact moved(cm->contact(contacts.at(0).id()));
+    QContactGeoLocation location(moved.detail<QContactGeoLocation>());
+    location.setLatitude(40.5);
+    moved.saveDetail(&location);
+    QVERIFY(cm->saveContact(&moved));
+    QCOMPARE(matchingLastNames(cm, latitudeFilter & longitudeFilter & nameFilter), QStringList() << QStringLiteral("Geob"));
+
+    QVERIFY(cm->removeContact(contacts.at(1).id()));
+    transientContacts.remove(cm, contacts.at(1).id());
+    QCOMPARE(matchingLastNames(cm, latitudeFilter & longitudeFilter & nameFilter), QStringList());
+
+    latitudeFilter.setRange(40.0, 41.0);
+    QCOMPARE(matchingLastNames(cm, latitudeFilter & longitudeFilter & nameFilter),
+             QStringList() << QStringLiteral("Geoa") << QStringLiteral("Geoc"));
+}
+
+void tst_QContactManagerFiltering::upcomingDates_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::upcomingDates()
+{
+    QFETCH(QContactManager*, cm);
+
+    QtContactsSqliteExtensions::ContactManagerEngine *cme = QtContactsSqliteExtensions::contactManagerEngine(*cm);
+
+    const QStringList lastNames(QStringList() << QStringLiteral("Datea") << QStringLiteral("Dateb") << QStringLiteral("Datec")
+                                              << QStringLiteral("Dated") << QStringLiteral("Datee"));
+    const QDate dates[] = { QDate(1980, 11, 15), QDate(2001, 12, 31), QDate(1990, 1, 5), QDate(1992, 2, 29), QDate(1985, 10, 31) };
+    const bool anniversary[] = { false, true, false, false, false };
+
+    QList<QContactId> contactIds;
+    for (int i = 0; i < lastNames.count(); ++i) {
+        QContact contact;
+        QContactName name;
+        name.setLastName(lastNames.at(i));
+        contact.saveDetail(&name);
+        if (anniversary[i]) {
+            QContactAnniversary detail;
+            detail.setOriginalDate(dates[i]);
+            contact.saveDetail(&detail);
+        } else {
+            QContactBirthday detail;
+            detail.setDate(dates[i]);
+            contact.saveDetail(&detail);
+        }
+        QVERIFY(cm->saveContact(&contact));
+        transientContacts.insert(cm, contact.id());
+        contactIds.append(contact.id());
+    }
+
+    // The occurrences before the start date are reported in the following year
+    const QDate startDate(2022, 11, 1);
+    const QDate occurrences[] = { QDate(2022, 11, 15), QDate(2022, 12, 31), QDate(2023, 1, 5), QDate(2023, 2, 28), QDate(2023, 10, 31) };
+
+    QList<QtContactsSqliteExtensions::UpcomingDate> upcoming;
+    QContactManager::Error error = QContactManager::NoError;
+    QVERIFY(cme->upcomingDates(startDate, -1, false, &upcoming, &error));
+    QCOMPARE(error, QContactManager::NoError);
+
+    QList<QtContactsSqliteExtensions::UpcomingDate> created;
+    QDate previous(startDate);
+    foreach (const QtContactsSqliteExtensions::UpcomingDate &date, upcoming) {
+        QVERIFY(date.nextOccurrence >= previous);
+        previous = date.nextOccurrence;
+        QVERIFY(date.displayLabel.isEmpty());
+        if (contactIds.contains(date.contactId)) {
+            created.append(date);
+        }
+    }
+
+    QCOMPARE(created.count(), contactIds.count());
+    for (int i = 0; i < created.count(); ++i) {
+        QCOMPARE(created.at(i).contactId, contactIds.at(i));
+        QCOMPARE(created.at(i).detailType, anniversary[i] ? QContactAnniversary::Type : QContactBirthday::Type);
+        QCOMPARE(created.at(i).date, dates[i]);
+        QCOMPARE(created.at(i).nextOccurrence, occurrences[i]);
+    }
+
+    // A limited query reports the first occurrences, across the end of the year
+    for (int count = 1; count <= upcoming.count(); ++count) {
+        QList<QtContactsSqliteExtensions::UpcomingDate> limited;
+        QVERIFY(cme->upcomingDates(startDate, count, false, &limited, &error));
+        QCOMPARE(limited.count(), count);
+        for (int i = 0; i < count; ++i) {
+            QCOMPARE(limited.at(i).contactId, upcoming.at(i).contactId);
+            QCOMPARE(limited.at(i).nextOccurrence, upcoming.at(i).nextOccurrence);
+        }
+    }
+
+    // Display labels are reported on request
+    upcoming.clear();
+    QVERIFY(cme->upcomingDates(startDate, -1, true, &upcoming, &error));
+    foreach (const QtContactsSqliteExtensions::UpcomingDate &date, upcoming) {
+        if (date.contactId == contactIds.at(0)) {
+            QCOMPARE(date.displayLabel, cm->contact(date.contactId).detail<QContactDisplayLabel>().label());
+            QVERIFY(!date.displayLabel.isEmpty());
+        }
+    }
+
+    // Changed dates are reflected in the occurrences
+    QContact changed(cm->contact(contactIds.at(0)));
+    QContactBirthday birthday(changed.detail<QContactBirthday>());
+    birthday.setDate(QDate(1980, 10, 1));
+    changed.saveDetail(&birthday);
+    QVERIFY(cm->saveContact(&changed));
+
+    QVERIFY(cm->removeContact(contactIds.at(2)));
+    transientContacts.remove(cm, contactIds.at(2));
+
+    upcoming.clear();
+    QVERIFY(cme->upcomingDates(startDate, -1, false, &upcoming, &error));
+    QList<QContactId> ordered;
+    foreach (const QtContactsSqliteExtensions::UpcomingDate &date, upcoming) {
+        if (contactIds.contains(date.contactId)) {
+            ordered.append(date.contactId);
+            if (date.contactId == contactIds.at(0)) {
+                QCOMPARE(date.nextOccurrence, QDate(2023, 10, 1));
+            }
+        }
+    }
+    QCOMPARE(ordered, QList<QContactId>() << contactIds.at(1) << contactIds.at(3) << contactIds.at(0) << contactIds.at(4));
+}
+
 void tst_QContactManagerFiltering::detailVariantFiltering_data()
 {
     QTest::addColumn<QContactManager *>("cm");
@@ -2470,6 +3488,142 @@ void tst_QContactManagerFiltering::convenienceFiltering()
     QCOMPARE(resultString, expected);
 }
 
+void tst_QContactManagerFiltering::collationKeySorting_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::collationKeySorting()
+{
+#ifndef QTCONTACTS_SQLITE_LOAD_ICU
+    QSKIP("Collation keys are only stored when ICU is loaded");
+#else
+    QFETCH(QContactManager*, cm);
+
+    if (QLocale().name() == QStringLiteral("C")) {
+        QSKIP("Collation keys are not stored for the C locale");
+    }
+
+    // Sorting by the stored keys ignores case and accents, unlike a binary comparison
+    const QStringList firstNames(QStringList() << QStringLiteral("Zed") << QStringLiteral("\u00e9mile")
+                                               << QStringLiteral("adam") << QStringLiteral("Eve") << QStringLiteral("edgar"));
+    const QStringList expected(QStringList() << QStringLiteral("adam") << QStringLiteral("edgar")
+                                             << QStringLiteral("\u00e9mile") << QStringLiteral("Eve") << QStringLiteral("Zed"));
+
+    QContactIdFilter idFilter;
+    QList<QContactId> contactIds;
+    foreach (const QString &firstName, firstNames) {
+        QContact contact;
+        QContactName name;
+        name.setFirstName(firstName);
+        contact.saveDetail(&name);
+        QVERIFY(cm->saveContact(&contact));
+        transientContacts.insert(cm, contact.id());
+        contactIds.append(contact.id());
+    }
+    idFilter.setIds(contactIds);
+
+    QContactSortOrder labelOrder;
+    labelOrder.setDetailType(QContactDisplayLabel::Type, QContactDisplayLabel::FieldLabel);
+
+    QList<QContactId> ids(cm->contactIds(idFilter, QList<QContactSortOrder>() << labelOrder));
+    QCOMPARE(ids.count(), expected.count());
+    for (int i = 0; i < ids.count(); ++i) {
+        QCOMPARE(cm->contact(ids.at(i)).detail<QContactName>().firstName(), expected.at(i));
+    }
+
+    labelOrder.setDirection(Qt::DescendingOrder);
+    ids = cm->contactIds(idFilter, QList<QContactSortOrder>() << labelOrder);
+    QCOMPARE(ids.count(), expected.count());
+    for (int i = 0; i < ids.count(); ++i) {
+        QCOMPARE(cm->contact(ids.at(i)).detail<QContactName>().firstName(), expected.at(expected.count() - 1 - i));
+    }
+
+    // The aggregate contacts are selected in display label order from the index, without sorting them
+    QtContactsSqliteExtensions::ContactManagerEngine *cme = QtContactsSqliteExtensions::contactManagerEngine(*cm);
+    QVERIFY(cme);
+
+    labelOrder.setDirection(Qt::AscendingOrder);
+    QList<QtContactsSqliteExtensions::QueryProfileStep> steps;
+    QContactManager::Error error = QContactManager::UnspecifiedError;
+    QVERIFY(cme->profileContactQuery(QContactFilter(), QList<QContactSortOrder>() << labelOrder, QContactFetchHint(), &steps, &error));
+    QCOMPARE(error, QContactManager::NoError);
+    QVERIFY(!steps.isEmpty());
+    QVERIFY(steps.first().statement.contains(QStringLiteral("Contacts.sortDisplayLabel")));
+    QVERIFY(!steps.first().statement.contains(QStringLiteral("LEFT JOIN DisplayLabels")));
+
+    // Without a collection constraint, or NULLS LAST support, the selection must still be sorted
+    if (steps.first().statement.contains(QStringLiteral("Contacts.collectionId = 1"))
+            && !steps.first().statement.contains(QStringLiteral("IS NULL"))) {
+        bool indexed = false;
+        bool sorted = false;
+        foreach (const QString &detail, steps.first().queryPlan) {
+            if (detail.contains(QStringLiteral("INDEX ContactsSortDisplayLabelIndex"))) {
+                indexed = true;
+            }
+            if (detail.contains(QStringLiteral("TEMP B-TREE FOR ORDER BY"))) {
+                sorted = true;
+            }
+        }
+        QVERIFY2(indexed && !sorted, qPrintable(steps.first().queryPlan.join(QStringLiteral("\n"))));
+    }
+#endif
+}
+
+void tst_QContactManagerFiltering::presenceRankSorting_data()
+{
+    QTest::addColumn<QContactManager *>("cm");
+
+    for (int i = 0; i < managers.size(); i++) {
+        QContactManager *cm = managers.at(i);
+        QTest::newRow(qPrintable(cm->objectName())) << cm;
+    }
+}
+
+void tst_QContactManagerFiltering::presenceRankSorting()
+{
+    QFETCH(QContactManager*, cm);
+
+    // Presence states are sorted by availability rather than by their values
+    const QContactPresence::PresenceState states[] = {
+        QContactPresence::PresenceOffline, QContactPresence::PresenceUnknown, QContactPresence::PresenceBusy,
+        QContactPresence::PresenceAvailable, QContactPresence::PresenceAway };
+    const QContactPresence::PresenceState expected[] = {
+        QContactPresence::PresenceAvailable, QContactPresence::PresenceAway, QContactPresence::PresenceBusy,
+        QContactPresence::PresenceOffline, QContactPresence::PresenceUnknown };
+
+    QContactIdFilter idFilter;
+    QList<QContactId> contactIds;
+    for (int i = 0; i < 5; ++i) {
+        QContact contact;
+        QContactName name;
+        name.setFirstName(QStringLiteral("Ranked"));
+        name.setLastName(QString::number(i));
+        contact.saveDetail(&name);
+        QContactPresence presence;
+        presence.setPresenceState(states[i]);
+        contact.saveDetail(&presence);
+        QVERIFY(cm->saveContact(&contact));
+        transientContacts.insert(cm, contact.id());
+        contactIds.append(contact.id());
+    }
+    idFilter.setIds(contactIds);
+
+    QContactSortOrder presenceOrder;
+    presenceOrder.setDetailType(QContactGlobalPresence::Type, QContactGlobalPresence::FieldPresenceState);
+
+    const QList<QContactId> ids(cm->contactIds(idFilter, QList<QContactSortOrder>() << presenceOrder));
+    QCOMPARE(ids.count(), 5);
+    for (int i = 0; i < ids.count(); ++i) {
+        QCOMPARE(cm->contact(ids.at(i)).detail<QContactGlobalPresence>().presenceState(), expected[i]);
+    }
+}
+
 void tst_QContactManagerFiltering::invalidFiltering_data()
 {
     QTest::addColumn<QContactManager*>("cm");
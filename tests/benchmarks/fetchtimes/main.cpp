@@ -312,7 +312,10 @@ static qint64 aggregatedPresenceUpdate(QContactManager &manager, bool quickMode)
         prefillData.append(generateContact(testAddressbook.id()));
     }
     qDebug() << "    prefilling database with" << prefillData.size() << "contacts... this will take a while...";
+    syncTimer.start();
     manager.saveContacts(&prefillData);
+    const qint64 prefillElapsed = syncTimer.elapsed();
+    qDebug() << "    prefilled" << prefillData.size() << "contacts in" << prefillElapsed << "milliseconds";
     QList<QContactId> deleteIds;
     for (const QContact &c : prefillData) {
         deleteIds.append(c.id());
@@ -406,6 +409,41 @@ static qint64 aggregatedPresenceUpdate(QContactManager &manager, bool quickMode)
              << "milliseconds (" << ((1.0 * presenceElapsed) / (1.0 * contactsToUpdate.size())) << " msec per updated contact )";
     elapsedTimeTotal += presenceElapsed;
 
+    // update a single stored detail type of each constituent, without a mask, so that
+    // the cost of regenerating only the changed type of each aggregate is measured.
+    morePrefillData = contactsToUpdate;
+    contactsToUpdate.clear();
+    for (int j = 0; j < morePrefillData.size(); ++j) {
+        QContact curr = morePrefillData.at(j);
+        QContactNickname nn = curr.detail<QContactNickname>();
+        nn.setNickname(nn.nickname() + QString::number(j));
+        curr.saveDetail(&nn);
+        contactsToUpdate.append(curr);
+    }
+
+    // perform a batch save.
+    syncTimer.start();
+    manager.saveContacts(&contactsToUpdate);
+    presenceElapsed = syncTimer.elapsed();
+    totalAggregatesInDatabase = manager.contactIds().count();
+    qDebug() << "    update ( batch of" << contactsToUpdate.size() << ") nick only (with" << totalAggregatesInDatabase << "existing in database, partial overlap):" << presenceElapsed
+             << "milliseconds (" << ((1.0 * presenceElapsed) / (1.0 * contactsToUpdate.size())) << " msec per updated contact )";
+    elapsedTimeTotal += presenceElapsed;
+
+    // fetch the updated contacts, whose presence is now read from the transient store.
+    QList<QContactId> updatedIds;
+    foreach (const QContact &contact, contactsToUpdate) {
+        updatedIds.append(contact.id());
+    }
+    QContactIdFilter updatedFilter;
+    updatedFilter.setIds(updatedIds);
+    syncTimer.start();
+    const QList<QContact> transientContacts = manager.contacts(updatedFilter);
+    qint64 transientFetchElapsed = syncTimer.elapsed();
+    qDebug() << "    fetch ( batch of" << transientContacts.size() << ") contacts with transient presence:" << transientFetchElapsed
+             << "milliseconds (" << ((1.0 * transientFetchElapsed) / (1.0 * transientContacts.size())) << " msec per fetched contact )";
+    elapsedTimeTotal += transientFetchElapsed;
+
     QContactManager::Error purgeError = QContactManager::NoError;
     QtContactsSqliteExtensions::ContactManagerEngine *cme = QtContactsSqliteExtensions::contactManagerEngine(manager);
     syncTimer.start();
@@ -459,7 +497,10 @@ static qint64 nonAggregatedPresenceUpdate(QContactManager &manager, bool quickMo
         prefillData.append(generateContact(testAddressbook.id()));
     }
     qDebug() << "    prefilling database with" << prefillData.size() << "contacts... this will take a while...";
+    syncTimer.start();
     manager.saveContacts(&prefillData);
+    const qint64 prefillElapsed = syncTimer.elapsed();
+    qDebug() << "    prefilled" << prefillData.size() << "contacts in" << prefillElapsed << "milliseconds";
     QList<QContactId> deleteIds;
     for (const QContact &c : prefillData) {
         deleteIds.append(c.id());
@@ -553,7 +594,10 @@ static qint64 scalingPresenceUpdate(QContactManager &manager, bool quickMode)
         prefillData.append(generateContact(testAddressbook.id()));
     }
     qDebug() << "    prefilling database with" << prefillData.size() << "contacts... this will take a while...";
+    syncTimer.start();
     manager.saveContacts(&prefillData);
+    const qint64 prefillElapsed = syncTimer.elapsed();
+    qDebug() << "    prefilled" << prefillData.size() << "contacts in" << prefillElapsed << "milliseconds";
     QList<QContactId> deleteIds;
     for (const QContact &c : prefillData) {
         deleteIds.append(c.id());
@@ -635,7 +679,10 @@ static qint64 entireBatchPresenceUpdate(QContactManager &manager, bool quickMode
         prefillData.append(generateContact(testAddressbook.id()));
     }
     qDebug() << "    prefilling database with" << prefillData.size() << "contacts... this will take a while...";
+    syncTimer.start();
     manager.saveContacts(&prefillData);
+    const qint64 prefillElapsed = syncTimer.elapsed();
+    qDebug() << "    prefilled" << prefillData.size() << "contacts in" << prefillElapsed << "milliseconds";
     QList<QContactId> deleteIds;
     for (const QContact &c : prefillData) {
         deleteIds.append(c.id());
@@ -715,7 +762,10 @@ static qint64 smallBatchPresenceUpdate(QContactManager &manager, bool quickMode)
         prefillData.append(generateContact(testAddressbook.id()));
     }
     qDebug() << "    prefilling database with" << prefillData.size() << "contacts... this will take a while...";
+    syncTimer.start();
     manager.saveContacts(&prefillData);
+    const qint64 prefillElapsed = syncTimer.elapsed();
+    qDebug() << "    prefilled" << prefillData.size() << "contacts in" << prefillElapsed << "milliseconds";
     QList<QContactId> deleteIds;
     for (const QContact &c : prefillData) {
         deleteIds.append(c.id());
@@ -807,7 +857,10 @@ static qint64 aggregationOperations(QContactManager &manager, bool quickMode)
         prefillData.append(generateContact(testAddressbook.id()));
     }
     qDebug() << "    prefilling database with" << prefillData.size() << "contacts... this will take a while...";
+    syncTimer.start();
     manager.saveContacts(&prefillData);
+    const qint64 prefillElapsed = syncTimer.elapsed();
+    qDebug() << "    prefilled" << prefillData.size() << "contacts in" << prefillElapsed << "milliseconds";
     QList<QContactId> deleteIds;
     for (const QContact &c : prefillData) {
         deleteIds.append(c.id());
@@ -931,7 +984,10 @@ static qint64 smallBatchWithExistingData(QContactManager &manager, bool quickMod
         prefillData.append(generateContact(testAddressbook.id()));
     }
     qDebug() << "    prefilling database with" << prefillData.size() << "contacts... this will take a while...";
+    syncTimer.start();
     manager.saveContacts(&prefillData);
+    const qint64 prefillElapsed = syncTimer.elapsed();
+    qDebug() << "    prefilled" << prefillData.size() << "contacts in" << prefillElapsed << "milliseconds";
 
     qDebug() << "    now performing timings (shouldn't get aggregated)...";
     for (int i = 0; i < smallerTestData.size(); ++i) {